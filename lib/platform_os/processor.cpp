@@ -1,14 +1,24 @@
 #include <lib/platform_common/processor.h>
 #include <lib/platform_efi/uefi_globals.h>
 
+#include <atomic>
+#include <thread>
+
 unsigned long long mainProcessorID = -1;
 
+// Thread running static initialization is considered as main processor
+static const std::thread::id mainThreadID = std::this_thread::get_id();
+static std::atomic<unsigned long long> otherThreadCount = 0;
+
 
-// Return processor number of processor running this function
+// Return processor number of processor running this function (threads other than the main thread are numbered
+// in the order of their first call)
 unsigned long long getRunningProcessorID()
 {
-    // TODO: implement this
-    return mainProcessorID;
+    if (std::this_thread::get_id() == mainThreadID)
+        return mainProcessorID;
+    thread_local const unsigned long long threadProcessorID = otherThreadCount++;
+    return threadProcessorID;
 }
 
 // Check if running processor is main processor (bootstrap processor in EFI)
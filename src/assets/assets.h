@@ -8,6 +8,8 @@
 #include "platform/time_stamp_counter.h"
 #include "platform/memory_util.h"
 #include "platform/profiling.h"
+#include "platform/fingerprint_tags.h"
+#include "platform/sparse_snapshot.h"
 
 #include "network_messages/assets.h"
 
@@ -34,10 +36,18 @@ GLOBAL_VAR_DECL AssetRecord* assets GLOBAL_VAR_INIT(nullptr);
 GLOBAL_VAR_DECL m256i* assetDigests GLOBAL_VAR_INIT(nullptr);
 static constexpr unsigned long long assetDigestsSizeInBytes = (ASSETS_CAPACITY * 2 - 1) * 32ULL;
 GLOBAL_VAR_DECL unsigned long long* assetChangeFlags GLOBAL_VAR_INIT(nullptr);
+// Pages of universe (64 records = 3 KB each) changed since the last base file of the node state snapshot
+GLOBAL_VAR_DECL SnapshotChangeTracker<ASSETS_CAPACITY, 64> universeSnapshotChanges;
 static constexpr char CONTRACT_ASSET_UNIT_OF_MEASUREMENT[7] = { 0, 0, 0, 0, 0, 0, 0 };
 
 static constexpr unsigned int NO_ASSET_INDEX = 0xffffffff;
 
+// Get fingerprint tag of public key in asset record (bits not used for hash map index)
+static inline unsigned char assetTag(const m256i& publicKey)
+{
+    return fingerprintTag(publicKey.m256i_u8[8]);
+}
+
 
 struct AssetStorage
 {
@@ -53,24 +63,51 @@ public: // TODO: make protected
 
 
     // Lists (single-linked) of
-    // - all issuances,
+    // - all issuances (issuances with same hash of asset name are consecutive),
     // - all ownerships belonging to each issuance
     // - all possessions belonging to each ownership
+    // Additionally, first issuance of each asset name hash for iterating issuances by name without knowing the issuer,
+    // and fingerprint tags of all non-empty records for fast lookup in the hash map (see issuanceIndex()).
     struct IndexLists
     {
+        static constexpr unsigned int assetNameHashBits = 16;
+
         unsigned int issuancesFirstIdx;
         unsigned int ownershipsPossessionsFirstIdx[ASSETS_CAPACITY];
 
         unsigned int nextIdx[ASSETS_CAPACITY];
 
+        unsigned int issuancesByNameFirstIdx[1 << assetNameHashBits];
+
+        unsigned char tags[ASSETS_CAPACITY + fingerprintTagsPadding];
+
+        // Return hash of asset name used as index in issuancesByNameFirstIdx
+        static unsigned int assetNameHash(unsigned long long assetName)
+        {
+            return (unsigned int)((assetName * 0x9E3779B97F4A7C15ULL) >> (64 - assetNameHashBits));
+        }
+
         void addIssuance(unsigned int newIssuanceIdx)
         {
-            // add as first element in linked list of all issuances
             ASSERT(newIssuanceIdx < ASSETS_CAPACITY);
             ASSERT(assets[newIssuanceIdx].varStruct.issuance.type == ISSUANCE);
             ASSERT(issuancesFirstIdx == NO_ASSET_INDEX || assets[issuancesFirstIdx].varStruct.issuance.type == ISSUANCE);
-            nextIdx[newIssuanceIdx] = issuancesFirstIdx;
-            issuancesFirstIdx = newIssuanceIdx;
+            const unsigned long long assetName = (*((unsigned long long*)assets[newIssuanceIdx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF;
+            unsigned int& sameNameHashFirstIdx = issuancesByNameFirstIdx[assetNameHash(assetName)];
+            if (sameNameHashFirstIdx == NO_ASSET_INDEX)
+            {
+                // first issuance with this name hash -> add as first element in linked list of all issuances
+                nextIdx[newIssuanceIdx] = issuancesFirstIdx;
+                issuancesFirstIdx = newIssuanceIdx;
+                sameNameHashFirstIdx = newIssuanceIdx;
+            }
+            else
+            {
+                // add behind first issuance with same name hash, keeping issuances with same name hash consecutive
+                nextIdx[newIssuanceIdx] = nextIdx[sameNameHashFirstIdx];
+                nextIdx[sameNameHashFirstIdx] = newIssuanceIdx;
+            }
+            setFingerprintTag<ASSETS_CAPACITY>(tags, newIssuanceIdx, assetTag(assets[newIssuanceIdx].varStruct.issuance.publicKey));
         }
 
         // Add newOwnershipIdx as first element in linked list of all ownerships of issuanceIdx
@@ -83,6 +120,7 @@ public: // TODO: make protected
             ASSERT(ownershipsPossessionsFirstIdx[issuanceIdx] == NO_ASSET_INDEX || assets[ownershipsPossessionsFirstIdx[issuanceIdx]].varStruct.issuance.type == OWNERSHIP);
             nextIdx[newOwnershipIdx] = ownershipsPossessionsFirstIdx[issuanceIdx];
             ownershipsPossessionsFirstIdx[issuanceIdx] = newOwnershipIdx;
+            setFingerprintTag<ASSETS_CAPACITY>(tags, newOwnershipIdx, assetTag(assets[newOwnershipIdx].varStruct.ownership.publicKey));
         }
 
         // Add newPossessionIdx as first element in linked list of all possessions of ownershipIdx
@@ -95,6 +133,7 @@ public: // TODO: make protected
             ASSERT(ownershipsPossessionsFirstIdx[ownershipIdx] == NO_ASSET_INDEX || assets[ownershipsPossessionsFirstIdx[ownershipIdx]].varStruct.possession.type == POSSESSION);
             nextIdx[newPossessionIdx] = ownershipsPossessionsFirstIdx[ownershipIdx];
             ownershipsPossessionsFirstIdx[ownershipIdx] = newPossessionIdx;
+            setFingerprintTag<ASSETS_CAPACITY>(tags, newPossessionIdx, assetTag(assets[newPossessionIdx].varStruct.possession.publicKey));
         }
 
         // Reset lists to empty
@@ -104,6 +143,8 @@ public: // TODO: make protected
             static_assert(NO_ASSET_INDEX == 0xffffffff, "Following setMem() expects NO_ASSET_INDEX == 0xffffffff");
             setMem(ownershipsPossessionsFirstIdx, sizeof(ownershipsPossessionsFirstIdx), 0xff);
             setMem(nextIdx, sizeof(nextIdx), 0xff);
+            setMem(issuancesByNameFirstIdx, sizeof(issuancesByNameFirstIdx), 0xff);
+            setMem(tags, sizeof(tags), 0);
         }
 
         // Rebuild lists from assets array (includes reset)
@@ -141,22 +182,16 @@ static unsigned int issuanceIndex(const m256i& issuer, unsigned long long assetN
 {
     PROFILE_SCOPE();
 
-    unsigned int idx = issuer.m256i_u32[0] & (ASSETS_CAPACITY - 1);
-    while (assets[idx].varStruct.issuance.type != EMPTY)
-    {
-        if (assets[idx].varStruct.issuance.type == ISSUANCE
-            && ((*((unsigned long long*)assets[idx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF) == assetName
-            && assets[idx].varStruct.issuance.publicKey == issuer)
+    bool found;
+    const unsigned int idx = probeFingerprintTags<ASSETS_CAPACITY>(as.indexLists.tags, issuer.m256i_u32[0], assetTag(issuer),
+        [&issuer, assetName](unsigned int i)
         {
-            // found matching entry
-            return idx;
-        }
+            return assets[i].varStruct.issuance.type == ISSUANCE
+                && ((*((unsigned long long*)assets[i].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF) == assetName
+                && assets[i].varStruct.issuance.publicKey == issuer;
+        }, found);
 
-        idx = (idx + 1) & (ASSETS_CAPACITY - 1);
-    }
-
-    // no matching entry found
-    return NO_ASSET_INDEX;
+    return found ? idx : NO_ASSET_INDEX;
 }
 
 
@@ -717,6 +752,7 @@ static void getUniverseDigest(m256i& digest)
         if (assetChangeFlags[digestIndex >> 6] & (1ULL << (digestIndex & 63)))
         {
             KangarooTwelve(&assets[digestIndex], sizeof(AssetRecord), &assetDigests[digestIndex], 32);
+            universeSnapshotChanges.markChanged(digestIndex);
         }
     }
     unsigned int previousLevelBeginning = 0;
@@ -766,17 +802,79 @@ static bool saveUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, const CHAR
     return false;
 }
 
-static bool loadUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, CHAR16* directory = NULL)
+// Save universe snapshot of the node states. If only few pages changed since the last base file, only the changed
+// pages are saved to the delta file. Otherwise, the universe is saved to the base file in sparse format (falling back
+// to dense format if the data does not fit into reorgBuffer) and the delta is reset. Asset digests have to be up to
+// date, because the root is stored for verification. Uses reorgBuffer, so it must not run in parallel to tick processing.
+static bool saveUniverseSnapshot(const CHAR16* fileName, const CHAR16* deltaFileName, const CHAR16* directory = NULL)
+{
+    PROFILE_SCOPE();
+
+    logToConsole(L"Saving universe snapshot...");
+
+    const unsigned long long beginningTick = __rdtsc();
+
+    bool savedBase;
+    ACQUIRE(universeLock);
+    long long savedSize = saveSnapshotBaseOrDelta<AssetRecord, ASSETS_CAPACITY>(fileName, deltaFileName, assets,
+        assetDigests[(ASSETS_CAPACITY * 2 - 1) - 1], [](const AssetRecord& asset) { return asset.varStruct.issuance.type == EMPTY; },
+        universeSnapshotChanges, (unsigned char*)reorgBuffer, reorgBufferSize, directory, savedBase);
+    RELEASE(universeLock);
+
+    if (savedSize > 0)
+    {
+        setNumber(message, savedSize, TRUE);
+        appendText(message, savedBase ? L" bytes of the universe data are saved (full, " : L" bytes of the universe data are saved (delta, ");
+        appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
+        appendText(message, L" microseconds).");
+        logToConsole(message);
+        return true;
+    }
+    return false;
+}
+
+// Load universe from file in dense or sparse format (see saveUniverseSnapshot()). If sparseFileMerkleRoot is passed,
+// it is set to the universe digest stored in the sparse file header (or zero for dense files). If deltaFileName is
+// passed, the delta file of the node state snapshot is applied and sparseFileMerkleRoot is set to the root stored in
+// the delta file.
+static bool loadUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, CHAR16* directory = NULL, m256i* sparseFileMerkleRoot = nullptr,
+    const CHAR16* deltaFileName = nullptr)
 {
     PROFILE_SCOPE();
 
-    long long loadedSize = load(fileName, ASSETS_CAPACITY * sizeof(AssetRecord), (unsigned char*)assets, directory);
-    if (loadedSize != ASSETS_CAPACITY * sizeof(AssetRecord))
+    m256i baseMerkleRoot, baseDigest;
+    long long loadedSize = loadSparseOrDenseSnapshot<AssetRecord, ASSETS_CAPACITY>(fileName, assets, &baseMerkleRoot,
+        (unsigned char*)reorgBuffer, reorgBufferSize, directory, deltaFileName ? &baseDigest : nullptr);
+    if (loadedSize < 0)
     {
         logStatusToConsole(L"EFI_FILE_PROTOCOL.Read() reads invalid number of bytes", loadedSize, __LINE__);
 
         return false;
     }
+
+    m256i merkleRoot = baseMerkleRoot;
+    if (deltaFileName)
+    {
+        universeSnapshotChanges.setBase(loadedSize, baseDigest);
+        const long long loadedDeltaSize = loadSnapshotDelta<AssetRecord, ASSETS_CAPACITY>(deltaFileName, assets, baseDigest,
+            merkleRoot, universeSnapshotChanges, (unsigned char*)reorgBuffer, reorgBufferSize, directory);
+        if (loadedDeltaSize < 0)
+        {
+            universeSnapshotChanges.invalidateBase();
+            logToConsole(L"Universe delta file is missing, invalid, or does not match universe file");
+
+            return false;
+        }
+    }
+    else
+    {
+        universeSnapshotChanges.invalidateBase();
+    }
+    if (sparseFileMerkleRoot)
+    {
+        *sparseFileMerkleRoot = merkleRoot;
+    }
+
     as.indexLists.rebuild();
     return true;
 }
@@ -871,6 +969,7 @@ static void assetsEndEpoch()
     copyMem(assets, reorgAssets, ASSETS_CAPACITY * sizeof(AssetRecord));
 
     setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+    universeSnapshotChanges.invalidateBase();
 
     as.indexLists.rebuild();
 
@@ -35,7 +35,5 @@ static void deinitCommonBuffers()
     }
 }
 
-static void* __scratchpad()
-{
-    return reorgBuffer;
-}
+// Scratchpad buffer for contracts (returns reorgBuffer), defined in contract_core/contract_exec.h
+static void* __scratchpad();
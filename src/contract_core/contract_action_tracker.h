@@ -32,13 +32,31 @@ public:
     bool allocBuffer()
     {
         actions = nullptr;
-        return allocPoolWithErrorLog(L"ContractActionTracker", maxActions * sizeof(ContractAction), (void**)&actions, __LINE__);
+        balances = nullptr;
+        balanceSlots = nullptr;
+        if (!allocPoolWithErrorLog(L"ContractActionTracker", maxActions * sizeof(ContractAction), (void**)&actions, __LINE__)
+            || !allocPoolWithErrorLog(L"ContractActionTracker balances", maxBalances * sizeof(Balance), (void**)&balances, __LINE__)
+            || !allocPoolWithErrorLog(L"ContractActionTracker balance slots", balanceSlotCount * sizeof(unsigned int), (void**)&balanceSlots, __LINE__))
+        {
+            freeBuffer();
+            return false;
+        }
+        setMem(balanceSlots, balanceSlotCount * sizeof(unsigned int), 0);
+        numBalances = 0;
+        return true;
     }
 
     void freeBuffer()
     {
         if (actions)
             freePool(actions);
+        if (balances)
+            freePool(balances);
+        if (balanceSlots)
+            freePool(balanceSlots);
+        actions = nullptr;
+        balances = nullptr;
+        balanceSlots = nullptr;
     }
 
     // Called before every use, allocBuffer() needs to be called before.
@@ -46,6 +64,12 @@ public:
     {
         ASSERT(actions != nullptr);
         numActions = 0;
+
+        // Only clear slots that have been used
+        for (unsigned int i = 0; i < numBalances; ++i)
+            balanceSlots[balances[i].slot] = 0;
+        numBalances = 0;
+        balancesOverflow = false;
     }
 
     bool addQuTransfer(const m256i& sourcePublicKey, const m256i& destinationPublicKey, long long amount)
@@ -62,15 +86,33 @@ public:
         qa.quTransfer.destinationPublicKey = destinationPublicKey;
         qa.quTransfer.amount = amount;
 
+        addToBalance(sourcePublicKey, -amount);
+        addToBalance(destinationPublicKey, amount);
+
         return true;
     }
 
-    long long getOverallQuTransferBalance(const m256i& publicKey)
+    // Return number of actions that can be added until the tracker is full
+    unsigned int getNumberOfFreeActions() const
+    {
+        ASSERT(numActions <= maxActions);
+        return maxActions - numActions;
+    }
+
+    // Return net amount of QU received by publicKey in the actions tracked since init()
+    long long getOverallQuTransferBalance(const m256i& publicKey) const
     {
+        if (!balancesOverflow)
+        {
+            const Balance* balance = findBalance(publicKey);
+            return (balance) ? balance->amount : 0;
+        }
+
+        // Too many entities for balance map -> scan all actions
         long long amount = 0;
         for (unsigned int i = 0; i < numActions; ++i)
         {
-            ContractAction& qa = actions[i];
+            const ContractAction& qa = actions[i];
             if (qa.type == ContractAction::quTransferType)
             {
                 if (qa.quTransfer.sourcePublicKey == publicKey)
@@ -82,7 +124,94 @@ public:
         return amount;
     }
 
+    // Call f(publicKey, amount) for every entity involved in the tracked QU transfers, in the order of their first
+    // appearance. Returns false without calling f if there were too many entities for the balance map.
+    template <typename Func>
+    bool forEachQuTransferBalance(Func f) const
+    {
+        if (balancesOverflow)
+            return false;
+        for (unsigned int i = 0; i < numBalances; ++i)
+            f(balances[i].publicKey, balances[i].amount);
+        return true;
+    }
+
 private:
+    // Net balance change of one entity
+    struct Balance
+    {
+        m256i publicKey;
+        long long amount;
+        unsigned int slot;
+    };
+
+    static constexpr unsigned long long maxBalancesLimit = 65536;
+    static constexpr unsigned int maxBalances = (unsigned int)((2ULL * maxActions < maxBalancesLimit) ? 2ULL * maxActions : maxBalancesLimit);
+
+    static constexpr unsigned int getBalanceSlotCount()
+    {
+        // Power of 2 with load factor <= 0.5
+        unsigned int count = 1;
+        while (count < 2 * maxBalances)
+            count *= 2;
+        return count;
+    }
+    static constexpr unsigned int balanceSlotCount = getBalanceSlotCount();
+
+    static unsigned int getHomeSlot(const m256i& publicKey)
+    {
+        const unsigned long long hash = (publicKey.m256i_u64[0] ^ publicKey.m256i_u64[1] ^ publicKey.m256i_u64[2] ^ publicKey.m256i_u64[3])
+            * 0x9E3779B97F4A7C15ULL;
+        return (unsigned int)(hash >> 32) & (balanceSlotCount - 1);
+    }
+
+    const Balance* findBalance(const m256i& publicKey) const
+    {
+        for (unsigned int slot = getHomeSlot(publicKey); balanceSlots[slot]; slot = (slot + 1) & (balanceSlotCount - 1))
+        {
+            const Balance& balance = balances[balanceSlots[slot] - 1];
+            if (balance.publicKey == publicKey)
+                return &balance;
+        }
+        return nullptr;
+    }
+
+    void addToBalance(const m256i& publicKey, long long amount)
+    {
+        if (balancesOverflow)
+            return;
+
+        unsigned int slot = getHomeSlot(publicKey);
+        for (; balanceSlots[slot]; slot = (slot + 1) & (balanceSlotCount - 1))
+        {
+            Balance& balance = balances[balanceSlots[slot] - 1];
+            if (balance.publicKey == publicKey)
+            {
+                balance.amount += amount;
+                return;
+            }
+        }
+
+        if (numBalances == maxBalances)
+        {
+            // Balance map is full -> getOverallQuTransferBalance() falls back to scanning actions until next init()
+            balancesOverflow = true;
+            return;
+        }
+
+        Balance& balance = balances[numBalances++];
+        balance.publicKey = publicKey;
+        balance.amount = amount;
+        balance.slot = slot;
+        balanceSlots[slot] = numBalances;
+    }
+
     ContractAction* actions;
     unsigned int numActions;
+
+    // Open-addressing hash map of net balance changes: balanceSlots holds index + 1 of entry in balances (0 = empty)
+    Balance* balances;
+    unsigned int* balanceSlots;
+    unsigned int numBalances;
+    bool balancesOverflow;
 };
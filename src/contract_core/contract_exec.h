@@ -8,18 +8,23 @@
 #include "platform/read_write_lock.h"
 #include "platform/debugging.h"
 #include "platform/memory.h"
+#include "platform/parallel_jobs.h"
 
 #include "contract_core/contract_def.h"
 #include "contract_core/stack_buffer.h"
 #include "contract_core/contract_action_tracker.h"
+#include "contract_core/execution_time_histograms.h"
+#include "contract_core/contract_function_cache.h"
 
 #include "logging/logging.h"
 #include "common_buffers.h"
+#include "kangaroo_twelve.h"
 
 // TODO: remove, only for debug output
 #include "system.h"
 
 #include <lib/platform_common/long_jump.h>
+#include <lib/platform_common/processor.h>
 
 
 enum ContractError
@@ -35,19 +40,31 @@ enum ContractError
 };
 
 // Used to store: locals and for first invocation level also input and output
-typedef StackBuffer<unsigned int, 32 * 1024 * 1024> ContractLocalsStack;
-GLOBAL_VAR_DECL ContractLocalsStack contractLocalsStack[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
-GLOBAL_VAR_DECL volatile char contractLocalsStackLock[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
+// The first NUMBER_OF_CONTRACT_EXECUTION_BUFFERS stacks are shared (acquired with acquireContractLocalsStack(), used
+// by tick and contract processors and as fallback), the others are bound to a processor running contract functions
+// (stack index NUMBER_OF_CONTRACT_EXECUTION_BUFFERS + processor ID, see initProcessorContractLocalsStack()).
+typedef StackBuffer<unsigned int, 0> ContractLocalsStack;
+constexpr unsigned int CONTRACT_LOCALS_STACK_SIZE = 32 * 1024 * 1024;
+constexpr unsigned int NUMBER_OF_CONTRACT_LOCALS_STACKS = NUMBER_OF_CONTRACT_EXECUTION_BUFFERS + MAX_NUMBER_OF_PROCESSORS;
+GLOBAL_VAR_DECL ContractLocalsStack contractLocalsStack[NUMBER_OF_CONTRACT_LOCALS_STACKS];
+GLOBAL_VAR_DECL void* contractLocalsStackBuffers[NUMBER_OF_CONTRACT_LOCALS_STACKS];
+GLOBAL_VAR_DECL volatile char contractLocalsStackLock[NUMBER_OF_CONTRACT_LOCALS_STACKS];
 GLOBAL_VAR_DECL volatile long contractLocalsStackLockWaitingCount;
 GLOBAL_VAR_DECL long contractLocalsStackLockWaitingCountMax;
 
+// Statistics of waiting for a shared stack and of function calls that needed more than the stack of their processor
+GLOBAL_VAR_DECL volatile long long contractLocalsStackWaits;
+GLOBAL_VAR_DECL volatile long long contractLocalsStackWaitTicks;
+GLOBAL_VAR_DECL unsigned long long contractLocalsStackWaitTicksMax;
+GLOBAL_VAR_DECL volatile long long contractProcessorLocalsStackOverflows;
+
 struct ContractExecErrorData
 {
     LongJumpBuffer longJumpBuffer;
     unsigned int errorCode;
     unsigned int _paddingTo8;
 };
-GLOBAL_VAR_DECL ContractExecErrorData contractExecutionErrorData[contractCount];
+GLOBAL_VAR_DECL ContractExecErrorData contractExecutionErrorData[NUMBER_OF_CONTRACT_LOCALS_STACKS];
 
 GLOBAL_VAR_DECL ReadWriteLock contractStateLock[contractCount];
 GLOBAL_VAR_DECL unsigned char* contractStates[contractCount];
@@ -56,10 +73,328 @@ GLOBAL_VAR_DECL volatile long long contractTotalExecutionTicks[contractCount];
 // Contract error state, persistent and only set on error of procedure (TODO: only execute procedures if NoContractError)
 GLOBAL_VAR_DECL unsigned int contractError[contractCount];
 
-// TODO: If we ever have parallel procedure calls (of different contracts), we need to make
-// access to contractStateChangeFlags thread-safe
+// Flags of contracts whose state has changed (set with setContractStateChangeFlag())
 GLOBAL_VAR_DECL unsigned long long* contractStateChangeFlags GLOBAL_VAR_INIT(nullptr);
 
+// Set state change flag of contract (thread-safe, because procedures of different contracts may run in parallel)
+static inline void setContractStateChangeFlag(unsigned int contractIndex)
+{
+    _InterlockedOr64((volatile long long*)&contractStateChangeFlags[contractIndex >> 6], (long long)(1ULL << (contractIndex & 63)));
+}
+
+// Copies of the contract states at the end of a processed tick ("committed states"). While the tick processor is
+// changing states (see beginContractStateChanges()), user functions called by request processors run on these copies
+// instead of waiting for the write locks held by the contract processor. There are two sets of copies: functions
+// read the published set (contractCommittedStatesIndex), which is never written, and the tick processor updates the
+// other set and then publishes it. A function call pins the set it reads for the whole call, so all states read by a
+// function (and the functions it calls) belong to the same tick. If functions still read the other set, the tick
+// processor skips the update instead of waiting and retries after the next tick.
+// The copies are only allocated if CONTRACT_FUNCTIONS_READ_COMMITTED_STATES is enabled (see public_settings.h).
+GLOBAL_VAR_DECL unsigned char* contractCommittedStates[2][contractCount];
+GLOBAL_VAR_DECL unsigned long long contractCommittedStatesMemorySize; // bytes allocated for both sets
+GLOBAL_VAR_DECL volatile long long contractCommittedStatesIndex;
+GLOBAL_VAR_DECL volatile long long contractCommittedStatesReaders[2];
+GLOBAL_VAR_DECL unsigned int contractCommittedStatesTicks[2];
+GLOBAL_VAR_DECL volatile unsigned int contractCommittedStatesTick; // tick of published set, 0 if copies have not been made yet
+// States that may differ from the published copy
+GLOBAL_VAR_DECL unsigned long long contractCommittedStateOutdatedFlags[(contractCount + 63) / 64];
+// States with the copy of the unpublished set differing from the published copy
+GLOBAL_VAR_DECL unsigned long long contractCommittedStateBackOutdatedFlags[(contractCount + 63) / 64];
+GLOBAL_VAR_DECL volatile long long contractFunctionCallsOnCommittedStates;
+GLOBAL_VAR_DECL unsigned long long contractCommittedStatesUpdatesSkipped;
+
+// Index of the set of committed states read by the function call running with this stack, -1 if not reading committed states
+GLOBAL_VAR_DECL signed char contractLocalsStackCommittedStatesIndex[NUMBER_OF_CONTRACT_LOCALS_STACKS];
+
+// Contract states with at least one K12 chunk (8 KB) besides the first one are tracked in pages of this size. The pages
+// changed since the committed copy has been made are found by comparing state and copy in getComputerDigest(). Only
+// these pages are rehashed for the state digest (the K12 chaining values of the other pages are kept) and copied to
+// the committed state.
+static constexpr unsigned long long CONTRACT_STATE_PAGE_SIZE = K12_chunkSize;
+
+// K12 chaining values of pages 1 to N of each tracked state (page 0 is part of the final node)
+GLOBAL_VAR_DECL m256i* contractStatePageChainingValues[contractCount];
+// Pages of each tracked state that may differ from the committed copy
+GLOBAL_VAR_DECL unsigned long long* contractStateChangedPageFlags[contractCount];
+// Pages of each tracked state in which the copy of the unpublished set differs from the published copy
+GLOBAL_VAR_DECL unsigned long long* contractCommittedStateBackPageFlags[contractCount];
+// Flags of contracts with contractCommittedStateBackPageFlags known (unpublished copy may be updated page by page)
+GLOBAL_VAR_DECL unsigned long long contractCommittedStateBackPagesKnownFlags[(contractCount + 63) / 64];
+// Flags of contracts with chaining values computed from the committed copy
+GLOBAL_VAR_DECL unsigned long long contractStateChainingValuesMatchCopyFlags[(contractCount + 63) / 64];
+// Flags of contracts with contractStateChangedPageFlags set by latest digest (committed copy may be updated page by page)
+GLOBAL_VAR_DECL unsigned long long contractStateChangedPagesKnownFlags[(contractCount + 63) / 64];
+GLOBAL_VAR_DECL unsigned long long contractStatePagesHashed, contractStatePagesCopied;
+
+static inline unsigned long long getContractStatePageCount(unsigned int contractIndex)
+{
+    return KangarooTwelveLeafCount(contractDescriptions[contractIndex].stateSize) + 1;
+}
+
+// Allocate page tracking data of contract state (not needed for small states). Called on startup after allocating contractStates.
+static bool allocContractStatePageTracking(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    contractStatePageChainingValues[contractIndex] = nullptr;
+    contractStateChangedPageFlags[contractIndex] = nullptr;
+    contractCommittedStateBackPageFlags[contractIndex] = nullptr;
+    contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+    contractStateChangedPagesKnownFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+    contractCommittedStateBackPagesKnownFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+    const unsigned long long pageCount = getContractStatePageCount(contractIndex);
+    if (pageCount <= 1)
+        return true;
+    if (!allocPoolWithErrorLog(L"contractStatePageChainingValues", (pageCount - 1) * sizeof(m256i), (void**)&contractStatePageChainingValues[contractIndex], __LINE__)
+        || !allocPoolWithErrorLog(L"contractStateChangedPageFlags", (pageCount + 63) / 64 * 8, (void**)&contractStateChangedPageFlags[contractIndex], __LINE__)
+        || !allocPoolWithErrorLog(L"contractCommittedStateBackPageFlags", (pageCount + 63) / 64 * 8, (void**)&contractCommittedStateBackPageFlags[contractIndex], __LINE__))
+    {
+        return false;
+    }
+    setMem(contractStateChangedPageFlags[contractIndex], (pageCount + 63) / 64 * 8, 0);
+    setMem(contractCommittedStateBackPageFlags[contractIndex], (pageCount + 63) / 64 * 8, 0);
+    return true;
+}
+
+static void freeContractStatePageTracking(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    if (contractStatePageChainingValues[contractIndex])
+        freePool(contractStatePageChainingValues[contractIndex]);
+    if (contractStateChangedPageFlags[contractIndex])
+        freePool(contractStateChangedPageFlags[contractIndex]);
+    if (contractCommittedStateBackPageFlags[contractIndex])
+        freePool(contractCommittedStateBackPageFlags[contractIndex]);
+    contractStatePageChainingValues[contractIndex] = nullptr;
+    contractStateChangedPageFlags[contractIndex] = nullptr;
+    contractCommittedStateBackPageFlags[contractIndex] = nullptr;
+    contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+    contractStateChangedPagesKnownFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+    contractCommittedStateBackPagesKnownFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+}
+
+// Allocate both copies of contract state for committed states. Called on startup after allocating contractStates.
+static bool allocContractCommittedStates(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    const unsigned long long size = contractDescriptions[contractIndex].stateSize;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        contractCommittedStates[i][contractIndex] = nullptr;
+        if (!allocPoolWithErrorLog(L"contractCommittedStates", size, (void**)&contractCommittedStates[i][contractIndex], __LINE__))
+            return false;
+        contractCommittedStatesMemorySize += size;
+    }
+    return true;
+}
+
+static void freeContractCommittedStates(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        if (contractCommittedStates[i][contractIndex])
+        {
+            freePool(contractCommittedStates[i][contractIndex]);
+            contractCommittedStatesMemorySize -= contractDescriptions[contractIndex].stateSize;
+        }
+        contractCommittedStates[i][contractIndex] = nullptr;
+    }
+}
+
+// Return published copy of contract state, which is never written while it is published (nullptr if not allocated)
+static inline const unsigned char* getPublishedContractCommittedState(unsigned int contractIndex)
+{
+    return contractCommittedStates[contractCommittedStatesIndex][contractIndex];
+}
+
+// Compute K12 digest of contract state, which has to be locked for reading. Called by getComputerDigest() for changed
+// states. With page tracking, only pages that differ from the committed copy are rehashed. The result is the same as
+// KangarooTwelve(contractStates[contractIndex], stateSize, &digest, 32).
+static void computeContractStateDigest(unsigned int contractIndex, m256i& digest)
+{
+    ASSERT(contractIndex < contractCount);
+    const unsigned long long size = contractDescriptions[contractIndex].stateSize;
+    const unsigned char* state = contractStates[contractIndex];
+    const unsigned char* copy = getPublishedContractCommittedState(contractIndex);
+    m256i* chainingValues = contractStatePageChainingValues[contractIndex];
+    unsigned long long* changedPageFlags = contractStateChangedPageFlags[contractIndex];
+    if (!chainingValues || !changedPageFlags || !copy)
+    {
+        KangarooTwelve(state, (unsigned int)size, &digest, 32);
+        return;
+    }
+
+    // Pages equal to the copy can only be skipped if the chaining values have been computed from the copy
+    const unsigned long long contractFlag = 1ULL << (contractIndex & 63);
+    const bool compareWithCopy = (contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] & contractFlag) != 0;
+    contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] &= ~contractFlag;
+
+    const unsigned long long pageCount = getContractStatePageCount(contractIndex);
+    for (unsigned long long page = 0; page < pageCount; ++page)
+    {
+        const unsigned long long begin = page * CONTRACT_STATE_PAGE_SIZE;
+        const unsigned long long end = (begin + CONTRACT_STATE_PAGE_SIZE < size) ? begin + CONTRACT_STATE_PAGE_SIZE : size;
+        if (compareWithCopy && isEqualMem(state + begin, copy + begin, end - begin))
+            continue;
+
+        changedPageFlags[page >> 6] |= (1ULL << (page & 63));
+        if (page)
+        {
+            KangarooTwelveLeafChainingValue(state, size, page, chainingValues[page - 1].m256i_u8);
+            ++contractStatePagesHashed;
+        }
+    }
+    contractStateChangedPagesKnownFlags[contractIndex >> 6] |= contractFlag;
+
+    KangarooTwelveTreeDigest(state, chainingValues[0].m256i_u8, pageCount - 1, digest.m256i_u8, 32);
+}
+
+// Mark committed state as outdated after the state has been changed (called by getComputerDigest())
+static inline void markContractCommittedStateOutdated(unsigned int contractIndex)
+{
+    if (contractIndex < contractCount)
+        contractCommittedStateOutdatedFlags[contractIndex >> 6] |= (1ULL << (contractIndex & 63));
+}
+
+// Copy state to the unpublished set of committed states (backIndex), which will be published afterwards. If known,
+// only the pages are copied that differ from the published copy (changed pages are known from the latest digest and
+// the state has not been changed since) or in which the unpublished copy differs from the published one. Otherwise the
+// full state is copied. If the state hasn't been changed since the latest digest, its chaining values then match the
+// published copy.
+static void updateContractCommittedState(unsigned int contractIndex, unsigned int backIndex)
+{
+    const unsigned long long size = contractDescriptions[contractIndex].stateSize;
+    const unsigned long long contractFlag = 1ULL << (contractIndex & 63);
+    const bool outdated = (contractCommittedStateOutdatedFlags[contractIndex >> 6] & contractFlag) != 0;
+    const bool backOutdated = (contractCommittedStateBackOutdatedFlags[contractIndex >> 6] & contractFlag) != 0;
+    unsigned char* backCopy = contractCommittedStates[backIndex][contractIndex];
+    unsigned long long* changedPageFlags = contractStateChangedPageFlags[contractIndex];
+    unsigned long long* backPageFlags = contractCommittedStateBackPageFlags[contractIndex];
+    const bool stateChangedSinceDigest = (contractStateChangeFlags[contractIndex >> 6] & contractFlag) != 0;
+    const bool changedPagesKnown = changedPageFlags && !stateChangedSinceDigest
+        && (!outdated || (contractStateChangedPagesKnownFlags[contractIndex >> 6] & contractFlag));
+    const bool backPagesKnown = backPageFlags && (!backOutdated || (contractCommittedStateBackPagesKnownFlags[contractIndex >> 6] & contractFlag));
+    const unsigned long long pageFlagsSize = (getContractStatePageCount(contractIndex) + 63) / 64 * 8;
+    if (changedPagesKnown && backPagesKnown)
+    {
+        const unsigned long long pageCount = getContractStatePageCount(contractIndex);
+        for (unsigned long long page = 0; page < pageCount; ++page)
+        {
+            const unsigned long long pageFlag = 1ULL << (page & 63);
+            if ((outdated && (changedPageFlags[page >> 6] & pageFlag)) || (backOutdated && (backPageFlags[page >> 6] & pageFlag)))
+            {
+                const unsigned long long begin = page * CONTRACT_STATE_PAGE_SIZE;
+                const unsigned long long end = (begin + CONTRACT_STATE_PAGE_SIZE < size) ? begin + CONTRACT_STATE_PAGE_SIZE : size;
+                copyMem(backCopy + begin, contractStates[contractIndex] + begin, end - begin);
+                ++contractStatePagesCopied;
+            }
+        }
+    }
+    else
+    {
+        copyMem(backCopy, contractStates[contractIndex], size);
+    }
+    if (outdated)
+    {
+        // chaining values of the latest digest match the copy if the state hasn't been changed since
+        if (changedPagesKnown)
+            contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] |= contractFlag;
+        else
+            contractStateChainingValuesMatchCopyFlags[contractIndex >> 6] &= ~contractFlag;
+    }
+
+    // After publishing, the other copy (currently published) differs in the pages changed since it has been made
+    if (outdated)
+    {
+        contractCommittedStateBackOutdatedFlags[contractIndex >> 6] |= contractFlag;
+        if (changedPagesKnown)
+        {
+            copyMem(backPageFlags, changedPageFlags, pageFlagsSize);
+            contractCommittedStateBackPagesKnownFlags[contractIndex >> 6] |= contractFlag;
+        }
+        else
+        {
+            contractCommittedStateBackPagesKnownFlags[contractIndex >> 6] &= ~contractFlag;
+        }
+    }
+    else
+    {
+        contractCommittedStateBackOutdatedFlags[contractIndex >> 6] &= ~contractFlag;
+    }
+    if (changedPageFlags)
+        setMem(changedPageFlags, pageFlagsSize, 0);
+    contractStateChangedPagesKnownFlags[contractIndex >> 6] &= ~contractFlag;
+}
+
+// Copy outdated states to the unpublished set of committed states and publish it. Only called by tick processor after
+// all changes of the given tick have been applied and getComputerDigest() has been called. Never waits for functions
+// reading committed states: if functions still read the unpublished set (published before the latest update), the
+// update is skipped, the states stay marked as outdated, and false is returned. Without any copies allocated, nothing
+// is published, so function calls keep reading the current states.
+static bool updateContractCommittedStates(unsigned int tick)
+{
+    if (!contractCommittedStatesMemorySize)
+        return false;
+
+    const unsigned int backIndex = (unsigned int)(contractCommittedStatesIndex ^ 1);
+    if (contractCommittedStatesReaders[backIndex])
+    {
+        ++contractCommittedStatesUpdatesSkipped;
+        return false;
+    }
+
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        const unsigned long long contractFlag = 1ULL << (contractIndex & 63);
+        if (((contractCommittedStateOutdatedFlags[contractIndex >> 6] | contractCommittedStateBackOutdatedFlags[contractIndex >> 6]) & contractFlag)
+            && contractCommittedStates[backIndex][contractIndex] && contractStates[contractIndex])
+        {
+            contractStateLock[contractIndex].acquireRead();
+            updateContractCommittedState(contractIndex, backIndex);
+            contractStateLock[contractIndex].releaseRead();
+        }
+    }
+    setMem(contractCommittedStateOutdatedFlags, sizeof(contractCommittedStateOutdatedFlags), 0);
+
+    // Publish updated set. Functions that start afterwards read it, functions still reading the other set keep it
+    // from being updated next time.
+    contractCommittedStatesTicks[backIndex] = tick;
+    _InterlockedExchange64(&contractCommittedStatesIndex, backIndex);
+    contractCommittedStatesTick = tick;
+
+    return true;
+}
+
+// Pin the published set of committed states for reading by a function call. Returns the index of the set, which
+// isn't updated until releaseContractCommittedStatesForReading() has been called.
+static inline unsigned int acquireContractCommittedStatesForReading()
+{
+    while (true)
+    {
+        const long long index = contractCommittedStatesIndex;
+        _InterlockedIncrement64(&contractCommittedStatesReaders[index]);
+        if (index == contractCommittedStatesIndex)
+            return (unsigned int)index;
+
+        // set has been published and may be updated again before we read it -> retry with new set
+        _InterlockedDecrement64(&contractCommittedStatesReaders[index]);
+    }
+}
+
+static inline void releaseContractCommittedStatesForReading(unsigned int index)
+{
+    ASSERT(index < 2 && contractCommittedStatesReaders[index] > 0);
+    _InterlockedDecrement64(&contractCommittedStatesReaders[index]);
+}
+
+// Return tick of the current contract states. Without changes in progress, they equal the committed states.
+// Otherwise, they may already contain changes of the tick being processed.
+static inline unsigned int getCurrentContractStatesTick()
+{
+    const unsigned int committedTick = contractCommittedStatesTick;
+    return (committedTick && !(contractStateGeneration & 1)) ? committedTick : system.tick;
+}
+
 
 // Contract system procedures that serve as callbacks, such as PRE_ACQUIRE_SHARES,
 // break the rule that contracts can only call other contracts with lower index.
@@ -77,6 +412,213 @@ enum ContractCallbacksRunningFlags
 
 GLOBAL_VAR_DECL ContractActionTracker<CONTRACT_ACTION_TRACKER_SIZE> contractActionTracker;
 
+
+// Parallel execution of system procedures of several contracts (BEGIN_TICK and END_TICK)
+//
+// The procedures get tickets in the order of serial execution. The procedure with the lowest ticket that hasn't
+// finished has its turn. Other workers may start following procedures before their turn, backing up the state of the
+// contract first. Until its turn, a procedure may only access the state of its own contract. Before accessing anything
+// else (spectrum, universe, other contracts, log, scratchpad ...), it waits for its turn. If the procedure in turn (or
+// a procedure / function called by it) accesses the state of a contract whose procedure has been started before its
+// turn, this run is rolled back and repeated in turn. So the final state and log are the same as with serial execution.
+
+// Size of state backup buffer of each worker (procedures of contracts with larger state are only run in turn)
+constexpr unsigned long long CONTRACT_STATE_BACKUP_SIZE = 32 * 1024 * 1024;
+
+enum ContractSystemProcedureRunState
+{
+    ContractSysProcNotStarted = 0,
+    ContractSysProcRunningBeforeTurn = 1,
+    ContractSysProcAbortRequested = 2,
+    ContractSysProcFinishedBeforeTurn = 3,
+    ContractSysProcRestoring = 4,
+    ContractSysProcRunInTurn = 5, // rolled back or must not start before turn
+    ContractSysProcRunningInTurn = 6,
+    ContractSysProcFinished = 7,
+};
+
+struct ContractSystemProcedureSchedule
+{
+    unsigned int systemProcId;
+    unsigned int numberOfTickets;
+    unsigned int numberOfWorkers;
+    volatile long nextTicket;
+    volatile long ticketInTurn;
+
+    // Per contract: ticket or -1 if procedure isn't scheduled
+    int contractTickets[contractCount];
+
+    // Per ticket: contract, ContractSystemProcedureRunState, and worker that processes it
+    unsigned int ticketContracts[contractCount];
+    volatile long ticketRunStates[contractCount];
+    unsigned int ticketWorkers[contractCount];
+
+    // Per ticket: contract error before procedure was started before turn (restored on roll back)
+    unsigned int ticketContractErrors[contractCount];
+
+    // Per worker: stack, processor, and ticket of procedure currently running before its turn (-1 if none)
+    int workerStackIndices[NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS];
+    volatile unsigned long long workerProcessorIDs[NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS];
+    volatile long workerTicketsBeforeTurn[NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS];
+};
+
+GLOBAL_VAR_DECL ContractSystemProcedureSchedule contractSystemProcedureSchedule;
+GLOBAL_VAR_DECL unsigned char* contractStateBackupBuffers[NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS];
+
+// Number of procedures currently running before their turn
+GLOBAL_VAR_DECL volatile long contractSystemProceduresRunningBeforeTurn;
+
+// Statistics: number of procedures finished before their turn and number of procedures rolled back
+GLOBAL_VAR_DECL volatile long long contractSystemProceduresFinishedBeforeTurn;
+GLOBAL_VAR_DECL volatile long long contractSystemProceduresRolledBack;
+
+
+// Called by the worker running the procedure of a ticket before its turn before it accesses data shared with other
+// contracts. Waits for the turn or jumps back to the worker if the run has to be rolled back.
+static void waitForContractSystemProcedureTurnOfTicket(long ticket)
+{
+    auto& schedule = contractSystemProcedureSchedule;
+    const unsigned int workerIndex = schedule.ticketWorkers[ticket];
+    BEGIN_WAIT_WHILE(schedule.ticketInTurn != ticket
+        && schedule.ticketRunStates[ticket] == ContractSysProcRunningBeforeTurn)
+    {
+    }
+    END_WAIT_WHILE();
+
+    if (_InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcRunningInTurn, ContractSysProcRunningBeforeTurn)
+        != ContractSysProcRunningBeforeTurn)
+    {
+        // Roll back requested by procedure in turn -> continue in worker
+        LongJump(&contractExecutionErrorData[schedule.workerStackIndices[workerIndex]].longJumpBuffer, 1);
+    }
+
+    // Continue in turn (the state changes so far are the same as if the procedure had been started in turn)
+    schedule.workerTicketsBeforeTurn[workerIndex] = -1;
+    _InterlockedDecrement(&contractSystemProceduresRunningBeforeTurn);
+    contractActionTracker.init();
+}
+
+// Return if procedure of contract is currently run before its turn (used for resolving deadlocks)
+static inline bool isContractSystemProcedureRunningBeforeTurn(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    if (!contractSystemProceduresRunningBeforeTurn)
+        return false;
+    const int ticket = contractSystemProcedureSchedule.contractTickets[contractIndex];
+    return ticket >= 0 && contractSystemProcedureSchedule.ticketRunStates[ticket] >= ContractSysProcRunningBeforeTurn
+        && contractSystemProcedureSchedule.ticketRunStates[ticket] <= ContractSysProcAbortRequested;
+}
+
+// Called before the code of a contract accesses data shared with other contracts. Only waits if called by the
+// procedure running before its turn (not by functions of the contract running in request processors).
+static inline void waitForContractSystemProcedureTurn(unsigned int contractIndex)
+{
+    if (isContractSystemProcedureRunningBeforeTurn(contractIndex))
+    {
+        const int ticket = contractSystemProcedureSchedule.contractTickets[contractIndex];
+        const unsigned int workerIndex = contractSystemProcedureSchedule.ticketWorkers[ticket];
+        if (contractSystemProcedureSchedule.workerProcessorIDs[workerIndex] == getRunningProcessorID())
+            waitForContractSystemProcedureTurnOfTicket(ticket);
+    }
+}
+
+// Called before code without contract context (such as asset iterators) accesses data shared with other contracts
+static void waitForContractSystemProcedureTurnOfRunningProcessor()
+{
+    if (!contractSystemProceduresRunningBeforeTurn)
+        return;
+    const unsigned long long processorID = getRunningProcessorID();
+    auto& schedule = contractSystemProcedureSchedule;
+    for (unsigned int workerIndex = 0; workerIndex < schedule.numberOfWorkers; ++workerIndex)
+    {
+        const long ticket = schedule.workerTicketsBeforeTurn[workerIndex];
+        if (ticket >= 0 && schedule.workerProcessorIDs[workerIndex] == processorID)
+        {
+            waitForContractSystemProcedureTurnOfTicket(ticket);
+            return;
+        }
+    }
+}
+
+// Called before the state of a contract is accessed by the code of another contract. If the procedure of the contract
+// has been run before its turn, roll it back. It will be repeated in turn.
+static void rollBackContractSystemProcedureRunBeforeTurn(unsigned int contractIndex)
+{
+    ASSERT(contractIndex < contractCount);
+    auto& schedule = contractSystemProcedureSchedule;
+    const int ticket = schedule.contractTickets[contractIndex];
+    if (ticket < 0 || ticket <= schedule.ticketInTurn)
+        return;
+
+    while (1)
+    {
+        const long runState = schedule.ticketRunStates[ticket];
+        if (runState == ContractSysProcNotStarted)
+        {
+            // Prevent start before turn
+            if (_InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcRunInTurn, runState) == runState)
+                return;
+        }
+        else if (runState == ContractSysProcRunningBeforeTurn)
+        {
+            // Request roll back, which is done by the worker at its next wait for turn or when it finishes the run
+            _InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcAbortRequested, runState);
+        }
+        else if (runState == ContractSysProcFinishedBeforeTurn)
+        {
+            // Worker is waiting for the turn -> restore state here
+            if (_InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcRestoring, runState) == runState)
+            {
+                contractStateLock[contractIndex].acquireWrite();
+                copyMem(contractStates[contractIndex], contractStateBackupBuffers[schedule.ticketWorkers[ticket]], contractDescriptions[contractIndex].stateSize);
+                contractError[contractIndex] = schedule.ticketContractErrors[ticket];
+                contractStateLock[contractIndex].releaseWrite();
+                _InterlockedIncrement64(&contractSystemProceduresRolledBack);
+                schedule.ticketRunStates[ticket] = ContractSysProcRunInTurn;
+                return;
+            }
+        }
+        else if (runState == ContractSysProcRunInTurn)
+        {
+            return;
+        }
+        _mm_pause();
+    }
+}
+
+// Scratchpad buffer for contracts (shared, so procedures running before their turn need to wait for their turn)
+static void* __scratchpad()
+{
+    waitForContractSystemProcedureTurnOfRunningProcessor();
+    return reorgBuffer;
+}
+
+// For smartcontract logging
+template <typename T>
+static void __logContractDebugMessage(unsigned int contractIndex, T& msg)
+{
+    waitForContractSystemProcedureTurn(contractIndex);
+    logger.__logContractDebugMessage(contractIndex, msg);
+}
+template <typename T>
+static void __logContractErrorMessage(unsigned int contractIndex, T& msg)
+{
+    waitForContractSystemProcedureTurn(contractIndex);
+    logger.__logContractErrorMessage(contractIndex, msg);
+}
+template <typename T>
+static void __logContractInfoMessage(unsigned int contractIndex, T& msg)
+{
+    waitForContractSystemProcedureTurn(contractIndex);
+    logger.__logContractInfoMessage(contractIndex, msg);
+}
+template <typename T>
+static void __logContractWarningMessage(unsigned int contractIndex, T& msg)
+{
+    waitForContractSystemProcedureTurn(contractIndex);
+    logger.__logContractWarningMessage(contractIndex, msg);
+}
+
 // Instances of this struct are pushed on the contractLocalsStack during execution to support rollback of locks etc
 // in case of an error
 struct ContractRollbackInfo
@@ -86,6 +628,7 @@ struct ContractRollbackInfo
         ContractStateReuseLock = 0,
         ContractStateWriteLock = 1,
         ContractStateReadLock = 2,
+        ContractCommittedStateRead = 3, // no lock, set of committed states is pinned for the whole function call
     };
     unsigned int type : 2;
     unsigned int contractIndex : 30;
@@ -95,7 +638,7 @@ struct ContractRollbackInfo
 
 static inline ContractRollbackInfo* contractStackUnwindRollbackInfo(int stackIndex)
 {
-    ASSERT(stackIndex >= 0 && stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(stackIndex >= 0 && stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     char* ptr;
     unsigned int size;
     bool specialBlock;
@@ -110,9 +653,9 @@ static inline ContractRollbackInfo* contractStackUnwindRollbackInfo(int stackInd
 static bool rollbackContractFunctionCall(int stackIndex)
 {
     ASSERT(stackIndex >= 0);
-    ASSERT(stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     ASSERT(contractLocalsStackLock[stackIndex]);
-    if (stackIndex < 0 || stackIndex >= NUMBER_OF_CONTRACT_EXECUTION_BUFFERS || !contractLocalsStackLock[stackIndex])
+    if (stackIndex < 0 || stackIndex >= NUMBER_OF_CONTRACT_LOCALS_STACKS || !contractLocalsStackLock[stackIndex])
         return false;
 
     char* ptr;
@@ -123,9 +666,9 @@ static bool rollbackContractFunctionCall(int stackIndex)
         if (specialBlock && size == sizeof(ContractRollbackInfo))
         {
             auto cri = reinterpret_cast<ContractRollbackInfo*>(ptr);
-            ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock);
+            ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock || cri->type == ContractRollbackInfo::ContractCommittedStateRead);
             ASSERT(cri->contractIndex < contractCount);
-            ASSERT(contractStateLock[cri->contractIndex].getCurrentReaderLockCount() > 0);
+            ASSERT(cri->type == ContractRollbackInfo::ContractCommittedStateRead || contractStateLock[cri->contractIndex].getCurrentReaderLockCount() > 0);
             if (cri->type == ContractRollbackInfo::ContractStateReadLock
                 && cri->contractIndex < contractCount
                 && contractStateLock[cri->contractIndex].getCurrentReaderLockCount() > 0)
@@ -143,7 +686,28 @@ static bool initContractExec()
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
         contractStates[contractIndex] = nullptr;
+        contractCommittedStates[0][contractIndex] = nullptr;
+        contractCommittedStates[1][contractIndex] = nullptr;
+        contractStatePageChainingValues[contractIndex] = nullptr;
+        contractStateChangedPageFlags[contractIndex] = nullptr;
+        contractCommittedStateBackPageFlags[contractIndex] = nullptr;
     }
+    setMem(contractStateChainingValuesMatchCopyFlags, sizeof(contractStateChainingValuesMatchCopyFlags), 0);
+    setMem(contractStateChangedPagesKnownFlags, sizeof(contractStateChangedPagesKnownFlags), 0);
+    setMem(contractCommittedStateBackPagesKnownFlags, sizeof(contractCommittedStateBackPagesKnownFlags), 0);
+    contractStatePagesHashed = 0;
+    contractStatePagesCopied = 0;
+    setMem(contractCommittedStateOutdatedFlags, sizeof(contractCommittedStateOutdatedFlags), 0xff);
+    setMem(contractCommittedStateBackOutdatedFlags, sizeof(contractCommittedStateBackOutdatedFlags), 0xff);
+    contractCommittedStatesIndex = 0;
+    contractCommittedStatesReaders[0] = 0;
+    contractCommittedStatesReaders[1] = 0;
+    contractCommittedStatesTicks[0] = 0;
+    contractCommittedStatesTicks[1] = 0;
+    contractCommittedStatesTick = 0;
+    contractFunctionCallsOnCommittedStates = 0;
+    contractCommittedStatesUpdatesSkipped = 0;
+    setMem(contractLocalsStackCommittedStatesIndex, sizeof(contractLocalsStackCommittedStatesIndex), 0xff);
     setMem(contractSystemProcedures, sizeof(contractSystemProcedures), 0);
     setMem(contractSystemProcedureLocalsSizes, sizeof(contractSystemProcedureLocalsSizes), 0);
     setMem(contractUserFunctions, sizeof(contractUserFunctions), 0);
@@ -155,13 +719,25 @@ static bool initContractExec()
     setMem(contractUserProcedureOutputSizes, sizeof(contractUserProcedureOutputSizes), 0);
     setMem(contractUserProcedureLocalsSizes, sizeof(contractUserProcedureLocalsSizes), 0);
 
-    for (ContractLocalsStack::SizeType i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
-        contractLocalsStack[i].init();
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_LOCALS_STACKS; ++i)
+    {
+        if (i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS && !contractLocalsStackBuffers[i])
+        {
+            if (!allocPoolWithErrorLog(L"contractLocalsStack", CONTRACT_LOCALS_STACK_SIZE, &contractLocalsStackBuffers[i], __LINE__))
+                return false;
+        }
+        contractLocalsStack[i].init(contractLocalsStackBuffers[i], (contractLocalsStackBuffers[i]) ? CONTRACT_LOCALS_STACK_SIZE : 0);
+    }
     setMem((void*)contractLocalsStackLock, sizeof(contractLocalsStackLock), 0);
     contractLocalsStackLockWaitingCount = 0;
     contractLocalsStackLockWaitingCountMax = 0;
+    contractLocalsStackWaits = 0;
+    contractLocalsStackWaitTicks = 0;
+    contractLocalsStackWaitTicksMax = 0;
+    contractProcessorLocalsStackOverflows = 0;
 
     setMem((void*)contractTotalExecutionTicks, sizeof(contractTotalExecutionTicks), 0);
+    initContractExecutionTimeHistograms();
     setMem((void*)contractError, sizeof(contractError), 0);
     setMem((void*)contractExecutionErrorData, sizeof(contractExecutionErrorData), 0);
     for (int i = 0; i < contractCount; ++i)
@@ -175,11 +751,25 @@ static bool initContractExec()
     }
     setMem(contractStateChangeFlags, MAX_NUMBER_OF_CONTRACTS / 8, 0xFF);
 
+    if (!initContractFunctionCache())
+        return false;
+
     contractCallbacksRunning = NoContractCallback;
 
     if (!contractActionTracker.allocBuffer())
         return false;
 
+    setMem(&contractSystemProcedureSchedule, sizeof(contractSystemProcedureSchedule), 0);
+    setMem(contractSystemProcedureSchedule.contractTickets, sizeof(contractSystemProcedureSchedule.contractTickets), 0xff);
+    contractSystemProceduresRunningBeforeTurn = 0;
+    contractSystemProceduresFinishedBeforeTurn = 0;
+    contractSystemProceduresRolledBack = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS; ++i)
+    {
+        if (!allocPoolWithErrorLog(L"contractStateBackupBuffer", CONTRACT_STATE_BACKUP_SIZE, (void**)&contractStateBackupBuffers[i], __LINE__))
+            return false;
+    }
+
     return true;
 }
 
@@ -190,7 +780,28 @@ static void deinitContractExec()
         freePool(contractStateChangeFlags);
     }
 
+    deinitContractFunctionCache();
+
     contractActionTracker.freeBuffer();
+
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS; ++i)
+    {
+        if (contractStateBackupBuffers[i])
+        {
+            freePool(contractStateBackupBuffers[i]);
+            contractStateBackupBuffers[i] = nullptr;
+        }
+    }
+
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_LOCALS_STACKS; ++i)
+    {
+        if (contractLocalsStackBuffers[i])
+        {
+            freePool(contractLocalsStackBuffers[i]);
+            contractLocalsStackBuffers[i] = nullptr;
+        }
+        contractLocalsStack[i].init(nullptr, 0);
+    }
 }
 
 // Acquire lock of an currently unused stack (may block if all in use)
@@ -205,17 +816,32 @@ static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnor
     if (contractLocalsStackLockWaitingCountMax < waitingCount)
         contractLocalsStackLockWaitingCountMax = waitingCount;
 
+    // waiting starts when all stacks have been tried without success
     int i = stacksToIgnore;
+    unsigned long long waitStartTick = 0;
     BEGIN_WAIT_WHILE(TRY_ACQUIRE(contractLocalsStackLock[i]) == false)
     {
         ++i;
         if (i == NUMBER_OF_CONTRACT_EXECUTION_BUFFERS)
+        {
             i = stacksToIgnore;
+            if (!waitStartTick)
+                waitStartTick = __rdtsc();
+        }
     }
     END_WAIT_WHILE();
 
     _InterlockedDecrement(&contractLocalsStackLockWaitingCount);
 
+    if (waitStartTick)
+    {
+        const unsigned long long waitTicks = __rdtsc() - waitStartTick;
+        _InterlockedIncrement64(&contractLocalsStackWaits);
+        _interlockedadd64(&contractLocalsStackWaitTicks, waitTicks);
+        if (contractLocalsStackWaitTicksMax < waitTicks)
+            contractLocalsStackWaitTicksMax = waitTicks;
+    }
+
     stackIdx = i;
     ASSERT(stackIdx >= 0);
 
@@ -224,11 +850,80 @@ static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnor
         contractLocalsStack[stackIdx].freeAll();
 }
 
+// Return size of stacks bound to processors running contract functions. It is derived from the registered functions
+// and fits a call chain through all contracts running the largest function of each one, with each function calling
+// one more function of the same contract. Calls needing more are repeated on a shared stack.
+static unsigned int getProcessorContractLocalsStackSize()
+{
+    constexpr unsigned long long blockOverhead = 4 * sizeof(ContractLocalsStack::SizeType);
+    constexpr unsigned long long callOverhead = sizeof(QPI::QpiContextFunctionCall) + sizeof(ContractRollbackInfo) + blockOverhead;
+    unsigned long long size = 0;
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+    {
+        unsigned long long maxFunctionSize = 0;
+        for (unsigned int inputType = 0; inputType < 65536; ++inputType)
+        {
+            if (contractUserFunctions[contractIndex][inputType])
+            {
+                const unsigned long long functionSize = (unsigned long long)contractUserFunctionInputSizes[contractIndex][inputType]
+                    + contractUserFunctionOutputSizes[contractIndex][inputType] + contractUserFunctionLocalsSizes[contractIndex][inputType];
+                if (maxFunctionSize < functionSize)
+                    maxFunctionSize = functionSize;
+            }
+        }
+        if (maxFunctionSize)
+            size += 2 * (maxFunctionSize + callOverhead);
+    }
+
+    // round up to 64 KB
+    size = (size + 0xffff) & ~0xffffULL;
+    if (size < 0x10000)
+        size = 0x10000;
+    if (size > CONTRACT_LOCALS_STACK_SIZE)
+        size = CONTRACT_LOCALS_STACK_SIZE;
+    return (unsigned int)size;
+}
+
+// Allocate stack bound to the processor, so contract functions called by it don't need to wait for a shared stack.
+// Only call from main processor after contracts have been registered and before the processor calls any function.
+// Return false if the stack cannot be allocated. The processor then has no stack of its own, so
+// acquireProcessorContractLocalsStack() fails and it uses the shared stacks.
+static bool initProcessorContractLocalsStack(unsigned long long processorID, unsigned int stackSize)
+{
+    if (processorID >= MAX_NUMBER_OF_PROCESSORS)
+        return false;
+    const unsigned int stackIndex = NUMBER_OF_CONTRACT_EXECUTION_BUFFERS + (unsigned int)processorID;
+    if (contractLocalsStackBuffers[stackIndex])
+        return true;
+    if (!allocPoolWithErrorLog(L"contractLocalsStack", stackSize, &contractLocalsStackBuffers[stackIndex], __LINE__))
+        return false;
+    contractLocalsStack[stackIndex].init(contractLocalsStackBuffers[stackIndex], stackSize);
+    return true;
+}
+
+// Acquire lock of stack bound to running processor (never blocks). Return false if there is no such stack.
+static bool acquireProcessorContractLocalsStack(int& stackIdx)
+{
+    ASSERT(stackIdx < 0);
+    const unsigned long long processorID = getRunningProcessorID();
+    if (processorID >= MAX_NUMBER_OF_PROCESSORS)
+        return false;
+    const int i = NUMBER_OF_CONTRACT_EXECUTION_BUFFERS + (int)processorID;
+    if (!contractLocalsStack[i].capacity() || !TRY_ACQUIRE(contractLocalsStackLock[i]))
+        return false;
+
+    stackIdx = i;
+    ASSERT(contractLocalsStack[stackIdx].size() == 0);
+    if (contractLocalsStack[stackIdx].size())
+        contractLocalsStack[stackIdx].freeAll();
+    return true;
+}
+
 // Release locked stack (and reset stackIdx)
 static void releaseContractLocalsStack(int& stackIdx)
 {
     ASSERT(stackIdx >= 0);
-    ASSERT(stackIdx < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(stackIdx < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     ASSERT(contractLocalsStackLock[stackIdx]);
     RELEASE(contractLocalsStackLock[stackIdx]);
     stackIdx = -1;
@@ -237,8 +932,8 @@ static void releaseContractLocalsStack(int& stackIdx)
 // Allocate storage on ContractLocalsStack of QPI execution context
 void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) const
 {
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
-    if (_stackIndex < 0 || _stackIndex >= NUMBER_OF_CONTRACT_EXECUTION_BUFFERS)
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
+    if (_stackIndex < 0 || _stackIndex >= NUMBER_OF_CONTRACT_LOCALS_STACKS)
     {
 #ifndef NDEBUG
         CHAR16 dbgMsgBuf[100];
@@ -277,8 +972,8 @@ void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) c
 // Free last allocated storage on ContractLocalsStack of QPI execution context
 void QPI::QpiContextFunctionCall::__qpiFreeLocals() const
 {
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
-    if (_stackIndex < 0 || _stackIndex >= NUMBER_OF_CONTRACT_EXECUTION_BUFFERS)
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
+    if (_stackIndex < 0 || _stackIndex >= NUMBER_OF_CONTRACT_LOCALS_STACKS)
         return;
     contractLocalsStack[_stackIndex].free();
 }
@@ -287,7 +982,7 @@ void QPI::QpiContextFunctionCall::__qpiFreeLocals() const
 const QpiContextFunctionCall& QPI::QpiContextFunctionCall::__qpiConstructContextOtherContractFunctionCall(unsigned int otherContractIndex) const
 {
     ASSERT(otherContractIndex < _currentContractIndex);
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     char * buffer = contractLocalsStack[_stackIndex].allocate(sizeof(QpiContextFunctionCall));
     if (!buffer)
     {
@@ -316,7 +1011,7 @@ const QpiContextFunctionCall& QPI::QpiContextFunctionCall::__qpiConstructContext
 const QpiContextProcedureCall& QPI::QpiContextProcedureCall::__qpiConstructProcedureCallContext(unsigned int procContractIndex, QPI::sint64 invocationReward) const
 {
     ASSERT(_entryPoint != USER_FUNCTION_CALL);
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
 
     // A contract can only run a procedure of a contract with a lower index, exceptions are callback system procedures
     ASSERT(procContractIndex < _currentContractIndex || contractCallbacksRunning != NoContractCallback);
@@ -354,7 +1049,7 @@ const QpiContextProcedureCall& QPI::QpiContextProcedureCall::__qpiConstructProce
 // Called after a contract has run a function or procedure of a different contract or a system procedure
 void QPI::QpiContextFunctionCall::__qpiFreeContext() const
 {
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     contractLocalsStack[_stackIndex].free();
 }
 
@@ -389,10 +1084,17 @@ void* QPI::QpiContextFunctionCall::__qpiAcquireStateForReading(unsigned int cont
     addDebugMessageAboutContractStateLockChange(L"__qpiAcquireStateForReading", _currentContractIndex, contractIndex, _entryPoint);
 #endif
 
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     ASSERT(contractIndex < contractCount);
     ASSERT(contractIndex <= _currentContractIndex);
 
+    if (_entryPoint != USER_FUNCTION_CALL)
+    {
+        // Procedure may access other states only in its turn and states of later procedures must not be changed yet
+        waitForContractSystemProcedureTurn(_currentContractIndex);
+        rollBackContractSystemProcedureRunBeforeTurn(contractIndex);
+    }
+
     // Add rollback info for this lock to the stack
     auto rollbackInfo = reinterpret_cast<ContractRollbackInfo*>(contractLocalsStack[_stackIndex].allocateSpecial(sizeof(ContractRollbackInfo)));
     rollbackInfo->contractIndex = contractIndex;
@@ -410,12 +1112,22 @@ void* QPI::QpiContextFunctionCall::__qpiAcquireStateForReading(unsigned int cont
     if (_entryPoint == USER_FUNCTION_CALL)
     {
         // Entry point is user function (running in request processor)
+        // -> If the function call runs on committed states, no lock is needed (the set of committed states is pinned
+        //    during the whole call). States without committed copy are locked as usual.
+        const int committedStatesIndex = contractLocalsStackCommittedStatesIndex[_stackIndex];
+        if (committedStatesIndex >= 0 && contractCommittedStates[committedStatesIndex][contractIndex])
+        {
+            rollbackInfo->type = ContractRollbackInfo::ContractCommittedStateRead;
+            return contractCommittedStates[committedStatesIndex][contractIndex];
+        }
+
         // -> Default case: either get lock immediately or retry as long as no callback is running
         BEGIN_WAIT_WHILE(!contractStateLock[contractIndex].tryAcquireRead())
         {
-            if (contractCallbacksRunning != NoContractCallback)
+            if (contractCallbacksRunning != NoContractCallback || isContractSystemProcedureRunningBeforeTurn(contractIndex))
             {
-                // Special case: callback is running
+                // Special case: callback is running or the procedure holding the lock waits for its turn, which may
+                // depend on a lock held by this function
                 // -> Waiting for this lock may cause a deadlock
                 // -> Contract function is low priority and is stopped to prevent potential deadlocks
                 contractLocalsStack[_stackIndex].free();
@@ -474,10 +1186,21 @@ void QPI::QpiContextFunctionCall::__qpiReleaseStateForReading(unsigned int contr
     addDebugMessageAboutContractStateLockChange(L"__qpiReleaseStateForReading", _currentContractIndex, contractIndex, _entryPoint);
 #endif
 
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     ASSERT(contractIndex < contractCount);
     ASSERT(contractIndex <= _currentContractIndex);
-    if (contractCallbacksRunning == NoContractCallback)
+    if (contractLocalsStackCommittedStatesIndex[_stackIndex] >= 0)
+    {
+        // Function call runs on committed states: only release lock if state has no committed copy
+        ContractRollbackInfo* cri = contractStackUnwindRollbackInfo(_stackIndex);
+        ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock || cri->type == ContractRollbackInfo::ContractCommittedStateRead);
+        ASSERT(cri->contractIndex == contractIndex);
+        if (cri->type == ContractRollbackInfo::ContractStateReadLock)
+        {
+            contractStateLock[contractIndex].releaseRead();
+        }
+    }
+    else if (contractCallbacksRunning == NoContractCallback)
     {
         // Default case: no callback is running
         // - release read lock
@@ -515,7 +1238,11 @@ void* QPI::QpiContextProcedureCall::__qpiAcquireStateForWriting(unsigned int con
     // Entry point is procedure (running in contract processor), because functions cannot acquire write lock.
     ASSERT(_entryPoint != USER_FUNCTION_CALL);
     ASSERT(contractIndex < contractCount);
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
+
+    // Procedure may access other states only in its turn and states of later procedures must not be changed yet
+    waitForContractSystemProcedureTurn(_currentContractIndex);
+    rollBackContractSystemProcedureRunBeforeTurn(contractIndex);
 
     // Add rollback info for this lock to the stack
     auto rollbackInfo = reinterpret_cast<ContractRollbackInfo*>(contractLocalsStack[_stackIndex].allocateSpecial(sizeof(ContractRollbackInfo)));
@@ -574,7 +1301,7 @@ void QPI::QpiContextProcedureCall::__qpiReleaseStateForWriting(unsigned int cont
     addDebugMessageAboutContractStateLockChange(L"__qpiReleaseStateForWriting", _currentContractIndex, contractIndex, _entryPoint);
 #endif
 
-    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_LOCALS_STACKS);
     ASSERT(_entryPoint != USER_FUNCTION_CALL);
     ASSERT(contractIndex < contractCount);
     if (contractCallbacksRunning == NoContractCallback)
@@ -604,7 +1331,7 @@ void QPI::QpiContextProcedureCall::__qpiReleaseStateForWriting(unsigned int cont
             contractStateLock[contractIndex].releaseWrite();
         }
     }
-    contractStateChangeFlags[_currentContractIndex >> 6] |= (1ULL << (_currentContractIndex & 63));
+    setContractStateChangeFlag(_currentContractIndex);
 }
 
 // Used to run a special system procedure from within a contract for example in asset management rights transfer
@@ -639,6 +1366,10 @@ void QPI::QpiContextProcedureCall::__qpiCallSystemProc(unsigned int sysProcContr
     if (!contractSystemProcedures[sysProcContractIndex][sysProcId])
         return;
 
+    // Callbacks only run in the turn of the calling procedure (contractCallbacksRunning is shared)
+    waitForContractSystemProcedureTurn(_currentContractIndex);
+    rollBackContractSystemProcedureRunBeforeTurn(sysProcContractIndex);
+
     // Set flags of callbacks currently running (to prevent deadlocks and nested calling of QPI functions)
     auto contractCallbacksRunningBefore = contractCallbacksRunning;
     if (sysProcId == POST_INCOMING_TRANSFER)
@@ -665,8 +1396,10 @@ void QPI::QpiContextProcedureCall::__qpiCallSystemProc(unsigned int sysProcContr
         __qpiAbort(ContractErrorAllocLocalsFailed);
     setMem(localsBuffer, localsSize, 0);
 
-    // Run procedure
+    // Run procedure (nested call, so time is only added to histogram but not to total of contract)
+    const unsigned long long startTick = __rdtsc();
     contractSystemProcedures[sysProcContractIndex][sysProcId](context, state, &input, &output, localsBuffer);
+    addContractSystemProcedureExecutionTime(sysProcContractIndex, sysProcId, __rdtsc() - startTick);
 
     // Cleanup: free locals, release state, and free context
     contractLocalsStack[_stackIndex].free();
@@ -678,6 +1411,14 @@ void QPI::QpiContextProcedureCall::__qpiCallSystemProc(unsigned int sysProcContr
     contractCallbacksRunning = contractCallbacksRunningBefore;
 }
 
+// Return if a transfer to dest may run a POST_INCOMING_TRANSFER callback. When crediting several entities with one
+// acquisition of spectrumLock (see increaseEnergies()), a batch must end after such an entity, because the callback
+// would otherwise observe balances of entities credited after it.
+static inline bool mayRunPostIncomingTransferCallback(const m256i& dest)
+{
+    return dest.u64._3 == 0 && dest.u64._2 == 0 && dest.u64._1 == 0 && dest.u64._0 < contractCount;
+}
+
 // If dest is a contract, notify contract by running system procedure POST_INCOMING_TRANSFER
 void QPI::QpiContextProcedureCall::__qpiNotifyPostIncomingTransfer(const QPI::id& source, const QPI::id& dest, QPI::sint64 amount, QPI::uint8 type) const
 {
@@ -769,6 +1510,7 @@ void QPI::QpiContextForInit::__registerUserFunction(USER_FUNCTION userFunction,
     contractUserFunctionInputSizes[_currentContractIndex][inputType] = inputSize;
     contractUserFunctionOutputSizes[_currentContractIndex][inputType] = outputSize;
     contractUserFunctionLocalsSizes[_currentContractIndex][inputType] = localsSize;
+    registerContractUserEntryPointHistogram(_currentContractIndex, ContractEntryPointUserFunction, inputType);
 }
 
 void QPI::QpiContextForInit::__registerUserProcedure(USER_PROCEDURE userProcedure, unsigned short inputType, unsigned short inputSize, unsigned short outputSize, unsigned int localsSize) const
@@ -777,6 +1519,7 @@ void QPI::QpiContextForInit::__registerUserProcedure(USER_PROCEDURE userProcedur
     contractUserProcedureInputSizes[_currentContractIndex][inputType] = inputSize;
     contractUserProcedureOutputSizes[_currentContractIndex][inputType] = outputSize;
     contractUserProcedureLocalsSizes[_currentContractIndex][inputType] = localsSize;
+    registerContractUserEntryPointHistogram(_currentContractIndex, ContractEntryPointUserProcedure, inputType);
 }
 
 
@@ -790,6 +1533,16 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
         contractActionTracker.init();
     }
 
+    // Context using stack reserved by caller. If the procedure is run before its turn, the contract action tracker is
+    // initialized by waitForContractSystemProcedureTurn(), because it is shared with the procedure in turn.
+    QpiContextSystemProcedureCall(unsigned int contractIndex, SystemProcedureID systemProcId, int stackIndex, bool beforeTurn) : QPI::QpiContextProcedureCall(contractIndex, NULL_ID, 0, systemProcId)
+    {
+        ASSERT(stackIndex >= 0 && stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+        _stackIndex = stackIndex;
+        if (!beforeTurn)
+            contractActionTracker.init();
+    }
+
     // Run system procedure without input and output
     void call()
     {
@@ -828,7 +1581,9 @@ private:
 
         // reserve stack for this processor (may block), needed even if there are no locals, because procedure may call
         // functions / procedures / notifications that create locals etc.
-        acquireContractLocalsStack(_stackIndex);
+        const bool ownStack = (_stackIndex < 0);
+        if (ownStack)
+            acquireContractLocalsStack(_stackIndex);
 
         // acquire state for writing (may block)
         contractStateLock[_currentContractIndex].acquireWrite();
@@ -856,17 +1611,174 @@ private:
             contractLocalsStack[_stackIndex].free();
             ASSERT(contractLocalsStack[_stackIndex].size() == 0);
         }
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        addContractSystemProcedureExecutionTime(_currentContractIndex, systemProcId, executionTicks);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
-        contractStateChangeFlags[_currentContractIndex >> 6] |= (1ULL << (_currentContractIndex & 63));
+        setContractStateChangeFlag(_currentContractIndex);
 
         // release stack
-        releaseContractLocalsStack(_stackIndex);
+        if (ownStack)
+            releaseContractLocalsStack(_stackIndex);
     }
 };
 
+// Run procedure of ticket before its turn, after backing up the state. Returns with run state
+// ContractSysProcFinishedBeforeTurn, ContractSysProcRunningInTurn (finished in turn), or ContractSysProcRunInTurn
+// (rolled back).
+static void runContractSystemProcedureBeforeTurn(long ticket, unsigned int workerIndex)
+{
+    auto& schedule = contractSystemProcedureSchedule;
+    const unsigned int contractIndex = schedule.ticketContracts[ticket];
+    const int stackIndex = schedule.workerStackIndices[workerIndex];
+    const unsigned long long stateSize = contractDescriptions[contractIndex].stateSize;
+
+    // State isn't changed by other processors, because procedure of contract has not been started yet
+    copyMem(contractStateBackupBuffers[workerIndex], contractStates[contractIndex], stateSize);
+    schedule.ticketContractErrors[ticket] = contractError[contractIndex];
+    schedule.workerTicketsBeforeTurn[workerIndex] = ticket;
+    _InterlockedIncrement(&contractSystemProceduresRunningBeforeTurn);
+
+    if (SetJump(&contractExecutionErrorData[stackIndex].longJumpBuffer) == 0)
+    {
+        QpiContextSystemProcedureCall qpiContext(contractIndex, (SystemProcedureID)schedule.systemProcId, stackIndex, true);
+        qpiContext.call();
+
+        if (_InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcFinishedBeforeTurn, ContractSysProcRunningBeforeTurn)
+            == ContractSysProcRunningBeforeTurn)
+        {
+            // Finished without accessing shared data (may still be rolled back until its turn)
+            schedule.workerTicketsBeforeTurn[workerIndex] = -1;
+            _InterlockedDecrement(&contractSystemProceduresRunningBeforeTurn);
+            _InterlockedIncrement64(&contractSystemProceduresFinishedBeforeTurn);
+            return;
+        }
+        if (schedule.ticketRunStates[ticket] == ContractSysProcRunningInTurn)
+        {
+            // Reached turn while running (see waitForContractSystemProcedureTurnOfTicket())
+            return;
+        }
+
+        // Roll back requested after last wait for turn
+        ASSERT(schedule.ticketRunStates[ticket] == ContractSysProcAbortRequested);
+    }
+    else
+    {
+        // Long jump from waitForContractSystemProcedureTurnOfTicket() after roll back has been requested
+        contractLocalsStack[stackIndex].freeAll();
+        contractStateLock[contractIndex].releaseWrite();
+    }
+
+    // Roll back, procedure will be run again in its turn
+    contractStateLock[contractIndex].acquireWrite();
+    copyMem(contractStates[contractIndex], contractStateBackupBuffers[workerIndex], stateSize);
+    contractError[contractIndex] = schedule.ticketContractErrors[ticket];
+    contractStateLock[contractIndex].releaseWrite();
+    schedule.workerTicketsBeforeTurn[workerIndex] = -1;
+    _InterlockedDecrement(&contractSystemProceduresRunningBeforeTurn);
+    _InterlockedIncrement64(&contractSystemProceduresRolledBack);
+    schedule.ticketRunStates[ticket] = ContractSysProcRunInTurn;
+}
+
+// Part of parallel job: process tickets until all are taken, each one in its turn (or before if possible)
+static void processContractSystemProcedureTickets(void*, unsigned int workerIndex)
+{
+    auto& schedule = contractSystemProcedureSchedule;
+    const int stackIndex = schedule.workerStackIndices[workerIndex];
+    schedule.workerProcessorIDs[workerIndex] = getRunningProcessorID();
+
+    long ticket;
+    while ((ticket = _InterlockedIncrement(&schedule.nextTicket) - 1) < (long)schedule.numberOfTickets)
+    {
+        const unsigned int contractIndex = schedule.ticketContracts[ticket];
+        schedule.ticketWorkers[ticket] = workerIndex;
+
+        // Start before turn if not in turn yet, the state fits into the backup buffer, and it wasn't accessed by another
+        // procedure yet
+        if (schedule.ticketInTurn != ticket
+            && contractDescriptions[contractIndex].stateSize <= CONTRACT_STATE_BACKUP_SIZE
+            && _InterlockedCompareExchange(&schedule.ticketRunStates[ticket], ContractSysProcRunningBeforeTurn, ContractSysProcNotStarted)
+               == ContractSysProcNotStarted)
+        {
+            runContractSystemProcedureBeforeTurn(ticket, workerIndex);
+        }
+
+        WAIT_WHILE(schedule.ticketInTurn != ticket);
+
+        // Run in turn if not started or rolled back
+        const long runState = schedule.ticketRunStates[ticket];
+        ASSERT(runState == ContractSysProcNotStarted || runState == ContractSysProcRunInTurn
+            || runState == ContractSysProcFinishedBeforeTurn || runState == ContractSysProcRunningInTurn);
+        if (runState == ContractSysProcNotStarted || runState == ContractSysProcRunInTurn)
+        {
+            schedule.ticketRunStates[ticket] = ContractSysProcRunningInTurn;
+            QpiContextSystemProcedureCall qpiContext(contractIndex, (SystemProcedureID)schedule.systemProcId, stackIndex, false);
+            qpiContext.call();
+        }
+        schedule.ticketRunStates[ticket] = ContractSysProcFinished;
+
+        // Next ticket in turn
+        schedule.ticketInTurn = ticket + 1;
+    }
+}
+
+// Run system procedure (BEGIN_TICK or END_TICK) of the contracts in the order given. Procedures of different contracts
+// may run in parallel on processors helping with parallel jobs. The result is the same as running them one after the
+// other.
+static void runContractSystemProcedures(SystemProcedureID systemProcId, const unsigned int* contractIndices, unsigned int numberOfContracts)
+{
+    ASSERT(systemProcId == BEGIN_TICK || systemProcId == END_TICK);
+    ASSERT(numberOfContracts <= contractCount);
+    auto& schedule = contractSystemProcedureSchedule;
+
+    // Assign tickets to contracts with non-empty procedure
+    schedule.systemProcId = systemProcId;
+    schedule.numberOfTickets = 0;
+    for (unsigned int i = 0; i < numberOfContracts; ++i)
+    {
+        const unsigned int contractIndex = contractIndices[i];
+        ASSERT(contractIndex < contractCount);
+        if (contractSystemProcedures[contractIndex][systemProcId])
+        {
+            schedule.contractTickets[contractIndex] = schedule.numberOfTickets;
+            schedule.ticketContracts[schedule.numberOfTickets] = contractIndex;
+            schedule.ticketRunStates[schedule.numberOfTickets] = ContractSysProcNotStarted;
+            ++schedule.numberOfTickets;
+        }
+    }
+    if (!schedule.numberOfTickets)
+        return;
+
+    // Reserve stacks for workers (only the first one may block), at least one stack is left for functions
+    unsigned int numberOfWorkers = 0;
+    schedule.workerStackIndices[0] = -1;
+    acquireContractLocalsStack(schedule.workerStackIndices[numberOfWorkers++]);
+    for (int i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS - 1 && numberOfWorkers < NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS
+        && numberOfWorkers < schedule.numberOfTickets; ++i)
+    {
+        if (TRY_ACQUIRE(contractLocalsStackLock[i]))
+            schedule.workerStackIndices[numberOfWorkers++] = i;
+    }
+    for (unsigned int i = 0; i < numberOfWorkers; ++i)
+        schedule.workerTicketsBeforeTurn[i] = -1;
+    schedule.numberOfWorkers = numberOfWorkers;
+    schedule.nextTicket = 0;
+    schedule.ticketInTurn = 0;
+
+    runParallelJob(processContractSystemProcedureTickets, nullptr, numberOfWorkers);
+
+    // Cleanup
+    ASSERT(contractSystemProceduresRunningBeforeTurn == 0);
+    for (unsigned int i = 0; i < numberOfWorkers; ++i)
+        releaseContractLocalsStack(schedule.workerStackIndices[i]);
+    for (unsigned int i = 0; i < schedule.numberOfTickets; ++i)
+        schedule.contractTickets[schedule.ticketContracts[i]] = -1;
+    schedule.numberOfTickets = 0;
+    schedule.numberOfWorkers = 0;
+}
+
 // QPI context used to call contract user procedure from qubic core (contract processor), after transfer of invocation reward
 struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
 {
@@ -958,11 +1870,13 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
         // run procedure
         const unsigned long long startTick = __rdtsc();
         contractUserProcedures[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        addContractUserProcedureExecutionTime(_currentContractIndex, inputType, executionTicks);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
-        contractStateChangeFlags[_currentContractIndex >> 6] |= (1ULL << (_currentContractIndex & 63));
+        setContractStateChangeFlag(_currentContractIndex);
     }
 
     // free buffer after output has been copied (or isn't needed anymore)
@@ -985,11 +1899,13 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
 {
     char* outputBuffer;
     unsigned short outputSize;
+    unsigned int stateTick; // the contract states read by the function are the states at the end of this tick
 
     QpiContextUserFunctionCall(unsigned int contractIndex) : QPI::QpiContextFunctionCall(contractIndex, NULL_ID, 0, USER_FUNCTION_CALL)
     {
         outputBuffer = nullptr;
         outputSize = 0;
+        stateTick = 0;
     }
 
     ~QpiContextUserFunctionCall()
@@ -1016,10 +1932,27 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
         ASSERT(_currentContractIndex < contractCount);
         ASSERT(contractUserFunctions[_currentContractIndex][inputType]);
 
-        // reserve stack for this processor (may block)
+        // run on stack bound to this processor if available (never blocks), repeat on shared stack if it is too small
+        if (acquireProcessorContractLocalsStack(_stackIndex))
+        {
+            unsigned int errorCode = callOnAcquiredStack(inputType, inputPtr, inputSize);
+            if (errorCode != ContractErrorAllocLocalsFailed && errorCode != ContractErrorAllocContextOtherFunctionCallFailed)
+                return errorCode;
+            _InterlockedIncrement64(&contractProcessorLocalsStackOverflows);
+        }
+
+        // reserve shared stack for this processor (may block)
         constexpr unsigned int stacksNotUsedToReserveThemForStateWriter = 1;
         acquireContractLocalsStack(_stackIndex, stacksNotUsedToReserveThemForStateWriter);
 
+        return callOnAcquiredStack(inputType, inputPtr, inputSize);
+    }
+
+    // call function using the stack acquired before (released on error)
+    unsigned int callOnAcquiredStack(unsigned short inputType, const void* inputPtr, unsigned short inputSize)
+    {
+        ASSERT(_stackIndex >= 0);
+
         // allocate input, output, and locals buffer from stack and init them
         unsigned short fullInputSize = contractUserFunctionInputSizes[_currentContractIndex][inputType];
         outputSize = contractUserFunctionOutputSizes[_currentContractIndex][inputType];
@@ -1075,6 +2008,7 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
             // release all locks using stack unwinding
             rollbackContractFunctionCall(_stackIndex);
             ASSERT(contractLocalsStack[_stackIndex].size() == 0);
+            releaseCommittedStates();
 
             // release stack
             releaseContractLocalsStack(_stackIndex);
@@ -1083,20 +2017,48 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
             return errorCode;
         }
 
-        // acquire lock of contract state for reading (may block)
-        __qpiAcquireStateForReading(_currentContractIndex);
+        // run on committed states if the tick processor is changing states, so the function doesn't need to wait for
+        // the contract processor releasing the state locks
+        if (contractCommittedStatesTick && (contractStateGeneration & 1))
+        {
+            const unsigned int committedStatesIndex = acquireContractCommittedStatesForReading();
+            contractLocalsStackCommittedStatesIndex[_stackIndex] = (signed char)committedStatesIndex;
+            stateTick = contractCommittedStatesTicks[committedStatesIndex];
+            _InterlockedIncrement64(&contractFunctionCallsOnCommittedStates);
+        }
+        else
+        {
+            stateTick = getCurrentContractStatesTick();
+        }
+
+        // acquire lock of contract state for reading (may block if not running on committed states)
+        void* state = __qpiAcquireStateForReading(_currentContractIndex);
 
         // run function
         const unsigned long long startTick = __rdtsc();
-        contractUserFunctions[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        contractUserFunctions[_currentContractIndex][inputType](*this, state, inputBuffer, outputBuffer, localsBuffer);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        addContractUserFunctionExecutionTime(_currentContractIndex, inputType, executionTicks);
 
         // release lock of contract state
         __qpiReleaseStateForReading(_currentContractIndex);
+        releaseCommittedStates();
 
         return NoContractError;
     }
 
+    // unpin set of committed states if function call has been running on them
+    void releaseCommittedStates()
+    {
+        const int committedStatesIndex = contractLocalsStackCommittedStatesIndex[_stackIndex];
+        if (committedStatesIndex >= 0)
+        {
+            contractLocalsStackCommittedStatesIndex[_stackIndex] = -1;
+            releaseContractCommittedStatesForReading(committedStatesIndex);
+        }
+    }
+
     // free buffer after output has been copied
     void freeBuffer()
     {
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "platform/global_var.h"
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/m256.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Cache of outputs of user functions (queried with RequestContractFunction), so the same query in the same state
+// doesn't require to execute the function again. Functions may read everything that is changed by the tick processor
+// (state of other contracts, spectrum, universe, tick, time), so all entries are invalidated when the tick processor
+// changes anything (see beginContractStateChanges() / endContractStateChanges()) and when the tick changes.
+
+#define CONTRACT_FUNCTION_CACHE_SLOTS 1024 // must be 2^N
+#define CONTRACT_FUNCTION_CACHE_MAX_OUTPUT_SIZE 16384
+
+struct ContractFunctionCacheSlot
+{
+    volatile char lock;
+    unsigned char padding;
+    unsigned short inputType;
+    unsigned short inputSize;
+    unsigned short outputSize;
+    unsigned int contractIndex;
+    unsigned int tick;
+    unsigned long long stateGeneration; // 0 if slot is empty
+    m256i inputDigest;
+    unsigned char output[CONTRACT_FUNCTION_CACHE_MAX_OUTPUT_SIZE];
+};
+
+GLOBAL_VAR_DECL ContractFunctionCacheSlot* contractFunctionCacheSlots GLOBAL_VAR_INIT(nullptr);
+
+// Incremented before and after the tick processor changes states, so it is odd while states may be changing and the
+// cache must not be used
+GLOBAL_VAR_DECL volatile long long contractStateGeneration;
+
+GLOBAL_VAR_DECL volatile long long contractFunctionCacheHits;
+GLOBAL_VAR_DECL volatile long long contractFunctionCacheMisses;
+
+static bool initContractFunctionCache()
+{
+    if (!contractFunctionCacheSlots)
+    {
+        if (!allocPoolWithErrorLog(L"contractFunctionCacheSlots", CONTRACT_FUNCTION_CACHE_SLOTS * sizeof(ContractFunctionCacheSlot), (void**)&contractFunctionCacheSlots, __LINE__))
+        {
+            return false;
+        }
+    }
+    setMem(contractFunctionCacheSlots, CONTRACT_FUNCTION_CACHE_SLOTS * sizeof(ContractFunctionCacheSlot), 0);
+    contractStateGeneration = 2;
+    contractFunctionCacheHits = 0;
+    contractFunctionCacheMisses = 0;
+    return true;
+}
+
+static void deinitContractFunctionCache()
+{
+    if (contractFunctionCacheSlots)
+    {
+        freePool(contractFunctionCacheSlots);
+        contractFunctionCacheSlots = nullptr;
+    }
+}
+
+// Call before changing contract states, spectrum, or universe outside of contract function calls
+static void beginContractStateChanges()
+{
+    _InterlockedIncrement64(&contractStateGeneration);
+    ASSERT(contractStateGeneration & 1);
+}
+
+// Call after changes started with beginContractStateChanges() are done
+static void endContractStateChanges()
+{
+    ASSERT(contractStateGeneration & 1);
+    _InterlockedIncrement64(&contractStateGeneration);
+}
+
+// Key of query for cache lookup, stateGeneration and tick need to be read before executing the function
+struct ContractFunctionCacheKey
+{
+    m256i inputDigest;
+    unsigned long long stateGeneration;
+    unsigned int contractIndex;
+    unsigned int tick;
+    unsigned short inputType;
+    unsigned short inputSize;
+
+    void set(unsigned int contractIndex, unsigned short inputType, const void* input, unsigned short inputSize, unsigned int tick)
+    {
+        this->stateGeneration = contractStateGeneration;
+        this->contractIndex = contractIndex;
+        this->tick = tick;
+        this->inputType = inputType;
+        this->inputSize = inputSize;
+        KangarooTwelve(input, inputSize, &inputDigest, sizeof(inputDigest));
+    }
+
+    // The cache can be used only if no state changes are in progress
+    bool isCacheable() const
+    {
+        return contractFunctionCacheSlots && !(stateGeneration & 1);
+    }
+
+    ContractFunctionCacheSlot& slot() const
+    {
+        return contractFunctionCacheSlots[(inputDigest.m256i_u64[0] ^ contractIndex ^ ((unsigned long long)inputType << 32)) & (CONTRACT_FUNCTION_CACHE_SLOTS - 1)];
+    }
+
+    bool matches(const ContractFunctionCacheSlot& slot) const
+    {
+        return slot.stateGeneration == stateGeneration && slot.tick == tick && slot.contractIndex == contractIndex
+            && slot.inputType == inputType && slot.inputSize == inputSize && slot.inputDigest == inputDigest;
+    }
+};
+
+// Return locked slot with cached output if found (call releaseContractFunctionCacheSlot() after using output),
+// nullptr if not.
+static ContractFunctionCacheSlot* acquireCachedContractFunctionOutput(const ContractFunctionCacheKey& key)
+{
+    if (!key.isCacheable())
+        return nullptr;
+    ContractFunctionCacheSlot& slot = key.slot();
+    if (!TRY_ACQUIRE(slot.lock))
+        return nullptr;
+    // check generation again, because states may have changed since key was created
+    if (key.matches(slot) && key.stateGeneration == contractStateGeneration)
+    {
+        _InterlockedIncrement64(&contractFunctionCacheHits);
+        return &slot;
+    }
+    RELEASE(slot.lock);
+    return nullptr;
+}
+
+static void releaseContractFunctionCacheSlot(ContractFunctionCacheSlot* slot)
+{
+    RELEASE(slot->lock);
+}
+
+// Store output of function executed after key has been created (skipped if states have changed meanwhile or slot is
+// in use)
+static void cacheContractFunctionOutput(const ContractFunctionCacheKey& key, const void* output, unsigned short outputSize)
+{
+    if (!key.isCacheable())
+        return;
+    _InterlockedIncrement64(&contractFunctionCacheMisses);
+    if (outputSize > CONTRACT_FUNCTION_CACHE_MAX_OUTPUT_SIZE)
+        return;
+    ContractFunctionCacheSlot& slot = key.slot();
+    if (!TRY_ACQUIRE(slot.lock))
+        return;
+    if (key.stateGeneration == contractStateGeneration)
+    {
+        slot.stateGeneration = key.stateGeneration;
+        slot.tick = key.tick;
+        slot.contractIndex = key.contractIndex;
+        slot.inputType = key.inputType;
+        slot.inputSize = key.inputSize;
+        slot.inputDigest = key.inputDigest;
+        slot.outputSize = outputSize;
+        copyMem(slot.output, output, outputSize);
+    }
+    RELEASE(slot.lock);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "platform/global_var.h"
+#include "platform/memory.h"
+#include "platform/profiling.h"
+
+#include "contract_core/contract_def.h"
+
+
+enum ContractEntryPointType
+{
+    ContractEntryPointSystemProcedure = 0,
+    ContractEntryPointUserProcedure = 1,
+    ContractEntryPointUserFunction = 2,
+};
+
+struct ContractUserEntryPointInfo
+{
+    unsigned int contractIndex;
+    unsigned short type; // ContractEntryPointType
+    unsigned short inputType;
+};
+
+// Max number of user functions and procedures with their own histogram (all others share slot 0)
+#define CONTRACT_USER_ENTRY_POINT_HISTOGRAMS 4096
+
+GLOBAL_VAR_DECL ExecutionTimeHistogram contractSystemProcedureExecutionTimes[contractCount][contractSystemProcedureCount];
+GLOBAL_VAR_DECL ExecutionTimeHistogram contractUserEntryPointExecutionTimes[CONTRACT_USER_ENTRY_POINT_HISTOGRAMS];
+GLOBAL_VAR_DECL ContractUserEntryPointInfo contractUserEntryPointInfos[CONTRACT_USER_ENTRY_POINT_HISTOGRAMS];
+GLOBAL_VAR_DECL unsigned int contractUserEntryPointHistogramCount;
+
+// Histogram slots of user functions and procedures, assigned on registration (0 means no slot)
+GLOBAL_VAR_DECL unsigned short contractUserFunctionHistogramSlots[contractCount][65536];
+GLOBAL_VAR_DECL unsigned short contractUserProcedureHistogramSlots[contractCount][65536];
+
+static void initContractExecutionTimeHistograms()
+{
+    setMem((void*)contractSystemProcedureExecutionTimes, sizeof(contractSystemProcedureExecutionTimes), 0);
+    setMem((void*)contractUserEntryPointExecutionTimes, sizeof(contractUserEntryPointExecutionTimes), 0);
+    setMem(contractUserEntryPointInfos, sizeof(contractUserEntryPointInfos), 0);
+    setMem(contractUserFunctionHistogramSlots, sizeof(contractUserFunctionHistogramSlots), 0);
+    setMem(contractUserProcedureHistogramSlots, sizeof(contractUserProcedureHistogramSlots), 0);
+    contractUserEntryPointHistogramCount = 1; // slot 0 is shared by entry points without own slot
+}
+
+// Assign histogram slot to user function / procedure. Only called while registering contract entry points.
+static void registerContractUserEntryPointHistogram(unsigned int contractIndex, ContractEntryPointType type, unsigned short inputType)
+{
+    ASSERT(contractIndex < contractCount);
+    ASSERT(type == ContractEntryPointUserProcedure || type == ContractEntryPointUserFunction);
+    unsigned short& slot = (type == ContractEntryPointUserFunction)
+        ? contractUserFunctionHistogramSlots[contractIndex][inputType]
+        : contractUserProcedureHistogramSlots[contractIndex][inputType];
+    if (slot || contractUserEntryPointHistogramCount >= CONTRACT_USER_ENTRY_POINT_HISTOGRAMS)
+        return;
+    slot = (unsigned short)contractUserEntryPointHistogramCount++;
+    contractUserEntryPointInfos[slot].contractIndex = contractIndex;
+    contractUserEntryPointInfos[slot].type = type;
+    contractUserEntryPointInfos[slot].inputType = inputType;
+}
+
+static void addContractSystemProcedureExecutionTime(unsigned int contractIndex, unsigned int systemProcId, unsigned long long ticks)
+{
+    ASSERT(contractIndex < contractCount);
+    ASSERT(systemProcId < contractSystemProcedureCount);
+    contractSystemProcedureExecutionTimes[contractIndex][systemProcId].add(ticks);
+}
+
+static void addContractUserProcedureExecutionTime(unsigned int contractIndex, unsigned short inputType, unsigned long long ticks)
+{
+    ASSERT(contractIndex < contractCount);
+    contractUserEntryPointExecutionTimes[contractUserProcedureHistogramSlots[contractIndex][inputType]].add(ticks);
+}
+
+static void addContractUserFunctionExecutionTime(unsigned int contractIndex, unsigned short inputType, unsigned long long ticks)
+{
+    ASSERT(contractIndex < contractCount);
+    contractUserEntryPointExecutionTimes[contractUserFunctionHistogramSlots[contractIndex][inputType]].add(ticks);
+}
@@ -13,6 +13,19 @@ static m256i releasedPublicKeys[NUMBER_OF_COMPUTORS];
 static long long releasedAmounts[NUMBER_OF_COMPUTORS];
 static unsigned int numberOfReleasedEntities;
 
+// Credit refunds of entities from begin on with one acquisition of spectrumLock. The batch ends after the first
+// entity that may run a POST_INCOMING_TRANSFER callback or earlier if increaseEnergies() stops before an entity that
+// may cause logging. Returns the end of the batch.
+static unsigned int creditRefundBatch(const m256i* publicKeys, const long long* amounts, unsigned int begin, unsigned int count)
+{
+    unsigned int end = begin;
+    while (end < count && !mayRunPostIncomingTransferCallback(publicKeys[end]))
+        ++end;
+    if (end < count)
+        ++end;
+    return begin + increaseEnergies(publicKeys + begin, amounts + begin, end - begin);
+}
+
 
 // Bid in contract IPO (caller has to ensure that contractIndex is in IPO phase).
 // This deducts price * quantity QU. Bids that don't get shares are refunded.
@@ -99,23 +112,36 @@ static long long bidInContractIPO(long long price, unsigned short quantity, cons
                         ipo->prices[j--] = tmpPrice;
                     }
 
-                    contractStateChangeFlags[contractIndex >> 6] |= (1ULL << (contractIndex & 63));
+                    setContractStateChangeFlag(contractIndex);
                     ++registeredBids;
                 }
             }
             contractStateLock[contractIndex].releaseWrite();
 
+            // Remove entities without refund, keeping the order
+            unsigned int numberOfRefundedEntities = 0;
             for (unsigned int i = 0; i < numberOfReleasedEntities; i++)
             {
                 if (!releasedAmounts[i])
                     continue;
-                increaseEnergy(releasedPublicKeys[i], releasedAmounts[i]);
-                if (qpiContext)
-                    qpiContext->__qpiNotifyPostIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
-                else
-                    notifyContractOfIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
-                const QuTransfer quTransfer = { m256i::zero(), releasedPublicKeys[i], releasedAmounts[i] };
-                logger.logQuTransfer(quTransfer);
+                releasedPublicKeys[numberOfRefundedEntities] = releasedPublicKeys[i];
+                releasedAmounts[numberOfRefundedEntities++] = releasedAmounts[i];
+            }
+            numberOfReleasedEntities = numberOfRefundedEntities;
+
+            // Credit in batches ending after entities that may run a callback, which must not observe later refunds
+            for (unsigned int i = 0; i < numberOfReleasedEntities; )
+            {
+                const unsigned int batchEnd = creditRefundBatch(releasedPublicKeys, releasedAmounts, i, numberOfReleasedEntities);
+                for (; i < batchEnd; i++)
+                {
+                    if (qpiContext)
+                        qpiContext->__qpiNotifyPostIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
+                    else
+                        notifyContractOfIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
+                    const QuTransfer quTransfer = { m256i::zero(), releasedPublicKeys[i], releasedAmounts[i] };
+                    logger.logQuTransfer(quTransfer);
+                }
             }
         }
     }
@@ -170,13 +196,16 @@ static void finishIPOs()
                     transferShareOwnershipAndPossession(ownershipIndex, possessionIndex, ipo->publicKeys[i], 1, &destinationOwnershipIndex, &destinationPossessionIndex, true);
                 }
             }
-            for (unsigned int i = 0; i < numberOfReleasedEntities; i++)
+            for (unsigned int i = 0; i < numberOfReleasedEntities; )
             {
-                ASSERT(releasedAmounts[i] > 0);
-                increaseEnergy(releasedPublicKeys[i], releasedAmounts[i]);
-                notifyContractOfIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
-                const QuTransfer quTransfer = { m256i::zero(), releasedPublicKeys[i], releasedAmounts[i] };
-                logger.logQuTransfer(quTransfer);
+                const unsigned int batchEnd = creditRefundBatch(releasedPublicKeys, releasedAmounts, i, numberOfReleasedEntities);
+                for (; i < batchEnd; i++)
+                {
+                    ASSERT(releasedAmounts[i] > 0);
+                    notifyContractOfIncomingTransfer(m256i::zero(), releasedPublicKeys[i], releasedAmounts[i], QPI::TransferType::ipoBidRefund);
+                    const QuTransfer quTransfer = { m256i::zero(), releasedPublicKeys[i], releasedAmounts[i] };
+                    logger.logQuTransfer(quTransfer);
+                }
             }
             contractStateLock[contractIndex].releaseRead();
 
@@ -2,6 +2,7 @@
 
 #include "contracts/qpi.h"
 
+#include "contract_core/contract_exec.h"
 #include "assets/assets.h"
 #include "spectrum/spectrum.h"
 
@@ -10,6 +11,7 @@
 // Start iteration with issuance filter (selects first record).
 void QPI::AssetIssuanceIterator::begin(const QPI::AssetIssuanceSelect& issuance)
 {
+    waitForContractSystemProcedureTurnOfRunningProcessor();
     _issuance = issuance;
     _issuanceIdx = NO_ASSET_INDEX;
 
@@ -64,8 +66,10 @@ bool QPI::AssetIssuanceIterator::next()
         // issuer is unknow -> use index lists instead of hash map to iterate through issuances
         if (_issuanceIdx == NO_ASSET_INDEX)
         {
-            // get first issuance
-            _issuanceIdx = as.indexLists.issuancesFirstIdx;
+            // get first issuance (of all or of those with same name hash, which are consecutive in list of all issuances)
+            _issuanceIdx = (_issuance.anyName)
+                ? as.indexLists.issuancesFirstIdx
+                : as.indexLists.issuancesByNameFirstIdx[AssetStorage::IndexLists::assetNameHash(_issuance.assetName)];
         }
         else
         {
@@ -79,9 +83,20 @@ bool QPI::AssetIssuanceIterator::next()
         // if specific asset name is requested, make sure the issuance matches
         if (!_issuance.anyName)
         {
-            while (_issuanceIdx != NO_ASSET_INDEX
-                && ((*((unsigned long long*)assets[_issuanceIdx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF) != _issuance.assetName)
+            const unsigned int nameHash = AssetStorage::IndexLists::assetNameHash(_issuance.assetName);
+            while (_issuanceIdx != NO_ASSET_INDEX)
             {
+                const unsigned long long assetName = (*((unsigned long long*)assets[_issuanceIdx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF;
+                if (assetName == _issuance.assetName)
+                    break;
+
+                // end of issuances with same name hash -> no more matching issuances
+                if (AssetStorage::IndexLists::assetNameHash(assetName) != nameHash)
+                {
+                    _issuanceIdx = NO_ASSET_INDEX;
+                    break;
+                }
+
                 _issuanceIdx = as.indexLists.nextIdx[_issuanceIdx];
                 ASSERT(_issuanceIdx == NO_ASSET_INDEX
                     || (_issuanceIdx < ASSETS_CAPACITY
@@ -109,6 +124,7 @@ uint64 QPI::AssetIssuanceIterator::assetName() const
 // Start iteration with given issuance and given ownership filter (selects first record).
 void QPI::AssetOwnershipIterator::begin(const QPI::Asset& issuance, const QPI::AssetOwnershipSelect& ownership)
 {
+    waitForContractSystemProcedureTurnOfRunningProcessor();
     _issuance = issuance;
     _issuanceIdx = ::issuanceIndex(issuance.issuer, issuance.assetName);
     _ownership = ownership;
@@ -267,11 +283,46 @@ bool QPI::AssetPossessionIterator::next()
 {
     ASSERT(_issuanceIdx < ASSETS_CAPACITY && _ownershipIdx < ASSETS_CAPACITY);
 
-    if (!_possession.anyPossessor)
+    if (!_possession.anyPossessor && _ownership.anyOwner)
     {
-        // searching for specific possessor -> use hash map
+        // searching for specific possessor of any owner -> use hash map of possessor, checking that possession
+        // belongs to an ownership of the issuance instead of searching the possessor for each ownership
+        if (_possessionIdx == NO_ASSET_INDEX)
+        {
+            _possessionIdx = _possession.possessor.m256i_u32[0] & (ASSETS_CAPACITY - 1);
+        }
+        else
+        {
+            _possessionIdx = (_possessionIdx + 1) & (ASSETS_CAPACITY - 1);
+        }
+        while (assets[_possessionIdx].varStruct.possession.type != EMPTY)
+        {
+            if (assets[_possessionIdx].varStruct.possession.type == POSSESSION
+                && assets[_possessionIdx].varStruct.possession.publicKey == _possession.possessor
+                && (_possession.anyManagingContract || assets[_possessionIdx].varStruct.possession.managingContractIndex == _possession.managingContract))
+            {
+                const unsigned int ownershipIdx = assets[_possessionIdx].varStruct.possession.ownershipIndex;
+                ASSERT(ownershipIdx < ASSETS_CAPACITY && assets[ownershipIdx].varStruct.ownership.type == OWNERSHIP);
+                if (assets[ownershipIdx].varStruct.ownership.issuanceIndex == _issuanceIdx
+                    && (_ownership.anyManagingContract || assets[ownershipIdx].varStruct.ownership.managingContractIndex == _ownership.managingContract))
+                {
+                    // found matching entry
+                    _ownershipIdx = ownershipIdx;
+                    return true;
+                }
+            }
+
+            _possessionIdx = (_possessionIdx + 1) & (ASSETS_CAPACITY - 1);
+        }
 
-        // TODO: the common case of specific possessor and don't care about ownership should be optimized from O(N^2) to O(N)
+        // no matching entry found
+        _possessionIdx = NO_ASSET_INDEX;
+        _ownershipIdx = NO_ASSET_INDEX;
+        return false;
+    }
+    else if (!_possession.anyPossessor)
+    {
+        // searching for specific possessor of specific owner -> use hash map
         do
         {
             if (_possessionIdx == NO_ASSET_INDEX)
@@ -379,6 +430,7 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
     uint16 sourceOwnershipManagingContractIndex, uint16 sourcePossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -460,8 +512,18 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
 }
 
 
+// Holders credited in one batch by distributeDividends(). Only one contract runs distributeDividends() at a time (in its turn)
+// and it cannot be nested, because it fails in POST_INCOMING_TRANSFER callbacks.
+// A batch ends after a holder that may run a POST_INCOMING_TRANSFER callback and after the holder that does not fit
+// into the contract action tracker anymore. So callbacks and __qpiAbort() observe the same spectrum as if each holder
+// was credited, tracked, notified, and logged before the next holder.
+static constexpr unsigned int dividendBatchCapacity = NUMBER_OF_COMPUTORS;
+static m256i dividendBatchPublicKeys[dividendBatchCapacity];
+static long long dividendBatchAmounts[dividendBatchCapacity];
+
 bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return false;
@@ -496,24 +558,43 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
         while (!iter.reachedEnd())
         {
-            ASSERT(iter.possessionIndex() < ASSETS_CAPACITY);
+            // Collect batch of holders and credit all dividends with one acquisition of spectrumLock
+            const unsigned int freeActions = contractActionTracker.getNumberOfFreeActions();
+            const unsigned int maxBatchSize = (freeActions < dividendBatchCapacity) ? freeActions + 1 : dividendBatchCapacity;
+            unsigned int batchSize = 0;
+            while (!iter.reachedEnd() && batchSize < maxBatchSize)
+            {
+                ASSERT(iter.possessionIndex() < ASSETS_CAPACITY);
 
-            const auto& possession = assets[iter.possessionIndex()].varStruct.possession;
-            const long long dividend = amountPerShare * possession.numberOfShares;
+                const auto& possession = assets[iter.possessionIndex()].varStruct.possession;
+                dividendBatchPublicKeys[batchSize] = possession.publicKey;
+                dividendBatchAmounts[batchSize] = amountPerShare * possession.numberOfShares;
+                ++batchSize;
 
-            increaseEnergy(possession.publicKey, dividend);
+                totalShareCounter += possession.numberOfShares;
 
-            if (!contractActionTracker.addQuTransfer(_currentContractId, possession.publicKey, dividend))
-                __qpiAbort(ContractErrorTooManyActions);
+                iter.next();
 
-            __qpiNotifyPostIncomingTransfer(_currentContractId, possession.publicKey, dividend, TransferType::qpiDistributeDividends);
+                if (mayRunPostIncomingTransferCallback(possession.publicKey))
+                    break;
+            }
 
-            const QuTransfer quTransfer = { _currentContractId, possession.publicKey, dividend };
-            logger.logQuTransfer(quTransfer);
+            // Track, notify, and log transfers in the order of the holders (increaseEnergies() may credit only a part
+            // of the batch, so spectrum stats and dust burning logged while crediting come after the earlier transfers)
+            for (unsigned int i = 0; i < batchSize; )
+            {
+                const unsigned int creditedEnd = i + increaseEnergies(dividendBatchPublicKeys + i, dividendBatchAmounts + i, batchSize - i);
+                for (; i < creditedEnd; ++i)
+                {
+                    if (!contractActionTracker.addQuTransfer(_currentContractId, dividendBatchPublicKeys[i], dividendBatchAmounts[i]))
+                        __qpiAbort(ContractErrorTooManyActions);
 
-            totalShareCounter += possession.numberOfShares;
+                    __qpiNotifyPostIncomingTransfer(_currentContractId, dividendBatchPublicKeys[i], dividendBatchAmounts[i], TransferType::qpiDistributeDividends);
 
-            iter.next();
+                    const QuTransfer quTransfer = { _currentContractId, dividendBatchPublicKeys[i], dividendBatchAmounts[i] };
+                    logger.logQuTransfer(quTransfer);
+                }
+            }
         }
 
         ASSERT(totalShareCounter == NUMBER_OF_COMPUTORS || totalShareCounter == 0);
@@ -527,6 +608,7 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
 long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, const QPI::id& issuer, signed char numberOfDecimalPlaces, long long numberOfShares, unsigned long long unitOfMeasurement) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (((unsigned char)name) < 'A' || ((unsigned char)name) > 'Z'
         || name > 0xFFFFFFFFFFFFFF)
     {
@@ -589,11 +671,13 @@ long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, cons
 // TODO: remove after testing period, because numberOfShares() can do this and more
 long long QPI::QpiContextFunctionCall::numberOfPossessedShares(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, unsigned short ownershipManagingContractIndex, unsigned short possessionManagingContractIndex) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     return ::numberOfPossessedShares(assetName, issuer, owner, possessor, ownershipManagingContractIndex, possessionManagingContractIndex);
 }
 
 sint64 QPI::QpiContextFunctionCall::numberOfShares(const QPI::Asset& asset, const QPI::AssetOwnershipSelect& ownership, const QPI::AssetPossessionSelect& possession) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     return ::numberOfShares(asset, ownership, possession);
 }
 
@@ -602,6 +686,7 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
     uint16 destinationOwnershipManagingContractIndex, uint16 destinationPossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -682,6 +767,7 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
 
 long long QPI::QpiContextProcedureCall::transferShareOwnershipAndPossession(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, long long numberOfShares, const m256i& newOwnerAndPossessor) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (numberOfShares <= 0 || numberOfShares > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -791,6 +877,7 @@ iteration:
 
 bool QPI::QpiContextFunctionCall::isAssetIssued(const m256i& issuer, unsigned long long assetName) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     bool res = ::issuanceIndex(issuer, assetName) != NO_ASSET_INDEX;
     return res;
 }
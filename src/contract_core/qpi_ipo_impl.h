@@ -4,6 +4,7 @@
 
 QPI::sint64 QPI::QpiContextProcedureCall::bidInIPO(unsigned int IPOContractIndex, long long price, unsigned int quantity) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (contractCallbacksRunning != NoContractCallback)
         return -1;
 
@@ -30,6 +31,7 @@ QPI::sint64 QPI::QpiContextProcedureCall::bidInIPO(unsigned int IPOContractIndex
 // Returns the ID of the entity who has made this IPO bid or NULL_ID if the ipoContractIndex or ipoBidIndex are invalid.
 QPI::id QPI::QpiContextFunctionCall::ipoBidId(QPI::uint32 ipoContractIndex, QPI::uint32 ipoBidIndex) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (ipoContractIndex >= contractCount || system.epoch >= contractDescriptions[ipoContractIndex].constructionEpoch || ipoBidIndex >= NUMBER_OF_COMPUTORS)
     {
         return NULL_ID;
@@ -46,6 +48,7 @@ QPI::id QPI::QpiContextFunctionCall::ipoBidId(QPI::uint32 ipoContractIndex, QPI:
 // Returns the price of an IPO bid, -1 if contract index is invalid, -2 if contract is not in IPO, -3 if bid index is invalid.
 QPI::sint64 QPI::QpiContextFunctionCall::ipoBidPrice(QPI::uint32 ipoContractIndex, QPI::uint32 ipoBidIndex) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (ipoContractIndex >= contractCount)
     {
         return -1;
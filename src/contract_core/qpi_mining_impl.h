@@ -1,6 +1,7 @@
 #pragma once
 
 #include "contracts/qpi.h"
+#include "contract_core/contract_exec.h"
 #include "score.h"
 
 static ScoreFunction<
@@ -16,6 +17,7 @@ static ScoreFunction<
 
 m256i QPI::QpiContextFunctionCall::computeMiningFunction(const m256i miningSeed, const m256i publicKey, const m256i nonce) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     (*score_qpi)(0, publicKey, miningSeed, nonce);
     return score_qpi->getLastOutput(0);
 }
@@ -14,6 +14,9 @@ namespace QPI
 		// Maximum number of voters
 		static constexpr uint32 maxVoters = NUMBER_OF_COMPUTORS;
 
+		// Votes are counted by scanning all votes in getVotingSummary() (no running sums stored with proposals)
+		static constexpr bool keepVotingSummary = false;
+
 		// Check if proposer has right to propose (and is not NULL_ID)
 		bool isValidProposer(const QpiContextFunctionCall& qpi, const id& proposerId) const
 		{
@@ -100,6 +103,18 @@ namespace QPI
 			return qpi.computor(voterIndex);
 		}
 
+		// Return weight of votes of given voter (each computor has one vote)
+		uint32 getVoteWeight(const QpiContextFunctionCall& qpi, uint32 voterIndex) const
+		{
+			return 1;
+		}
+
+		// Return sum of weights of all voters
+		uint32 getTotalVoteWeight(const QpiContextFunctionCall& qpi) const
+		{
+			return maxVoters;
+		}
+
 	protected:
 		// TODO: maybe replace by hash map?
 		// needs to be initialized with zeros
@@ -116,9 +131,178 @@ namespace QPI
 		}
 	};
 
-	template <unsigned int maxShareholders>
-	struct ProposalAndVotingByShareholders
+	template <uint16 proposalSlotCount, uint64 assetNameInt64>
+	struct ProposalAndVotingByShareholders : public ProposalAndVotingByComputors<proposalSlotCount>
 	{
+		typedef ProposalAndVotingByComputors<proposalSlotCount> BaseClass;
+
+		// Maximum number of voters (distinct shareholders, a contract has NUMBER_OF_COMPUTORS shares)
+		static constexpr uint32 maxVoters = NUMBER_OF_COMPUTORS;
+
+		// Votes are weighted by shares, so keep running sums of vote weights with each proposal
+		static constexpr bool keepVotingSummary = true;
+
+		// Check if proposer has right to propose (and is not NULL_ID)
+		bool isValidProposer(const QpiContextFunctionCall& qpi, const id& proposerId) const
+		{
+			if (isZero(proposerId))
+				return false;
+			return qpi.numberOfShares(Asset{ NULL_ID, assetNameInt64 }, AssetOwnershipSelect::byOwner(proposerId), AssetPossessionSelect::byPossessor(proposerId)) > 0;
+		}
+
+		// Get new proposal slot (each proposer may have at most one).
+		// The first call in an epoch captures the shareholders who may vote in this epoch.
+		// Returns proposal index or INVALID_PROPOSAL_INDEX on error.
+		// CAUTION: Only pass valid proposers!
+		uint16 getNewProposalIndex(const QpiContextFunctionCall& qpi, const id& proposerId)
+		{
+			updateShareholders(qpi);
+			return BaseClass::getNewProposalIndex(qpi, proposerId);
+		}
+
+		// Get voter index for given ID or INVALID_VOTER_INDEX if has no right to vote
+		// Voter index is index in list of shareholders captured when first proposal of epoch has been set.
+		// Before, the voters of the current epoch are determined from the current possessions (without capturing
+		// them, because this may be called by functions), which gives the same result if no shares are transferred
+		// until the first proposal.
+		uint32 getVoterIndex(const QpiContextFunctionCall& qpi, const id& voterId) const
+		{
+			if (isZero(voterId))
+				return INVALID_VOTER_INDEX;
+			uint32 voterIndex = INVALID_VOTER_INDEX;
+			if (shareholderEpoch == qpi.epoch())
+			{
+				if (!shareholderIndices.get(voterId, voterIndex))
+					return INVALID_VOTER_INDEX;
+				return voterIndex;
+			}
+			forEachCurrentShareholder(qpi, [&](uint32 index, const id& possessor)
+				{
+					if (possessor != voterId)
+						return true;
+					voterIndex = index;
+					return false;
+				});
+			return voterIndex;
+		}
+
+		// Return voter ID for given voter index or NULL_ID on error
+		id getVoterId(const QpiContextFunctionCall& qpi, uint32 voterIndex) const
+		{
+			if (voterIndex >= maxVoters)
+				return NULL_ID;
+			if (shareholderEpoch == qpi.epoch())
+				return (voterIndex < shareholderCount) ? shareholders[voterIndex] : NULL_ID;
+			id voterId = NULL_ID;
+			forEachCurrentShareholder(qpi, [&](uint32 index, const id& possessor)
+				{
+					if (index != voterIndex)
+						return true;
+					voterId = possessor;
+					return false;
+				});
+			return voterId;
+		}
+
+		// Return weight of votes of given voter (number of shares possessed when shareholders have been captured,
+		// or currently possessed shares if shareholders of current epoch haven't been captured yet)
+		uint32 getVoteWeight(const QpiContextFunctionCall& qpi, uint32 voterIndex) const
+		{
+			if (shareholderEpoch == qpi.epoch())
+				return (voterIndex < shareholderCount) ? shareholderShares[voterIndex] : 0;
+			const id voterId = getVoterId(qpi, voterIndex);
+			if (isZero(voterId))
+				return 0;
+			return uint32(qpi.numberOfShares(Asset{ NULL_ID, assetNameInt64 }, AssetOwnershipSelect::any(), AssetPossessionSelect::byPossessor(voterId)));
+		}
+
+		// Return sum of weights of all voters
+		uint32 getTotalVoteWeight(const QpiContextFunctionCall& qpi) const
+		{
+			if (shareholderEpoch == qpi.epoch())
+				return totalShares;
+			return uint32(qpi.numberOfShares(Asset{ NULL_ID, assetNameInt64 }));
+		}
+
+	protected:
+		// Capture shareholders and their shares if not done in current epoch yet. Keeping them fixed during the epoch
+		// makes sure that shares cannot be transferred to vote twice and that the weight of a vote does not change.
+		void updateShareholders(const QpiContextFunctionCall& qpi)
+		{
+			if (shareholderEpoch == qpi.epoch())
+				return;
+
+			shareholderEpoch = qpi.epoch();
+			shareholderIndices.reset();
+			shareholderCount = 0;
+			totalShares = 0;
+
+			AssetPossessionIterator iter(Asset{ NULL_ID, assetNameInt64 });
+			while (!iter.reachedEnd())
+			{
+				const id possessor = iter.possessor();
+				const sint64 shares = iter.numberOfPossessedShares();
+				if (shares > 0 && !isZero(possessor))
+				{
+					uint32 voterIndex;
+					if (!shareholderIndices.get(possessor, voterIndex))
+					{
+						// cannot have more possessors than shares
+						ASSERT(shareholderCount < maxVoters);
+						voterIndex = shareholderCount++;
+						shareholders[voterIndex] = possessor;
+						shareholderShares[voterIndex] = 0;
+						shareholderIndices.set(possessor, voterIndex);
+					}
+					shareholderShares[voterIndex] += uint32(shares);
+					totalShares += uint32(shares);
+				}
+				iter.next();
+			}
+		}
+
+		// Call f(voterIndex, possessor) for the distinct shareholders in the order in which updateShareholders() would
+		// assign voter indices, until f returns false. This doesn't need memory for looking up possessors seen before, so
+		// it takes quadratic time, which is okay for the few queries before the first proposal of an epoch.
+		template <typename F>
+		void forEachCurrentShareholder(const QpiContextFunctionCall& qpi, F f) const
+		{
+			const Asset asset{ NULL_ID, assetNameInt64 };
+			uint32 voterIndex = 0;
+			uint32 position = 0;
+			for (AssetPossessionIterator iter(asset); !iter.reachedEnd(); iter.next(), ++position)
+			{
+				const id possessor = iter.possessor();
+				if (iter.numberOfPossessedShares() <= 0 || isZero(possessor))
+					continue;
+
+				// skip possessor already seen in previous possession record
+				bool seenBefore = false;
+				AssetPossessionIterator prevIter(asset);
+				for (uint32 prevPosition = 0; prevPosition < position; ++prevPosition, prevIter.next())
+				{
+					if (prevIter.possessor() == possessor && prevIter.numberOfPossessedShares() > 0)
+					{
+						seenBefore = true;
+						break;
+					}
+				}
+				if (seenBefore)
+					continue;
+
+				if (!f(voterIndex, possessor))
+					return;
+				++voterIndex;
+			}
+		}
+
+		// Shareholders who may vote in epoch shareholderEpoch, their shares, and voter index lookup by ID
+		HashMap<id, uint32, 1024> shareholderIndices;
+		id shareholders[maxVoters];
+		uint32 shareholderShares[maxVoters];
+		uint32 shareholderCount;
+		uint32 totalShares;
+		uint16 shareholderEpoch;
 	};
 
 	// Check if given type is valid (supported by most comprehensive ProposalData class).
@@ -325,6 +509,159 @@ namespace QPI
 		}
 	};
 
+	// Add value * factor to signed 128-bit integer (low, high). Requires |factor| < 2^31.
+	inline void __addProductToInt128(uint64& low, sint64& high, sint64 value, sint64 factor)
+	{
+		// split value into 32-bit parts, so that both partial products fit into sint64
+		const sint64 productLow = (value & 0xffffffff) * factor;
+		const sint64 productHigh = (value >> 32) * factor;
+
+		uint64 newLow = low + uint64(productLow);
+		high += (productLow >> 63) + (newLow < low);
+		low = newLow;
+
+		newLow = low + (uint64(productHigh) << 32);
+		high += (productHigh >> 32) + (newLow < low);
+		low = newLow;
+	}
+
+	// Divide signed 128-bit integer (low, high) by divisor > 0, rounding toward zero. Quotient must fit into sint64.
+	inline sint64 __divideInt128(uint64 low, sint64 high, uint32 divisor)
+	{
+		const bool negative = high < 0;
+		uint64 magnitudeLow = low;
+		uint64 magnitudeHigh = uint64(high);
+		if (negative)
+		{
+			magnitudeLow = ~low + 1;
+			magnitudeHigh = ~magnitudeHigh + (magnitudeLow == 0);
+		}
+
+		// long division with 32-bit digits
+		const uint32 digits[4] = { uint32(magnitudeHigh >> 32), uint32(magnitudeHigh), uint32(magnitudeLow >> 32), uint32(magnitudeLow) };
+		uint64 quotient = 0, remainder = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			const uint64 current = (remainder << 32) | digits[i];
+			quotient = (quotient << 32) | (current / divisor);
+			remainder = current % divisor;
+		}
+		return (negative) ? -sint64(quotient) : sint64(quotient);
+	}
+
+	// Used internally by ProposalVoting to store a proposal with all votes and running sums of vote weights, which are
+	// updated with each vote, so getting the voting summary does not require to scan all votes.
+	// Used if ProposerAndVoterHandlingType::keepVotingSummary is true.
+	template <typename ProposalDataType, uint32 numOfVoters>
+	struct ProposalWithAllVoteDataAndSummary : public ProposalWithAllVoteData<ProposalDataType, numOfVoters>
+	{
+		typedef ProposalWithAllVoteData<ProposalDataType, numOfVoters> BaseClass;
+
+		// Sum of weights of all votes casted
+		uint32 totalVoteWeight;
+
+		// Sum of weights of votes per option (option voting)
+		uint32 optionVoteWeights[8];
+
+		// Weighted sum of scalar votes as signed 128-bit integer (cannot overflow)
+		uint64 scalarVoteSumLow;
+		sint64 scalarVoteSumHigh;
+
+		// Set proposal and reset all votes
+		bool set(const ProposalDataType& proposal)
+		{
+			if (!BaseClass::set(proposal))
+				return false;
+
+			totalVoteWeight = 0;
+			setMemory(optionVoteWeights, 0);
+			scalarVoteSumLow = 0;
+			scalarVoteSumHigh = 0;
+			return true;
+		}
+
+		// Set vote value (as used in ProposalSingleVoteData) of given voter if voter and value are valid.
+		// The weight of a voter must not change while voting is possible, because it is also used for removing the
+		// previous vote of the voter from the sums.
+		bool setVoteValue(uint32 voterIndex, sint64 voteValue, uint32 weight)
+		{
+			const sint64 previousVoteValue = this->getVoteValue(voterIndex);
+			if (!BaseClass::setVoteValue(voterIndex, voteValue))
+				return false;
+
+			addToSums(previousVoteValue, -sint64(weight));
+			addToSums(voteValue, weight);
+			return true;
+		}
+
+		// Set totalVotes and optionVoteCount / scalarVotingResult of summary from running sums
+		void getVotingSummary(ProposalSummarizedVotingDataV1& votingSummary) const
+		{
+			votingSummary.totalVotes = totalVoteWeight;
+			if (this->type == ProposalTypes::VariableScalarMean)
+			{
+				// make sure union is zeroed and set mean value of votes
+				setMemory(votingSummary.optionVoteCount, 0);
+				votingSummary.scalarVotingResult = (totalVoteWeight) ? __divideInt128(scalarVoteSumLow, scalarVoteSumHigh, totalVoteWeight) : 0;
+			}
+			else
+			{
+				auto& hist = votingSummary.optionVoteCount;
+				hist.setAll(0);
+				for (uint16 i = 0; i < votingSummary.optionCount; ++i)
+					hist.set(i, optionVoteWeights[i]);
+			}
+		}
+
+	protected:
+		// Add vote value with given (negative or positive) weight to sums
+		void addToSums(sint64 voteValue, sint64 weight)
+		{
+			if (voteValue == NO_VOTE_VALUE)
+				return;
+
+			totalVoteWeight += uint32(weight);
+			if (this->type == ProposalTypes::VariableScalarMean)
+			{
+				__addProductToInt128(scalarVoteSumLow, scalarVoteSumHigh, voteValue, weight);
+			}
+			else
+			{
+				ASSERT(voteValue >= 0 && voteValue < 8);
+				optionVoteWeights[voteValue] += uint32(weight);
+			}
+		}
+	};
+
+	// Set vote value in proposal storage without running sums (weight is ignored)
+	template <typename ProposalDataType, uint32 numOfVoters>
+	bool __setVoteValue(ProposalWithAllVoteData<ProposalDataType, numOfVoters>& p, uint32 voterIndex, sint64 voteValue, uint32 weight)
+	{
+		return p.setVoteValue(voterIndex, voteValue);
+	}
+
+	// Set vote value in proposal storage with running sums
+	template <typename ProposalDataType, uint32 numOfVoters>
+	bool __setVoteValue(ProposalWithAllVoteDataAndSummary<ProposalDataType, numOfVoters>& p, uint32 voterIndex, sint64 voteValue, uint32 weight)
+	{
+		return p.setVoteValue(voterIndex, voteValue, weight);
+	}
+
+	// Get voting summary from running sums, which are not available in this proposal storage
+	template <typename ProposalDataType, uint32 numOfVoters>
+	bool __getRunningVotingSummary(const ProposalWithAllVoteData<ProposalDataType, numOfVoters>& p, ProposalSummarizedVotingDataV1& votingSummary)
+	{
+		return false;
+	}
+
+	// Get voting summary from running sums
+	template <typename ProposalDataType, uint32 numOfVoters>
+	bool __getRunningVotingSummary(const ProposalWithAllVoteDataAndSummary<ProposalDataType, numOfVoters>& p, ProposalSummarizedVotingDataV1& votingSummary)
+	{
+		p.getVotingSummary(votingSummary);
+		return true;
+	}
+
 	template <typename ProposerAndVoterHandlingType, typename ProposalDataType>
 	uint16 QpiContextProposalProcedureCall<ProposerAndVoterHandlingType, ProposalDataType>::setProposal(
 		const id& proposer,
@@ -433,7 +770,7 @@ namespace QPI
 		unsigned int voterIndex = pv.proposersAndVoters.getVoterIndex(qpi, voter);
 
 		// Set vote value (checking that voter index and value are valid)
-		return proposal.setVoteValue(voterIndex, vote.voteValue);
+		return __setVoteValue(proposal, voterIndex, vote.voteValue, pv.proposersAndVoters.getVoteWeight(qpi, voterIndex));
 	}
 
 	template <typename ProposerAndVoterHandlingType, typename ProposalDataType>
@@ -556,9 +893,13 @@ namespace QPI
 		votingSummary.proposalIndex = proposalIndex;
 		votingSummary.optionCount = ProposalTypes::optionCount(p.type);
 		votingSummary.proposalTick = p.tick;
-		votingSummary.authorizedVoters = pv.maxVoters;
+		votingSummary.authorizedVoters = pv.proposersAndVoters.getTotalVoteWeight(qpi);
 		votingSummary.totalVotes = 0;
 
+		// use running sums if kept with proposal (no need to scan all votes)
+		if (__getRunningVotingSummary(pv.proposals[proposalIndex], votingSummary))
+			return true;
+
 		if (p.type == ProposalTypes::VariableScalarMean)
 		{
 			// scalar voting -> compute mean value of votes
@@ -6,6 +6,7 @@
 
 bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     int index = spectrumIndex(id);
     if (index < 0)
     {
@@ -36,12 +37,13 @@ bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity
 // Return reference to fee reserve of contract for changing its value (data stored in state of contract 0)
 static long long& contractFeeReserve(unsigned int contractIndex)
 {
-    contractStateChangeFlags[0] |= 1ULL;
+    setContractStateChangeFlag(0);
     return ((Contract0State*)contractStates[0])->contractFeeReserves[contractIndex];
 }
 
 long long QPI::QpiContextProcedureCall::burn(long long amount) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (amount < 0 || amount > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -76,6 +78,7 @@ long long QPI::QpiContextProcedureCall::burn(long long amount) const
 
 long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long long amount) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return INVALID_AMOUNT;
@@ -118,6 +121,7 @@ long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long
 
 m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     int index = spectrumIndex(currentId);
     while (++index < SPECTRUM_CAPACITY)
     {
@@ -133,6 +137,7 @@ m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 
 m256i QPI::QpiContextFunctionCall::prevId(const m256i& currentId) const
 {
+    waitForContractSystemProcedureTurn(_currentContractIndex);
     int index = spectrumIndex(currentId);
     while (--index >= 0)
     {
@@ -7,13 +7,42 @@
 // Supports unwinding for analyzing stack in error handling and tagging blocks as "special" (for example those
 // with infos about locks that need to be released).
 // #define TRACK_MAX_STACK_BUFFER_SIZE to collect info on how much stack is used.
+// With bufferSize 0, the memory is not part of the StackBuffer but passed to init(), so the capacity can be chosen
+// at runtime.
+template <typename StackBufferSizeType, StackBufferSizeType bufferSize, bool externalBuffer = (bufferSize == 0)>
+struct StackBufferStorage
+{
+    static constexpr StackBufferSizeType capacity()
+    {
+        return bufferSize;
+    }
+
+protected:
+    char _buffer[bufferSize];
+};
+
+template <typename StackBufferSizeType, StackBufferSizeType bufferSize>
+struct StackBufferStorage<StackBufferSizeType, bufferSize, true>
+{
+    StackBufferSizeType capacity() const
+    {
+        return _capacity;
+    }
+
+protected:
+    char* _buffer;
+    StackBufferSizeType _capacity;
+};
+
 template <typename StackBufferSizeType, StackBufferSizeType bufferSize>
-struct StackBuffer
+struct StackBuffer : public StackBufferStorage<StackBufferSizeType, bufferSize>
 {
     // Data type used for size and index.
     typedef StackBufferSizeType SizeType;
     static_assert(SizeType(-1) > 0, "Signed StackBufferSizeType is not supported!");
 
+    using StackBufferStorage<StackBufferSizeType, bufferSize>::capacity;
+
     // Constructor (disabled because not called without MS CRT, you need to call init() to init)
     //StackBuffer()
     //{
@@ -30,10 +59,14 @@ struct StackBuffer
 #endif
     }
 
-    // Return capacity of buffer in bytes
-    static constexpr SizeType capacity()
+    // Initialize as empty stack using the passed memory (only if bufferSize is 0, memory not zeroed)
+    void init(void* buffer, SizeType capacity)
     {
-        return bufferSize;
+        static_assert(bufferSize == 0, "Only supported by StackBuffer with external buffer!");
+        ASSERT(capacity <= sizeMask);
+        this->_buffer = (char*)buffer;
+        this->_capacity = capacity;
+        init();
     }
 
     // Number of bytes currently used.
@@ -57,11 +90,11 @@ struct StackBuffer
     // Allocate storage in buffer.
     char* allocate(SizeType size, bool specialBlock = false)
     {
-        ASSERT(_allocatedSize <= bufferSize);
+        ASSERT(_allocatedSize <= capacity());
 
         // allocate fails of size after allocating overflows buffer size or the used size type
         StackBufferSizeType newSize = _allocatedSize + size + sizeof(SizeType);
-        if (newSize > bufferSize || newSize <= _allocatedSize)
+        if (newSize > capacity() || newSize <= _allocatedSize)
         {
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
             ++_failedAllocAttempts;
@@ -73,7 +106,7 @@ struct StackBuffer
             appendText(dbgMsg, L", failed new size ");
             appendNumber(dbgMsg, newSize, TRUE);
             appendText(dbgMsg, L", capacity ");
-            appendNumber(dbgMsg, bufferSize, TRUE);
+            appendNumber(dbgMsg, capacity(), TRUE);
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
             appendText(dbgMsg, L", max alloc ");
             appendNumber(dbgMsg, _maxAllocatedSize, TRUE);
@@ -86,7 +119,7 @@ struct StackBuffer
         }
 
         // get pointer to return
-        char* allocatedBuffer = _buffer + _allocatedSize;
+        char* allocatedBuffer = this->_buffer + _allocatedSize;
 
         // store size from before allocating buffer
         SizeType* sizeBeforeAlloc = reinterpret_cast<SizeType*>(allocatedBuffer + size);
@@ -97,7 +130,7 @@ struct StackBuffer
         // update size
         _allocatedSize = newSize;
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
-        ASSERT(_maxAllocatedSize <= bufferSize);
+        ASSERT(_maxAllocatedSize <= capacity());
         if (_allocatedSize > _maxAllocatedSize)
             _maxAllocatedSize = _allocatedSize;
 #endif
@@ -115,12 +148,12 @@ struct StackBuffer
     bool free()
     {
         // get size before last alloc
-        bool okay = (_allocatedSize <= bufferSize) && (_allocatedSize >= sizeof(SizeType));
+        bool okay = (_allocatedSize <= capacity()) && (_allocatedSize >= sizeof(SizeType));
 #if !defined(NO_UEFI)
-        ASSERT(_allocatedSize <= bufferSize);
+        ASSERT(_allocatedSize <= capacity());
         ASSERT(_allocatedSize >= sizeof(SizeType));
 #endif
-        SizeType sizeBeforeLastAlloc = *reinterpret_cast<SizeType*>(_buffer + _allocatedSize - sizeof(SizeType)) & sizeMask;
+        SizeType sizeBeforeLastAlloc = *reinterpret_cast<SizeType*>(this->_buffer + _allocatedSize - sizeof(SizeType)) & sizeMask;
 #if !defined(NO_UEFI)
         ASSERT(sizeBeforeLastAlloc < _allocatedSize);
 #endif
@@ -129,10 +162,10 @@ struct StackBuffer
         // some additional checks and ouput for debugging
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
 #if !defined(NO_UEFI)
-        ASSERT(_maxAllocatedSize <= bufferSize);
+        ASSERT(_maxAllocatedSize <= capacity());
         ASSERT(sizeBeforeLastAlloc < _maxAllocatedSize);
 #endif
-        okay = okay && (_maxAllocatedSize <= bufferSize) && (sizeBeforeLastAlloc < _maxAllocatedSize);
+        okay = okay && (_maxAllocatedSize <= capacity()) && (sizeBeforeLastAlloc < _maxAllocatedSize);
 #endif
 #if !defined(NDEBUG) && !defined(NO_UEFI)
         CHAR16 dbgMsg[200];
@@ -143,7 +176,7 @@ struct StackBuffer
             appendText(dbgMsg, L", after free() ");
             appendNumber(dbgMsg, sizeBeforeLastAlloc, TRUE);
             appendText(dbgMsg, L", capacity ");
-            appendNumber(dbgMsg, bufferSize, TRUE);
+            appendNumber(dbgMsg, capacity(), TRUE);
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
             appendText(dbgMsg, L", max alloc ");
             appendNumber(dbgMsg, _maxAllocatedSize, TRUE);
@@ -180,18 +213,18 @@ struct StackBuffer
         if (_allocatedSize < sizeof(SizeType))
             return false;
         SizeType sizePtrOffset = _allocatedSize - sizeof(SizeType);
-        SizeType prevSizeAndFlag = *reinterpret_cast<SizeType*>(_buffer + sizePtrOffset);
+        SizeType prevSizeAndFlag = *reinterpret_cast<SizeType*>(this->_buffer + sizePtrOffset);
         size = sizePtrOffset - (prevSizeAndFlag & sizeMask);
         bool okay = free();
         specialBlock = (prevSizeAndFlag & specialBlockFlag) != 0;
-        buffer = _buffer + _allocatedSize;
+        buffer = this->_buffer + _allocatedSize;
         return okay;
     }
 
 protected:
     // structure of buffer content: [ allocated buffer 1 | size before allocating buffer 1 | allocated buffer 2 | size before buffer 2 | ... | alloc. buf. n | size bef. buf. n ]
     // "size before allocating buffer" may have specialBlockFlag set.
-    char _buffer[bufferSize];
+    // (_buffer is defined in StackBufferStorage)
 
     // number of bytes used in buffer
     SizeType _allocatedSize;
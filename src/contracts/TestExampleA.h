@@ -77,6 +77,7 @@ protected:
 	Array<QpiFunctionsOutput, 16> qpiFunctionsOutputBeginTick; // Output of QPI functions queried by the BEGIN_TICK procedure for the last 16 ticks
 	Array<QpiFunctionsOutput, 16> qpiFunctionsOutputEndTick; // Output of QPI functions queried by the END_TICK procedure for the last 16 ticks
 	Array<QpiFunctionsOutput, 16> qpiFunctionsOutputUserProc; // Output of QPI functions queried by the USER_PROCEDURE
+	uint32 numberOfEndTicks; // Incremented before any QPI call in END_TICK, so re-running it after a missing state restore is visible
 
 	PUBLIC_FUNCTION(QueryQpiFunctions)
 	{
@@ -164,6 +165,8 @@ protected:
 
 	END_TICK()
 	{
+		state.numberOfEndTicks++;
+
 		state.qpiFunctionsOutputTemp.year = qpi.year();
 		state.qpiFunctionsOutputTemp.month = qpi.month();
 		state.qpiFunctionsOutputTemp.day = qpi.day();
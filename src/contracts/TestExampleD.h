@@ -6,10 +6,16 @@ struct TESTEXD2
 
 struct TESTEXD : public ContractBase
 {
+	// Tick of the END_TICK record of TESTEXA of the current tick, as seen by END_TICK of this contract. It is always 0,
+	// because END_TICK of TESTEXA runs after this one (also if it has been started in parallel, see contract_exec.h).
+	uint32 endTickOfTestExampleASeen;
+
 	struct END_TICK_locals
 	{
 		Entity entity;
 		sint64 balance;
+		TESTEXA::ReturnQpiFunctionsOutputEndTick_input testExAInput;
+		TESTEXA::ReturnQpiFunctionsOutputEndTick_output testExAOutput;
 	};
 
 	END_TICK_WITH_LOCALS()
@@ -21,6 +27,11 @@ struct TESTEXD : public ContractBase
 		{
 			qpi.distributeDividends(locals.balance / NUMBER_OF_COMPUTORS);
 		}
+
+		// Read state of TESTEXA, whose END_TICK may have been started before its turn
+		locals.testExAInput.tick = qpi.tick();
+		CALL_OTHER_CONTRACT_FUNCTION(TESTEXA, ReturnQpiFunctionsOutputEndTick, locals.testExAInput, locals.testExAOutput);
+		state.endTickOfTestExampleASeen = locals.testExAOutput.qpiFunctionsOutput.tick;
 	}
 
 	REGISTER_USER_FUNCTIONS_AND_PROCEDURES()
@@ -1091,6 +1091,8 @@ namespace QPI
 	};
 
 	// Iterator for possession records of specific issuance also providing filtering options.
+	// The order of the records is unspecified. If a specific possessor of any owner is selected, the records are
+	// returned in the order they are stored in the universe hash map, not grouped by ownership.
 	// CAUTION CORE DEVS: DOES NOT TAKE CARE OF LOCKING! (not relevant for contract devs)
 	class AssetPossessionIterator : public AssetOwnershipIterator
 	{
@@ -1468,6 +1470,16 @@ namespace QPI
 	template <typename ProposalDataType, uint32 numOfVoters>
 	struct ProposalWithAllVoteData;
 
+	// Used internally by ProposalVoting to store a proposal with all votes and running sums of vote weights
+	template <typename ProposalDataType, uint32 numOfVoters>
+	struct ProposalWithAllVoteDataAndSummary;
+
+	// Selection of proposal storage type (with running sums if keepVotingSummary)
+	template <bool keepVotingSummary, typename ProposalDataType, uint32 numOfVoters>
+	struct __ProposalStorageTypeSelector { typedef ProposalWithAllVoteData<ProposalDataType, numOfVoters> type; };
+	template <typename ProposalDataType, uint32 numOfVoters>
+	struct __ProposalStorageTypeSelector<true, ProposalDataType, numOfVoters> { typedef ProposalWithAllVoteDataAndSummary<ProposalDataType, numOfVoters> type; };
+
 
 	// Option for ProposerAndVoterHandlingT in ProposalVoting that allows both voting and setting proposals for computors only.
 	template <uint16 proposalSlotCount = NUMBER_OF_COMPUTORS>
@@ -1477,7 +1489,10 @@ namespace QPI
 	template <uint16 proposalSlotCount>
 	struct ProposalByAnyoneVotingByComputors;
 
-	template <unsigned int maxShareholders>
+	// Option for ProposerAndVoterHandlingT in ProposalVoting that allows both voting and setting proposals for shareholders
+	// of the asset with name assetNameInt64 issued by NULL_ID (shares of a contract). Votes are weighted by number of
+	// shares, which are captured with the first proposal set in an epoch.
+	template <uint16 proposalSlotCount, uint64 assetNameInt64>
 	struct ProposalAndVotingByShareholders;
 
 	template <typename ProposerAndVoterHandlingType, typename ProposalDataType>
@@ -1504,10 +1519,11 @@ namespace QPI
 
 		typedef ProposerAndVoterHandlingT ProposerAndVoterHandlingType;
 		typedef ProposalDataT ProposalDataType;
-		typedef ProposalWithAllVoteData<
+		typedef typename __ProposalStorageTypeSelector<
+			ProposerAndVoterHandlingT::keepVotingSummary,
 			ProposalDataT,
 			maxVoters
-		> ProposalAndVotesDataType;
+		>::type ProposalAndVotesDataType;
 
 		static_assert(maxProposals <= INVALID_PROPOSAL_INDEX);
 		static_assert(maxVoters <= INVALID_VOTER_INDEX);
@@ -1534,6 +1534,78 @@ static inline void KangarooTwelve(const void* input, unsigned int inputByteLen,
     KangarooTwelve((const unsigned char*)input, inputByteLen, (unsigned char*)output, outputByteLen);
 }
 
+// Incremental KangarooTwelve of large inputs: if inputByteLen >= K12_chunkSize, the input is split into the first chunk
+// and leaves of K12_chunkSize bytes (the last leaf may be shorter). The digest is computed from the first chunk and the
+// chaining values of all leaves. So if the chaining values are kept, only the ones of changed leaves need to be
+// recomputed. KangarooTwelveTreeDigest() yields the same digest as KangarooTwelve().
+
+// Return number of leaves of input (0 means that KangarooTwelve() does not use tree hashing for this size)
+static inline unsigned long long KangarooTwelveLeafCount(unsigned long long inputByteLen)
+{
+    // The empty customization string is encoded as one zero byte appended to the input
+    return inputByteLen / K12_chunkSize;
+}
+
+// Compute chaining value (K12_capacityInBytes bytes) of leaf with index 1 <= leafIndex <= KangarooTwelveLeafCount(inputByteLen)
+static void KangarooTwelveLeafChainingValue(const unsigned char* input, unsigned long long inputByteLen, unsigned long long leafIndex,
+    unsigned char* chainingValue)
+{
+    KangarooTwelve_F leafNode;
+    setMem(&leafNode, sizeof(KangarooTwelve_F), 0);
+    const unsigned long long begin = leafIndex * K12_chunkSize;
+    const unsigned long long end = (begin + K12_chunkSize < inputByteLen) ? begin + K12_chunkSize : inputByteLen;
+    KangarooTwelve_F_Absorb(&leafNode, input + begin, end - begin);
+    if (begin + K12_chunkSize > inputByteLen)
+    {
+        // Last leaf includes encoding of customization string
+        const unsigned char zero = 0;
+        KangarooTwelve_F_Absorb(&leafNode, &zero, 1);
+    }
+    leafNode.state[leafNode.byteIOIndex] ^= K12_suffixLeaf;
+    leafNode.state[K12_rateInBytes - 1] ^= 0x80;
+    KeccakP1600_Permute_12rounds(leafNode.state);
+    copyMem(chainingValue, leafNode.state, K12_capacityInBytes);
+}
+
+// Compute digest from first chunk of input and chaining values of leafCount >= 1 leaves (stored one after the other)
+static void KangarooTwelveTreeDigest(const unsigned char* input, const unsigned char* chainingValues, unsigned long long leafCount,
+    unsigned char* output, unsigned int outputByteLen)
+{
+    KangarooTwelve_F finalNode;
+    setMem(&finalNode, sizeof(KangarooTwelve_F), 0);
+    KangarooTwelve_F_Absorb(&finalNode, input, K12_chunkSize);
+    finalNode.state[finalNode.byteIOIndex] ^= 0x03;
+    if (++finalNode.byteIOIndex == K12_rateInBytes)
+    {
+        KeccakP1600_Permute_12rounds(finalNode.state);
+        finalNode.byteIOIndex = 0;
+    }
+    else
+    {
+        finalNode.byteIOIndex = (finalNode.byteIOIndex + 7) & ~7;
+    }
+
+    KangarooTwelve_F_Absorb(&finalNode, chainingValues, leafCount * K12_capacityInBytes);
+
+    unsigned int n = 0;
+    for (unsigned long long v = leafCount; v && (n < sizeof(unsigned long long)); ++n, v >>= 8)
+    {
+    }
+    unsigned char encbuf[sizeof(unsigned long long) + 1 + 2];
+    for (unsigned int i = 1; i <= n; ++i)
+    {
+        encbuf[i - 1] = (unsigned char)(leafCount >> (8 * (n - i)));
+    }
+    encbuf[n] = (unsigned char)n;
+    encbuf[++n] = 0xFF;
+    encbuf[++n] = 0xFF;
+    KangarooTwelve_F_Absorb(&finalNode, encbuf, ++n);
+    finalNode.state[finalNode.byteIOIndex] ^= 0x06;
+    finalNode.state[K12_rateInBytes - 1] ^= 0x80;
+    KeccakP1600_Permute_12rounds(finalNode.state);
+    copyMem(output, finalNode.state, outputByteLen);
+}
+
 static void KangarooTwelve64To32(const unsigned char* input, unsigned char* output)
 {
 #if defined (__AVX512F__) && !GENERIC_K12
@@ -230,17 +230,31 @@ struct SpectrumStats
 #define LOG_BUFFER_PAGE_SIZE 300000000ULL
 #define PMAP_LOG_PAGE_SIZE 30000000ULL
 #define IMAP_LOG_PAGE_SIZE 10000ULL
+#define EMAP_LOG_PAGE_SIZE 10000ULL
+#define EBLK_LOG_PAGE_SIZE 65536ULL
+#define LOG_ENTITY_FILTER_BITS_PER_ENTITY 16 // size of per-tick Bloom filter of entities touched by log events
+#define LOG_ENTITY_FILTER_MAX_ENTITIES 65536 // ticks with more distinct entities are searched without filter
+#define LOG_ENTITY_QUERY_MAX_TICKS 10000 // max number of ticks searched per RequestLogIdsOfEntity
 #define VM_NUM_CACHE_PAGE 8
+#define LOG_COMPRESS_PAGES 1 // store log pages compressed on disk
+#define LOG_STAGING_BUFFER_SIZE 1048576ULL // log events of a tx are staged before appending them to logBuffer
+#define LOG_STAGING_MAX_EVENTS 16384
+#define LOG_MAX_SUBSCRIPTIONS 16
+#define LOG_SUBSCRIPTION_MAX_WINDOW_SIZE 268435456ULL
  // Virtual memory with 100'000'000 items per page and 4 pages on cache
 #ifdef NO_UEFI
 #define TEXT_LOGS_AS_NUMBER 0
 #define TEXT_PMAP_AS_NUMBER 0
 #define TEXT_BUF_AS_NUMBER 0
 #define TEXT_IMAP_AS_NUMBER 0 
+#define TEXT_EMAP_AS_NUMBER 0
+#define TEXT_EBLK_AS_NUMBER 0
 #else
 #define TEXT_LOGS_AS_NUMBER 32370064710631532ULL // L"logs"
 #define TEXT_PMAP_AS_NUMBER 31525614010564720ULL // L"pmap"
 #define TEXT_IMAP_AS_NUMBER 31525614010564713ULL // L"imap"
+#define TEXT_EMAP_AS_NUMBER 31525614010564709ULL // L"emap"
+#define TEXT_EBLK_AS_NUMBER 30118286370930789ULL // L"eblk"
 #define TEXT_BUF_AS_NUMBER 28710885718818914ULL  // L"buff"
 #endif
 
@@ -258,13 +272,197 @@ public:
         long long length[LOG_TX_PER_TICK];
     };
 
+    // Blocked Bloom filter of the entities touched by the log events of a tick (see forEachEntityOfLogEvent()).
+    // The number of blocks of a tick's filter depends on its number of distinct entities (LOG_ENTITY_FILTER_BITS_PER_ENTITY
+    // bits per entity), so busy ticks don't saturate the filter. All bits of an entity are in one 512-bit block, so checking
+    // an entity only reads one block.
+    struct EntityFilter
+    {
+        struct Block
+        {
+            unsigned long long bits[8];
+        };
+        static constexpr unsigned int bitsPerEntity = 8;
+        static constexpr unsigned long long maxNumberOfBlocks = (LOG_ENTITY_FILTER_MAX_ENTITIES * LOG_ENTITY_FILTER_BITS_PER_ENTITY + 511) / 512;
+
+        static unsigned long long mix(unsigned long long h)
+        {
+            h ^= h >> 30;
+            h *= 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 27;
+            h *= 0x94D049BB133111EBULL;
+            h ^= h >> 31;
+            return h;
+        }
+
+        // hash of entity (never 0)
+        static unsigned long long hash(const m256i& entity)
+        {
+            // all parts of the key are mixed, because contract IDs only differ in the first 8 bytes
+            const unsigned long long h = mix(entity.m256i_u64[0] ^ mix(entity.m256i_u64[1] ^ mix(entity.m256i_u64[2] ^ mix(entity.m256i_u64[3]))));
+            return h ? h : 1;
+        }
+
+        static unsigned long long getNumberOfBlocks(unsigned long long numberOfEntities)
+        {
+            return (numberOfEntities * LOG_ENTITY_FILTER_BITS_PER_ENTITY + 511) / 512;
+        }
+
+        static unsigned long long getBlockIndex(unsigned long long entityHash, unsigned long long numberOfBlocks)
+        {
+            return entityHash % numberOfBlocks;
+        }
+
+        // get the 9-bit bit indices within the block of an entity
+        static void getBits(unsigned long long entityHash, unsigned short bitIndices[bitsPerEntity])
+        {
+            const unsigned long long g = mix(entityHash + 0x9E3779B97F4A7C15ULL);
+            for (unsigned int i = 0; i < 6; i++)
+            {
+                bitIndices[i] = (unsigned short)((g >> (i * 9)) & 511);
+            }
+            bitIndices[6] = (unsigned short)((entityHash >> 32) & 511);
+            bitIndices[7] = (unsigned short)((entityHash >> 41) & 511);
+        }
+
+        static void add(Block& block, unsigned long long entityHash)
+        {
+            unsigned short bitIndices[bitsPerEntity];
+            getBits(entityHash, bitIndices);
+            for (unsigned int i = 0; i < bitsPerEntity; i++)
+            {
+                block.bits[bitIndices[i] >> 6] |= 1ULL << (bitIndices[i] & 63);
+            }
+        }
+
+        // return false if entity is not in the filter block (true may be false positive)
+        static bool mayContain(const Block& block, unsigned long long entityHash)
+        {
+            unsigned short bitIndices[bitsPerEntity];
+            getBits(entityHash, bitIndices);
+            for (unsigned int i = 0; i < bitsPerEntity; i++)
+            {
+                if (!(block.bits[bitIndices[i] >> 6] & (1ULL << (bitIndices[i] & 63))))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Call f(publicKey) for each public key in a log event message of the given type (custom and contract messages
+    // aren't indexed, because their layout is unknown)
+    template <typename F>
+    static void forEachEntityOfLogEvent(unsigned char messageType, const char* message, unsigned int messageSize, F f)
+    {
+        switch (messageType)
+        {
+        case QU_TRANSFER:
+            if (messageSize >= offsetof(QuTransfer, _terminator))
+            {
+                const QuTransfer* m = (const QuTransfer*)message;
+                f(m->sourcePublicKey);
+                f(m->destinationPublicKey);
+            }
+            break;
+        case ASSET_ISSUANCE:
+            if (messageSize >= offsetof(AssetIssuance, _terminator))
+            {
+                f(((const AssetIssuance*)message)->issuerPublicKey);
+            }
+            break;
+        case ASSET_OWNERSHIP_CHANGE:
+        case ASSET_POSSESSION_CHANGE:
+            // same layout
+            if (messageSize >= offsetof(AssetOwnershipChange, _terminator))
+            {
+                const AssetOwnershipChange* m = (const AssetOwnershipChange*)message;
+                f(m->sourcePublicKey);
+                f(m->destinationPublicKey);
+                f(m->issuerPublicKey);
+            }
+            break;
+        case BURNING:
+            if (messageSize >= offsetof(Burning, _terminator))
+            {
+                f(((const Burning*)message)->sourcePublicKey);
+            }
+            break;
+        case DUST_BURNING:
+            if (messageSize >= 2)
+            {
+                DustBurning* m = (DustBurning*)message;
+                if (m->messageSize() <= messageSize)
+                {
+                    for (unsigned short i = 0; i < m->numberOfBurns; i++)
+                    {
+                        f(m->entity(i).publicKey);
+                    }
+                }
+            }
+            break;
+        case ASSET_OWNERSHIP_MANAGING_CONTRACT_CHANGE:
+            if (messageSize >= offsetof(AssetOwnershipManagingContractChange, _terminator))
+            {
+                const AssetOwnershipManagingContractChange* m = (const AssetOwnershipManagingContractChange*)message;
+                f(m->ownershipPublicKey);
+                f(m->issuerPublicKey);
+            }
+            break;
+        case ASSET_POSSESSION_MANAGING_CONTRACT_CHANGE:
+            if (messageSize >= offsetof(AssetPossessionManagingContractChange, _terminator))
+            {
+                const AssetPossessionManagingContractChange* m = (const AssetPossessionManagingContractChange*)message;
+                f(m->possessionPublicKey);
+                f(m->ownershipPublicKey);
+                f(m->issuerPublicKey);
+            }
+            break;
+        }
+    }
+
 private:
-    inline static VirtualMemory<char, TEXT_BUF_AS_NUMBER, TEXT_LOGS_AS_NUMBER, LOG_BUFFER_PAGE_SIZE, VM_NUM_CACHE_PAGE> logBuffer;
-    inline static VirtualMemory<BlobInfo, TEXT_PMAP_AS_NUMBER, TEXT_LOGS_AS_NUMBER, PMAP_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE> mapLogIdToBufferIndex;
-    inline static VirtualMemory<TickBlobInfo, TEXT_IMAP_AS_NUMBER, TEXT_LOGS_AS_NUMBER, IMAP_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE> mapTxToLogId;
+    inline static VirtualMemory<char, TEXT_BUF_AS_NUMBER, TEXT_LOGS_AS_NUMBER, LOG_BUFFER_PAGE_SIZE, VM_NUM_CACHE_PAGE, LOG_COMPRESS_PAGES> logBuffer;
+    inline static VirtualMemory<BlobInfo, TEXT_PMAP_AS_NUMBER, TEXT_LOGS_AS_NUMBER, PMAP_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE, LOG_COMPRESS_PAGES> mapLogIdToBufferIndex;
+    inline static VirtualMemory<TickBlobInfo, TEXT_IMAP_AS_NUMBER, TEXT_LOGS_AS_NUMBER, IMAP_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE, LOG_COMPRESS_PAGES> mapTxToLogId;
+    // blocks of entity filter of each tick: startIndex is first block in entityFilterBlocks, length is number of blocks
+    // (0 if no entity is touched, -1 if tick has to be searched without filter)
+    inline static VirtualMemory<BlobInfo, TEXT_EMAP_AS_NUMBER, TEXT_LOGS_AS_NUMBER, EMAP_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE, LOG_COMPRESS_PAGES> mapTickToEntityFilter;
+    inline static VirtualMemory<EntityFilter::Block, TEXT_EBLK_AS_NUMBER, TEXT_LOGS_AS_NUMBER, EBLK_LOG_PAGE_SIZE, VM_NUM_CACHE_PAGE, LOG_COMPRESS_PAGES> entityFilterBlocks;
     inline static TickBlobInfo currentTickTxToId;
+    // distinct entities of current tick: hash set of entity hashes (0 is empty slot) and list of used slots
+    inline static unsigned long long currentTickEntityHashes[LOG_ENTITY_FILTER_MAX_ENTITIES * 2];
+    inline static unsigned int currentTickEntitySlots[LOG_ENTITY_FILTER_MAX_ENTITIES];
+    inline static unsigned int numberOfCurrentTickEntities; // LOG_ENTITY_FILTER_MAX_ENTITIES + 1 if there are too many
+    inline static EntityFilter::Block currentTickEntityFilterBlocks[EntityFilter::maxNumberOfBlocks];
     inline static char responseBuffers[MAX_NUMBER_OF_PROCESSORS][RequestResponseHeader::max_size];
 
+    // Log events are staged (with the digest field not set yet) and appended to logBuffer and mapLogIdToBufferIndex
+    // in one batch at tx boundaries. Logging only happens in the tick/contract processor, which run one after the
+    // other, so one staging buffer keeps the order of log IDs.
+    inline static char stagedLogEvents[LOG_STAGING_BUFFER_SIZE];
+    inline static BlobInfo stagedLogEventInfos[LOG_STAGING_MAX_EVENTS];
+    inline static unsigned long long stagedLogEventsSize;
+    inline static unsigned int numberOfStagedLogEvents;
+
+    // Clients subscribed to log events with RequestLogSubscription
+    struct LogSubscription
+    {
+        Peer* peer; // NULL if unused
+        IPv4Address address;
+        unsigned int dejavu;
+        unsigned long long nextLogId; // next log event to push
+        unsigned long long ackedLogId; // client has received all log events before this
+        unsigned long long windowSize; // max number of bytes pushed beyond ackedLogId
+        unsigned int generation; // changed if stream is restarted or cancelled, so a running push doesn't override it
+    };
+    inline static LogSubscription logSubscriptions[LOG_MAX_SUBSCRIPTIONS];
+    inline static volatile char logSubscriptionsLock;
+    inline static volatile bool logEventsToPush; // set if subscribers may be pushed more log events
+    inline static volatile char logSubscriptionsPushLock; // held by the request processor pushing log events
+    inline static char logSubscriptionBuffer[RequestResponseHeader::max_size]; // only used with logSubscriptionsPushLock
+
 #if LOG_STATE_DIGEST
     // Digests of log data:
     // d(i) = K12(concat(d(i-1), log(spectrum), log(universe))
@@ -321,22 +519,16 @@ private:
         return true;
     }
 
-    static void logMessage(unsigned int messageSize, unsigned char messageType, const void* message)
+    // set log digest in header, feed message to state digest, and add touched entities to filter of current tick
+    static void finalizeLogEvent(char* header, const char* message)
     {
 #if ENABLED_LOGGING
-        char buffer[LOG_HEADER_SIZE];
-        tx.addLogId();
-        logBuf.set(logId, logBufferTail, LOG_HEADER_SIZE + messageSize);
-        *((unsigned short*)(buffer)) = system.epoch;
-        *((unsigned int*)(buffer + 2)) = system.tick;
-        *((unsigned int*)(buffer + 6)) = messageSize | (messageType << 24);
-        *((unsigned long long*)(buffer + 10)) = logId++;
+        const unsigned int messageSize = getLogSize(header);
+        const unsigned char messageType = header[9];
         unsigned long long logDigest = 0;
         KangarooTwelve(message, messageSize, &logDigest, 8);
-        *((unsigned long long*)(buffer + 18)) = logDigest;
-        logBufferTail += LOG_HEADER_SIZE + messageSize;
-        logBuffer.appendMany(buffer, LOG_HEADER_SIZE);
-        logBuffer.appendMany((char*)message, messageSize);
+        *((unsigned long long*)(header + 18)) = logDigest;
+        forEachEntityOfLogEvent(messageType, message, messageSize, [](const m256i& entity) { addEntityOfCurrentTick(entity); });
 #if LOG_STATE_DIGEST
         if (messageType == QU_TRANSFER || messageType == ASSET_ISSUANCE || messageType == ASSET_OWNERSHIP_CHANGE || messageType == ASSET_POSSESSION_CHANGE ||
             messageType == BURNING || messageType == DUST_BURNING || messageType == SPECTRUM_STATS || messageType == ASSET_OWNERSHIP_MANAGING_CONTRACT_CHANGE ||
@@ -351,6 +543,44 @@ private:
 #endif
         }
 #endif
+#endif
+    }
+
+    static void logMessage(unsigned int messageSize, unsigned char messageType, const void* message)
+    {
+#if ENABLED_LOGGING
+        const unsigned long long eventSize = LOG_HEADER_SIZE + messageSize;
+        if (stagedLogEventsSize + eventSize > LOG_STAGING_BUFFER_SIZE || numberOfStagedLogEvents == LOG_STAGING_MAX_EVENTS)
+        {
+            flushStagedLogEvents();
+        }
+
+        char header[LOG_HEADER_SIZE];
+        char* buffer = (eventSize <= LOG_STAGING_BUFFER_SIZE) ? stagedLogEvents + stagedLogEventsSize : header;
+        tx.addLogId();
+        *((unsigned short*)(buffer)) = system.epoch;
+        *((unsigned int*)(buffer + 2)) = system.tick;
+        *((unsigned int*)(buffer + 6)) = messageSize | (messageType << 24);
+        *((unsigned long long*)(buffer + 10)) = logId++;
+        *((unsigned long long*)(buffer + 18)) = 0;
+
+        if (buffer == header)
+        {
+            // too large for staging buffer (which is empty now)
+            finalizeLogEvent(header, (const char*)message);
+            logBuffer.appendMany(header, LOG_HEADER_SIZE);
+            logBuffer.appendMany((char*)message, messageSize);
+            logBuf.set(logId - 1, logBufferTail, eventSize);
+        }
+        else
+        {
+            copyMem(buffer + LOG_HEADER_SIZE, message, messageSize);
+            stagedLogEventInfos[numberOfStagedLogEvents].startIndex = logBufferTail;
+            stagedLogEventInfos[numberOfStagedLogEvents].length = eventSize;
+            numberOfStagedLogEvents++;
+            stagedLogEventsSize += eventSize;
+        }
+        logBufferTail += eventSize;
 #endif
     }
 public:
@@ -391,6 +621,11 @@ public:
 
         static BlobInfo getBlobInfo(unsigned long long logId)
         {
+            if (logId >= mapLogIdToBufferIndex.size())
+            {
+                // not generated yet (reading would return zeros, which look like a valid header of log ID 0)
+                return BlobInfo{ -1,-1 };
+            }
             char buf[LOG_HEADER_SIZE];
             setMem(buf, sizeof(buf), 0);
             BlobInfo res = mapLogIdToBufferIndex[logId];
@@ -402,6 +637,55 @@ public:
             return BlobInfo{ -1,-1 };
         }
 
+        // Return the largest toID <= maxToID such that the log events [fromID, toID] take at most maxSize bytes, or -1
+        // if event fromID isn't available or doesn't fit. Events that haven't been generated yet are ignored. The start indices in mapLogIdToBufferIndex are prefix sums of
+        // the event sizes, so this is a binary search that only reads the (few) pages of mapLogIdToBufferIndex in range.
+        static long long getLastLogIdFitting(unsigned long long fromID, unsigned long long maxToID, unsigned long long maxSize)
+        {
+            const BlobInfo startInfo = getBlobInfo(fromID);
+            if (startInfo.startIndex == -1 || startInfo.length == -1 || (unsigned long long)startInfo.length > maxSize || maxToID < fromID)
+            {
+                return -1;
+            }
+
+            // each event has at least the header, so there is no need to search further
+            unsigned long long lo = fromID;
+            unsigned long long hi = fromID + maxSize / LOG_HEADER_SIZE - 1;
+            if (hi > maxToID)
+            {
+                hi = maxToID;
+            }
+            if (hi >= mapLogIdToBufferIndex.size())
+            {
+                hi = mapLogIdToBufferIndex.size() - 1;
+            }
+            while (lo < hi)
+            {
+                const unsigned long long mid = lo + (hi - lo + 1) / 2;
+                const BlobInfo info = mapLogIdToBufferIndex[mid];
+                if (info.startIndex >= startInfo.startIndex && info.length > 0
+                    && (unsigned long long)(info.startIndex + info.length - startInfo.startIndex) <= maxSize)
+                {
+                    lo = mid;
+                }
+                else
+                {
+                    hi = mid - 1;
+                }
+            }
+            if (lo != fromID && getBlobInfo(lo).startIndex == -1)
+            {
+                return -1;
+            }
+            return lo;
+        }
+
+        // number of log events that can be read
+        static unsigned long long getNumberOfLogIds()
+        {
+            return mapLogIdToBufferIndex.size();
+        }
+
         static void set(unsigned long long logId, long long index, long long length)
         {
             ASSERT(logId == mapLogIdToBufferIndex.size());
@@ -427,12 +711,14 @@ public:
     {
         static bool init()
         {
-            return mapTxToLogId.init();
+            return mapTxToLogId.init() && mapTickToEntityFilter.init() && entityFilterBlocks.init();
         }
 
         static void deinit()
         {
             mapTxToLogId.deinit();
+            mapTickToEntityFilter.deinit();
+            entityFilterBlocks.deinit();
         }
 
         // return the logID ranges of a tx hash
@@ -515,19 +801,119 @@ public:
         static void _commit()
         {
             mapTxToLogId.append(currentTickTxToId);
+            commitEntityFilterOfCurrentTick();
         }
 
         static void commitAndCleanCurrentTxToLogId()
         {
             _commit();
             cleanCurrentTickTxToId();
+            clearEntitiesOfCurrentTick();
         }
     } tx;
+
+    static void addEntityOfCurrentTick(const m256i& entity)
+    {
+        if (numberOfCurrentTickEntities > LOG_ENTITY_FILTER_MAX_ENTITIES)
+        {
+            return;
+        }
+        constexpr unsigned int hashSetSize = LOG_ENTITY_FILTER_MAX_ENTITIES * 2;
+        const unsigned long long h = EntityFilter::hash(entity);
+        unsigned int slot = (unsigned int)(h % hashSetSize);
+        while (currentTickEntityHashes[slot])
+        {
+            if (currentTickEntityHashes[slot] == h)
+            {
+                return;
+            }
+            slot = (slot + 1) % hashSetSize;
+        }
+        if (numberOfCurrentTickEntities == LOG_ENTITY_FILTER_MAX_ENTITIES)
+        {
+            // too many entities, tick will be searched without filter
+            numberOfCurrentTickEntities++;
+            return;
+        }
+        currentTickEntityHashes[slot] = h;
+        currentTickEntitySlots[numberOfCurrentTickEntities++] = slot;
+    }
+
+    static void clearEntitiesOfCurrentTick()
+    {
+        for (unsigned int i = 0; i < numberOfCurrentTickEntities && i < LOG_ENTITY_FILTER_MAX_ENTITIES; i++)
+        {
+            currentTickEntityHashes[currentTickEntitySlots[i]] = 0;
+        }
+        numberOfCurrentTickEntities = 0;
+    }
+
+    // build filter of entities of current tick and append it to entityFilterBlocks
+    static void commitEntityFilterOfCurrentTick()
+    {
+        BlobInfo info;
+        info.startIndex = entityFilterBlocks.size();
+        info.length = 0;
+        if (numberOfCurrentTickEntities > LOG_ENTITY_FILTER_MAX_ENTITIES)
+        {
+            info.length = -1;
+        }
+        else if (numberOfCurrentTickEntities)
+        {
+            const unsigned long long numberOfBlocks = EntityFilter::getNumberOfBlocks(numberOfCurrentTickEntities);
+            setMem(currentTickEntityFilterBlocks, numberOfBlocks * sizeof(EntityFilter::Block), 0);
+            for (unsigned int i = 0; i < numberOfCurrentTickEntities; i++)
+            {
+                const unsigned long long h = currentTickEntityHashes[currentTickEntitySlots[i]];
+                EntityFilter::add(currentTickEntityFilterBlocks[EntityFilter::getBlockIndex(h, numberOfBlocks)], h);
+            }
+            entityFilterBlocks.appendMany(currentTickEntityFilterBlocks, numberOfBlocks);
+            info.length = numberOfBlocks;
+        }
+        mapTickToEntityFilter.append(info);
+    }
+
+    // return false if entity is not touched by the log events of the tick (true may be false positive)
+    static bool tickMayContainEntity(unsigned int tick, const m256i& entity)
+    {
+        BlobInfo info;
+        mapTickToEntityFilter.getOne(tick - tickBegin, &info);
+        if (info.length <= 0)
+        {
+            return info.length != 0;
+        }
+        const unsigned long long h = EntityFilter::hash(entity);
+        EntityFilter::Block block;
+        entityFilterBlocks.getOne(info.startIndex + EntityFilter::getBlockIndex(h, info.length), &block);
+        return EntityFilter::mayContain(block, h);
+    }
 #endif
 
+    // compute digests of staged log events and append them to the log buffer, so they can be read
+    static void flushStagedLogEvents()
+    {
+#if ENABLED_LOGGING
+        if (!numberOfStagedLogEvents)
+        {
+            return;
+        }
+        char* event = stagedLogEvents;
+        for (unsigned int i = 0; i < numberOfStagedLogEvents; i++)
+        {
+            finalizeLogEvent(event, event + LOG_HEADER_SIZE);
+            event += stagedLogEventInfos[i].length;
+        }
+        logBuffer.appendMany(stagedLogEvents, stagedLogEventsSize);
+        mapLogIdToBufferIndex.appendMany(stagedLogEventInfos, numberOfStagedLogEvents);
+        stagedLogEventsSize = 0;
+        numberOfStagedLogEvents = 0;
+#endif
+    }
+
     static void registerNewTx(const unsigned int tick, const unsigned int txId)
     {
 #if ENABLED_LOGGING
+        flushStagedLogEvents();
         tx._registerNewTx(tick, txId);
 #endif
     }
@@ -565,9 +951,22 @@ public:
         tx.init();
         logBufferTail = 0;
         logId = 0;
+        stagedLogEventsSize = 0;
+        numberOfStagedLogEvents = 0;
         lastUpdatedTick = 0;
+        ACQUIRE(logSubscriptionsLock);
+        for (int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+        {
+            // log IDs restart with new epoch
+            logSubscriptions[i].nextLogId = 0;
+            logSubscriptions[i].ackedLogId = 0;
+            logSubscriptions[i].generation++;
+        }
+        RELEASE(logSubscriptionsLock);
+        logEventsToPush = true;
         tickBegin = _tickBegin;
         tx.cleanCurrentTickTxToId();
+        clearEntitiesOfCurrentTick();
 #if LOG_STATE_DIGEST
         XKCP::KangarooTwelve_Initialize(&k12, 128, 32);
         m256i zeroHash = m256i::zero();
@@ -580,6 +979,7 @@ public:
     {
 #if ENABLED_LOGGING
         ASSERT((_tick == lastUpdatedTick + 1) || (_tick == tickBegin));
+        flushStagedLogEvents();
 #if LOG_STATE_DIGEST
         unsigned long long index = lastUpdatedTick - tickBegin;
         XKCP::KangarooTwelve_Final(&k12, digests[index].m256i_u8, (const unsigned char*)"", 0);
@@ -589,6 +989,24 @@ public:
         tx.commitAndCleanCurrentTxToLogId();
         ASSERT(mapTxToLogId.size() == (_tick - tickBegin + 1));
         lastUpdatedTick = _tick;
+        // log events are read and pushed to subscribers by a request processor, so this doesn't delay the tick processor
+        logEventsToPush = true;
+#endif
+    }
+
+    // drop entity filters of all committed ticks, so they are searched without filtering (ticks committed later get filters)
+    static void disableEntityFiltersOfCommittedTicks()
+    {
+#if ENABLED_LOGGING
+        mapTickToEntityFilter.init();
+        entityFilterBlocks.init();
+        BlobInfo noFilter;
+        noFilter.startIndex = 0;
+        noFilter.length = -1;
+        while (mapTickToEntityFilter.size() < mapTxToLogId.size())
+        {
+            mapTickToEntityFilter.append(noFilter);
+        }
 #endif
     }
     
@@ -599,9 +1017,10 @@ public:
     bool saveCurrentLoggingStates(CHAR16* dir)
     {
 #if ENABLED_LOGGING
+        flushStagedLogEvents();
         unsigned char* buffer = (unsigned char*)__scratchpad();        
         static_assert(reorgBufferSize >= LOG_BUFFER_PAGE_SIZE + PMAP_LOG_PAGE_SIZE * sizeof(BlobInfo) + IMAP_LOG_PAGE_SIZE * sizeof(TickBlobInfo)
-            + sizeof(digests) + 600, "scratchpad is too small");
+            + EMAP_LOG_PAGE_SIZE * sizeof(BlobInfo) + EBLK_LOG_PAGE_SIZE * sizeof(EntityFilter::Block) + sizeof(digests) + 600, "scratchpad is too small");
         unsigned long long writeSz = 0;
         // copy currentPage of log buffer ~ 100MiB
         unsigned long long sz = logBuffer.dumpVMState(buffer);
@@ -636,6 +1055,14 @@ public:
         *((unsigned int*)buffer) = currentTxId; buffer += 4;
         *((unsigned int*)buffer) = currentTick; buffer += 4;
         writeSz += 8 + 8 + 4 + 4 + 4 + 4;
+
+        // mapTickToEntityFilter ~ 160KiB and entityFilterBlocks ~ 4MiB (last, because older state files don't have them)
+        sz = mapTickToEntityFilter.dumpVMState(buffer);
+        buffer += sz;
+        writeSz += sz;
+        sz = entityFilterBlocks.dumpVMState(buffer);
+        buffer += sz;
+        writeSz += sz;
         buffer = (unsigned char*)__scratchpad(); // reset back to original pos
         sz = save(L"logEventState.db", writeSz, buffer, dir);
         if (sz != writeSz)
@@ -653,7 +1080,7 @@ public:
 #if ENABLED_LOGGING
         unsigned char* buffer = (unsigned char*)__scratchpad();
         static_assert(reorgBufferSize >= LOG_BUFFER_PAGE_SIZE + PMAP_LOG_PAGE_SIZE * sizeof(BlobInfo) + IMAP_LOG_PAGE_SIZE * sizeof(TickBlobInfo)
-            + sizeof(digests) + 600, "scratchpad is too small");
+            + EMAP_LOG_PAGE_SIZE * sizeof(BlobInfo) + EBLK_LOG_PAGE_SIZE * sizeof(EntityFilter::Block) + sizeof(digests) + 600, "scratchpad is too small");
         CHAR16 fileName[] = L"logEventState.db";
         const long long fileSz = getFileSize(fileName, dir);
         if (fileSz == -1)
@@ -701,7 +1128,27 @@ public:
         tickBegin = *((unsigned int*)buffer); buffer += 4;
         lastUpdatedTick = *((unsigned int*)buffer); buffer += 4;
         currentTxId = *((unsigned int*)buffer); buffer += 4;
-        currentTick = *((unsigned int*)buffer);
+        currentTick = *((unsigned int*)buffer); buffer += 4;
+        readSz += 8 + 8 + 4 + 4 + 4 + 4;
+        stagedLogEventsSize = 0;
+        numberOfStagedLogEvents = 0;
+        clearEntitiesOfCurrentTick();
+
+        // mapTickToEntityFilter and entityFilterBlocks
+        if (readSz + mapTickToEntityFilter.getPageSize() + 16 + entityFilterBlocks.getPageSize() + 16 == (unsigned long long)fileSz)
+        {
+            sz = mapTickToEntityFilter.loadVMState(buffer);
+            buffer += sz;
+            readSz += sz;
+            sz = entityFilterBlocks.loadVMState(buffer);
+            buffer += sz;
+            readSz += sz;
+        }
+        else
+        {
+            // state saved without (or with older format of) entity filters
+            disableEntityFiltersOfCommittedTicks();
+        }
 #endif
     }
 
@@ -861,28 +1308,24 @@ public:
 
     // get log state digest
     static void processRequestGetLogDigest(Peer* peer, RequestResponseHeader* header);
-};
 
-GLOBAL_VAR_DECL qLogger logger;
+    // Request: ranges of log ID, response with continuation token
+    static void processRequestLogPage(unsigned long long processorNumber, Peer* peer, RequestResponseHeader* header);
 
-// For smartcontract logging
-template <typename T>
-static void __logContractDebugMessage(unsigned int size, T& msg)
-{
-    logger.__logContractDebugMessage(size, msg);
-}
-template <typename T>
-static void __logContractErrorMessage(unsigned int size, T& msg)
-{
-    logger.__logContractErrorMessage(size, msg);
-}
-template <typename T>
-static void __logContractInfoMessage(unsigned int size, T& msg)
-{
-    logger.__logContractInfoMessage(size, msg);
-}
-template <typename T>
-static void __logContractWarningMessage(unsigned int size, T& msg)
-{
-    logger.__logContractWarningMessage(size, msg);
-}
\ No newline at end of file
+    // get IDs of log events touching an entity in a tick range
+    static void processRequestLogIdsOfEntity(unsigned long long processorNumber, Peer* peer, RequestResponseHeader* header);
+
+    // subscribe to log events pushed after each tick
+    static void processRequestLogSubscription(Peer* peer, RequestResponseHeader* header);
+
+    // push new log events to subscribed clients, called by request processors (one of them pushes at a time, at most one
+    // message per subscriber and call). Not called by the main processor, because reading log events may load pages.
+    static void pushLogEventsToSubscribers();
+
+private:
+    // push one message of log events to (copy of) subscription if its window allows, without holding logSubscriptionsLock
+    // return true if more log events can be pushed
+    static bool pushLogEventsToSubscriber(LogSubscription& subscription);
+};
+
+GLOBAL_VAR_DECL qLogger logger;
\ No newline at end of file
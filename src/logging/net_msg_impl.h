@@ -14,35 +14,19 @@ void qLogger::processRequestLog(unsigned long long processorNumber, Peer* peer,
         && request->passcode[2] == logReaderPasscodes[2]
         && request->passcode[3] == logReaderPasscodes[3])
     {
-        BlobInfo startIdBufferRange = logBuf.getBlobInfo(request->fromID);
         BlobInfo endIdBufferRange = logBuf.getBlobInfo(request->toID); // inclusive
-        if (startIdBufferRange.startIndex != -1 && startIdBufferRange.length != -1
-            && endIdBufferRange.startIndex != -1 && endIdBufferRange.length != -1)
+        constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(RequestResponseHeader);
+        const long long toID = (endIdBufferRange.startIndex != -1 && endIdBufferRange.length != -1)
+            ? logBuf.getLastLogIdFitting(request->fromID, request->toID, maxPayloadSize) : -1;
+        if (toID != -1)
         {
-            unsigned long long toID = request->toID;
+            BlobInfo startIdBufferRange = mapLogIdToBufferIndex[request->fromID];
+            endIdBufferRange = mapLogIdToBufferIndex[toID];
             long long startFrom = startIdBufferRange.startIndex;
             long long length = endIdBufferRange.length + endIdBufferRange.startIndex - startFrom;
-            constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(sizeof(RequestResponseHeader));
-
-            if (length > maxPayloadSize)
-            {
-                while (length > maxPayloadSize && toID > request->fromID)
-                {
-                    toID = request->fromID + (toID - request->fromID) / 2;
-                    endIdBufferRange = logBuf.getBlobInfo(toID);
-                    length = endIdBufferRange.length + endIdBufferRange.startIndex - startFrom;
-                }
-            }
-            if (length < maxPayloadSize)
-            {
-                char* rBuffer = responseBuffers[processorNumber];
-                logBuffer.getMany(rBuffer, startFrom, length);
-                enqueueResponse(peer, (unsigned int)(length), RespondLog::type, header->dejavu(), rBuffer);
-            }
-            else
-            {
-                enqueueResponse(peer, 0, RespondLog::type, header->dejavu(), NULL);
-            }
+            char* rBuffer = responseBuffers[processorNumber];
+            logBuffer.getMany(rBuffer, startFrom, length);
+            enqueueResponse(peer, (unsigned int)(length), RespondLog::type, header->dejavu(), rBuffer);
         }
         else
         {
@@ -54,6 +38,48 @@ void qLogger::processRequestLog(unsigned long long processorNumber, Peer* peer,
     enqueueResponse(peer, 0, RespondLog::type, header->dejavu(), NULL);
 }
 
+// Request: ranges of log ID, response with continuation token
+void qLogger::processRequestLogPage(unsigned long long processorNumber, Peer* peer, RequestResponseHeader* header)
+{
+#if ENABLED_LOGGING
+    RequestLogPage* request = header->getPayload<RequestLogPage>();
+    if (request->passcode[0] == logReaderPasscodes[0]
+        && request->passcode[1] == logReaderPasscodes[1]
+        && request->passcode[2] == logReaderPasscodes[2]
+        && request->passcode[3] == logReaderPasscodes[3])
+    {
+        RespondLogPage* resp = (RespondLogPage*)responseBuffers[processorNumber];
+        char* events = (char*)(resp + 1);
+        constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(RequestResponseHeader) - sizeof(RespondLogPage);
+        unsigned long long toID = request->toID;
+        const unsigned long long numberOfLogIds = logBuf.getNumberOfLogIds();
+        if (toID >= numberOfLogIds)
+        {
+            // not generated yet, the client can continue later
+            toID = numberOfLogIds - 1;
+        }
+        const long long lastID = (numberOfLogIds) ? logBuf.getLastLogIdFitting(request->fromID, toID, maxPayloadSize) : -1;
+        long long length = 0;
+        if (lastID != -1)
+        {
+            BlobInfo startIdBufferRange = mapLogIdToBufferIndex[request->fromID];
+            BlobInfo endIdBufferRange = mapLogIdToBufferIndex[lastID];
+            long long startFrom = startIdBufferRange.startIndex;
+            length = endIdBufferRange.length + endIdBufferRange.startIndex - startFrom;
+            logBuffer.getMany(events, startFrom, length);
+            resp->nextLogId = lastID + 1;
+        }
+        else
+        {
+            resp->nextLogId = -1;
+        }
+        enqueueResponse(peer, (unsigned int)(sizeof(RespondLogPage) + length), RespondLogPage::type, header->dejavu(), resp);
+        return;
+    }
+#endif
+    enqueueResponse(peer, 0, RespondLogPage::type, header->dejavu(), NULL);
+}
+
 void qLogger::processRequestTxLogInfo(unsigned long long processorNumber, Peer* peer, RequestResponseHeader* header)
 {
 #if ENABLED_LOGGING
@@ -191,4 +217,310 @@ void qLogger::processRequestGetLogDigest(Peer* peer, RequestResponseHeader* head
     }
 #endif
     enqueueResponse(peer, 0, ResponseLogStateDigest::type, header->dejavu(), NULL);
+}
+
+void qLogger::processRequestLogIdsOfEntity(unsigned long long processorNumber, Peer* peer, RequestResponseHeader* header)
+{
+#if ENABLED_LOGGING
+    RequestLogIdsOfEntity* request = header->getPayload<RequestLogIdsOfEntity>();
+    if (request->passcode[0] == logReaderPasscodes[0]
+        && request->passcode[1] == logReaderPasscodes[1]
+        && request->passcode[2] == logReaderPasscodes[2]
+        && request->passcode[3] == logReaderPasscodes[3]
+        && request->fromTick >= tickBegin
+        && request->fromTick <= request->toTick
+        && request->fromTick <= lastUpdatedTick)
+    {
+        // first half of response buffer is used for the response, second half for reading log data
+        constexpr unsigned long long halfBufferSize = RequestResponseHeader::max_size / 2;
+        constexpr unsigned long long maxLogIds = (halfBufferSize - sizeof(RespondLogIdsOfEntity)) / sizeof(long long);
+        constexpr unsigned long long maxEventInfos = 4096;
+        char* rBuffer = responseBuffers[processorNumber];
+        RespondLogIdsOfEntity* resp = (RespondLogIdsOfEntity*)rBuffer;
+        long long* logIds = (long long*)(resp + 1);
+        TickBlobInfo* tickInfo = (TickBlobInfo*)(rBuffer + halfBufferSize);
+        BlobInfo* eventInfos = (BlobInfo*)(tickInfo + 1);
+        char* events = (char*)(eventInfos + maxEventInfos);
+        const unsigned long long eventsBufferSize = RequestResponseHeader::max_size - (events - rBuffer);
+        const m256i entity = request->entity;
+
+        unsigned int toTick = request->toTick;
+        if (toTick > lastUpdatedTick)
+        {
+            toTick = lastUpdatedTick;
+        }
+        if (toTick - request->fromTick >= LOG_ENTITY_QUERY_MAX_TICKS)
+        {
+            toTick = request->fromTick + LOG_ENTITY_QUERY_MAX_TICKS - 1;
+        }
+
+        resp->numberOfLogIds = 0;
+        resp->nextLogId = 0;
+        bool responseFull = false;
+        unsigned int tick;
+        for (tick = request->fromTick; tick <= toTick; tick++)
+        {
+            if (!tickMayContainEntity(tick, entity))
+            {
+                continue;
+            }
+
+            // log IDs of a tick are consecutive
+            tx.getTickLogIdInfo(tickInfo, tick);
+            long long beginLogId = -1, endLogId = -1;
+            for (int i = 0; i < LOG_TX_PER_TICK; i++)
+            {
+                if (tickInfo->fromLogId[i] >= 0 && tickInfo->length[i] > 0)
+                {
+                    if (beginLogId == -1 || tickInfo->fromLogId[i] < beginLogId)
+                    {
+                        beginLogId = tickInfo->fromLogId[i];
+                    }
+                    if (tickInfo->fromLogId[i] + tickInfo->length[i] > endLogId)
+                    {
+                        endLogId = tickInfo->fromLogId[i] + tickInfo->length[i];
+                    }
+                }
+            }
+
+            if (tick == request->fromTick && beginLogId < (long long)request->fromLogId)
+            {
+                // continue search of previous request in the middle of the tick
+                beginLogId = request->fromLogId;
+            }
+
+            // filter may have false positives, so check the log events of the tick
+            long long id = beginLogId;
+            while (id < endLogId && !responseFull)
+            {
+                unsigned long long numberOfEvents = endLogId - id;
+                if (numberOfEvents > maxEventInfos)
+                {
+                    numberOfEvents = maxEventInfos;
+                }
+                mapLogIdToBufferIndex.getMany(eventInfos, id, numberOfEvents);
+                if (eventInfos[0].length < LOG_HEADER_SIZE || (unsigned long long)eventInfos[0].length > eventsBufferSize)
+                {
+                    // not available (pruned)
+                    id++;
+                    continue;
+                }
+
+                // read consecutive events that fit into the buffer at once
+                unsigned long long numberOfReadEvents = 1;
+                long long readSize = eventInfos[0].length;
+                while (numberOfReadEvents < numberOfEvents
+                    && eventInfos[numberOfReadEvents].startIndex == eventInfos[0].startIndex + readSize
+                    && eventInfos[numberOfReadEvents].length >= LOG_HEADER_SIZE
+                    && (unsigned long long)(readSize + eventInfos[numberOfReadEvents].length) <= eventsBufferSize)
+                {
+                    readSize += eventInfos[numberOfReadEvents].length;
+                    numberOfReadEvents++;
+                }
+                logBuffer.getMany(events, eventInfos[0].startIndex, readSize);
+
+                for (unsigned long long i = 0; i < numberOfReadEvents && !responseFull; i++)
+                {
+                    const char* event = events + (eventInfos[i].startIndex - eventInfos[0].startIndex);
+                    const unsigned int messageSize = getLogSize(event);
+                    if (getLogId(event) != (unsigned long long)(id + i) || messageSize + LOG_HEADER_SIZE != eventInfos[i].length)
+                    {
+                        continue;
+                    }
+                    bool touched = false;
+                    forEachEntityOfLogEvent(event[9], event + LOG_HEADER_SIZE, messageSize, [&](const m256i& e) { touched |= (e == entity); });
+                    if (touched)
+                    {
+                        if (resp->numberOfLogIds == maxLogIds)
+                        {
+                            // continue with this event in next request
+                            responseFull = true;
+                            resp->nextLogId = id + i;
+                        }
+                        else
+                        {
+                            logIds[resp->numberOfLogIds++] = id + i;
+                        }
+                    }
+                }
+                id += numberOfReadEvents;
+            }
+
+            if (responseFull)
+            {
+                break;
+            }
+        }
+        resp->nextTick = tick;
+
+        enqueueResponse(peer, (unsigned int)(sizeof(RespondLogIdsOfEntity) + resp->numberOfLogIds * sizeof(long long)),
+            RespondLogIdsOfEntity::type, header->dejavu(), resp);
+        return;
+    }
+#endif
+    enqueueResponse(peer, 0, RespondLogIdsOfEntity::type, header->dejavu(), NULL);
+}
+
+void qLogger::processRequestLogSubscription(Peer* peer, RequestResponseHeader* header)
+{
+#if ENABLED_LOGGING
+    RequestLogSubscription* request = header->getPayload<RequestLogSubscription>();
+    if (request->passcode[0] == logReaderPasscodes[0]
+        && request->passcode[1] == logReaderPasscodes[1]
+        && request->passcode[2] == logReaderPasscodes[2]
+        && request->passcode[3] == logReaderPasscodes[3])
+    {
+        RespondLogSubscription resp;
+        resp.nextLogId = -1;
+        resp.windowSize = 0;
+
+        ACQUIRE(logSubscriptionsLock);
+        LogSubscription* subscription = NULL;
+        LogSubscription* unusedSubscription = NULL;
+        for (int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+        {
+            LogSubscription& s = logSubscriptions[i];
+            if (s.peer == peer && s.address == peer->address)
+            {
+                subscription = &s;
+            }
+            else if (!s.peer || !s.peer->tcp4Protocol || s.peer->isClosing || s.peer->address != s.address)
+            {
+                unusedSubscription = &s;
+            }
+        }
+
+        if (!request->windowSize)
+        {
+            if (subscription)
+            {
+                subscription->peer = NULL;
+                subscription->generation++;
+            }
+        }
+        else
+        {
+            if (!subscription && unusedSubscription)
+            {
+                subscription = unusedSubscription;
+                subscription->peer = NULL;
+            }
+            if (subscription)
+            {
+                if (!subscription->peer || request->fromID < subscription->ackedLogId || request->fromID > subscription->nextLogId)
+                {
+                    // new subscription or restart
+                    subscription->nextLogId = request->fromID;
+                    subscription->generation++;
+                }
+                subscription->ackedLogId = request->fromID;
+                subscription->peer = peer;
+                subscription->address = peer->address;
+                subscription->dejavu = header->dejavu();
+                // each log event has to fit into the window
+                subscription->windowSize = request->windowSize;
+                if (subscription->windowSize < RequestResponseHeader::max_size)
+                {
+                    subscription->windowSize = RequestResponseHeader::max_size;
+                }
+                if (subscription->windowSize > LOG_SUBSCRIPTION_MAX_WINDOW_SIZE)
+                {
+                    subscription->windowSize = LOG_SUBSCRIPTION_MAX_WINDOW_SIZE;
+                }
+                resp.nextLogId = subscription->nextLogId;
+                resp.windowSize = subscription->windowSize;
+            }
+        }
+
+        RELEASE(logSubscriptionsLock);
+
+        enqueueResponse(peer, sizeof(RespondLogSubscription), RespondLogSubscription::type, header->dejavu(), &resp);
+        if (resp.nextLogId != -1)
+        {
+            // events are pushed by request processors
+            logEventsToPush = true;
+        }
+        return;
+    }
+#endif
+    enqueueResponse(peer, 0, RespondLogSubscription::type, header->dejavu(), NULL);
+}
+
+void qLogger::pushLogEventsToSubscribers()
+{
+#if ENABLED_LOGGING
+    if (!logEventsToPush || !TRY_ACQUIRE(logSubscriptionsPushLock))
+    {
+        return;
+    }
+    logEventsToPush = false;
+    for (int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+    {
+        ACQUIRE(logSubscriptionsLock);
+        LogSubscription& sharedSubscription = logSubscriptions[i];
+        if (sharedSubscription.peer)
+        {
+            if (!sharedSubscription.peer->tcp4Protocol || !sharedSubscription.peer->isConnectedAccepted || sharedSubscription.peer->isClosing
+                || sharedSubscription.peer->address != sharedSubscription.address)
+            {
+                // connection is closed
+                sharedSubscription.peer = NULL;
+            }
+        }
+        LogSubscription subscription = sharedSubscription;
+        RELEASE(logSubscriptionsLock);
+        if (!subscription.peer)
+        {
+            continue;
+        }
+
+        // reading log events may load pages from disk, so it's done without holding the lock
+        if (pushLogEventsToSubscriber(subscription))
+        {
+            logEventsToPush = true;
+        }
+
+        ACQUIRE(logSubscriptionsLock);
+        if (sharedSubscription.peer == subscription.peer && sharedSubscription.generation == subscription.generation)
+        {
+            sharedSubscription.nextLogId = subscription.nextLogId;
+        }
+        RELEASE(logSubscriptionsLock);
+    }
+    RELEASE(logSubscriptionsPushLock);
+#endif
+}
+
+bool qLogger::pushLogEventsToSubscriber(LogSubscription& subscription)
+{
+#if ENABLED_LOGGING
+    // only log events of committed txs are pushed (staged events are not in mapLogIdToBufferIndex yet)
+    const unsigned long long numberOfLogEvents = mapLogIdToBufferIndex.size();
+    if (subscription.nextLogId >= numberOfLogEvents || subscription.ackedLogId > subscription.nextLogId)
+    {
+        return false;
+    }
+    constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(RequestResponseHeader);
+    const long long windowEnd = mapLogIdToBufferIndex[subscription.ackedLogId].startIndex + subscription.windowSize;
+
+    // collect consecutive log events that fit into one message and the window
+    const long long startIndex = mapLogIdToBufferIndex[subscription.nextLogId].startIndex;
+    const long long endLimit = min(windowEnd, startIndex + maxPayloadSize);
+    const long long lastLogId = (endLimit > startIndex)
+        ? logBuf.getLastLogIdFitting(subscription.nextLogId, numberOfLogEvents - 1, endLimit - startIndex) : -1;
+    if (lastLogId == -1)
+    {
+        // window is full, continued after acknowledgement
+        return false;
+    }
+    const BlobInfo lastInfo = mapLogIdToBufferIndex[lastLogId];
+    const long long endIndex = lastInfo.startIndex + lastInfo.length;
+
+    logBuffer.getMany(logSubscriptionBuffer, startIndex, endIndex - startIndex);
+    enqueueResponse(subscription.peer, (unsigned int)(endIndex - startIndex), RespondLog::type, subscription.dejavu, logSubscriptionBuffer);
+    subscription.nextLogId = lastLogId + 1;
+    return subscription.nextLogId < numberOfLogEvents;
+#else
+    return false;
+#endif
 }
\ No newline at end of file
@@ -355,22 +355,24 @@ static void enqueueResponse(Peer* peer, RequestResponseHeader* responseHeader)
 }
 
 // Add message to response queue of specific peer. If peer is NULL, it will be sent to random peers. Can be called from any thread.
-static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char type, unsigned int dejavu, const void* data)
+// The payload is the fixed-size part prefix followed by the variable-size part data.
+static void enqueueResponse(Peer* peer, unsigned int prefixSize, const void* prefix, unsigned int dataSize, unsigned char type, unsigned int dejavu, const void* data)
 {
     PROFILE_SCOPE();
 
     ACQUIRE(responseQueueHeadLock);
 
-    if ((responseQueueBufferHead >= responseQueueBufferTail || responseQueueBufferHead + sizeof(RequestResponseHeader) + dataSize < responseQueueBufferTail)
+    const unsigned int payloadSize = prefixSize + dataSize;
+    if ((responseQueueBufferHead >= responseQueueBufferTail || responseQueueBufferHead + sizeof(RequestResponseHeader) + payloadSize < responseQueueBufferTail)
         && (unsigned short)(responseQueueElementHead + 1) != responseQueueElementTail)
     {
         ASSERT(responseQueueElementHead < RESPONSE_QUEUE_LENGTH);
         ASSERT(responseQueueBufferHead < RESPONSE_QUEUE_BUFFER_SIZE);
-        ASSERT(responseQueueBufferHead + sizeof(RequestResponseHeader) + dataSize < RESPONSE_QUEUE_BUFFER_SIZE);
+        ASSERT(responseQueueBufferHead + sizeof(RequestResponseHeader) + payloadSize < RESPONSE_QUEUE_BUFFER_SIZE);
 
         responseQueueElements[responseQueueElementHead].offset = responseQueueBufferHead;
         RequestResponseHeader* responseHeader = (RequestResponseHeader*)&responseQueueBuffer[responseQueueBufferHead];
-        if (!responseHeader->checkAndSetSize(sizeof(RequestResponseHeader) + dataSize))
+        if (!responseHeader->checkAndSetSize(sizeof(RequestResponseHeader) + payloadSize))
         {
 #ifndef NDEBUG
             addDebugMessage(L"Error: Message size exceeds maximum message size!");
@@ -378,9 +380,13 @@ static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char typ
         }
         responseHeader->setType(type);
         responseHeader->setDejavu(dejavu);
+        if (prefix)
+        {
+            copyMem(&responseQueueBuffer[responseQueueBufferHead + sizeof(RequestResponseHeader)], prefix, prefixSize);
+        }
         if (data)
         {
-            copyMem(&responseQueueBuffer[responseQueueBufferHead + sizeof(RequestResponseHeader)], data, dataSize);
+            copyMem(&responseQueueBuffer[responseQueueBufferHead + sizeof(RequestResponseHeader) + prefixSize], data, dataSize);
         }
         responseQueueBufferHead += responseHeader->size();
         responseQueueElements[responseQueueElementHead].peer = peer;
@@ -394,6 +400,12 @@ static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char typ
     RELEASE(responseQueueHeadLock);
 }
 
+// Add message to response queue of specific peer. If peer is NULL, it will be sent to random peers. Can be called from any thread.
+static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char type, unsigned int dejavu, const void* data)
+{
+    enqueueResponse(peer, 0, nullptr, dataSize, type, dejavu, data);
+}
+
 /**
 * checks if a given address is a bogon address
 * a bogon address is an ip address which should not be used publicly (e.g. private networks)
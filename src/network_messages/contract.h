@@ -50,3 +50,33 @@ struct RespondContractFunction // Returns result of contract function invocation
         type = 43,
     };
 };
+
+
+struct RequestContractFunctionWithTick // Invokes contract function like RequestContractFunction, but the response also contains the tick of the contract states
+{
+    unsigned int contractIndex;
+    unsigned short inputType;
+    unsigned short inputSize;
+    // Variable-size input
+
+    enum {
+        type = 70,
+    };
+};
+
+static_assert(sizeof(RequestContractFunctionWithTick) == sizeof(RequestContractFunction), "Something is wrong with the struct size.");
+
+
+// Returns result of contract function invocation (the message size is 0 if the invocation has failed).
+// Only the contract states are read as of the end of the given tick. QPI functions reading the spectrum (such as
+// qpi.getEntity()) or the universe (such as qpi.numberOfShares()) see the current data, which may already contain
+// changes of the tick being processed.
+struct RespondContractFunctionWithTick
+{
+    unsigned int tick; // The function has read the contract states as of the end of this tick
+    // Variable-size output
+
+    enum {
+        type = 71,
+    };
+};
@@ -27,6 +27,30 @@ struct RespondLog
     };
 };
 
+// Fetches log like RequestLog, but the response starts with a continuation token. If the events of the range don't
+// fit into one message (or aren't generated yet), the response contains the events [fromID, nextLogId) and the client
+// continues with fromID = nextLogId.
+struct RequestLogPage
+{
+    unsigned long long passcode[4];
+    unsigned long long fromID;
+    unsigned long long toID; // inclusive
+
+    enum {
+        type = 68,
+    };
+};
+
+struct RespondLogPage
+{
+    long long nextLogId; // first log ID not included in response, -1 if fromID isn't available
+    // Variable-size log of events [fromID, nextLogId) follows
+
+    enum {
+        type = 69,
+    };
+};
+
 
 // Request logid ranges from tx hash
 struct RequestLogIdRangeFromTx
@@ -114,4 +138,60 @@ struct ResponseLogStateDigest
     enum {
         type = 59,
     };
+};
+
+// Subscribe to log events. From fromID on, the node pushes log events as RespondLog messages (with the dejavu of this
+// request) whenever a tick is committed. Flow control: at most windowSize bytes of log events are pushed beyond the
+// acknowledged log ID. Sending this request again with fromID set to the next log ID expected by the client
+// acknowledges the events before fromID (a fromID outside of the pushed range restarts the stream at fromID).
+// Pushing is best-effort, missing ranges can be fetched with RequestLog. windowSize 0 cancels the subscription.
+struct RequestLogSubscription
+{
+    unsigned long long passcode[4];
+    unsigned long long fromID;
+    unsigned long long windowSize;
+
+    enum {
+        type = 64,
+    };
+};
+
+// Response to above request
+struct RespondLogSubscription
+{
+    long long nextLogId; // next log ID that will be pushed, -1 if subscription is rejected or cancelled
+    unsigned long long windowSize; // window size used by the node
+
+    enum {
+        type = 65,
+    };
+};
+
+// Request the IDs of log events touching an entity (as source, destination, issuer, owner, or possessor) in the tick
+// range [fromTick, toTick]. Custom and contract messages are not searched.
+struct RequestLogIdsOfEntity
+{
+    unsigned long long passcode[4];
+    m256i entity;
+    unsigned int fromTick;
+    unsigned int toTick;
+    unsigned long long fromLogId; // events of fromTick before this log ID are skipped (0 to search the whole tick)
+
+    enum {
+        type = 66,
+    };
+};
+
+// Response to above request, followed by numberOfLogIds log IDs (long long) in ascending order. If the response doesn't
+// cover the whole range (because of limits of the node), the client should send another request with fromTick = nextTick
+// and fromLogId = nextLogId.
+struct RespondLogIdsOfEntity
+{
+    unsigned int nextTick; // first tick that hasn't been searched completely yet (toTick + 1 if search is complete)
+    unsigned int numberOfLogIds;
+    unsigned long long nextLogId; // first log ID of nextTick that hasn't been searched yet (0 if nextTick hasn't been searched)
+
+    enum {
+        type = 67,
+    };
 };
\ No newline at end of file
@@ -85,4 +85,51 @@ struct SpecialCommandSetConsoleLoggingModeRequestAndResponse
     unsigned char padding[7];
 };
 
+#define SPECIAL_COMMAND_GET_CONTRACT_EXECUTION_HISTOGRAMS 18ULL
+struct SpecialCommandGetContractExecutionHistogramsRequest
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int contractIndex;
+    unsigned int padding;
+};
+
+template<unsigned int maxNumberOfEntryPoints>
+struct SpecialCommandGetContractExecutionHistogramsResponse
+{
+    struct EntryPoint
+    {
+        unsigned short type; // 0 = system procedure (id is SystemProcedureID), 1 = user procedure, 2 = user function (id is input type)
+        unsigned short id;
+        unsigned int padding;
+        unsigned long long totalTicks;
+        unsigned long long bucketCounts[48]; // bucket i counts executions taking [2^i, 2^(i+1)) TSC ticks (bucket 0 from 0)
+    };
+
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned long long tscFrequency; // TSC ticks per second
+    unsigned int contractIndex;
+    unsigned int numberOfEntryPoints; // only entry points that have been executed are included
+    EntryPoint entryPoints[maxNumberOfEntryPoints];
+};
+
+#define SPECIAL_COMMAND_GET_PROFILING_DATA 19ULL // request is SpecialCommand
+template<unsigned int maxCsvSize>
+struct SpecialCommandGetProfilingDataResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int csvSize;
+    unsigned int padding;
+    char csv[maxCsvSize]; // same CSV format as profiling.csv, but 8-bit characters (truncated at line end if too long)
+};
+
+#define SPECIAL_COMMAND_WRITE_PROFILING_DATA_FILE 20ULL // request and response is SpecialCommand, profiling.csv is written by main loop
+
+#define SPECIAL_COMMAND_WRITE_PROFILING_TRACE_FILE 21ULL // request is SpecialCommand
+struct SpecialCommandWriteProfilingTraceFileResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    int numberOfEvents; // events written to profiling_trace.json in background, -1 if tracing is disabled or busy
+    unsigned int padding;
+};
+
 #pragma pack(pop)
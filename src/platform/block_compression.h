@@ -0,0 +1,203 @@
+#pragma once
+
+#include "assert.h"
+#include "memory.h"
+
+// Fast LZ compression of independent blocks of up to 64 KiB (LZ4-like sequence format)
+// Each sequence is: token (high nibble: literal length, low nibble: match length - 4, 15 means that more length bytes
+// follow), literal length bytes, literals, 2-byte match offset, match length bytes. The last sequence has no match.
+
+static constexpr unsigned int LZ_MAX_BLOCK_SIZE = 65536;
+static constexpr unsigned int LZ_HASH_TABLE_SIZE = 4096;
+static constexpr unsigned int LZ_MIN_MATCH = 4;
+
+static inline unsigned int lzRead32(const unsigned char* p)
+{
+    unsigned int v;
+    copyMem(&v, p, 4);
+    return v;
+}
+
+static inline unsigned int lzHash(unsigned int v)
+{
+    return (v * 2654435761u) >> 20;
+}
+
+// write length extension bytes (255 means that more bytes follow), return false if dst is too small
+static inline bool lzWriteLength(unsigned char*& op, const unsigned char* oend, unsigned int length)
+{
+    while (length >= 255)
+    {
+        if (op >= oend)
+        {
+            return false;
+        }
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op >= oend)
+    {
+        return false;
+    }
+    *op++ = (unsigned char)length;
+    return true;
+}
+
+// write a sequence of literals [literals, literals + numLiterals) followed by a match (if matchLength != 0)
+static inline bool lzWriteSequence(unsigned char*& op, const unsigned char* oend, const unsigned char* literals, unsigned int numLiterals,
+    unsigned int matchOffset, unsigned int matchLength)
+{
+    if (op >= oend)
+    {
+        return false;
+    }
+    unsigned char* token = op++;
+    *token = (unsigned char)((numLiterals < 15 ? numLiterals : 15) << 4);
+    if (numLiterals >= 15 && !lzWriteLength(op, oend, numLiterals - 15))
+    {
+        return false;
+    }
+    if (numLiterals > (unsigned long long)(oend - op))
+    {
+        return false;
+    }
+    copyMem(op, literals, numLiterals);
+    op += numLiterals;
+
+    if (matchLength)
+    {
+        if (op + 2 > oend)
+        {
+            return false;
+        }
+        *op++ = (unsigned char)matchOffset;
+        *op++ = (unsigned char)(matchOffset >> 8);
+        matchLength -= LZ_MIN_MATCH;
+        *token |= (matchLength < 15 ? matchLength : 15);
+        if (matchLength >= 15 && !lzWriteLength(op, oend, matchLength - 15))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compress srcSize (<= LZ_MAX_BLOCK_SIZE) bytes from src to dst. hashTable must have LZ_HASH_TABLE_SIZE entries.
+// Return the compressed size, or 0 if it would exceed dstCapacity (block should be stored uncompressed then).
+static unsigned int lzCompressBlock(const unsigned char* src, unsigned int srcSize, unsigned char* dst, unsigned int dstCapacity,
+    unsigned short* hashTable)
+{
+    ASSERT(srcSize <= LZ_MAX_BLOCK_SIZE);
+    unsigned char* op = dst;
+    const unsigned char* oend = dst + dstCapacity;
+    unsigned int anchor = 0;
+    if (srcSize > LZ_MIN_MATCH)
+    {
+        setMem(hashTable, LZ_HASH_TABLE_SIZE * sizeof(unsigned short), 0);
+        const unsigned int matchLimit = srcSize - LZ_MIN_MATCH;
+        unsigned int ip = 1;
+        while (ip <= matchLimit)
+        {
+            const unsigned int sequence = lzRead32(src + ip);
+            const unsigned int h = lzHash(sequence);
+            const unsigned int candidate = hashTable[h];
+            hashTable[h] = (unsigned short)ip;
+            if (candidate < ip && lzRead32(src + candidate) == sequence)
+            {
+                unsigned int matchLength = LZ_MIN_MATCH;
+                while (ip + matchLength < srcSize && src[candidate + matchLength] == src[ip + matchLength])
+                {
+                    matchLength++;
+                }
+                if (!lzWriteSequence(op, oend, src + anchor, ip - anchor, ip - candidate, matchLength))
+                {
+                    return 0;
+                }
+                ip += matchLength;
+                anchor = ip;
+            }
+            else
+            {
+                // skip faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+    }
+    if (!lzWriteSequence(op, oend, src + anchor, srcSize - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return (unsigned int)(op - dst);
+}
+
+// read length extension bytes, return false if src is too small
+static inline bool lzReadLength(const unsigned char*& ip, const unsigned char* iend, unsigned int& length)
+{
+    unsigned char b;
+    do
+    {
+        if (ip >= iend)
+        {
+            return false;
+        }
+        b = *ip++;
+        length += b;
+    } while (b == 255 && length < LZ_MAX_BLOCK_SIZE);
+    return b != 255;
+}
+
+// Decompress srcSize bytes from src to exactly dstSize bytes in dst. Return false if data is corrupted.
+// Decompressing in place is possible if dst + dstSize <= src.
+static bool lzDecompressBlock(const unsigned char* src, unsigned int srcSize, unsigned char* dst, unsigned int dstSize)
+{
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + srcSize;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + dstSize;
+    while (ip < iend)
+    {
+        const unsigned char token = *ip++;
+        unsigned int numLiterals = token >> 4;
+        if (numLiterals == 15 && !lzReadLength(ip, iend, numLiterals))
+        {
+            return false;
+        }
+        if (numLiterals > (unsigned long long)(iend - ip) || numLiterals > (unsigned long long)(oend - op))
+        {
+            return false;
+        }
+        copyMem(op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        if (ip == iend)
+        {
+            // last sequence has no match
+            break;
+        }
+
+        if (ip + 2 > iend)
+        {
+            return false;
+        }
+        const unsigned int matchOffset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        unsigned int matchLength = token & 15;
+        if (matchLength == 15 && !lzReadLength(ip, iend, matchLength))
+        {
+            return false;
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (matchOffset == 0 || matchOffset > (unsigned long long)(op - dst) || matchLength > (unsigned long long)(oend - op))
+        {
+            return false;
+        }
+        // match may overlap with its own output (repeated patterns)
+        const unsigned char* match = op - matchOffset;
+        for (unsigned int i = 0; i < matchLength; i++)
+        {
+            op[i] = match[i];
+        }
+        op += matchLength;
+    }
+    return op == oend;
+}
@@ -400,6 +400,10 @@ static long long save(const CHAR16* fileName, unsigned long long totalSize, cons
 
 OPTIMIZE_OFF()
 
+// Function called by the thread processing a background save right before writing the file, for example to compress
+// the data into the buffer. It returns the number of bytes to save.
+typedef unsigned long long (*AsyncFileIOPrepareSaveFunction)(void* context);
+
 struct FileItem
 {
     enum ItemState
@@ -417,6 +421,9 @@ struct FileItem
     unsigned long long mSize;
     unsigned char* mpBuffer;
     const unsigned char* mpConstBuffer;
+    volatile long long* mpResult; // If not NULL, result of save/load is stored here before the slot is freed
+    AsyncFileIOPrepareSaveFunction mpPrepareSave; // If not NULL, called before saving to get the data in the buffer
+    void* mpPrepareSaveContext;
     char mState;
     unsigned long long mReservedSize;
     long long mAge;
@@ -550,6 +557,8 @@ public:
         {
             mFileItems[i].mpBuffer = NULL;
             mFileItems[i].mpConstBuffer = NULL;
+            mFileItems[i].mpResult = NULL;
+            mFileItems[i].mpPrepareSave = NULL;
         }
         mCurrentIdx = 0;
 
@@ -584,12 +593,55 @@ public:
             {
                 mFileItems[index].mState = FileItem::kFillingData;
                 mFileItems[index].mSize = requestedSize;
+                mFileItems[index].mpResult = NULL;
+                mFileItems[index].mpPrepareSave = NULL;
                 return &mFileItems[index];
             }
         }
         return NULL;
     }
+
+    // Finish all items waiting for processing without processing them, storing status in their results. Used when
+    // stopping, so nobody waits forever for a request that won't be processed anymore.
+    void cancelWaitingItems(long long status)
+    {
+        for (unsigned int i = 0; i < maxItems; i++)
+        {
+            FileItem& item = mFileItems[i];
+            if (item.waitForProcess())
+            {
+                if (item.mpResult)
+                {
+                    ATOMIC_STORE64(*item.mpResult, status);
+                }
+                item.markAsDone();
+            }
+        }
+    }
 protected:
+    // Save or load file of item, store result, and mark item as done
+    void processItem(FileItem& item, bool isSave)
+    {
+        long long sts = 0;
+        if (isSave)
+        {
+            if (item.mpPrepareSave)
+            {
+                item.mSize = item.mpPrepareSave(item.mpPrepareSaveContext);
+            }
+            sts = save(item.mFileName, item.mSize, item.mpConstBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
+        }
+        else
+        {
+            sts = load(item.mFileName, item.mSize, item.mpBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
+        }
+        if (item.mpResult)
+        {
+            ATOMIC_STORE64(*item.mpResult, sts);
+        }
+        item.markAsDone();
+    }
+
     // Real write happen here. This function expected call in main thread only. Need to flush all data in queue
     int flushIO(bool isSave, int numberOfProcessedItems = 0)
     {
@@ -626,16 +678,7 @@ protected:
             for (unsigned int i = 0; i < processedItemsCount; i++)
             {
                 FileItem& item = mFileItems[mPriorityArray[i]._key];
-                long long sts = 0;
-                if (isSave)
-                {
-                    sts = save(item.mFileName, item.mSize, item.mpConstBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-                }
-                else
-                {
-                    sts = load(item.mFileName, item.mSize, item.mpBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-                }
-                item.markAsDone();
+                processItem(item, isSave);
             }
         }
 
@@ -672,16 +715,7 @@ protected:
         if (maxIdx >= 0)
         {
             FileItem& item = mFileItems[maxIdx];
-            long long sts = 0;
-            if (isSave)
-            {
-                sts = save(item.mFileName, item.mSize, item.mpConstBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-            }
-            else
-            {
-                sts = load(item.mFileName, item.mSize, item.mpBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-            }
-            item.markAsDone();
+            processItem(item, isSave);
         }
         else
         {
@@ -735,7 +769,8 @@ public:
         kBufferFull = -3,
         kUnsupported = -4,
         kTimeOut = -5,
-        kStop = -6
+        kStop = -6,
+        kPending = -7
     };
 
     bool init(EFI_MP_SERVICES_PROTOCOL* pMPServices, unsigned long long totalWriteSize)
@@ -804,6 +839,10 @@ public:
 
         // Flush all remained tasks
         flush();
+
+        // Fail requests queued after the flush, so waitForAsyncBackgroundFileIO() doesn't wait forever
+        mFileBlockingReadQueue.cancelWaitingItems(kStop);
+        mFileBlockingWriteQueue.cancelWaitingItems(kStop);
         if (mpSaveBuffer == NULL)
         {
             freePool(mpSaveBuffer);
@@ -896,6 +935,68 @@ public:
         return (long long)totalSize;
     }
 
+    // Schedule write without copying the data and without waiting for the write. The buffer must stay untouched until
+    // the write is done, which is signaled by storing the result of save() in *pResult. If prepareSave is passed, it is
+    // called by the writing thread to fill the buffer (of size totalSize or less) and to get the size to save.
+    long long asyncBackgroundSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory, volatile long long* pResult,
+        AsyncFileIOPrepareSaveFunction prepareSave = NULL, void* prepareSaveContext = NULL)
+    {
+        if (mIsStop)
+        {
+            return kStop;
+        }
+
+        FileItem* pFileItem = mFileBlockingWriteQueue.requestFreeSlot(totalSize);
+        if (pFileItem == NULL)
+        {
+            return kQueueFull;
+        }
+
+        // Steal the buffer like blocking save, but slot is freed by the flushing thread after the write
+        pFileItem->set(fileName, totalSize, directory);
+        pFileItem->mpConstBuffer = buffer;
+        pFileItem->mpResult = pResult;
+        pFileItem->mpPrepareSave = prepareSave;
+        pFileItem->mpPrepareSaveContext = prepareSaveContext;
+        pFileItem->mState = FileItem::kWait;
+
+        // Mainthread. Flush the save queue immediately
+        if (isMainThread())
+        {
+            mFileBlockingWriteQueue.flushWrite();
+        }
+        return kNoError;
+    }
+
+    // Schedule load without waiting for the read. The buffer must stay untouched until the read is done, which is
+    // signaled by storing the result of load() in *pResult.
+    long long asyncBackgroundLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory, volatile long long* pResult)
+    {
+        if (mIsStop)
+        {
+            return kStop;
+        }
+
+        FileItem* pFileItem = mFileBlockingReadQueue.requestFreeSlot(totalSize);
+        if (pFileItem == NULL)
+        {
+            return kQueueFull;
+        }
+
+        // Slot is freed by the flushing thread after the read
+        pFileItem->set(fileName, totalSize, directory);
+        pFileItem->mpBuffer = buffer;
+        pFileItem->mpResult = pResult;
+        pFileItem->mState = FileItem::kWait;
+
+        // Mainthread. Flush the load queue immediately
+        if (isMainThread())
+        {
+            mFileBlockingReadQueue.flushRead();
+        }
+        return kNoError;
+    }
+
     // Function to schedule load. Buffer will be filled data, make sure the buffer is untouched until this function done
     long long asyncLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
     {
@@ -1084,6 +1185,87 @@ static long long asyncSave(const CHAR16* fileName, unsigned long long totalSize,
     return (long long)AsyncFileIO::kUnknown;
 }
 
+// Wait a bit for free slots in the queues of background operations. Flushes the queues if called from main thread.
+static void waitForAsyncFileIOQueue()
+{
+    if (gAsyncFileIO->isMainThread())
+    {
+        gAsyncFileIO->flush();
+    }
+    else
+    {
+        _mm_pause();
+    }
+}
+
+// Asynchorous save file in background without copying the buffer
+// This function can be called from any thread and returns immediately. *result is set to AsyncFileIO::kPending until
+// the save operation happened in flushAsyncFileIOBuffer. Then it is set to the return value of save(), or to
+// AsyncFileIO::kStop if the file I/O is stopped before. The buffer must stay untouched until then (see
+// waitForAsyncBackgroundFileIO()). If the queue is full, it waits until a slot is free. If prepareSave is passed, it
+// is called by the thread doing the save, which gets the data ready in the buffer and returns its size (<= totalSize).
+static void asyncBackgroundSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory, volatile long long* result,
+    AsyncFileIOPrepareSaveFunction prepareSave = NULL, void* prepareSaveContext = NULL)
+{
+    ATOMIC_STORE64(*result, AsyncFileIO::kPending);
+    if (gAsyncFileIO)
+    {
+        long long sts;
+        while ((sts = gAsyncFileIO->asyncBackgroundSave(fileName, totalSize, buffer, directory, result, prepareSave, prepareSaveContext)) == AsyncFileIO::kQueueFull)
+        {
+            waitForAsyncFileIOQueue();
+        }
+        if (sts != AsyncFileIO::kNoError)
+        {
+            ATOMIC_STORE64(*result, sts);
+        }
+        return;
+    }
+
+    ATOMIC_STORE64(*result, AsyncFileIO::kUnknown);
+}
+
+// Wait until operation started by asyncBackgroundSave() or asyncBackgroundLoad() is done. Flushes the queues if called
+// from main thread.
+static void waitForAsyncBackgroundFileIO(volatile long long* result)
+{
+    while (ATOMIC_LOAD64(*result) == AsyncFileIO::kPending)
+    {
+        if (gAsyncFileIO && gAsyncFileIO->isMainThread())
+        {
+            gAsyncFileIO->flush();
+        }
+        else
+        {
+            _mm_pause();
+        }
+    }
+}
+
+// Asynchorous load file in background
+// This function can be called from any thread and returns immediately. *result is set to AsyncFileIO::kPending until
+// the load operation happened in flushAsyncFileIOBuffer. Then it is set to the return value of load(). The buffer must
+// stay untouched until then (see waitForAsyncBackgroundFileIO()). If the queue is full, it waits until a slot is free.
+static void asyncBackgroundLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory, volatile long long* result)
+{
+    ATOMIC_STORE64(*result, AsyncFileIO::kPending);
+    if (gAsyncFileIO)
+    {
+        long long sts;
+        while ((sts = gAsyncFileIO->asyncBackgroundLoad(fileName, totalSize, buffer, directory, result)) == AsyncFileIO::kQueueFull)
+        {
+            waitForAsyncFileIOQueue();
+        }
+        if (sts != AsyncFileIO::kNoError)
+        {
+            ATOMIC_STORE64(*result, sts);
+        }
+        return;
+    }
+
+    ATOMIC_STORE64(*result, AsyncFileIO::kUnknown);
+}
+
 // Asynchorous load a file
 // This function can be called from any thread and is a blocking function
 // To avoid lock and the actual load happen, flushAsyncFileIOBuffer must be called in main thread
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <lib/platform_common/qintrin.h>
+
+// Fingerprint tags for speeding up lookups in hash maps with linear probing (such as spectrum and universe).
+// A tag array has one byte per hash map slot: 0 for an empty slot or a non-zero fingerprint of the key in the slot.
+// Lookups compare the tags of many slots at once with SIMD instructions and only access the records of slots with
+// matching tag. The layout of the records (which is relevant for digests and files) is not changed.
+//
+// The tags of the first fingerprintTagsPadding slots are mirrored after the end of the array, so SIMD loads can be
+// done without special handling of the wrap-around. Allocate capacity + fingerprintTagsPadding bytes.
+
+#if defined(__AVX512BW__)
+static constexpr unsigned int fingerprintTagsChunkSize = 64;
+#else
+static constexpr unsigned int fingerprintTagsChunkSize = 32;
+#endif
+static constexpr unsigned int fingerprintTagsPadding = 64;
+
+
+// Get fingerprint tag from one byte of the key. Empty slots are marked by 0, so 0 is mapped to 1.
+static inline unsigned char fingerprintTag(unsigned char keyByte)
+{
+    return keyByte ? keyByte : 1;
+}
+
+// Set tag of slot index (tag 0 marks the slot as empty).
+template <unsigned int capacity>
+static inline void setFingerprintTag(unsigned char* tags, unsigned int index, unsigned char tag)
+{
+    static_assert(capacity >= fingerprintTagsPadding && (capacity & (capacity - 1)) == 0);
+    tags[index] = tag;
+    if (index < fingerprintTagsPadding)
+        tags[capacity + index] = tag;
+}
+
+// Update mirrored tags after the tags of the first slots have been changed without setFingerprintTag().
+template <unsigned int capacity>
+static inline void updateMirroredFingerprintTags(unsigned char* tags)
+{
+    for (unsigned int i = 0; i < fingerprintTagsPadding; i++)
+        tags[capacity + i] = tags[i];
+}
+
+// Get bit masks of slots in chunk starting at index, which have the given tag or are empty.
+static inline void matchFingerprintTagsChunk(const unsigned char* tags, unsigned int index, unsigned char tag,
+    unsigned long long& matchMask, unsigned long long& emptyMask)
+{
+#if defined(__AVX512BW__)
+    const __m512i chunk = _mm512_loadu_si512(tags + index);
+    matchMask = _mm512_cmpeq_epi8_mask(chunk, _mm512_set1_epi8(tag));
+    emptyMask = _mm512_cmpeq_epi8_mask(chunk, _mm512_setzero_si512());
+#else
+    const __m256i chunk = _mm256_loadu_si256((const __m256i*)(tags + index));
+    matchMask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(tag)));
+    emptyMask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_setzero_si256()));
+#endif
+}
+
+// Linear probing starting at slot startIndex, checking only slots with matching tag by calling isMatch(index).
+// Returns index of the first slot for which isMatch() returns true and sets found = true. If no matching slot is
+// found before the first empty slot, returns the index of the first empty slot and sets found = false.
+// Requires that the hash map has at least one empty slot.
+template <unsigned int capacity, typename IsMatchFunc>
+static unsigned int probeFingerprintTags(const unsigned char* tags, unsigned int startIndex, unsigned char tag,
+    IsMatchFunc isMatch, bool& found)
+{
+    static_assert(fingerprintTagsChunkSize <= fingerprintTagsPadding);
+    unsigned int index = startIndex & (capacity - 1);
+    while (true)
+    {
+        unsigned long long matchMask, emptyMask;
+        matchFingerprintTagsChunk(tags, index, tag, matchMask, emptyMask);
+
+        // Only slots before the first empty slot belong to the probing sequence
+        if (emptyMask)
+            matchMask &= (emptyMask & (0 - emptyMask)) - 1;
+
+        while (matchMask)
+        {
+            const unsigned int matchIndex = (index + (unsigned int)_tzcnt_u64(matchMask)) & (capacity - 1);
+            if (isMatch(matchIndex))
+            {
+                found = true;
+                return matchIndex;
+            }
+            matchMask &= matchMask - 1;
+        }
+
+        if (emptyMask)
+        {
+            found = false;
+            return (index + (unsigned int)_tzcnt_u64(emptyMask)) & (capacity - 1);
+        }
+
+        index = (index + fingerprintTagsChunkSize) & (capacity - 1);
+    }
+}
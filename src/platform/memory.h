@@ -1,5 +1,7 @@
 #pragma once
 
+#include <lib/platform_common/qintrin.h>
+
 #ifdef NO_UEFI
 
 // Defined in test/stdlib_impl.cpp
@@ -160,4 +162,24 @@ static inline bool isZero(const void* ptr, unsigned long long size)
             return false;
     }
     return true;
+}
+
+// Return if size bytes at a and b are equal (compares 32 bytes at once, for example for finding changed pages)
+static inline bool isEqualMem(const void* a, const void* b, unsigned long long size)
+{
+    const unsigned char* aPtr = (const unsigned char*)a;
+    const unsigned char* bPtr = (const unsigned char*)b;
+    unsigned long long i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(aPtr + i)), _mm256_loadu_si256((const __m256i*)(bPtr + i)));
+        if (!_mm256_testz_si256(diff, diff))
+            return false;
+    }
+    for (; i < size; ++i)
+    {
+        if (aPtr[i] != bPtr[i])
+            return false;
+    }
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <lib/platform_common/qintrin.h>
+
+#include "global_var.h"
+#include "concurrency.h"
+
+// Function processing one part of a parallel job. Parts must be independent of each other.
+typedef void (*ParallelJobFunction)(void* context, unsigned int partIndex);
+
+struct ParallelJob
+{
+    ParallelJobFunction function;
+    void* context;
+    unsigned int numberOfParts;
+    volatile long nextPart;
+    volatile long finishedParts;
+};
+
+// Currently running job (nullptr if none). Only one job may run at a time (guarded by parallelJobLock).
+GLOBAL_VAR_DECL ParallelJob* volatile currentParallelJob GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL volatile char parallelJobLock GLOBAL_VAR_INIT(0);
+
+// Number of processors currently inside helpWithParallelJob()
+GLOBAL_VAR_DECL volatile long parallelJobHelperCount GLOBAL_VAR_INIT(0);
+
+// Statistics: number of parts processed by helpers (not by the processor calling runParallelJob())
+GLOBAL_VAR_DECL volatile long long parallelJobPartsProcessedByHelpers GLOBAL_VAR_INIT(0);
+
+
+// Grab and process parts of the job until no part is left. Returns number of parts processed.
+static unsigned int processParallelJobParts(ParallelJob* job)
+{
+    unsigned int processedParts = 0;
+    long partIndex;
+    while ((partIndex = _InterlockedIncrement(&job->nextPart) - 1) < (long)job->numberOfParts)
+    {
+        job->function(job->context, (unsigned int)partIndex);
+        _InterlockedIncrement(&job->finishedParts);
+        ++processedParts;
+    }
+    return processedParts;
+}
+
+// Help processing the currently running parallel job, if any. Called by idle processors (request processors).
+// Returns quickly if there is no job.
+static void helpWithParallelJob()
+{
+    if (!currentParallelJob)
+        return;
+
+    // Announce helper before reading job pointer, so runParallelJob() waits for us before the job goes out of scope
+    _InterlockedIncrement(&parallelJobHelperCount);
+    ParallelJob* job = currentParallelJob;
+    if (job)
+    {
+        const unsigned int processedParts = processParallelJobParts(job);
+        if (processedParts)
+            _InterlockedExchangeAdd64(&parallelJobPartsProcessedByHelpers, processedParts);
+    }
+    _InterlockedDecrement(&parallelJobHelperCount);
+}
+
+// Run function(context, partIndex) for all partIndex in [0, numberOfParts). The calling processor processes parts
+// itself and other processors calling helpWithParallelJob() join in. Returns after all parts have been processed.
+// The result must not depend on which processor runs which part, so the outcome is the same without any helper
+// (for example in tests).
+// If another job is running, all parts are processed by the calling processor. This also covers nested jobs started
+// from within a part (for example a spectrum reorganization triggered by a contract procedure run as a part), which
+// would deadlock otherwise.
+static void runParallelJob(ParallelJobFunction function, void* context, unsigned int numberOfParts)
+{
+    ParallelJob job;
+    job.function = function;
+    job.context = context;
+    job.numberOfParts = numberOfParts;
+    job.nextPart = 0;
+    job.finishedParts = 0;
+
+    if (!TRY_ACQUIRE(parallelJobLock))
+    {
+        processParallelJobParts(&job);
+        return;
+    }
+    currentParallelJob = &job;
+
+    processParallelJobParts(&job);
+
+    // Wait until parts processed by helpers are finished
+    WAIT_WHILE(job.finishedParts < (long)numberOfParts);
+
+    // Make sure no helper accesses the job anymore before it goes out of scope. The interlocked exchange is a full
+    // barrier, so the pointer is cleared before the helper count is read. A plain store could be reordered after the
+    // load, letting a helper increment the count after we read 0 and still see the old pointer.
+    _InterlockedExchangePointer((void* volatile*)&currentParallelJob, nullptr);
+    WAIT_WHILE(parallelJobHelperCount != 0);
+
+    RELEASE(parallelJobLock);
+}
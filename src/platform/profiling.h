@@ -16,11 +16,150 @@ struct ProfilingData
     unsigned long long runtimeMin;
 };
 
+// Hash map of ProfilingData with fixed capacity (2^N entries). Entries can be added and updated by multiple processors
+// at the same time without locking, because entries are never moved while measurements are recorded.
+class ProfilingDataTable
+{
+public:
+    // Allocate hash map with given capacity (power of 2), discarding all data
+    bool init(unsigned int capacity)
+    {
+        ASSERT((capacity & (capacity - 1)) == 0);
+        deinit();
+        if (!allocPoolWithErrorLog(L"ProfilingDataTable", capacity * sizeof(ProfilingData), (void**)&mDataPtr, __LINE__))
+            return false;
+        mDataSize = capacity;
+        mDataUsedEntryCount = 0;
+        return true;
+    }
+
+    void deinit()
+    {
+        if (mDataPtr)
+            freePool(mDataPtr);
+        mDataPtr = nullptr;
+        mDataSize = 0;
+        mDataUsedEntryCount = 0;
+    }
+
+    void clear()
+    {
+        if (mDataPtr)
+        {
+            setMem(mDataPtr, mDataSize * sizeof(ProfilingData), 0);
+            mDataUsedEntryCount = 0;
+        }
+    }
+
+    unsigned int capacity() const
+    {
+        return mDataSize;
+    }
+
+    unsigned int usedEntryCount() const
+    {
+        return mDataUsedEntryCount;
+    }
+
+    const ProfilingData& entry(unsigned int i) const
+    {
+        ASSERT(i < mDataSize);
+        return mDataPtr[i];
+    }
+
+    // Add count, sum, min, and max of run-time measurements to entry of given key (= name + line). Return false if
+    // there is no space for a new entry.
+    bool add(const char* name, unsigned long long line, unsigned long long numOfExec, unsigned long long runtimeSum,
+        unsigned long long runtimeMin, unsigned long long runtimeMax)
+    {
+        ProfilingData* entry = getEntry(name, line);
+        if (!entry)
+            return false;
+        _interlockedadd64((volatile long long*)&entry->numOfExec, numOfExec);
+        _interlockedadd64((volatile long long*)&entry->runtimeSum, runtimeSum);
+        unsigned long long current = entry->runtimeMin;
+        while (current > runtimeMin)
+        {
+            const unsigned long long before = _InterlockedCompareExchange64((volatile long long*)&entry->runtimeMin, runtimeMin, current);
+            if (before == current)
+                break;
+            current = before;
+        }
+        current = entry->runtimeMax;
+        while (current < runtimeMax)
+        {
+            const unsigned long long before = _InterlockedCompareExchange64((volatile long long*)&entry->runtimeMax, runtimeMax, current);
+            if (before == current)
+                break;
+            current = before;
+        }
+        return true;
+    }
+
+protected:
+    // Value of ProfilingData::name while the entry is being created by another processor
+    static constexpr long long nameBeingCreated = 1;
+
+    ProfilingData* mDataPtr = nullptr;
+    unsigned int mDataSize = 0;
+    volatile long mDataUsedEntryCount = 0;
+
+    // Return entry of given key (pair of name and line), create entry if not found. Return nullptr if hash map is too full.
+    ProfilingData* getEntry(const char* name, unsigned long long line)
+    {
+        if (!mDataPtr)
+            return nullptr;
+        ASSERT((mDataSize & (mDataSize - 1)) == 0); // mDataSize must be 2^N
+
+        const unsigned long long mask = (mDataSize - 1);
+        unsigned long long i = hashFunction(name, line) & mask;
+        for (unsigned int probes = 0; probes < mDataSize; ++probes, i = (i + 1) & mask)
+        {
+            ProfilingData& entry = mDataPtr[i];
+            volatile long long* entryName = (volatile long long*)&entry.name;
+            if (!*entryName)
+            {
+                // free slot -> entry not available yet -> add new entry if hash map isn't too full (keep lookup fast)
+                if (mDataUsedEntryCount * 4 >= mDataSize * 3)
+                    return nullptr;
+                if (_InterlockedCompareExchange64(entryName, nameBeingCreated, 0) == 0)
+                {
+                    _InterlockedIncrement(&mDataUsedEntryCount);
+                    entry.line = line;
+                    entry.runtimeMin = (unsigned long long)-1;
+                    _InterlockedExchange64(entryName, (long long)name); // publish entry
+                    return &entry;
+                }
+            }
+            // wait if other processor is creating entry in this slot
+            while (*entryName == nameBeingCreated)
+                _mm_pause();
+            if (entry.name == name && entry.line == line)
+            {
+                // found entry in hash map
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    // Compute hash sum for given key
+    static unsigned long long hashFunction(const char* name, unsigned long long line)
+    {
+        return (((unsigned long long)name) ^ line);
+    }
+};
+
+// Collects ProfilingData in one shard per processor, so recording a measurement doesn't need a lock and doesn't
+// contend with other processors. Shards are merged when the data is dumped.
 class ProfilingDataCollector
 {
 public:
-    // Init buffer (optional). This reduces the number of allocations.
-    bool init(unsigned int expectedProfilingDataItems = 8)
+    static constexpr unsigned int shardCount = 32;
+
+    // Init buffers (optional). Buffers have fixed size, so expectedProfilingDataItems should not be too low.
+    // Must not be called while other processors record measurements.
+    bool init(unsigned int expectedProfilingDataItems = 256)
     {
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
         bool okay = doInit(expectedProfilingDataItems);
@@ -28,27 +167,25 @@ public:
         return okay;
     }
 
-    // Clear buffer, discarding all measurements
+    // Clear buffers, discarding all measurements
     void clear()
     {
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
-        if (mDataPtr)
-        {
-            setMem(mDataPtr, mDataSize * sizeof(ProfilingData), 0);
-            mDataUsedEntryCount = 0;
-        }
+        for (unsigned int i = 0; i < shardCount; ++i)
+            mShards[i].clear();
+        mDroppedMeasurements = 0;
         RELEASE(mLock);
     }
 
-    // Free buffer
+    // Free buffers. Must not be called while other processors record measurements.
     void deinit()
     {
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
-        if (mDataPtr)
-            freePool(mDataPtr);
-        mDataPtr = nullptr;
-        mDataSize = 0;
-        mDataUsedEntryCount = 0;
+        for (unsigned int i = 0; i < shardCount; ++i)
+            mShards[i].deinit();
+        mMerged.deinit();
+        mInitialized = false;
+        mDroppedMeasurements = 0;
         RELEASE(mLock);
     }
 
@@ -63,26 +200,30 @@ public:
         if (endTsc < startTsc)
             return;
 
-        ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
-
-        // Make sure hash map is initialized
-        if (mDataPtr || doInit())
+        // Make sure buffers are initialized
+        if (!mInitialized)
         {
-            // Fill entry
-            const unsigned long long dt = endTsc - startTsc;
-            ProfilingData& newEntry = getEntry(name, line);
-            newEntry.numOfExec += 1;
-            newEntry.runtimeSum += dt;
-            if (newEntry.runtimeMin > dt)
-                newEntry.runtimeMin = dt;
-            if (newEntry.runtimeMax < dt)
-                newEntry.runtimeMax = dt;
+            ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
+            if (!mInitialized)
+                doInit();
+            RELEASE(mLock);
+            if (!mInitialized)
+                return;
         }
 
-        RELEASE(mLock);
+        // Record in shard of this processor (shards may be shared if there are more processors, which is safe but slower)
+        const unsigned long long dt = endTsc - startTsc;
+        if (!mShards[getRunningProcessorID() % shardCount].add(name, line, 1, dt, dt, dt))
+            _InterlockedIncrement64(&mDroppedMeasurements);
     }
-    
-    // Write CSV file with ProfilingData and hash function values (to check distribution)
+
+    // Number of measurements discarded because buffers were full (increase expectedProfilingDataItems in init())
+    unsigned long long droppedMeasurements() const
+    {
+        return mDroppedMeasurements;
+    }
+
+    // Write CSV file with merged ProfilingData and hash function values (to check distribution)
     bool writeToFile()
     {
         ASSERT(isMainProcessor());
@@ -116,29 +257,15 @@ public:
 
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
 
+        merge();
+
         // output hash for each entry?
-        bool okay = writeStringToFile(file, L"idx,name,line,count,sum_microseconds,avg_microseconds,min_microseconds,max_microseconds\r\n");
-        for (unsigned int i = 0; i < mDataSize; ++i)
+        bool okay = writeStringToFile(file, csvHeader);
+        for (unsigned int i = 0; i < mMerged.capacity(); ++i)
         {
-            if (mDataPtr[i].name)
+            if (mMerged.entry(i).name)
             {
-                unsigned long long runtimeSumMicroseconds = ticksToMicroseconds(mDataPtr[i].runtimeSum);
-                setNumber(message, i, false);
-                appendText(message, ",\"");
-                appendText(message, mDataPtr[i].name);
-                appendText(message, "\",");
-                appendNumber(message, mDataPtr[i].line, false);
-                appendText(message, ",");
-                appendNumber(message, mDataPtr[i].numOfExec, false);
-                appendText(message, ",");
-                appendNumber(message, runtimeSumMicroseconds, false);
-                appendText(message, ",");
-                appendNumber(message, (mDataPtr[i].numOfExec > 0) ? runtimeSumMicroseconds / mDataPtr[i].numOfExec : 0, false);
-                appendText(message, ",");
-                appendNumber(message, ticksToMicroseconds(mDataPtr[i].runtimeMin), false);
-                appendText(message, ",");
-                appendNumber(message, ticksToMicroseconds(mDataPtr[i].runtimeMax), false);
-                appendText(message, "\r\n");
+                getCsvLine(message, i, mMerged.entry(i));
                 okay &= writeStringToFile(file, message);
             }
         }
@@ -154,6 +281,28 @@ public:
         return okay;
     }
 
+    // Write merged ProfilingData as CSV text (same format as file, but 8-bit characters) to buffer, which can be done on
+    // any processor. Lines not fitting into the buffer are omitted. Return number of bytes written.
+    unsigned int writeCsvToBuffer(char* buffer, unsigned int bufferSize)
+    {
+        ASSERT(frequency);
+        CHAR16 line[256];
+        unsigned int size = 0;
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
+        merge();
+        bool okay = appendStringToBuffer(buffer, bufferSize, size, csvHeader);
+        for (unsigned int i = 0; okay && i < mMerged.capacity(); ++i)
+        {
+            if (mMerged.entry(i).name)
+            {
+                getCsvLine(line, i, mMerged.entry(i));
+                okay = appendStringToBuffer(buffer, bufferSize, size, line);
+            }
+        }
+        RELEASE(mLock);
+        return size;
+    }
+
     static unsigned long long ticksToMicroseconds(unsigned long long ticks)
     {
         ASSERT(frequency);
@@ -179,110 +328,112 @@ public:
     }
 
 protected:
-    // Hash map of mDataSize = 2^N elements of ProfilingData
-    ProfilingData* mDataPtr = nullptr;
-    unsigned int mDataSize = 0;
-    unsigned int mDataUsedEntryCount = 0;
-    
-    // Lock preventing concurrent access (acquired and released in public functions)
+    static constexpr const CHAR16* csvHeader = L"idx,name,line,count,sum_microseconds,avg_microseconds,min_microseconds,max_microseconds\r\n";
+
+    // Shards written by the processors (without locking) and hash map of all data (only accessed with mLock)
+    ProfilingDataTable mShards[shardCount];
+    ProfilingDataTable mMerged;
+    volatile bool mInitialized = false;
+    volatile long long mDroppedMeasurements = 0;
+
+    // Lock preventing concurrent init / merge (acquired and released in public functions)
     volatile char mLock = 0;
 
-    // Init buffer. Assumes caller has acquired mLock.
-    bool doInit(unsigned int expectedProfilingDataItems = 8)
+    // Init buffers. Assumes caller has acquired mLock.
+    bool doInit(unsigned int expectedProfilingDataItems = 256)
     {
-        // Compute size of new hash map
+        // Compute size of new hash maps
         unsigned int newDataSize = 8;
         while (newDataSize < expectedProfilingDataItems)
             newDataSize <<= 1;
 
-        // Make sure there is enough space in the new hash map
-        if (newDataSize < mDataUsedEntryCount)
-            return false;
+        // Make sure there is enough space for the data recorded before
+        if (mInitialized)
+        {
+            merge();
+            if (newDataSize < mMerged.usedEntryCount())
+                return false;
+        }
         newDataSize <<= 1;
 
-        // Keep old data for copying to new hash map
-        ProfilingData* oldDataPtr = mDataPtr;
-        const unsigned int oldDataSize = mDataSize;
-        const unsigned int oldDataUsedEntryCount = mDataUsedEntryCount;
-
-        // Allocate new hash map (init to zero)
-        if (!allocPoolWithErrorLog(L"ProfilingDataCollector", newDataSize * sizeof(ProfilingData), (void**)&mDataPtr, __LINE__))
+        // Allocate new tables. The data recorded before (merged from all shards above) is moved to shard 0, because
+        // mMerged is rebuilt from the shards on each merge().
+        ProfilingDataTable oldMerged = mMerged;
+        mMerged = ProfilingDataTable();
+        if (!mMerged.init(newDataSize))
+        {
+            mMerged = oldMerged;
             return false;
-        mDataSize = newDataSize;
-        mDataUsedEntryCount = 0;
-
-        // If there was a hash map before, fill entries in new map and free old map
-        if (oldDataPtr)
+        }
+        for (unsigned int i = 0; i < shardCount; ++i)
         {
-            for (unsigned int i = 0; i < oldDataSize; ++i)
+            if (!mShards[i].init(newDataSize))
             {
-                if (oldDataPtr[i].name)
-                {
-                    const ProfilingData& oldEntry = oldDataPtr[i];
-                    ProfilingData& newEntry = getEntry(oldEntry.name, oldEntry.line);
-                    newEntry.numOfExec = oldEntry.numOfExec;
-                    newEntry.runtimeSum = oldEntry.runtimeSum;
-                    newEntry.runtimeMin = oldEntry.runtimeMin;
-                    newEntry.runtimeMax = oldEntry.runtimeMax;
-                }
+                oldMerged.deinit();
+                mInitialized = false;
+                return false;
             }
-            ASSERT(mDataUsedEntryCount == oldDataUsedEntryCount);
-
-            freePool(oldDataPtr);
         }
+        for (unsigned int i = 0; i < oldMerged.capacity(); ++i)
+        {
+            const ProfilingData& oldEntry = oldMerged.entry(i);
+            if (oldEntry.name)
+                mShards[0].add(oldEntry.name, oldEntry.line, oldEntry.numOfExec, oldEntry.runtimeSum, oldEntry.runtimeMin, oldEntry.runtimeMax);
+        }
+        oldMerged.deinit();
+        mInitialized = true;
 
         return true;
     }
 
-    // Return entry of given key (pair of name and line), create entry if not found. Assumes caller has acquired mLock.
-    ProfilingData& getEntry(const char* name, unsigned long long line)
+    // Merge data of all shards into mMerged. Assumes caller has acquired mLock.
+    void merge()
     {
-        ASSERT(mDataPtr && mDataSize > 0);          // requires data to be initialized
-        ASSERT((mDataSize & (mDataSize - 1)) == 0); // mDataSize must be 2^N
-
-        const unsigned long long mask = (mDataSize - 1);
-        unsigned long long i = hashFunction(name, line) & mask;
-    iteration:
-        if (mDataPtr[i].name == name && mDataPtr[i].line == line)
+        mMerged.clear();
+        for (unsigned int s = 0; s < shardCount; ++s)
         {
-            // found entry in hash map
-            return mDataPtr[i];
-        }
-        else
-        {
-            if (!mDataPtr[i].name)
+            const ProfilingDataTable& shard = mShards[s];
+            for (unsigned int i = 0; i < shard.capacity(); ++i)
             {
-                // free slot -> entry not available yet -> add new entry
-                ++mDataUsedEntryCount;
-                mDataPtr[i].name = name;
-                mDataPtr[i].line = line;
-                mDataPtr[i].runtimeMin = (unsigned long long)-1;
-                return mDataPtr[i];
-            }
-            else
-            {
-                // hash collision
-                // -> check if hash map has enough free space
-                if (mDataUsedEntryCount * 2 > mDataSize)
-                {
-                    if (doInit(mDataUsedEntryCount * 2))
-                    {
-                        // hash map has been extended -> restart getting entry
-                        return getEntry(name, line);
-                    }
-                }
-
-                // -> check next entry in hash map
-                i = (i + 1) & mask;
-                goto iteration;
+                const ProfilingData& entry = shard.entry(i);
+                // skip entries that are free or being created
+                if ((unsigned long long)entry.name > 1)
+                    mMerged.add(entry.name, entry.line, entry.numOfExec, entry.runtimeSum, entry.runtimeMin, entry.runtimeMax);
             }
         }
     }
 
-    // Compute hash sum for given key
-    static unsigned long long hashFunction(const char* name, unsigned long long line)
+    static void getCsvLine(CHAR16* line, unsigned int idx, const ProfilingData& entry)
     {
-        return (((unsigned long long)name) ^ line);
+        unsigned long long runtimeSumMicroseconds = ticksToMicroseconds(entry.runtimeSum);
+        setNumber(line, idx, false);
+        appendText(line, ",\"");
+        appendText(line, entry.name);
+        appendText(line, "\",");
+        appendNumber(line, entry.line, false);
+        appendText(line, ",");
+        appendNumber(line, entry.numOfExec, false);
+        appendText(line, ",");
+        appendNumber(line, runtimeSumMicroseconds, false);
+        appendText(line, ",");
+        appendNumber(line, (entry.numOfExec > 0) ? runtimeSumMicroseconds / entry.numOfExec : 0, false);
+        appendText(line, ",");
+        appendNumber(line, ticksToMicroseconds(entry.runtimeMin), false);
+        appendText(line, ",");
+        appendNumber(line, ticksToMicroseconds(entry.runtimeMax), false);
+        appendText(line, "\r\n");
+    }
+
+    // Append string as 8-bit characters if it fits completely
+    static bool appendStringToBuffer(char* buffer, unsigned int bufferSize, unsigned int& size, const CHAR16* str)
+    {
+        const unsigned int strLen = stringLength(str);
+        if (size + strLen > bufferSize)
+            return false;
+        for (unsigned int i = 0; i < strLen; ++i)
+            buffer[size + i] = (char)str[i];
+        size += strLen;
+        return true;
     }
 
 #ifdef NO_UEFI
@@ -322,6 +473,265 @@ protected:
 GLOBAL_VAR_DECL ProfilingDataCollector gProfilingDataCollector;
 
 
+// Histogram of execution times measured with the time stamp counter (TSC), with logarithmic buckets:
+// bucket 0 counts durations of less than 2 ticks, bucket i > 0 counts durations in [2^i, 2^(i+1)) ticks (the last
+// bucket also counts all longer durations). Adding is lock-free, so it can be done from all processors.
+struct ExecutionTimeHistogram
+{
+    static constexpr unsigned int bucketCount = 48;
+
+    volatile long long bucketCounts[bucketCount];
+    volatile long long totalTicks;
+
+    static unsigned int getBucket(unsigned long long ticks)
+    {
+        const unsigned int bucket = 63 - (unsigned int)_lzcnt_u64(ticks | 1);
+        return (bucket < bucketCount) ? bucket : bucketCount - 1;
+    }
+
+    void add(unsigned long long ticks)
+    {
+        _InterlockedIncrement64(&bucketCounts[getBucket(ticks)]);
+        _interlockedadd64(&totalTicks, ticks);
+    }
+
+    unsigned long long count() const
+    {
+        unsigned long long sum = 0;
+        for (unsigned int i = 0; i < bucketCount; ++i)
+            sum += bucketCounts[i];
+        return sum;
+    }
+
+    // Return upper bound of the duration in ticks that is not exceeded by the given percentage of executions
+    unsigned long long percentileUpperBound(unsigned int percent) const
+    {
+        const unsigned long long total = count();
+        const unsigned long long threshold = (total * percent + 99) / 100;
+        unsigned long long sum = 0;
+        for (unsigned int i = 0; i < bucketCount; ++i)
+        {
+            sum += bucketCounts[i];
+            if (sum >= threshold)
+                return 2ULL << i;
+        }
+        return 2ULL << (bucketCount - 1);
+    }
+};
+
+// Event recorded by ProfilingEventTracer (duration of a scope)
+struct ProfilingTraceEvent
+{
+    volatile unsigned long long sequenceNumber; // index + 1 of event in ring buffer, 0 while event is written
+    const char* name;
+    unsigned long long startTsc;
+    unsigned long long endTsc;
+    unsigned int tick;
+    unsigned int processorId;
+};
+
+// Records timestamped events into one fixed-size ring buffer per processor (oldest events are overwritten), in order
+// to see timelines of single ticks. Recording is lock-free. The events can be exported in Chrome trace JSON format,
+// which can be viewed with chrome://tracing or https://ui.perfetto.dev.
+class ProfilingEventTracer
+{
+public:
+    static constexpr unsigned int shardCount = ProfilingDataCollector::shardCount;
+
+    // Allocate ring buffers with eventsPerShard (2^N) events each and buffer for JSON export, discarding all events.
+    // Tracing is disabled until init() has been called. Must not be called while other processors record events.
+    bool init(unsigned int eventsPerShard = 4096)
+    {
+        ASSERT((eventsPerShard & (eventsPerShard - 1)) == 0);
+        deinit();
+        const unsigned long long eventCount = (unsigned long long)eventsPerShard * shardCount;
+        if (!allocPoolWithErrorLog(L"ProfilingEventTracer", eventCount * sizeof(ProfilingTraceEvent), (void**)&mEvents, __LINE__))
+            return false;
+        mJsonBufferSize = eventCount * maxJsonEventSize + 64;
+        if (!allocPoolWithErrorLog(L"ProfilingEventTracer", mJsonBufferSize, (void**)&mJsonBuffer, __LINE__))
+        {
+            freePool(mEvents);
+            mEvents = nullptr;
+            return false;
+        }
+        setMem((void*)mNextEventIndex, sizeof(mNextEventIndex), 0);
+        mEventsPerShard = eventsPerShard;
+        mSaveResult = 0;
+        return true;
+    }
+
+    // Free buffers. Must not be called while other processors record events or file is saved.
+    void deinit()
+    {
+        if (mEvents)
+            freePool(mEvents);
+        if (mJsonBuffer)
+            freePool(mJsonBuffer);
+        mEvents = nullptr;
+        mJsonBuffer = nullptr;
+        mEventsPerShard = 0;
+        mJsonBufferSize = 0;
+    }
+
+    // Set tick number that is stored in the following events
+    void setTick(unsigned int tick)
+    {
+        mCurrentTick = tick;
+    }
+
+    // Record event. The name is stored as a pointer, so it should be a string literal.
+    void addEvent(const char* name, unsigned long long startTsc, unsigned long long endTsc)
+    {
+        if (!mEvents)
+            return;
+        const unsigned long long processorId = getRunningProcessorID();
+        const unsigned long long shard = processorId % shardCount;
+        const unsigned long long index = _InterlockedIncrement64(&mNextEventIndex[shard]) - 1;
+        ProfilingTraceEvent& event = mEvents[shard * mEventsPerShard + (index & (mEventsPerShard - 1))];
+        event.sequenceNumber = 0;
+        event.name = name;
+        event.startTsc = startTsc;
+        event.endTsc = endTsc;
+        event.tick = mCurrentTick;
+        event.processorId = (unsigned int)processorId;
+        event.sequenceNumber = index + 1;
+    }
+
+    // Write events currently in the ring buffers as Chrome trace JSON to buffer (8-bit characters). Events not fitting
+    // into the buffer are omitted. Events written concurrently are skipped. Return number of bytes written.
+    unsigned long long writeChromeTraceJson(char* buffer, unsigned long long bufferSize, unsigned int* numberOfEvents = nullptr)
+    {
+        ASSERT(frequency);
+        ASSERT(bufferSize >= 64);
+        unsigned long long size = 0;
+        unsigned int eventCount = 0;
+        appendString(buffer, size, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        // timestamps are relative to oldest event
+        unsigned long long minStartTsc = 0xffffffffffffffffllu;
+        const unsigned long long totalEventCount = (unsigned long long)mEventsPerShard * shardCount;
+        for (unsigned long long i = 0; i < totalEventCount; ++i)
+        {
+            if (mEvents[i].sequenceNumber && mEvents[i].startTsc < minStartTsc)
+                minStartTsc = mEvents[i].startTsc;
+        }
+
+        for (unsigned long long i = 0; i < totalEventCount; ++i)
+        {
+            if (size + maxJsonEventSize + 3 > bufferSize)
+                break;
+
+            // copy event, skip if it is empty or changed while copying
+            const unsigned long long sequenceNumber = mEvents[i].sequenceNumber;
+            if (!sequenceNumber)
+                continue;
+            ProfilingTraceEvent event;
+            copyMem(&event, (const void*)&mEvents[i], sizeof(event));
+            if (mEvents[i].sequenceNumber != sequenceNumber || event.sequenceNumber != sequenceNumber
+                || event.startTsc < minStartTsc || event.endTsc < event.startTsc)
+                continue;
+
+            if (eventCount)
+                appendString(buffer, size, ",");
+            appendString(buffer, size, "\n{\"name\":\"");
+            appendName(buffer, size, event.name);
+            appendString(buffer, size, "\",\"ph\":\"X\",\"pid\":0,\"tid\":");
+            appendNumber(buffer, size, event.processorId);
+            appendString(buffer, size, ",\"ts\":");
+            appendMicroseconds(buffer, size, event.startTsc - minStartTsc);
+            appendString(buffer, size, ",\"dur\":");
+            appendMicroseconds(buffer, size, event.endTsc - event.startTsc);
+            appendString(buffer, size, ",\"args\":{\"tick\":");
+            appendNumber(buffer, size, event.tick);
+            appendString(buffer, size, "}}");
+            ++eventCount;
+        }
+
+        appendString(buffer, size, "\n]}\n");
+        if (numberOfEvents)
+            *numberOfEvents = eventCount;
+        return size;
+    }
+
+    // Export events to JSON file in background. Can be called from any processor. Return number of events or -1 if
+    // tracing is not initialized or the previous export is still in progress.
+    int writeChromeTraceFile(const CHAR16* fileName = L"profiling_trace.json")
+    {
+        if (!mJsonBuffer)
+            return -1;
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
+        if (mSaveResult == AsyncFileIO::kPending)
+        {
+            RELEASE(mLock);
+            return -1;
+        }
+        unsigned int numberOfEvents = 0;
+        const unsigned long long size = writeChromeTraceJson(mJsonBuffer, mJsonBufferSize, &numberOfEvents);
+        asyncBackgroundSave(fileName, size, (const unsigned char*)mJsonBuffer, nullptr, &mSaveResult);
+        RELEASE(mLock);
+        return numberOfEvents;
+    }
+
+protected:
+    // Upper bound of the size of one event in JSON (with name truncated to maxJsonEventNameSize)
+    static constexpr unsigned int maxJsonEventNameSize = 96;
+    static constexpr unsigned int maxJsonEventSize = maxJsonEventNameSize + 160;
+
+    ProfilingTraceEvent* mEvents = nullptr;
+    unsigned int mEventsPerShard = 0;
+    volatile unsigned int mCurrentTick = 0;
+    volatile long long mNextEventIndex[shardCount];
+
+    char* mJsonBuffer = nullptr;
+    unsigned long long mJsonBufferSize = 0;
+    volatile long long mSaveResult = 0;
+
+    // Lock preventing concurrent export (buffer is used until background save is done)
+    volatile char mLock = 0;
+
+    static void appendString(char* buffer, unsigned long long& size, const char* str)
+    {
+        for (unsigned int i = 0; str[i]; ++i)
+            buffer[size++] = str[i];
+    }
+
+    // Append name truncated to maxJsonEventNameSize, replacing characters that would need escaping in JSON
+    static void appendName(char* buffer, unsigned long long& size, const char* name)
+    {
+        for (unsigned int i = 0; name[i] && i < maxJsonEventNameSize; ++i)
+            buffer[size++] = (name[i] == '"' || name[i] == '\\' || name[i] < ' ') ? '\'' : name[i];
+    }
+
+    static void appendNumber(char* buffer, unsigned long long& size, unsigned long long value)
+    {
+        char digits[20];
+        unsigned int digitCount = 0;
+        do
+        {
+            digits[digitCount++] = '0' + (char)(value % 10);
+            value /= 10;
+        } while (value);
+        while (digitCount)
+            buffer[size++] = digits[--digitCount];
+    }
+
+    // Append duration with nanosecond resolution in microseconds (unit of Chrome trace format)
+    static void appendMicroseconds(char* buffer, unsigned long long& size, unsigned long long ticks)
+    {
+        const unsigned long long nanoseconds = (ticks / frequency) * 1000000000llu + ((ticks % frequency) * 1000000000llu) / frequency;
+        appendNumber(buffer, size, nanoseconds / 1000);
+        buffer[size++] = '.';
+        const unsigned long long fraction = nanoseconds % 1000;
+        buffer[size++] = '0' + (char)(fraction / 100);
+        buffer[size++] = '0' + (char)((fraction / 10) % 10);
+        buffer[size++] = '0' + (char)(fraction % 10);
+    }
+};
+
+// Global tracer used by ProfilingTracingScope
+GLOBAL_VAR_DECL ProfilingEventTracer gProfilingEventTracer;
+
+
 // Measure profiling statistics during life-time of object (from construction to destruction).
 // Construction and destruction must happen on the same processor to ensure accurate results.
 class ProfilingScope
@@ -342,6 +752,27 @@ protected:
     unsigned long long mStartTsc;
 };
 
+// Like ProfilingScope, but additionally records an event in gProfilingEventTracer for timeline analysis.
+class ProfilingTracingScope
+{
+public:
+    ProfilingTracingScope(const char* scopeName, unsigned long long scopeLine) : mScopeName(scopeName), mScopeLine(scopeLine), mStartTsc(__rdtsc())
+    {
+    }
+
+    ~ProfilingTracingScope()
+    {
+        const unsigned long long endTsc = __rdtsc();
+        gProfilingDataCollector.addMeasurement(mScopeName, mScopeLine, mStartTsc, endTsc);
+        gProfilingEventTracer.addEvent(mScopeName, mStartTsc, endTsc);
+    }
+
+protected:
+    const char* mScopeName;
+    unsigned long long mScopeLine;
+    unsigned long long mStartTsc;
+};
+
 // Measure profiling statistics with pairs of start/stop calls.
 // CAUTION: Attempts to use this led to freezes on EFI. Furthermore, the main intended use case, which is measuring
 // hand-over time between different processors probably doesn't work reliably because TSC may not be synced between
@@ -378,10 +809,11 @@ protected:
 
 #ifdef ENABLE_PROFILING
 #define PROFILE_SCOPE() ProfilingScope __profilingScopeObject(__FUNCTION__, __LINE__)
-#define PROFILE_NAMED_SCOPE(name) ProfilingScope __profilingScopeObject(name, __LINE__)
+#define PROFILE_NAMED_SCOPE(name) ProfilingTracingScope __profilingScopeObject(name, __LINE__)
 #define PROFILE_SCOPE_BEGIN() { PROFILE_SCOPE()
 #define PROFILE_NAMED_SCOPE_BEGIN(name) { PROFILE_NAMED_SCOPE(name)
 #define PROFILE_SCOPE_END() }
+#define PROFILE_TRACE_TICK(tick) gProfilingEventTracer.setTick(tick)
 /*
 See ProfilingStopwatch for comments.
 #define PROFILE_STOPWATCH_DEF(objectName, descriptiveNameString) ProfilingStopwatch objectName(descriptiveNameString, __LINE__)
@@ -394,6 +826,7 @@ See ProfilingStopwatch for comments.
 #define PROFILE_SCOPE_BEGIN() {
 #define PROFILE_NAMED_SCOPE_BEGIN(name) {
 #define PROFILE_SCOPE_END() }
+#define PROFILE_TRACE_TICK(tick)
 /*
 See ProfilingStopwatch for comments.
 #define PROFILE_STOPWATCH_DEF(objectName, descriptiveNameString)
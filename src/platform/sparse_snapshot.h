@@ -0,0 +1,360 @@
+#pragma once
+
+#include <lib/platform_common/qintrin.h>
+
+#include "file_io.h"
+#include "m256.h"
+#include "memory.h"
+
+#include "kangaroo_twelve.h"
+
+// Sparse file format for snapshots of hash maps with many empty slots (such as spectrum and universe).
+// Only non-empty records are stored, each with its index in the hash map:
+//
+//     SparseSnapshotHeader | unsigned int index[numberOfRecords] | Record record[numberOfRecords]
+//
+// The header also stores the Merkle root of the hash map at the time of saving, which can be used to verify that the
+// loaded data is consistent with other parts of a snapshot (such as stored digests), and a K12 digest of the indices and
+// records, which is checked when loading, so a corrupted payload isn't accepted with an intact header.
+// The dense file format (raw array of all records) stays supported for loading. Dense files are detected by the
+// missing magic number at the beginning of the file.
+
+struct SparseSnapshotHeader
+{
+    unsigned long long magic;
+    unsigned int recordSize;
+    unsigned int capacity;
+    unsigned int numberOfRecords;
+    unsigned int reserved;
+    m256i merkleRoot;
+    m256i payloadDigest;    // K12 of the data following the header
+
+    static constexpr unsigned long long magicValue = 0x3245535241505351ULL; // "QSPARSE2"
+};
+
+static_assert(sizeof(SparseSnapshotHeader) == 88, "Something is wrong with the struct size.");
+
+// Digest of the data following the header of a snapshot file
+static m256i snapshotPayloadDigest(const unsigned char* payload, unsigned long long size)
+{
+    ASSERT(size <= 0xFFFFFFFFULL);
+    m256i digest;
+    KangarooTwelve(payload, (unsigned int)size, &digest, sizeof(digest));
+    return digest;
+}
+
+
+// Save records[0, capacity) in sparse format, using buffer of bufferSize bytes for encoding. If payloadDigest is not
+// NULL, it is set to the digest stored in the header. Returns number of bytes saved or -1 on error. Returns -2 without
+// writing the file if the encoded data does not fit into the buffer (caller may save in dense format instead).
+template <typename RecordT, unsigned int capacity, typename IsEmptyFunc>
+static long long saveSparseSnapshot(const CHAR16* fileName, const RecordT* records, const m256i& merkleRoot,
+    IsEmptyFunc isEmpty, unsigned char* buffer, unsigned long long bufferSize, const CHAR16* directory = NULL,
+    m256i* payloadDigest = nullptr)
+{
+    unsigned int numberOfRecords = 0;
+    for (unsigned int i = 0; i < capacity; i++)
+    {
+        if (!isEmpty(records[i]))
+            numberOfRecords++;
+    }
+
+    const unsigned long long totalSize = sizeof(SparseSnapshotHeader) + numberOfRecords * (sizeof(unsigned int) + sizeof(RecordT));
+    if (totalSize > bufferSize)
+        return -2;
+
+    SparseSnapshotHeader* header = (SparseSnapshotHeader*)buffer;
+    header->magic = SparseSnapshotHeader::magicValue;
+    header->recordSize = sizeof(RecordT);
+    header->capacity = capacity;
+    header->numberOfRecords = numberOfRecords;
+    header->reserved = 0;
+    header->merkleRoot = merkleRoot;
+
+    unsigned int* indices = (unsigned int*)(buffer + sizeof(SparseSnapshotHeader));
+    RecordT* packedRecords = (RecordT*)(indices + numberOfRecords);
+    unsigned int packedIndex = 0;
+    for (unsigned int i = 0; i < capacity; i++)
+    {
+        if (!isEmpty(records[i]))
+        {
+            indices[packedIndex] = i;
+            copyMem(&packedRecords[packedIndex], &records[i], sizeof(RecordT));
+            packedIndex++;
+        }
+    }
+    header->payloadDigest = snapshotPayloadDigest(buffer + sizeof(SparseSnapshotHeader), totalSize - sizeof(SparseSnapshotHeader));
+    if (payloadDigest)
+        *payloadDigest = header->payloadDigest;
+
+    const long long savedSize = save(fileName, totalSize, buffer, directory);
+    return (savedSize == totalSize) ? savedSize : -1;
+}
+
+// Load records[0, capacity) from file, which may be in sparse or dense format. Uses buffer of bufferSize bytes for
+// decoding sparse files. If merkleRoot is not NULL, it is set to the root stored in the sparse file header or to zero
+// if the file is dense. Returns number of bytes loaded or -1 on error (including a payload of a sparse file that
+// doesn't match the digest in its header). Dense files have no digest, so they can't be verified.
+// If fileDigest is not NULL, it is set to a digest identifying the content of the file, which is the payload digest of
+// a sparse file or the digest of all records of a dense file (only computed if requested, because it takes a pass over
+// all records).
+template <typename RecordT, unsigned int capacity>
+static long long loadSparseOrDenseSnapshot(const CHAR16* fileName, RecordT* records, m256i* merkleRoot,
+    unsigned char* buffer, unsigned long long bufferSize, const CHAR16* directory = NULL, m256i* fileDigest = nullptr)
+{
+    static_assert(capacity * sizeof(RecordT) >= sizeof(SparseSnapshotHeader));
+
+    SparseSnapshotHeader header;
+    if (load(fileName, sizeof(header), (unsigned char*)&header, directory) != sizeof(header))
+        return -1;
+
+    if (header.magic != SparseSnapshotHeader::magicValue)
+    {
+        // Dense format
+        if (merkleRoot)
+            *merkleRoot = m256i::zero();
+        const long long loadedSize = load(fileName, capacity * sizeof(RecordT), (unsigned char*)records, directory);
+        if (loadedSize != capacity * sizeof(RecordT))
+            return -1;
+        if (fileDigest)
+            *fileDigest = snapshotPayloadDigest((const unsigned char*)records, capacity * sizeof(RecordT));
+        return loadedSize;
+    }
+
+    if (header.recordSize != sizeof(RecordT) || header.capacity != capacity || header.numberOfRecords > capacity)
+        return -1;
+
+    const unsigned long long totalSize = sizeof(SparseSnapshotHeader) + header.numberOfRecords * (sizeof(unsigned int) + sizeof(RecordT));
+    if (totalSize > bufferSize || load(fileName, totalSize, buffer, directory) != totalSize)
+        return -1;
+    if (snapshotPayloadDigest(buffer + sizeof(SparseSnapshotHeader), totalSize - sizeof(SparseSnapshotHeader)) != header.payloadDigest)
+        return -1;
+
+    const unsigned int* indices = (const unsigned int*)(buffer + sizeof(SparseSnapshotHeader));
+    const RecordT* packedRecords = (const RecordT*)(indices + header.numberOfRecords);
+    setMem(records, capacity * sizeof(RecordT), 0);
+    for (unsigned int packedIndex = 0; packedIndex < header.numberOfRecords; packedIndex++)
+    {
+        // Indices must be strictly increasing
+        const unsigned int i = indices[packedIndex];
+        if (i >= capacity || (packedIndex > 0 && i <= indices[packedIndex - 1]))
+            return -1;
+        copyMem(&records[i], &packedRecords[packedIndex], sizeof(RecordT));
+    }
+
+    if (merkleRoot)
+        *merkleRoot = header.merkleRoot;
+    if (fileDigest)
+        *fileDigest = header.payloadDigest;
+    return totalSize;
+}
+
+
+// Delta snapshots: The hash map is divided into pages of recordsPerPage records. A delta file contains all pages
+// changed since the base snapshot (which is saved with saveSparseSnapshot() or in dense format). Loading applies the
+// delta on top of the base:
+//
+//     SnapshotDeltaHeader | unsigned int pageIndex[numberOfPages] | Record page[numberOfPages][recordsPerPage]
+//
+// The delta is cumulative (not relative to the previous delta), so there is at most one delta file per base file.
+// It is bound to its base by the digest identifying the base file (see loadSparseOrDenseSnapshot()), so a delta is
+// never applied to another base, even if both bases are dense. Like sparse files, a delta stores the digest of its
+// payload, which is checked when loading.
+
+struct SnapshotDeltaHeader
+{
+    unsigned long long magic;
+    unsigned int recordSize;
+    unsigned int capacity;
+    unsigned int recordsPerPage;
+    unsigned int numberOfPages;
+    m256i baseDigest;       // Digest identifying the base file
+    m256i merkleRoot;       // Merkle root after applying the delta
+    m256i payloadDigest;    // K12 of the data following the header
+
+    static constexpr unsigned long long magicValue = 0x323041544C454451ULL; // "QDELTA02"
+};
+
+static_assert(sizeof(SnapshotDeltaHeader) == 120, "Something is wrong with the struct size.");
+
+// Tracks the pages changed since the base snapshot, and size and identity of the base file.
+template <unsigned int capacity, unsigned int recordsPerPage>
+struct SnapshotChangeTracker
+{
+    static constexpr unsigned int numberOfPages = capacity / recordsPerPage;
+    static_assert(numberOfPages % 64 == 0 && numberOfPages * recordsPerPage == capacity);
+
+    unsigned long long changedPageFlags[numberOfPages / 64];
+    unsigned long long baseSize;    // Size of base file in bytes, 0 if there is no valid base file for saving a delta
+    m256i baseDigest;               // Digest identifying the base file (see loadSparseOrDenseSnapshot())
+
+    void markChanged(unsigned int recordIndex)
+    {
+        const unsigned int pageIndex = recordIndex / recordsPerPage;
+        changedPageFlags[pageIndex >> 6] |= (1ULL << (pageIndex & 63));
+    }
+
+    bool isChanged(unsigned int pageIndex) const
+    {
+        return (changedPageFlags[pageIndex >> 6] >> (pageIndex & 63)) & 1;
+    }
+
+    unsigned int countChangedPages() const
+    {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfPages / 64; i++)
+            count += (unsigned int)_mm_popcnt_u64(changedPageFlags[i]);
+        return count;
+    }
+
+    // Set base file after saving or loading it. Clears the changed pages.
+    void setBase(unsigned long long size, const m256i& digest)
+    {
+        setMem(changedPageFlags, sizeof(changedPageFlags), 0);
+        baseSize = size;
+        baseDigest = digest;
+    }
+
+    // Force saving full base with next snapshot (for example if all records have been moved by reorganization)
+    void invalidateBase()
+    {
+        baseSize = 0;
+    }
+};
+
+template <typename RecordT, unsigned int recordsPerPage>
+static constexpr unsigned long long snapshotDeltaSize(unsigned int numberOfPages)
+{
+    return sizeof(SnapshotDeltaHeader) + numberOfPages * (sizeof(unsigned int) + recordsPerPage * sizeof(RecordT));
+}
+
+// Save all pages of records[0, capacity) changed since the base snapshot into delta file, using buffer of bufferSize
+// bytes for encoding. Returns number of bytes saved or -1 on error. Returns -2 without writing the file if the
+// encoded data does not fit into the buffer.
+template <typename RecordT, unsigned int capacity, unsigned int recordsPerPage>
+static long long saveSnapshotDelta(const CHAR16* fileName, const RecordT* records, const m256i& merkleRoot,
+    const SnapshotChangeTracker<capacity, recordsPerPage>& tracker, unsigned char* buffer, unsigned long long bufferSize,
+    const CHAR16* directory = NULL)
+{
+    const unsigned int numberOfPages = tracker.countChangedPages();
+    const unsigned long long totalSize = snapshotDeltaSize<RecordT, recordsPerPage>(numberOfPages);
+    if (totalSize > bufferSize)
+        return -2;
+
+    SnapshotDeltaHeader* header = (SnapshotDeltaHeader*)buffer;
+    header->magic = SnapshotDeltaHeader::magicValue;
+    header->recordSize = sizeof(RecordT);
+    header->capacity = capacity;
+    header->recordsPerPage = recordsPerPage;
+    header->numberOfPages = numberOfPages;
+    header->baseDigest = tracker.baseDigest;
+    header->merkleRoot = merkleRoot;
+
+    unsigned int* pageIndices = (unsigned int*)(buffer + sizeof(SnapshotDeltaHeader));
+    RecordT* pages = (RecordT*)(pageIndices + numberOfPages);
+    unsigned int packedIndex = 0;
+    for (unsigned int pageIndex = 0; pageIndex < tracker.numberOfPages; pageIndex++)
+    {
+        if (tracker.isChanged(pageIndex))
+        {
+            pageIndices[packedIndex] = pageIndex;
+            copyMem(&pages[packedIndex * recordsPerPage], &records[pageIndex * recordsPerPage], recordsPerPage * sizeof(RecordT));
+            packedIndex++;
+        }
+    }
+    header->payloadDigest = snapshotPayloadDigest(buffer + sizeof(SnapshotDeltaHeader), totalSize - sizeof(SnapshotDeltaHeader));
+
+    const long long savedSize = save(fileName, totalSize, buffer, directory);
+    return (savedSize == totalSize) ? savedSize : -1;
+}
+
+// Apply delta file to records[0, capacity), which have been loaded from the base file identified by baseDigest (see
+// loadSparseOrDenseSnapshot()). Uses buffer of bufferSize bytes for decoding. Sets merkleRoot to the root stored in the
+// delta file, and marks the pages of the delta as changed in tracker (which has to be set to the base before). Returns
+// number of bytes loaded or -1 on error. Every base is saved with a delta (empty after saving the base), so a missing
+// or unreadable delta file is an error, as well as a delta of another base or a corrupted payload.
+template <typename RecordT, unsigned int capacity, unsigned int recordsPerPage>
+static long long loadSnapshotDelta(const CHAR16* fileName, RecordT* records, const m256i& baseDigest, m256i& merkleRoot,
+    SnapshotChangeTracker<capacity, recordsPerPage>& tracker, unsigned char* buffer, unsigned long long bufferSize,
+    const CHAR16* directory = NULL)
+{
+    SnapshotDeltaHeader header;
+    if (load(fileName, sizeof(header), (unsigned char*)&header, directory) != sizeof(header))
+        return -1;
+
+    if (header.magic != SnapshotDeltaHeader::magicValue || header.recordSize != sizeof(RecordT) || header.capacity != capacity
+        || header.recordsPerPage != recordsPerPage || header.numberOfPages > tracker.numberOfPages
+        || header.baseDigest != baseDigest)
+        return -1;
+
+    const unsigned long long totalSize = snapshotDeltaSize<RecordT, recordsPerPage>(header.numberOfPages);
+    if (totalSize > bufferSize || load(fileName, totalSize, buffer, directory) != totalSize)
+        return -1;
+    if (snapshotPayloadDigest(buffer + sizeof(SnapshotDeltaHeader), totalSize - sizeof(SnapshotDeltaHeader)) != header.payloadDigest)
+        return -1;
+
+    const unsigned int* pageIndices = (const unsigned int*)(buffer + sizeof(SnapshotDeltaHeader));
+    const RecordT* pages = (const RecordT*)(pageIndices + header.numberOfPages);
+    for (unsigned int packedIndex = 0; packedIndex < header.numberOfPages; packedIndex++)
+    {
+        // Page indices must be strictly increasing
+        const unsigned int pageIndex = pageIndices[packedIndex];
+        if (pageIndex >= tracker.numberOfPages || (packedIndex > 0 && pageIndex <= pageIndices[packedIndex - 1]))
+            return -1;
+        copyMem(&records[pageIndex * recordsPerPage], &pages[packedIndex * recordsPerPage], recordsPerPage * sizeof(RecordT));
+        tracker.markChanged(pageIndex * recordsPerPage);
+    }
+
+    merkleRoot = header.merkleRoot;
+    return totalSize;
+}
+
+// Save snapshot of records[0, capacity) as delta if there is a base file and the delta is less than half of the size of
+// the base. Otherwise, save new base file (sparse, or dense if sparse data does not fit into buffer) and empty delta.
+// Sets savedBase to indicate which kind of snapshot has been saved. Returns number of bytes saved or -1 on error.
+template <typename RecordT, unsigned int capacity, unsigned int recordsPerPage, typename IsEmptyFunc>
+static long long saveSnapshotBaseOrDelta(const CHAR16* baseFileName, const CHAR16* deltaFileName, const RecordT* records,
+    const m256i& merkleRoot, IsEmptyFunc isEmpty, SnapshotChangeTracker<capacity, recordsPerPage>& tracker,
+    unsigned char* buffer, unsigned long long bufferSize, const CHAR16* directory, bool& savedBase)
+{
+    if (tracker.baseSize && snapshotDeltaSize<RecordT, recordsPerPage>(tracker.countChangedPages()) * 2 <= tracker.baseSize)
+    {
+        savedBase = false;
+        const long long savedSize = saveSnapshotDelta<RecordT, capacity, recordsPerPage>(deltaFileName, records, merkleRoot,
+            tracker, buffer, bufferSize, directory);
+        if (savedSize != -2)
+        {
+            if (savedSize < 0)
+                tracker.invalidateBase();
+            return savedSize;
+        }
+    }
+
+    savedBase = true;
+    m256i baseDigest;
+    long long savedSize = saveSparseSnapshot<RecordT, capacity>(baseFileName, records, merkleRoot, isEmpty, buffer, bufferSize,
+        directory, &baseDigest);
+    if (savedSize == -2)
+    {
+        baseDigest = snapshotPayloadDigest((const unsigned char*)records, capacity * sizeof(RecordT));
+        savedSize = save(baseFileName, capacity * sizeof(RecordT), (const unsigned char*)records, directory);
+        if (savedSize != capacity * sizeof(RecordT))
+            savedSize = -1;
+    }
+    if (savedSize < 0)
+    {
+        tracker.invalidateBase();
+        return -1;
+    }
+
+    // Replace delta of previous base by empty delta
+    tracker.setBase(savedSize, baseDigest);
+    const long long deltaSize = saveSnapshotDelta<RecordT, capacity, recordsPerPage>(deltaFileName, records, merkleRoot,
+        tracker, buffer, bufferSize, directory);
+    if (deltaSize < 0)
+    {
+        tracker.invalidateBase();
+        return -1;
+    }
+    return savedSize + deltaSize;
+}
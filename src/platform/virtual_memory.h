@@ -5,6 +5,7 @@
 #include "platform/time.h"
 #include "platform/memory_util.h"
 #include "platform/debugging.h"
+#include "platform/block_compression.h"
 
 #include "four_q.h"
 #include "kangaroo_twelve.h"
@@ -28,21 +29,63 @@ inline constexpr const T& min(const T& left, const T& right)
 // prefixName is used for generating page file names on disk, it must be unique if there are multiple VirtualMemory instances
 // pageCapacity is number of items (T) inside a page
 // it stores (numCachePage) pages on RAM for faster loading (the strategy mimics CPU cache lines)
+// cache slots are evicted with the CLOCK algorithm, slots are pinned while readers copy from them without holding the lock,
+// pages are loaded from disk without holding the lock, and the next page is read ahead for sequential reads
+// the current page is double-buffered: a full page is written to disk in background (write-behind) while appending
+// continues in the other buffer, appending only waits if the previous full page is still being written
+// if compressPages is set, pages are stored on disk as independently compressed blocks with an index of block sizes,
+// the full page is compressed by the thread writing it to disk, not by the appending thread
+// (page files stored without compression can still be loaded)
 // this class can be used to debug illegal memory access issue
-template <typename T, unsigned long long prefixName, unsigned long long pageDirectory, unsigned long long pageCapacity = 100000, unsigned long long numCachePage = 128>
+template <typename T, unsigned long long prefixName, unsigned long long pageDirectory, unsigned long long pageCapacity = 100000, unsigned long long numCachePage = 128, bool compressPages = false>
 class VirtualMemory
 {
     const unsigned long long pageSize = sizeof(T) * pageCapacity;
 private:
+    // compressed page file: CompressedPageHeader | unsigned int compressedBlockSize[numCompressedBlocks] | blocks
+    // blocks with compressedBlockSize equal to the uncompressed size are stored uncompressed
+    struct CompressedPageHeader
+    {
+        unsigned long long magic;
+        unsigned long long pageSize;
+        unsigned long long dataSize; // total size of blocks
+        unsigned int blockSize;
+        unsigned int numberOfBlocks;
+    };
+    static constexpr unsigned long long compressedPageMagic = 0x31454741505A4C51ULL; // "QLZPAGE1"
+    static constexpr unsigned long long numCompressedBlocks = (sizeof(T) * pageCapacity + LZ_MAX_BLOCK_SIZE - 1) / LZ_MAX_BLOCK_SIZE;
+    static constexpr unsigned long long compressedPageIndexSize = sizeof(CompressedPageHeader) + numCompressedBlocks * sizeof(unsigned int);
+
+    // A compressed page is decompressed in place: the file is loaded to the end of the slot buffer, below a copy of its
+    // header and index. With a margin of one block plus two indices, the output of each block ends before its input.
+    static constexpr unsigned long long slotMargin = compressPages ? ((LZ_MAX_BLOCK_SIZE + 2 * compressedPageIndexSize + sizeof(T) - 1) / sizeof(T)) * sizeof(T) : 0;
+    static constexpr unsigned long long slotSize = sizeof(T) * pageCapacity + slotMargin;
+
+    // slot of the full page that is written to disk in background (it is kept for reading until the next page is full)
+    static constexpr int writeBehindSlot = numCachePage + 1;
+
     // on RAM
+    T* pageBuffers = NULL; // memory of all page buffers
+    unsigned short lzHashTable[compressPages ? LZ_HASH_TABLE_SIZE : 1];
     T* currentPage = NULL; // current page is cache[0]
-    T* cache[numCachePage + 1];
+    T* cache[numCachePage + 2];
     CHAR16* pageDir = NULL;
 
-    unsigned long long cachePageId[numCachePage + 1];
-    unsigned long long lastAccessedTimestamp[numCachePage + 1]; // in millisecond
+    static constexpr unsigned long long pageTableSize = numCachePage * 2;
+
+    unsigned long long cachePageId[numCachePage + 2];
+    // state of cache slots 1..numCachePage (slot 0 and writeBehindSlot are only changed by appending)
+    unsigned int pinCount[numCachePage + 2]; // number of readers copying from slot without holding memLock
+    volatile long long loadResult[numCachePage + 2]; // AsyncFileIO::kPending while loading, pageSize if page is valid
+    bool referenced[numCachePage + 2]; // reference bits of CLOCK eviction
+    int clockHand; // next slot checked by CLOCK eviction
+    int pageTable[pageTableSize]; // hint of cache slot by pageId % pageTableSize, verified with cachePageId
+    unsigned long long lastReadPageId; // for detecting sequential reads
     unsigned long long currentId; // total items in this array, aka: latest item index + 1
     unsigned long long currentPageId; // current page index that's written on
+    volatile long long writeBehindResult; // result of writing page in writeBehindSlot, AsyncFileIO::kPending while writing
+    unsigned long long writeBehindFileSize; // size of file written for page in writeBehindSlot
+    int compressionSlot; // cache slot borrowed for compressing the page in writeBehindSlot until it is written, 0 if none
 
     volatile char memLock; // every read/write needs a memory lock, can optimize later
 
@@ -61,18 +104,97 @@ private:
         appendText(pageName, L".pg");
     }
 
-    void writeCurrentPageToDisk()
+    // compress the full page in writeBehindSlot into the borrowed compressionSlot and return the file size
+    // called by the thread writing the page to disk (see startWritingFullPageToDisk()) without holding memLock,
+    // the buffers aren't changed by appending until the write is finished
+    static unsigned long long compressFullPageForWriting(void* context)
+    {
+        VirtualMemory* vm = (VirtualMemory*)context;
+        vm->writeBehindFileSize = vm->compressFullPage((unsigned char*)vm->cache[vm->compressionSlot]);
+        return vm->writeBehindFileSize;
+    }
+
+    // compress the full page in writeBehindSlot into compressedPage (at least index size + pageSize) and return the file size
+    unsigned long long compressFullPage(unsigned char* compressedPage)
+    {
+        CompressedPageHeader* header = (CompressedPageHeader*)compressedPage;
+        unsigned int* compressedBlockSize = (unsigned int*)(compressedPage + sizeof(CompressedPageHeader));
+        unsigned char* data = compressedPage + compressedPageIndexSize;
+        const unsigned char* page = (const unsigned char*)cache[writeBehindSlot];
+        unsigned long long dataSize = 0;
+        for (unsigned long long i = 0; i < numCompressedBlocks; i++)
+        {
+            const unsigned int blockSize = (unsigned int)min(pageSize - i * LZ_MAX_BLOCK_SIZE, (unsigned long long)LZ_MAX_BLOCK_SIZE);
+            const unsigned char* block = page + i * LZ_MAX_BLOCK_SIZE;
+            unsigned int size = lzCompressBlock(block, blockSize, data + dataSize, blockSize - 1, lzHashTable);
+            if (size == 0)
+            {
+                copyMem(data + dataSize, block, blockSize);
+                size = blockSize;
+            }
+            compressedBlockSize[i] = size;
+            dataSize += size;
+        }
+        header->magic = compressedPageMagic;
+        header->pageSize = pageSize;
+        header->dataSize = dataSize;
+        header->blockSize = LZ_MAX_BLOCK_SIZE;
+        header->numberOfBlocks = (unsigned int)numCompressedBlocks;
+        return compressedPageIndexSize + dataSize;
+    }
+
+    // start writing the full page in writeBehindSlot to disk without waiting for the write
+    // must be called with memLock acquired
+    void startWritingFullPageToDisk()
     {
         CHAR16 pageName[64];
-        generatePageName(pageName, currentPageId);
+        generatePageName(pageName, cachePageId[writeBehindSlot]);
+        const unsigned char* fileData = (const unsigned char*)cache[writeBehindSlot];
+        writeBehindFileSize = pageSize;
+        AsyncFileIOPrepareSaveFunction prepareSave = NULL;
+        if (compressPages)
+        {
+            // instead of allocating another page buffer, a cache slot (large enough for index and uncompressed page)
+            // is evicted and pinned as output buffer until the write is finished
+            // the page is compressed by the writing thread, so appending isn't delayed by compressing
+            // if all slots are in use by readers, the page is written uncompressed
+            const int slot = getEvictableCacheSlot();
+            if (slot > 0)
+            {
+                cachePageId[slot] = -1;
+                loadResult[slot] = 0;
+                referenced[slot] = false;
+                pinCount[slot]++;
+                compressionSlot = slot;
+                fileData = (const unsigned char*)cache[slot];
+                writeBehindFileSize = compressedPageIndexSize + pageSize;
+                prepareSave = compressFullPageForWriting;
+            }
+        }
 #ifdef NO_UEFI
-        auto sz = save(pageName, pageSize, (unsigned char*)currentPage, pageDir);
+        if (prepareSave)
+        {
+            prepareSave(this);
+        }
+        writeBehindResult = save(pageName, writeBehindFileSize, fileData, pageDir);
 #else
-        auto sz = asyncSave(pageName, pageSize, (unsigned char*)currentPage, pageDir, true);
+        asyncBackgroundSave(pageName, writeBehindFileSize, fileData, pageDir, &writeBehindResult, prepareSave, this);
 #endif
+    }
+
+    // wait until the page in writeBehindSlot is written to disk (only waits if disk is slower than appending)
+    void waitForWritingFullPageToDisk()
+    {
+        waitForAsyncBackgroundFileIO(&writeBehindResult);
+        releaseCompressionSlot();
+        if (writeBehindResult == 0)
+        {
+            // no page written since last check
+            return;
+        }
 
 #if !defined(NDEBUG)
-        if (sz != pageSize)
+        if (writeBehindResult != writeBehindFileSize)
         {
             addDebugMessage(L"Failed to store virtualMemory to disk. Old data maybe lost");
         }
@@ -86,145 +208,360 @@ private:
             debugMsg[6] = L' ';
             debugMsg[7] = 0;
             appendText(debugMsg, L"page ");
-            appendNumber(debugMsg, currentPageId, true);
+            appendNumber(debugMsg, cachePageId[writeBehindSlot], true);
             appendText(debugMsg, L" is written into disk");
             addDebugMessage(debugMsg);
         }
 #endif
+        writeBehindResult = 0;
     }
 
-    // return the most outdated cache page
-    int getMostOutdatedCachePage()
+    // unpin the cache slot borrowed for compressing if the compressed page has been written
+    // must be called with memLock acquired
+    void releaseCompressionSlot()
     {
-        // i = 1 because 0 is used for current page
-        int min_index = 1;
-        for (int i = 1; i <= numCachePage; i++)
+        if (compressionSlot > 0 && writeBehindResult != AsyncFileIO::kPending)
+        {
+            pinCount[compressionSlot]--;
+            compressionSlot = 0;
+        }
+    }
+
+    void cleanCurrentPage()
+    {
+        setMem(currentPage, pageSize, 0);
+    }
+
+    // check if slot 1..numCachePage contains the page or is loading it
+    bool isCachedInSlot(int slot, unsigned long long pageId)
+    {
+        return slot > 0 && slot <= numCachePage && cachePageId[slot] == pageId
+            && (loadResult[slot] == AsyncFileIO::kPending || loadResult[slot] == (long long)pageSize);
+    }
+
+    // return cache id given cache_page_id (-1 if page is not on RAM)
+    int findCachePage(unsigned long long requested_page_id)
+    {
+        if (cachePageId[0] == requested_page_id)
+        {
+            return 0;
+        }
+        if (cachePageId[writeBehindSlot] == requested_page_id)
         {
-            if (lastAccessedTimestamp[i] == 0)
+            return writeBehindSlot;
+        }
+        int slot = pageTable[requested_page_id % pageTableSize];
+        if (!isCachedInSlot(slot, requested_page_id))
+        {
+            // hint is outdated or used by another page
+            for (slot = 1; slot <= numCachePage; slot++)
             {
-                return i;
+                if (isCachedInSlot(slot, requested_page_id))
+                {
+                    break;
+                }
             }
-            if ((lastAccessedTimestamp[i] < lastAccessedTimestamp[min_index]) || (lastAccessedTimestamp[i] == lastAccessedTimestamp[min_index] && cachePageId[i] < cachePageId[min_index]))
+            if (slot > numCachePage)
             {
-                min_index = i;
+                return -1;
             }
+            pageTable[requested_page_id % pageTableSize] = slot;
         }
-        return min_index;
+        return slot;
     }
 
-    void copyCurrentPageToCache()
+    // CLOCK eviction: return a slot that is neither pinned nor loading and that has not been referenced since the clock
+    // hand passed it last time, return -1 if all slots are in use
+    int getEvictableCacheSlot()
     {
-        int cache_slot_idx = getMostOutdatedCachePage();
-        copyMem(cache[cache_slot_idx], currentPage, pageSize);
-        lastAccessedTimestamp[cache_slot_idx] = now_ms();
-        cachePageId[cache_slot_idx] = currentPageId;
-#ifndef NDEBUG
+        releaseCompressionSlot();
+        for (int i = 0; i < 2 * numCachePage; i++)
         {
-            CHAR16 debugMsg[128];
-            unsigned long long tmp = prefixName;
-            debugMsg[0] = L'[';
-            copyMem(debugMsg + 1, &tmp, 8);
-            debugMsg[5] = L']';
-            debugMsg[6] = L' ';
-            debugMsg[7] = 0;
-            appendText(debugMsg, L"page ");
-            appendNumber(debugMsg, currentPageId, true);
-            appendText(debugMsg, L" is moved to cache slot ");
-            appendNumber(debugMsg, cache_slot_idx, true);
-            addDebugMessage(debugMsg);
+            const int slot = clockHand;
+            clockHand = (clockHand < numCachePage) ? clockHand + 1 : 1;
+            if (pinCount[slot] || loadResult[slot] == AsyncFileIO::kPending)
+            {
+                continue;
+            }
+            if (referenced[slot] && loadResult[slot] == (long long)pageSize)
+            {
+                referenced[slot] = false;
+                continue;
+            }
+            return slot;
         }
-#endif
+        return -1;
     }
 
-    void cleanCurrentPage()
+    // assign cache slot to page and mark it as loading, return -1 if all slots are in use
+    int reserveCacheSlot(unsigned long long pageId)
     {
-        setMem(currentPage, pageSize, 0);
+        int slot = getEvictableCacheSlot();
+        if (slot < 0)
+        {
+            return -1;
+        }
+        cachePageId[slot] = pageId;
+        loadResult[slot] = AsyncFileIO::kPending;
+        referenced[slot] = false;
+        pageTable[pageId % pageTableSize] = slot;
+        return slot;
     }
 
-    // return cache id given cache_page_id
-    int findCachePage(unsigned long long requested_page_id)
+    long long loadPageFile(const CHAR16* pageName, unsigned long long size, unsigned char* buffer)
     {
-        // TODO: consider implementing a tree here for faster search
-        for (int i = 0; i <= numCachePage; i++)
-        {
-            if (cachePageId[i] == requested_page_id)
-            {
 #ifdef NO_UEFI
+        return load(pageName, size, buffer, pageDir);
 #else
-                lastAccessedTimestamp[i] = now_ms();
+        volatile long long result;
+        asyncBackgroundLoad(pageName, size, buffer, pageDir, &result);
+        waitForAsyncBackgroundFileIO(&result);
+        return result;
 #endif
-                return i;
-            }
-        }
-        return -1;
     }
 
-    // load a page from disk to cache
-    // if page is already on cache, return the id
-    // return cache index
-    int loadPageToCache(unsigned long long pageId)
+    // load compressed page file into slot and decompress it in place, return pageSize on success
+    long long loadCompressedPage(int slot, const CHAR16* pageName)
     {
-        int cache_page_id = findCachePage(pageId);
+        unsigned char* slotBuffer = (unsigned char*)cache[slot];
+        unsigned char* index = slotBuffer + slotSize - compressedPageIndexSize;
+        if (loadPageFile(pageName, compressedPageIndexSize, index) != compressedPageIndexSize)
+        {
+            return -1;
+        }
+        const CompressedPageHeader* header = (const CompressedPageHeader*)index;
+        if (header->magic != compressedPageMagic)
+        {
+            // page was stored without compression
+            return loadPageFile(pageName, pageSize, slotBuffer);
+        }
+        if (header->pageSize != pageSize || header->blockSize != LZ_MAX_BLOCK_SIZE || header->numberOfBlocks != numCompressedBlocks
+            || header->dataSize > pageSize)
+        {
+            return -1;
+        }
+        const unsigned long long fileSize = compressedPageIndexSize + header->dataSize;
+        unsigned char* file = index - fileSize;
+        if (loadPageFile(pageName, fileSize, file) != fileSize)
+        {
+            return -1;
+        }
 
-        if (cache_page_id != -1)
+        const unsigned int* compressedBlockSize = (const unsigned int*)(index + sizeof(CompressedPageHeader));
+        const unsigned char* data = file + compressedPageIndexSize;
+        const unsigned char* dataEnd = data + header->dataSize;
+        for (unsigned long long i = 0; i < numCompressedBlocks; i++)
         {
-            return cache_page_id;
+            const unsigned int blockSize = (unsigned int)min(pageSize - i * LZ_MAX_BLOCK_SIZE, (unsigned long long)LZ_MAX_BLOCK_SIZE);
+            unsigned char* block = slotBuffer + i * LZ_MAX_BLOCK_SIZE;
+            const unsigned int size = compressedBlockSize[i];
+            if (size > blockSize || size > (unsigned long long)(dataEnd - data))
+            {
+                return -1;
+            }
+            if (size == blockSize)
+            {
+                copyMem(block, data, blockSize);
+            }
+            else if (!lzDecompressBlock(data, size, block, blockSize))
+            {
+                return -1;
+            }
+            data += size;
         }
+        return (data == dataEnd) ? pageSize : -1;
+    }
+
+    // start loading page into the reserved slot, called without holding memLock (loading slots aren't evicted)
+    // compressed pages are loaded and decompressed before returning
+    void startLoadingPage(int slot, unsigned long long pageId)
+    {
         CHAR16 pageName[64];
         generatePageName(pageName, pageId);
-        cache_page_id = getMostOutdatedCachePage();
+        if (compressPages)
+        {
+            loadResult[slot] = loadCompressedPage(slot, pageName);
+            return;
+        }
 #ifdef NO_UEFI
-        auto sz = load(pageName, pageSize, (unsigned char*)cache[cache_page_id], pageDir);
-        lastAccessedTimestamp[cache_page_id] = 0;
+        loadResult[slot] = load(pageName, pageSize, (unsigned char*)cache[slot], pageDir);
 #else
-#if !defined(NDEBUG)
+        asyncBackgroundLoad(pageName, pageSize, (unsigned char*)cache[slot], pageDir, &loadResult[slot]);
+#endif
+    }
+
+    void waitForLoadingPages()
+    {
+        for (int i = 1; i <= numCachePage; i++)
         {
-            CHAR16 debugMsg[128];
-            setText(debugMsg, L"Trying to load OLD page: ");
-            appendNumber(debugMsg, pageId, true);
-            addDebugMessage(debugMsg);
+            waitForAsyncBackgroundFileIO(&loadResult[i]);
         }
-#endif
-        auto sz = asyncLoad(pageName, pageSize, (unsigned char*)cache[cache_page_id], pageDir);
-        if (sz != pageSize)
+    }
+
+    // start loading a full page in background if it is neither on RAM nor loading yet
+    // must be called with memLock acquired, which is released while starting the load
+    // (compressed pages are not read ahead, because they are decompressed by the loading thread)
+    void readAhead(unsigned long long pageId)
+    {
+        if (compressPages || pageId >= currentPageId || findCachePage(pageId) != -1)
         {
-#if !defined(NDEBUG)
-            addDebugMessage(L"Failed to load virtualMemory from disk");
-#endif
-            return -1;
+            return;
+        }
+        int slot = reserveCacheSlot(pageId);
+        if (slot < 0)
+        {
+            return;
         }
-        lastAccessedTimestamp[cache_page_id] = now_ms();
+        RELEASE(memLock);
+        startLoadingPage(slot, pageId);
+        ACQUIRE(memLock);
+    }
+
+    // return cache id of the page for reading, loading it from disk if needed (-1 if it cannot be loaded)
+    // must be called with memLock acquired, which is released while waiting for loading the page
+    // cache slots 1..numCachePage are returned pinned, so they are not evicted until unpinned
+    // readAheadPageId is loaded in background if the requested page is in a cache slot
+    int pinCachePage(unsigned long long pageId, unsigned long long readAheadPageId)
+    {
+        while (true)
+        {
+            int cache_page_id = findCachePage(pageId);
+            if (cache_page_id == 0 || cache_page_id == writeBehindSlot)
+            {
+                // all following pages are on RAM too
+                return cache_page_id;
+            }
+            if (cache_page_id > 0)
+            {
+                if (loadResult[cache_page_id] == AsyncFileIO::kPending)
+                {
+                    // page is loaded by another reader or read-ahead
+                    RELEASE(memLock);
+                    waitForAsyncBackgroundFileIO(&loadResult[cache_page_id]);
+                    ACQUIRE(memLock);
+                    continue;
+                }
+                pinCount[cache_page_id]++;
+                referenced[cache_page_id] = true;
+                readAhead(readAheadPageId);
+                return cache_page_id;
+            }
+
+            cache_page_id = reserveCacheSlot(pageId);
+            if (cache_page_id < 0)
+            {
+                // all slots are pinned or loading (one may be used for compressing the page that is written to disk)
+                const bool waitForWrite = compressionSlot > 0;
+                RELEASE(memLock);
+                if (waitForWrite)
+                {
+                    waitForAsyncBackgroundFileIO(&writeBehindResult);
+                }
+                else
+                {
+                    _mm_pause();
+                }
+                ACQUIRE(memLock);
+                continue;
+            }
+            pinCount[cache_page_id]++;
+#if !defined(NDEBUG) && !defined(NO_UEFI)
+            {
+                CHAR16 debugMsg[128];
+                setText(debugMsg, L"Trying to load OLD page: ");
+                appendNumber(debugMsg, pageId, true);
+                addDebugMessage(debugMsg);
+            }
 #endif
-        cachePageId[cache_page_id] = pageId;
+            RELEASE(memLock);
+            startLoadingPage(cache_page_id, pageId);
+            ACQUIRE(memLock);
+            readAhead(readAheadPageId);
+            RELEASE(memLock);
+            waitForAsyncBackgroundFileIO(&loadResult[cache_page_id]);
+            ACQUIRE(memLock);
+
+            if (loadResult[cache_page_id] != (long long)pageSize)
+            {
 #if !defined(NDEBUG)
+                addDebugMessage(L"Failed to load virtualMemory from disk");
+#endif
+                pinCount[cache_page_id]--;
+                cachePageId[cache_page_id] = -1;
+                return -1;
+            }
+            referenced[cache_page_id] = true;
+#if !defined(NDEBUG) && !defined(NO_UEFI)
+            {
+                CHAR16 debugMsg[128];
+                unsigned long long tmp = prefixName;
+                debugMsg[0] = L'[';
+                copyMem(debugMsg + 1, &tmp, 8);
+                debugMsg[5] = L']';
+                debugMsg[6] = L' ';
+                debugMsg[7] = 0;
+                appendText(debugMsg, L"Load complete. Page ");
+                appendNumber(debugMsg, pageId, true);
+                appendText(debugMsg, L" is loaded into slot ");
+                appendNumber(debugMsg, cache_page_id, true);
+                addDebugMessage(debugMsg);
+            }
+#endif
+            return cache_page_id;
+        }
+    }
+
+    // copy numItems items starting at index (all in the same page) to dst, return false if page cannot be loaded
+    // must be called with memLock acquired
+    bool copyFromPage(T* dst, unsigned long long index, unsigned long long numItems, unsigned long long readAheadPageId)
+    {
+        const int cache_page_id = pinCachePage(index / pageCapacity, readAheadPageId);
+        if (cache_page_id == -1)
         {
-            CHAR16 debugMsg[128];
-            unsigned long long tmp = prefixName;
-            debugMsg[0] = L'[';
-            copyMem(debugMsg + 1, &tmp, 8);
-            debugMsg[5] = L']';
-            debugMsg[6] = L' ';
-            debugMsg[7] = 0;
-            appendText(debugMsg, L"Load complete. Page ");
-            appendNumber(debugMsg, pageId, true);
-            appendText(debugMsg, L" is loaded into slot ");
-            appendNumber(debugMsg, cache_page_id, true);
-            addDebugMessage(debugMsg);
+            return false;
         }
-#endif
-        return cache_page_id;
+        const T* src = cache[cache_page_id] + (index % pageCapacity);
+        if (cache_page_id == 0 || cache_page_id == writeBehindSlot)
+        {
+            // buffers of current page and write-behind page are swapped by appending, so copy while holding the lock
+            copyMem(dst, src, numItems * sizeof(T));
+            return true;
+        }
+
+        // pinned slot isn't evicted, so other readers and appending can continue while copying
+        RELEASE(memLock);
+        copyMem(dst, src, numItems * sizeof(T));
+        ACQUIRE(memLock);
+        pinCount[cache_page_id]--;
+        return true;
+    }
+
+    // read ahead the next page if the read continues in it or if pages are read sequentially
+    unsigned long long getReadAheadPageId(unsigned long long pageId, bool readContinuesInNextPage)
+    {
+        const bool sequential = readContinuesInNextPage || pageId == lastReadPageId + 1;
+        lastReadPageId = pageId;
+        return sequential ? pageId + 1 : (unsigned long long)-1;
     }
 
     // only call after append
     // check if current page is full
-    // if yes, write current page to disk and cache
+    // if yes, swap current page with the write-behind buffer and start writing it to disk in background
     // then clean current page
     void tryPersistingPage()
     {
         if (currentId % pageCapacity == 0)
         {
-            writeCurrentPageToDisk();
-            copyCurrentPageToCache();
+            // back-pressure: the buffer of the previous full page is reused, so its write must be finished
+            waitForWritingFullPageToDisk();
+
+            T* fullPage = currentPage;
+            currentPage = cache[writeBehindSlot];
+            cache[0] = currentPage;
+            cache[writeBehindSlot] = fullPage;
+            cachePageId[writeBehindSlot] = currentPageId;
+            startWritingFullPageToDisk();
+
             cleanCurrentPage();
             cachePageId[0] = currentId / pageCapacity;
             currentPageId++;
@@ -233,9 +570,24 @@ private:
 
     void reset()
     {
-        setMem(currentPage, pageSize * (numCachePage + 1), 0);
+        waitForWritingFullPageToDisk();
+        waitForLoadingPages();
+        setMem(pageBuffers, slotSize * (numCachePage + 2), 0);
+        currentPage = pageBuffers;
+        for (int i = 0; i <= writeBehindSlot; i++)
+        {
+            cache[i] = (T*)((unsigned char*)pageBuffers + i * slotSize);
+        }
         setMem(cachePageId, sizeof(cachePageId), 0xff);
-        setMem(lastAccessedTimestamp, sizeof(lastAccessedTimestamp), 0);
+        setMem(pinCount, sizeof(pinCount), 0);
+        setMem(referenced, sizeof(referenced), 0);
+        setMem(pageTable, sizeof(pageTable), 0);
+        for (int i = 0; i <= writeBehindSlot; i++)
+        {
+            loadResult[i] = 0;
+        }
+        clockHand = 1;
+        lastReadPageId = -1;
         cachePageId[0] = 0;
         currentId = 0;
         currentPageId = 0;
@@ -246,22 +598,23 @@ public:
     VirtualMemory()
     {
         memLock = 0;
+        writeBehindResult = 0;
+        compressionSlot = 0;
+        for (int i = 0; i <= writeBehindSlot; i++)
+        {
+            loadResult[i] = 0;
+        }
     }
 
     bool init()
     {
         ACQUIRE(memLock);
-        if (currentPage == NULL)
+        if (pageBuffers == NULL)
         {
-            if (!allocPoolWithErrorLog(L"VirtualMemory.Page", pageSize * (numCachePage + 1), (void**)&currentPage, __LINE__))
+            if (!allocPoolWithErrorLog(L"VirtualMemory.Page", slotSize * (numCachePage + 2), (void**)&pageBuffers, __LINE__))
             {
                 return false;
             }
-            cache[0] = currentPage;
-            for (int i = 1; i <= numCachePage; i++)
-            {
-                cache[i] = cache[i - 1] + pageCapacity;
-            }
         }
 
         if (pageDir == NULL)
@@ -305,9 +658,12 @@ public:
     }
     void deinit()
     {
-        if (currentPage != NULL)
+        if (pageBuffers != NULL)
         {
-            freePool(currentPage);
+            waitForWritingFullPageToDisk();
+            waitForLoadingPages();
+            freePool(pageBuffers);
+            pageBuffers = NULL;
             currentPage = NULL;
         }
         if (pageDir != NULL)
@@ -330,71 +686,20 @@ public:
             RELEASE(memLock);
             return 0;
         }
-        RELEASE(memLock);
-
-        // processing
-        unsigned long long c_bytes = 0;
-        unsigned long long p_start = offset;
-        unsigned long long p_end = offset + numItems;
 
         // visualizer:
         // [     PAGE N    ] [ PAGE N + 1] [ PAGE N + 2] [ PAGE N + 3] ... [ PAGE N + K-2 ] [ PAGE N + K-1 ] [ PAGE N + K ]
         //        ^[                        REQUESTED MEMORY REGION                               ]^
         //         [HEAD   ] [                            BODY                            ] [TAIL ]
-
-        // HEAD
-        unsigned long long hs = offset; // head start
-        unsigned long long rhs = (hs / pageCapacity) * pageCapacity; // rounded hs
-        unsigned long long r_page_id = rhs / pageCapacity;
-        unsigned long long he = min(rhs + pageCapacity, offset + numItems); // head end
-        unsigned long long n_item = he - hs; // copy [hs, he)
-        ACQUIRE(memLock);
-        int cache_page_idx = loadPageToCache(r_page_id);
-        if (cache_page_idx == -1)
-        {
-#if !defined(NDEBUG)
-            addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-            setMem(dst, numItems * sizeof(T), 0);
-            RELEASE(memLock);
-            return 0;
-        }
-        copyMem(dst, cache[cache_page_idx] + (hs % pageCapacity), n_item * sizeof(T));
-        dst += n_item;
-        c_bytes += n_item * sizeof(T);
-        RELEASE(memLock);
-        // BODY
-        unsigned long long bs = he; //bodystart
-        if (he < p_end && (p_end - he) >= pageCapacity) // need to copy fullpage in the "middle"
-        {
-            for (bs = he; bs + pageCapacity <= p_end; bs += pageCapacity)
-            {
-                r_page_id = bs / pageCapacity;
-                ACQUIRE(memLock);
-                cache_page_idx = loadPageToCache(r_page_id);
-                if (cache_page_idx == -1)
-                {
-#if !defined(NDEBUG)
-                    addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-                    setMem(dst, numItems * sizeof(T), 0);
-                    RELEASE(memLock);
-                    return 0;
-                }
-                copyMem(dst, cache[cache_page_idx], pageSize);
-                dst += pageCapacity;
-                c_bytes += pageSize;
-                RELEASE(memLock);
-            }
-        }
-        // TAIL
-        if (bs < p_end)
+        // each part is copied from its page while the next page is read ahead
+        unsigned long long c_bytes = 0;
+        unsigned long long p_end = offset + numItems;
+        for (unsigned long long ps = offset; ps < p_end; )
         {
-            r_page_id = bs / pageCapacity;
-            n_item = p_end - bs; // copy [bs, p_end)
-            ACQUIRE(memLock);
-            int cache_page_idx = loadPageToCache(r_page_id);
-            if (cache_page_idx == -1)
+            unsigned long long r_page_id = ps / pageCapacity;
+            unsigned long long pe = min((r_page_id + 1) * pageCapacity, p_end); // copy [ps, pe)
+            unsigned long long n_item = pe - ps;
+            if (!copyFromPage(dst + (ps - offset), ps, n_item, getReadAheadPageId(r_page_id, pe < p_end)))
             {
 #if !defined(NDEBUG)
                 addDebugMessage(L"Invalid cache page index, return zeroes array");
@@ -403,11 +708,10 @@ public:
                 RELEASE(memLock);
                 return 0;
             }
-            copyMem(dst, cache[cache_page_idx], n_item * sizeof(T));
-            dst += n_item;
             c_bytes += n_item * sizeof(T);
-            RELEASE(memLock);
+            ps = pe;
         }
+        RELEASE(memLock);
         return c_bytes;
     }
 
@@ -461,36 +765,17 @@ public:
 
     // return array[index]
     // if index is not in current page it will try to find it in cache
-    // if index is not in cache it will load the page to most outdated cache
+    // if index is not in cache it will load the page to a cache slot chosen by CLOCK eviction
     T get(unsigned long long index)
     {
         T result;
-        ACQUIRE(memLock);
-        if (index >= currentId) // out of bound
-        {
-            setMem(&result, sizeof(T), 0);
-            RELEASE(memLock);
-            return result;
-        }
-        unsigned long long requested_page_id = index / pageCapacity;
-        int cache_page_idx = loadPageToCache(requested_page_id);
-        if (cache_page_idx == -1)
-        {
-#if !defined(NDEBUG)
-            addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-            setMem(&result, sizeof(T), 0);
-            RELEASE(memLock);
-            return result;
-        }
-        result = cache[cache_page_idx][index % pageCapacity];
-        RELEASE(memLock);
+        getOne(index, &result);
         return result;
     }
 
     // return array[index]
     // if index is not in current page it will try to find it in cache
-    // if index is not in cache it will load the page to most outdated cache
+    // if index is not in cache it will load the page to a cache slot chosen by CLOCK eviction
     void getOne(unsigned long long index, T* result)
     {
         ACQUIRE(memLock);
@@ -501,17 +786,13 @@ public:
             return;
         }
         unsigned long long requested_page_id = index / pageCapacity;
-        int cache_page_idx = loadPageToCache(requested_page_id);
-        if (cache_page_idx == -1)
+        if (!copyFromPage(result, index, 1, getReadAheadPageId(requested_page_id, false)))
         {
 #if !defined(NDEBUG)
             addDebugMessage(L"Invalid cache page index, return zeroes array");
 #endif
             setMem(result, sizeof(T), 0);
-            RELEASE(memLock);
-            return;
         }
-        copyMem(result, &(cache[cache_page_idx][index % pageCapacity]), sizeof(T));
         RELEASE(memLock);
         return;
     }
@@ -523,9 +804,10 @@ public:
 
     // append (single) data to latest
     // if current page is fully written it will:
-    // (1) write current page to disk
-    // (2) copy current page to cache
-    // (3) clean current page for new data
+    // (1) wait until the previous full page is written to disk
+    // (2) swap current page with the write-behind buffer, which keeps the full page readable until the next page is full
+    // (3) start writing the full page to disk in background (compressed by the writing thread if enabled)
+    // (4) clean current page for new data
     void append(const T& data)
     {
         ASSERT(currentPage != NULL);
@@ -551,6 +833,10 @@ public:
         CHAR16 pageName[64];
         generatePageName(pageName, pageId);
         ACQUIRE(memLock);
+        if (pageId == cachePageId[writeBehindSlot])
+        {
+            waitForWritingFullPageToDisk();
+        }
         bool success = (asyncRemoveFile(pageName, pageDir)) == 0;
         RELEASE(memLock);
         return success;
@@ -621,6 +907,8 @@ public:
     unsigned long long dumpVMState(unsigned char* buffer)
     {
         ACQUIRE(memLock);
+        // the dumped state refers to all full pages, so they need to be on disk
+        waitForWritingFullPageToDisk();
         unsigned long long ret = 0;
         copyMem(buffer, currentPage, pageSize);
         ret += pageSize;
@@ -654,7 +942,8 @@ public:
         ret += 8;
 
         cachePageId[0] = currentPageId;
-        lastAccessedTimestamp[0] = now_ms();
+        waitForWritingFullPageToDisk();
+        cachePageId[writeBehindSlot] = -1;
         RELEASE(memLock);
         return ret;
     }
@@ -11,11 +11,23 @@
 #define MAX_NUMBER_OF_PROCESSORS 32
 #define NUMBER_OF_SOLUTION_PROCESSORS 12
 
-// Number of buffers available for executing contract functions in parallel; having more means reserving a bit more RAM (+1 = +32 MB)
-// and less waiting in request processors if there are more parallel contract function requests. The maximum value that may make sense
-// is MAX_NUMBER_OF_PROCESSORS - 1.
+// Number of shared buffers available for executing contract functions in parallel; having more means reserving a bit more RAM
+// (+1 = +32 MB) and less waiting if there are more parallel contract executions. Request processors additionally get their own smaller
+// stack sized for the registered contract functions and only fall back to the shared buffers if it overflows. The maximum value that
+// may make sense is MAX_NUMBER_OF_PROCESSORS - 1.
 #define NUMBER_OF_CONTRACT_EXECUTION_BUFFERS 10
 
+// Max number of processors running BEGIN_TICK / END_TICK procedures of different contracts in parallel (1 = run them one
+// after the other on the contract processor). Each one needs one of the contract execution buffers and reserves a buffer
+// of CONTRACT_STATE_BACKUP_SIZE (see contract_exec.h) for rolling back states. The result is the same for all values.
+#define NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS 4
+
+// Keep two copies of every contract state as of the end of the last processed tick (the memory of all contract states
+// is needed 3 times instead of once, the amount is shown on startup). With the copies, contract functions called by
+// request processors don't wait for the tick processor while it changes states, and only changed pages of large states
+// are rehashed for the computer digest. Set to 0 to save the memory.
+#define CONTRACT_FUNCTIONS_READ_COMMITTED_STATES 1
+
 #define USE_SCORE_CACHE 1
 #define SCORE_CACHE_SIZE 2000000 // the larger the better
 #define SCORE_CACHE_COLLISION_RETRIES 20 // number of retries to find entry in cache in case of hash collision
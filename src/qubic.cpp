@@ -29,6 +29,7 @@
 #include "platform/time_stamp_counter.h"
 #include "platform/memory_util.h"
 #include "platform/profiling.h"
+#include "platform/parallel_jobs.h"
 
 #include "platform/custom_stack.h"
 
@@ -146,6 +147,8 @@ static volatile char computorPendingTransactionsLock = 0;
 static unsigned char* computorPendingTransactions = NULL;
 static unsigned char* computorPendingTransactionDigests = NULL;
 static unsigned long long spectrumChangeFlags[SPECTRUM_CAPACITY / (sizeof(unsigned long long) * 8)];
+static unsigned long long contractStateSnapshotChangeFlags[MAX_NUMBER_OF_CONTRACTS / (sizeof(unsigned long long) * 8)]; // Contract states changed since last saved in node state snapshot
+static unsigned short nodeStateSnapshotEpoch = 0; // Epoch of the snapshot directory, whose files can be updated by saving deltas
 
 static unsigned long long mainLoopNumerator = 0, mainLoopDenominator = 0;
 static unsigned char contractProcessorState = 0;
@@ -206,6 +209,8 @@ static unsigned long long K12MeasurementsCount = 0;
 static unsigned long long K12MeasurementsSum = 0;
 static volatile char minerScoreArrayLock = 0;
 static SpecialCommandGetMiningScoreRanking<MAX_NUMBER_OF_MINERS> requestMiningScoreRanking;
+static SpecialCommandGetContractExecutionHistogramsResponse<512> contractExecutionHistogramsResponse;
+static SpecialCommandGetProfilingDataResponse<256 * 1024> profilingDataResponse;
 
 // Custom mining related variables and constants
 static unsigned int gCustomMiningSharesCount[NUMBER_OF_COMPUTORS] = { 0 };
@@ -213,6 +218,7 @@ static CustomMiningSharesCounter gCustomMiningSharesCounter;
 
 // variables and declare for persisting state
 static volatile int requestPersistingNodeState = 0;
+static volatile char requestWritingProfilingData = 0;
 static volatile int persistingNodeStateTickProcWaiting = 0;
 static m256i initialRandomSeedFromPersistingState;
 static bool loadMiningSeedFromFile = false;
@@ -238,7 +244,7 @@ struct
     unsigned char customMiningSharesCounterData[CustomMiningSharesCounter::_customMiningSolutionCounterDataSize];
 } nodeStateBuffer;
 #endif
-static bool saveComputer(CHAR16* directory = NULL);
+static bool saveComputer(CHAR16* directory = NULL, const unsigned long long* changedContractFlags = NULL);
 static bool saveSystem(CHAR16* directory = NULL);
 static bool loadComputer(CHAR16* directory = NULL, bool forceLoadFromFile = false);
 static bool saveRevenueComponents(CHAR16* directory = NULL);
@@ -415,11 +421,14 @@ static void getComputerDigest(m256i& digest)
                 contractStateLock[digestIndex].acquireRead();
 
                 const unsigned long long startTick = __rdtsc();
-                KangarooTwelve(contractStates[digestIndex], (unsigned int)size, &contractStateDigests[digestIndex], 32);
+                computeContractStateDigest(digestIndex, contractStateDigests[digestIndex]);
                 const unsigned long long executionTicks = __rdtsc() - startTick;
 
                 contractStateLock[digestIndex].releaseRead();
 
+                contractStateSnapshotChangeFlags[digestIndex >> 6] |= (1ULL << (digestIndex & 63));
+                markContractCommittedStateOutdated(digestIndex);
+
                 // K12 of state is included in contract execution time
                 _interlockedadd64(&contractTotalExecutionTicks[digestIndex], executionTicks);
 
@@ -1393,32 +1402,63 @@ static void processRequestContractIPO(Peer* peer, RequestResponseHeader* header)
     enqueueResponse(peer, sizeof(respondContractIPO), RespondContractIPO::type, header->dejavu(), &respondContractIPO);
 }
 
+// Respond to RequestContractFunction or RequestContractFunctionWithTick with function output
+static void enqueueContractFunctionResponse(Peer* peer, RequestResponseHeader* header, unsigned int stateTick, unsigned short outputSize, const void* output)
+{
+    if (header->type() == RequestContractFunctionWithTick::type)
+    {
+        RespondContractFunctionWithTick response;
+        response.tick = stateTick;
+        enqueueResponse(peer, sizeof(response), &response, outputSize, RespondContractFunctionWithTick::type, header->dejavu(), output);
+    }
+    else
+    {
+        enqueueResponse(peer, outputSize, RespondContractFunction::type, header->dejavu(), output);
+    }
+}
+
+// Handles RequestContractFunction and RequestContractFunctionWithTick, which have the same layout
 static void processRequestContractFunction(Peer* peer, const unsigned long long processorNumber, RequestResponseHeader* header)
 {
     // TODO: Invoked function may enter endless loop, so a timeout (and restart) is required for request processing threads
 
+    const unsigned char responseType = (header->type() == RequestContractFunctionWithTick::type) ? RespondContractFunctionWithTick::type : RespondContractFunction::type;
     RequestContractFunction* request = header->getPayload<RequestContractFunction>();
     if (header->size() != sizeof(RequestResponseHeader) + sizeof(RequestContractFunction) + request->inputSize
         || !request->contractIndex || request->contractIndex >= contractCount
         || system.epoch < contractDescriptions[request->contractIndex].constructionEpoch
         || !contractUserFunctions[request->contractIndex][request->inputType])
     {
-        enqueueResponse(peer, 0, RespondContractFunction::type, header->dejavu(), NULL);
+        enqueueResponse(peer, 0, responseType, header->dejavu(), NULL);
     }
     else
     {
+        // respond with cached output if the same query has been executed since the last state change
+        const unsigned char* input = ((unsigned char*)request) + sizeof(RequestContractFunction);
+        const unsigned int currentStatesTick = getCurrentContractStatesTick();
+        ContractFunctionCacheKey cacheKey;
+        cacheKey.set(request->contractIndex, request->inputType, input, request->inputSize, system.tick);
+        ContractFunctionCacheSlot* cacheSlot = acquireCachedContractFunctionOutput(cacheKey);
+        if (cacheSlot)
+        {
+            enqueueContractFunctionResponse(peer, header, currentStatesTick, cacheSlot->outputSize, cacheSlot->output);
+            releaseContractFunctionCacheSlot(cacheSlot);
+            return;
+        }
+
         QpiContextUserFunctionCall qpiContext(request->contractIndex);
-        auto errorCode = qpiContext.call(request->inputType, (((unsigned char*)request) + sizeof(RequestContractFunction)), request->inputSize);
+        auto errorCode = qpiContext.call(request->inputType, input, request->inputSize);
         if (errorCode == NoContractError)
         {
             // success: respond with function output
-            enqueueResponse(peer, qpiContext.outputSize, RespondContractFunction::type, header->dejavu(), qpiContext.outputBuffer);
+            enqueueContractFunctionResponse(peer, header, qpiContext.stateTick, qpiContext.outputSize, qpiContext.outputBuffer);
+            cacheContractFunctionOutput(cacheKey, qpiContext.outputBuffer, qpiContext.outputSize);
         }
         else
         {
             // error: respond with empty output, send TryAgain if the function was stopped to resolve a potential
             // deadlock
-            unsigned char type = RespondContractFunction::type;
+            unsigned char type = responseType;
             if (errorCode == ContractErrorStoppedToResolveDeadlock)
                 type = TryAgain::type;
             enqueueResponse(peer, 0, type, header->dejavu(), NULL);
@@ -1789,6 +1829,79 @@ static void processSpecialCommand(Peer* peer, RequestResponseHeader* header)
             }
             break;
 
+            case SPECIAL_COMMAND_GET_CONTRACT_EXECUTION_HISTOGRAMS:
+            {
+                const auto* _request = header->getPayload<SpecialCommandGetContractExecutionHistogramsRequest>();
+                auto& response = contractExecutionHistogramsResponse;
+                static_assert(sizeof(response.entryPoints[0].bucketCounts) == sizeof(ExecutionTimeHistogram::bucketCounts), "Unexpected size");
+                response.everIncreasingNonceAndCommandType = _request->everIncreasingNonceAndCommandType;
+                response.tscFrequency = frequency;
+                response.contractIndex = _request->contractIndex;
+                response.numberOfEntryPoints = 0;
+                const unsigned int maxNumberOfEntryPoints = sizeof(response.entryPoints) / sizeof(response.entryPoints[0]);
+                if (header->size() >= sizeof(RequestResponseHeader) + sizeof(SpecialCommandGetContractExecutionHistogramsRequest) + SIGNATURE_SIZE
+                    && _request->contractIndex < contractCount)
+                {
+                    auto addEntryPoint = [&](unsigned short type, unsigned short id, const ExecutionTimeHistogram& histogram)
+                    {
+                        if (response.numberOfEntryPoints < maxNumberOfEntryPoints && histogram.count())
+                        {
+                            auto& entryPoint = response.entryPoints[response.numberOfEntryPoints++];
+                            entryPoint.type = type;
+                            entryPoint.id = id;
+                            entryPoint.padding = 0;
+                            entryPoint.totalTicks = histogram.totalTicks;
+                            copyMem(entryPoint.bucketCounts, (const void*)histogram.bucketCounts, sizeof(entryPoint.bucketCounts));
+                        }
+                    };
+                    for (unsigned int i = 0; i < contractSystemProcedureCount; i++)
+                    {
+                        addEntryPoint(ContractEntryPointSystemProcedure, i, contractSystemProcedureExecutionTimes[_request->contractIndex][i]);
+                    }
+                    for (unsigned int slot = 1; slot < contractUserEntryPointHistogramCount; slot++)
+                    {
+                        const ContractUserEntryPointInfo& info = contractUserEntryPointInfos[slot];
+                        if (info.contractIndex == _request->contractIndex)
+                        {
+                            addEntryPoint(info.type, info.inputType, contractUserEntryPointExecutionTimes[slot]);
+                        }
+                    }
+                }
+                enqueueResponse(peer,
+                    sizeof(response) - sizeof(response.entryPoints) + sizeof(response.entryPoints[0]) * response.numberOfEntryPoints,
+                    SpecialCommand::type,
+                    header->dejavu(),
+                    &response);
+            }
+            break;
+
+            case SPECIAL_COMMAND_GET_PROFILING_DATA:
+            {
+                auto& response = profilingDataResponse;
+                response.everIncreasingNonceAndCommandType = request->everIncreasingNonceAndCommandType;
+                response.csvSize = gProfilingDataCollector.writeCsvToBuffer(response.csv, sizeof(response.csv));
+                response.padding = 0;
+                enqueueResponse(peer, sizeof(response) - sizeof(response.csv) + response.csvSize, SpecialCommand::type, header->dejavu(), &response);
+            }
+            break;
+
+            case SPECIAL_COMMAND_WRITE_PROFILING_DATA_FILE:
+            {
+                requestWritingProfilingData = 1;
+                enqueueResponse(peer, sizeof(SpecialCommand), SpecialCommand::type, header->dejavu(), request); // echo back to indicate success
+            }
+            break;
+
+            case SPECIAL_COMMAND_WRITE_PROFILING_TRACE_FILE:
+            {
+                SpecialCommandWriteProfilingTraceFileResponse response;
+                response.everIncreasingNonceAndCommandType = request->everIncreasingNonceAndCommandType;
+                response.numberOfEvents = gProfilingEventTracer.writeChromeTraceFile();
+                response.padding = 0;
+                enqueueResponse(peer, sizeof(response), SpecialCommand::type, header->dejavu(), &response);
+            }
+            break;
+
             case SPECIAL_COMMAND_SET_CONSOLE_LOGGING_MODE:
             {
                 const auto* _request = header->getPayload<SpecialCommandSetConsoleLoggingModeRequestAndResponse>();
@@ -2039,6 +2152,9 @@ static void requestProcessor(void* ProcedureArgument)
             _InterlockedIncrement(&epochTransitionWaitingRequestProcessors);
             BEGIN_WAIT_WHILE(epochTransitionState)
             {
+                // help with parallel processing of spectrum or universe in epoch transition
+                helpWithParallelJob();
+
                 {
                     // to avoid potential overflow: consume the queue without processing requests
                     ACQUIRE(requestQueueTailLock);
@@ -2076,6 +2192,13 @@ static void requestProcessor(void* ProcedureArgument)
             score->tryProcessSolution(processorNumber);
         }
         
+        // help tick or contract processor with long-running jobs (such as anti-dust spectrum reorganization)
+        helpWithParallelJob();
+
+        // push log events of committed ticks to subscribed clients (not done by tick processor or main loop, because
+        // reading the events may load pages from disk)
+        logger.pushLogEventsToSubscribers();
+
         if (requestQueueElementTail == requestQueueElementHead)
         {
             _mm_pause();
@@ -2219,6 +2342,7 @@ static void requestProcessor(void* ProcedureArgument)
                 break;
 
                 case RequestContractFunction::type:
+                case RequestContractFunctionWithTick::type:
                 {
                     processRequestContractFunction(peer, processorNumber, header);
                 }
@@ -2230,6 +2354,12 @@ static void requestProcessor(void* ProcedureArgument)
                 }
                 break;
 
+                case RequestLogPage::type:
+                {
+                    logger.processRequestLogPage(processorNumber, peer, header);
+                }
+                break;
+
                 case RequestLogIdRangeFromTx::type:
                 {
                     logger.processRequestTxLogInfo(processorNumber, peer, header);
@@ -2254,6 +2384,18 @@ static void requestProcessor(void* ProcedureArgument)
                 }
                 break;
 
+                case RequestLogIdsOfEntity::type:
+                {
+                    logger.processRequestLogIdsOfEntity(processorNumber, peer, header);
+                }
+                break;
+
+                case RequestLogSubscription::type:
+                {
+                    logger.processRequestLogSubscription(peer, header);
+                }
+                break;
+
                 case REQUEST_SYSTEM_INFO:
                 {
                     processRequestSystemInfo(peer, header);
@@ -2345,29 +2487,35 @@ static void contractProcessor(void*)
 
     case BEGIN_TICK:
     {
+        // Procedures of different contracts may run in parallel, but the result is the same as running them in this order
+        unsigned int contractIndices[contractCount];
+        unsigned int numberOfContracts = 0;
         for (executedContractIndex = 1; executedContractIndex < contractCount; executedContractIndex++)
         {
             if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
                 && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
             {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, BEGIN_TICK);
-                qpiContext.call();
+                contractIndices[numberOfContracts++] = executedContractIndex;
             }
         }
+        runContractSystemProcedures(BEGIN_TICK, contractIndices, numberOfContracts);
     }
     break;
 
     case END_TICK:
     {
+        // Procedures of different contracts may run in parallel, but the result is the same as running them in this order
+        unsigned int contractIndices[contractCount];
+        unsigned int numberOfContracts = 0;
         for (executedContractIndex = contractCount; executedContractIndex-- > 1; )
         {
             if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
                 && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
             {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, END_TICK);
-                qpiContext.call();
+                contractIndices[numberOfContracts++] = executedContractIndex;
             }
         }
+        runContractSystemProcedures(END_TICK, contractIndices, numberOfContracts);
     }
     break;
 
@@ -3011,7 +3159,8 @@ static bool makeAndBroadcastCustomMiningTransaction(int i, BroadcastFutureTickDa
 OPTIMIZE_OFF()
 static void processTick(unsigned long long processorNumber)
 {
-    PROFILE_SCOPE();
+    PROFILE_TRACE_TICK(system.tick);
+    PROFILE_NAMED_SCOPE("processTick()");
 
     if (system.tick > system.initialTick)
     {
@@ -3136,7 +3285,10 @@ static void processTick(unsigned long long processorNumber)
         }
         solutionTotalExecutionTicks = __rdtsc() - solutionProcessStartTick; // for tracking the time processing solutions
 
-        // Process all transaction of the tick
+        // Process all transaction of the tick. They are executed one after the other in the order of the tick data.
+        // Speculative parallel execution with read-set validation doesn't pay off here: a QU transfer costs about as
+        // much as validating its reads, the log (event order, log IDs of transactions, digest) and contract callbacks
+        // depend on the serial order, and contract procedures don't declare which states they read or write.
         PROFILE_NAMED_SCOPE_BEGIN("processTick(): process transactions");
         for (unsigned int transactionIndex = 0; transactionIndex < NUMBER_OF_TRANSACTIONS_PER_TICK; transactionIndex++)
         {
@@ -3203,6 +3355,7 @@ static void processTick(unsigned long long processorNumber)
 
     getUniverseDigest(etalonTick.saltedUniverseDigest);
     getComputerDigest(etalonTick.saltedComputerDigest);
+    updateContractCommittedStates(system.tick);
 
     // prepare custom mining shares packet ONCE
     if (isMainMode())
@@ -3510,9 +3663,24 @@ static void processTick(unsigned long long processorNumber)
     {
         addDebugMessage(L"BUG DETECTED: Spectrum info of continuous updating is inconsistent with counting from scratch!");
     }
+
+    // Check that continuous updating of entity category populations is consistent with counting from scratch
+    // (spectrumLock is needed, because the parts of parallel spectrum passes are shared with anti-dust)
+    unsigned int populations[entityCategoryCount];
+    ACQUIRE(spectrumLock);
+    countEntityCategoryPopulations(populations);
+    for (unsigned int categoryIndex = 0; categoryIndex < entityCategoryCount; categoryIndex++)
+    {
+        if (populations[categoryIndex] != entityCategoryPopulations[categoryIndex])
+        {
+            addDebugMessage(L"BUG DETECTED: Entity category populations of continuous updating are inconsistent with counting from scratch!");
+            break;
+        }
+    }
+    RELEASE(spectrumLock);
 #endif
 
-    // Update entity category populations and dust thresholds each 8 ticks
+    // Update dust thresholds based on the entity category populations each 8 ticks
     if ((system.tick & 7) == 0)
         updateAndAnalzeEntityCategoryPopulations();
     logger.updateTick(system.tick);
@@ -3917,6 +4085,15 @@ static bool saveAllNodeStates()
         return false;
     }
 
+    // Only files of the snapshot saved in the same directory before can be updated by saving deltas
+    if (nodeStateSnapshotEpoch != system.epoch)
+    {
+        spectrumSnapshotChanges.invalidateBase();
+        universeSnapshotChanges.invalidateBase();
+        setMem(contractStateSnapshotChangeFlags, sizeof(contractStateSnapshotChangeFlags), 0xFF);
+        nodeStateSnapshotEpoch = system.epoch;
+    }
+
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 4] = L'0';
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 3] = L'0';
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 2] = L'0';
@@ -3924,7 +4101,8 @@ static bool saveAllNodeStates()
     appendText(message, directory); appendText(message, L"/");
     appendText(message, SPECTRUM_FILE_NAME);
     logToConsole(message);
-    if (!saveSpectrum(SPECTRUM_FILE_NAME, directory))
+    CHAR16 SPECTRUM_DELTA_FILE_NAME[] = L"snapshotSpectrumDelta";
+    if (!saveSpectrumSnapshot(SPECTRUM_FILE_NAME, SPECTRUM_DELTA_FILE_NAME, directory))
     {
         logToConsole(L"Failed to save spectrum");
         return false;
@@ -3937,7 +4115,8 @@ static bool saveAllNodeStates()
     appendText(message, directory); appendText(message, L"/");
     appendText(message, UNIVERSE_FILE_NAME);
     logToConsole(message);
-    if (!saveUniverse(UNIVERSE_FILE_NAME, directory))
+    CHAR16 UNIVERSE_DELTA_FILE_NAME[] = L"snapshotUniverseDelta";
+    if (!saveUniverseSnapshot(UNIVERSE_FILE_NAME, UNIVERSE_DELTA_FILE_NAME, directory))
     {
         logToConsole(L"Failed to save universe");
         return false;
@@ -3948,11 +4127,12 @@ static bool saveAllNodeStates()
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 2] = L'0';
     setText(message, L"Saving computer files");
     logToConsole(message);
-    if (!saveComputer(directory))
+    if (!saveComputer(directory, contractStateSnapshotChangeFlags))
     {
         logToConsole(L"Failed to save computer");
         return false;
     }
+    setMem(contractStateSnapshotChangeFlags, sizeof(contractStateSnapshotChangeFlags), 0);
     setText(message, L"Saving system to system.snp");
     logToConsole(message);
 
@@ -4073,7 +4253,9 @@ static bool loadAllNodeStates()
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 4] = L'0';
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 3] = L'0';
     SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 2] = L'0';
-    if (!loadSpectrum(SPECTRUM_FILE_NAME, directory))
+    m256i spectrumFileMerkleRoot;
+    CHAR16 SPECTRUM_DELTA_FILE_NAME[] = L"snapshotSpectrumDelta";
+    if (!loadSpectrum(SPECTRUM_FILE_NAME, directory, &spectrumFileMerkleRoot, SPECTRUM_DELTA_FILE_NAME))
     {
         logToConsole(L"Failed to load spectrum");
         return false;
@@ -4082,7 +4264,9 @@ static bool loadAllNodeStates()
     UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 4] = L'0';
     UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 3] = L'0';
     UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 2] = L'0';
-    if (!loadUniverse(UNIVERSE_FILE_NAME, directory))
+    m256i universeFileMerkleRoot;
+    CHAR16 UNIVERSE_DELTA_FILE_NAME[] = L"snapshotUniverseDelta";
+    if (!loadUniverse(UNIVERSE_FILE_NAME, directory, &universeFileMerkleRoot, UNIVERSE_DELTA_FILE_NAME))
     {
         logToConsole(L"Failed to load universe");
         return false;
@@ -4156,6 +4340,11 @@ static bool loadAllNodeStates()
         logToConsole(L"Failed to load spectrum digest");
         return false;
     }
+    if (!isZero(spectrumFileMerkleRoot) && spectrumFileMerkleRoot != spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1])
+    {
+        logToConsole(L"Spectrum digest does not match spectrum file");
+        return false;
+    }
 
     CHAR16 UNIVERSE_DIGEST_FILE_NAME[] = L"snapshotUniverseDigest";
     loadedSize = load(UNIVERSE_DIGEST_FILE_NAME, assetDigestsSizeInBytes, (unsigned char*)assetDigests, directory);
@@ -4165,6 +4354,11 @@ static bool loadAllNodeStates()
         logToConsole(L"Failed to load universe digest");
         return false;
     }
+    if (!isZero(universeFileMerkleRoot) && universeFileMerkleRoot != assetDigests[(ASSETS_CAPACITY * 2 - 1) - 1])
+    {
+        logToConsole(L"Universe digest does not match universe file");
+        return false;
+    }
 
     CHAR16 COMPUTER_DIGEST_FILE_NAME[] = L"snapshotComputerDigest";
     loadedSize = load(COMPUTER_DIGEST_FILE_NAME, contractStateDigestsSizeInBytes, (unsigned char*)contractStateDigests, directory);
@@ -4196,6 +4390,11 @@ static bool loadAllNodeStates()
     logToConsole(L"Loading old logger...");
     logger.loadLastLoggingStates(directory);
 #endif
+
+    // Continue with saving deltas to the loaded snapshot
+    setMem(contractStateSnapshotChangeFlags, sizeof(contractStateSnapshotChangeFlags), 0);
+    nodeStateSnapshotEpoch = system.epoch;
+
     return true;
 }
 
@@ -4869,7 +5068,9 @@ static void tickProcessor(void*)
                     WAIT_WHILE(requestPersistingNodeState);
                     persistingNodeStateTickProcWaiting = 0;
                 }
+                beginContractStateChanges();
                 processTick(processorNumber);
+                endContractStateChanges();
                 latestProcessedTick = system.tick;
             }
 
@@ -5198,6 +5399,8 @@ static void tickProcessor(void*)
                                     // wait until all request processors are in waiting state
                                     WAIT_WHILE(epochTransitionWaitingRequestProcessors < nRequestProcessorIDs);
 
+                                    beginContractStateChanges();
+
                                     // end current epoch
                                     endEpoch();
 
@@ -5237,6 +5440,9 @@ static void tickProcessor(void*)
                                     etalonTick.saltedSpectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
                                     getUniverseDigest(etalonTick.saltedUniverseDigest);
                                     getComputerDigest(etalonTick.saltedComputerDigest);
+                                    updateContractCommittedStates(system.tick);
+
+                                    endContractStateChanges();
 
                                     epochTransitionState = 0;
                                 }
@@ -5357,7 +5563,8 @@ static bool loadComputer(CHAR16* directory, bool forceLoadFromFile)
     return true;
 }
 
-static bool saveComputer(CHAR16* directory)
+// Save contract states. If changedContractFlags is passed, only the states of contracts with flag set are saved.
+static bool saveComputer(CHAR16* directory, const unsigned long long* changedContractFlags)
 {
     logToConsole(L"Saving contract files...");
 
@@ -5368,6 +5575,10 @@ static bool saveComputer(CHAR16* directory)
 
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
+        if (changedContractFlags && !(changedContractFlags[contractIndex >> 6] & (1ULL << (contractIndex & 63))))
+        {
+            continue;
+        }
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 9] = contractIndex / 1000 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
@@ -5448,6 +5659,11 @@ static bool initialize()
         logToConsole(L"gProfilingDataCollector.init() failed!");
         return false;
     }
+    if (!gProfilingEventTracer.init(2048))
+    {
+        logToConsole(L"gProfilingEventTracer.init() failed!");
+        return false;
+    }
 #endif
 
     setMem(&tickTicks, sizeof(tickTicks), 0);
@@ -5498,7 +5714,8 @@ static bool initialize()
         if (!initAssets())
             return false;
 
-        initContractExec();
+        if (!initContractExec())
+            return false;
         for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
         {
             unsigned long long size = contractDescriptions[contractIndex].stateSize;
@@ -5506,7 +5723,22 @@ static bool initialize()
             {
                 return false;
             }
+#if CONTRACT_FUNCTIONS_READ_COMMITTED_STATES
+            if (!allocContractCommittedStates(contractIndex))
+            {
+                return false;
+            }
+            if (!allocContractStatePageTracking(contractIndex))
+            {
+                return false;
+            }
+#endif
         }
+#if CONTRACT_FUNCTIONS_READ_COMMITTED_STATES
+        setNumber(message, contractCommittedStatesMemorySize, TRUE);
+        appendText(message, L" bytes are used by the committed copies of contract states (CONTRACT_FUNCTIONS_READ_COMMITTED_STATES).");
+        logToConsole(message);
+#endif
 
         if (!allocPoolWithErrorLog(L"score", sizeof(*score), (void**)&score, __LINE__))
         {
@@ -5591,23 +5823,7 @@ static bool initialize()
             {
                 const unsigned long long beginningTick = __rdtsc();
 
-                unsigned int digestIndex;
-                for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
-                {
-                    KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
-                }
-                unsigned int previousLevelBeginning = 0;
-                unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-                while (numberOfLeafs > 1)
-                {
-                    for (unsigned int i = 0; i < numberOfLeafs; i += 2)
-                    {
-                        KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
-                    }
-
-                    previousLevelBeginning += numberOfLeafs;
-                    numberOfLeafs >>= 1;
-                }
+                rebuildSpectrumDigests();
 
                 setNumber(message, SPECTRUM_CAPACITY * sizeof(EntityRecord), TRUE);
                 appendText(message, L" bytes of the spectrum data are hashed (");
@@ -5646,6 +5862,7 @@ static bool initialize()
             {
                 setText(message, L"Computer digest = ");
                 getComputerDigest(computerDigest);
+                updateContractCommittedStates(system.tick);
                 CHAR16 digestChars[60 + 1];
                 getIdentity(computerDigest.m256i_u8, digestChars, true);
                 appendText(message, digestChars);
@@ -5826,6 +6043,8 @@ static void deinitialize()
         {
             freePool(contractStates[contractIndex]);
         }
+        freeContractCommittedStates(contractIndex);
+        freeContractStatePageTracking(contractIndex);
     }
 
     if (computorPendingTransactionDigests)
@@ -6275,6 +6494,75 @@ static void logHealthStatus()
     }
     logToConsole(message);
 
+    // Print contract entry points with highest total execution time (see SPECIAL_COMMAND_GET_CONTRACT_EXECUTION_HISTOGRAMS for details)
+    constexpr unsigned int numberOfTopEntryPoints = 5;
+    const ExecutionTimeHistogram* topHistograms[numberOfTopEntryPoints] = { nullptr };
+    unsigned int topContractIndices[numberOfTopEntryPoints];
+    unsigned short topTypes[numberOfTopEntryPoints], topIds[numberOfTopEntryPoints];
+    auto considerEntryPoint = [&](unsigned int contractIndex, unsigned short type, unsigned short id, const ExecutionTimeHistogram& histogram)
+    {
+        if (!histogram.totalTicks)
+            return;
+        int pos = numberOfTopEntryPoints;
+        while (pos > 0 && (!topHistograms[pos - 1] || topHistograms[pos - 1]->totalTicks < histogram.totalTicks))
+            --pos;
+        if (pos == numberOfTopEntryPoints)
+            return;
+        for (int i = numberOfTopEntryPoints - 1; i > pos; --i)
+        {
+            topHistograms[i] = topHistograms[i - 1];
+            topContractIndices[i] = topContractIndices[i - 1];
+            topTypes[i] = topTypes[i - 1];
+            topIds[i] = topIds[i - 1];
+        }
+        topHistograms[pos] = &histogram;
+        topContractIndices[pos] = contractIndex;
+        topTypes[pos] = type;
+        topIds[pos] = id;
+    };
+    for (unsigned int i = 0; i < contractCount; i++)
+    {
+        for (unsigned int j = 0; j < contractSystemProcedureCount; j++)
+        {
+            considerEntryPoint(i, ContractEntryPointSystemProcedure, j, contractSystemProcedureExecutionTimes[i][j]);
+        }
+    }
+    for (unsigned int slot = 0; slot < contractUserEntryPointHistogramCount; slot++)
+    {
+        const ContractUserEntryPointInfo& info = contractUserEntryPointInfos[slot];
+        considerEntryPoint(info.contractIndex, info.type, info.inputType, contractUserEntryPointExecutionTimes[slot]);
+    }
+    setText(message, L"Contract execution time: ");
+    for (unsigned int i = 0; i < numberOfTopEntryPoints && topHistograms[i] && frequency; i++)
+    {
+        if (i)
+            appendText(message, L" | ");
+        if (topHistograms[i] == &contractUserEntryPointExecutionTimes[0])
+        {
+            // entry points without own histogram
+            appendText(message, L"others");
+        }
+        else
+        {
+            appendText(message, L"#");
+            appendNumber(message, topContractIndices[i], FALSE);
+            appendText(message, (topTypes[i] == ContractEntryPointSystemProcedure) ? L" sys " : (topTypes[i] == ContractEntryPointUserProcedure) ? L" proc " : L" func ");
+            appendNumber(message, topIds[i], FALSE);
+        }
+        appendText(message, L": ");
+        appendNumber(message, topHistograms[i]->count(), TRUE);
+        appendText(message, L" calls, total ");
+        appendNumber(message, ProfilingDataCollector::ticksToMicroseconds(topHistograms[i]->totalTicks) / 1000, TRUE);
+        appendText(message, L" ms, p99 < ");
+        appendNumber(message, ProfilingDataCollector::ticksToMicroseconds(topHistograms[i]->percentileUpperBound(99)), TRUE);
+        appendText(message, L" us");
+    }
+    if (!topHistograms[0])
+    {
+        appendText(message, L"n/a");
+    }
+    logToConsole(message);
+
     // Print info about stack buffers used to run contracts
     setText(message, L"Contract stack buffer usage: ");
     for (int i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
@@ -6297,6 +6585,48 @@ static void logHealthStatus()
     appendNumber(message, contractLocalsStack[0].capacity(), TRUE);
     appendText(message, L" | max processors waiting ");
     appendNumber(message, contractLocalsStackLockWaitingCountMax, TRUE);
+    appendText(message, L" | waited ");
+    appendNumber(message, contractLocalsStackWaits, TRUE);
+    appendText(message, L" times, total ");
+    appendNumber(message, contractLocalsStackWaitTicks * 1000 / frequency, TRUE);
+    appendText(message, L" ms, max ");
+    appendNumber(message, contractLocalsStackWaitTicksMax * 1000000 / frequency, TRUE);
+    appendText(message, L" mcs");
+    logToConsole(message);
+
+    setText(message, L"Processor contract stacks: ");
+    unsigned int processorStacks = 0;
+    for (int i = NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; i < NUMBER_OF_CONTRACT_LOCALS_STACKS; ++i)
+    {
+        if (contractLocalsStack[i].capacity())
+        {
+            if (!processorStacks)
+            {
+                appendText(message, L"capacity ");
+                appendNumber(message, contractLocalsStack[i].capacity(), TRUE);
+                appendText(message, L" | ");
+            }
+            ++processorStacks;
+#ifdef TRACK_MAX_STACK_BUFFER_SIZE
+            appendText(message, L"proc ");
+            appendNumber(message, i - NUMBER_OF_CONTRACT_EXECUTION_BUFFERS, FALSE);
+            appendText(message, L" max ");
+            appendNumber(message, contractLocalsStack[i].maxSizeObserved(), TRUE);
+            appendText(message, L" | ");
+#endif
+        }
+    }
+    appendNumber(message, processorStacks, TRUE);
+    appendText(message, L" stacks, ");
+    appendNumber(message, contractProcessorLocalsStackOverflows, TRUE);
+    appendText(message, L" calls repeated on shared stack");
+    logToConsole(message);
+
+    setText(message, L"Contract function cache: ");
+    appendNumber(message, contractFunctionCacheHits, TRUE);
+    appendText(message, L" hits, ");
+    appendNumber(message, contractFunctionCacheMisses, TRUE);
+    appendText(message, L" misses");
     logToConsole(message);
 
     setText(message, L"Connections:");
@@ -6516,6 +6846,15 @@ static void processKeyPresses()
             appendText(message, L" ticks.");
             logToConsole(message);
 
+            setText(message, L"Contract state pages rehashed: ");
+            appendNumber(message, contractStatePagesHashed, TRUE);
+            appendText(message, L", copied to committed states: ");
+            appendNumber(message, contractStatePagesCopied, TRUE);
+            appendText(message, L", committed state updates skipped: ");
+            appendNumber(message, contractCommittedStatesUpdatesSkipped, TRUE);
+            appendText(message, L".");
+            logToConsole(message);
+
 #ifndef NDEBUG
             forceLogToConsoleAsAddDebugMessage = false;
 #endif
@@ -6754,6 +7093,7 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
         nRequestProcessorIDs = 0;
         nContractProcessorIDs = 0;
         nSolutionProcessorIDs = 0;
+        const unsigned int processorContractLocalsStackSize = getProcessorContractLocalsStackSize();
         
         for (int i = 0; i < MAX_NUMBER_OF_PROCESSORS; i++)
         {
@@ -6799,6 +7139,14 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                         processors[numberOfProcessors].type = Processor::RequestProcessor;
                         processors[numberOfProcessors].setupFunction(requestProcessor, &processors[numberOfProcessors]);
                         requestProcessorIDs[nRequestProcessorIDs++] = i;
+                        if (!initProcessorContractLocalsStack(i, processorContractLocalsStackSize))
+                        {
+                            // contract functions called by this processor wait for one of the shared stacks instead
+                            setText(message, L"Failed to allocate contract locals stack of processor ");
+                            appendNumber(message, i, FALSE);
+                            appendText(message, L", falling back to shared stacks.");
+                            logToConsole(message);
+                        }
                     }
 
                     createEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, shutdownCallback, NULL, &processors[numberOfProcessors].event);
@@ -7168,6 +7516,13 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
 
                 processKeyPresses();
 
+                if (requestWritingProfilingData)
+                {
+                    // file can only be written by main processor
+                    gProfilingDataCollector.writeToFile();
+                    requestWritingProfilingData = 0;
+                }
+
 #if TICK_STORAGE_AUTOSAVE_MODE
 #if TICK_STORAGE_AUTOSAVE_MODE == 1
                 bool nextAutoSaveTickUpdated = false;
@@ -7,6 +7,9 @@
 #include "platform/time_stamp_counter.h"
 #include "platform/memory.h"
 #include "platform/profiling.h"
+#include "platform/parallel_jobs.h"
+#include "platform/fingerprint_tags.h"
+#include "platform/sparse_snapshot.h"
 
 #include "network_messages/entity.h"
 
@@ -24,15 +27,39 @@ GLOBAL_VAR_DECL struct SpectrumInfo {
     unsigned long long totalAmount = 0; // Total amount of qubics in the spectrum
 } spectrumInfo;
 
+// Number of entities per balance category (category i contains balances in [2^i, 2^(i+1)-1], balance 0 is not counted).
+// Continuously updated on every balance change, so it is always consistent with the spectrum.
 GLOBAL_VAR_DECL unsigned int entityCategoryPopulations[48]; // Array size depends on max possible balance
 static constexpr unsigned char entityCategoryCount = sizeof(entityCategoryPopulations) / sizeof(entityCategoryPopulations[0]);
 GLOBAL_VAR_DECL unsigned long long dustThresholdBurnAll GLOBAL_VAR_INIT(0), dustThresholdBurnHalf GLOBAL_VAR_INIT(0);
 
+// Fingerprint tags of spectrum hash map slots for fast lookup (not part of the consensus state)
+GLOBAL_VAR_DECL unsigned char* spectrumTags GLOBAL_VAR_INIT(nullptr);
+static constexpr unsigned long long spectrumTagsSizeInBytes = SPECTRUM_CAPACITY + fingerprintTagsPadding;
+
 GLOBAL_VAR_DECL m256i* spectrumDigests GLOBAL_VAR_INIT(nullptr);
 static constexpr unsigned long long spectrumDigestsSizeInByte = (SPECTRUM_CAPACITY * 2 - 1) * 32ULL;
 
 GLOBAL_VAR_DECL unsigned long long spectrumReorgTotalExecutionTicks GLOBAL_VAR_INIT(0);
 
+// Pages of spectrum (64 entities = 4 KB each) changed since the last base file of the node state snapshot
+GLOBAL_VAR_DECL SnapshotChangeTracker<SPECTRUM_CAPACITY, 64> spectrumSnapshotChanges;
+
+// Full-spectrum passes of anti-dust and reorganization are split into this number of parts, which are processed
+// in parallel by runParallelJob(). The number of parts is fixed, so results do not depend on the number of helpers.
+static constexpr unsigned int spectrumParallelPartCount = 256; // Must be 2^N
+static constexpr unsigned int spectrumParallelPartSize = SPECTRUM_CAPACITY / spectrumParallelPartCount;
+
+// Intermediate results of the parts of parallel spectrum processing. They are shared by all parallel spectrum passes,
+// so these passes must not run concurrently (acquire spectrumLock while the node is running).
+GLOBAL_VAR_DECL struct SpectrumParallelPartData
+{
+    unsigned int entityCategoryPopulations[48];
+    unsigned int burnHalfCandidatesBefore;  // Number of burn-half candidates in previous parts
+    unsigned int reorgBeginIndex;           // First index of reorganization range, which starts with an empty slot
+    SpectrumInfo info;
+} spectrumParallelPartData[spectrumParallelPartCount];
+
 
 // Update SpectrumInfo data (exensive, because it iterates the whole spectrum), acquire no lock
 static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
@@ -51,23 +78,81 @@ static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
     }
 }
 
-// Compute balances that count as dust and are burned if 75% of spectrum hash map is filled.
-// All balances <= dustThresholdBurnAll are burned in this case.
-// Every 2nd balance <= dustThresholdBurnHalf is burned in this case.
-static void updateAndAnalzeEntityCategoryPopulations()
+// Get fingerprint tag of entity public key (bits not used for hash map index)
+static inline unsigned char spectrumTag(const m256i& publicKey)
 {
-    PROFILE_SCOPE();
-    static_assert(MAX_SUPPLY < (1llu << entityCategoryCount));
-    setMem(entityCategoryPopulations, sizeof(entityCategoryPopulations), 0);
+    return fingerprintTag(publicKey.m256i_u8[8]);
+}
 
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+// Set fingerprint tags of spectrum[beginIndex, endIndex) from scratch, acquire no lock
+static void rebuildSpectrumTags(unsigned int beginIndex = 0, unsigned int endIndex = SPECTRUM_CAPACITY)
+{
+    for (unsigned int i = beginIndex; i < endIndex; i++)
+    {
+        setFingerprintTag<SPECTRUM_CAPACITY>(spectrumTags, i, isZero(spectrum[i].publicKey) ? 0 : spectrumTag(spectrum[i].publicKey));
+    }
+}
+
+// Get index of category in entityCategoryPopulations for balance > 0
+static inline unsigned int entityCategoryIndex(unsigned long long balance)
+{
+    return 63 - (unsigned int)__lzcnt64(balance);
+}
+
+// Update entityCategoryPopulations after the balance of an entity changed from oldBalance to newBalance.
+// Needs to be called with spectrumLock acquired.
+static inline void updateEntityCategoryPopulations(unsigned long long oldBalance, unsigned long long newBalance)
+{
+    if (oldBalance)
+        entityCategoryPopulations[entityCategoryIndex(oldBalance)]--;
+    if (newBalance)
+        entityCategoryPopulations[entityCategoryIndex(newBalance)]++;
+}
+
+// Count entity balances per category in one part of the spectrum (parallel job of countEntityCategoryPopulations())
+static void countEntityCategoryPopulationsPart(void*, unsigned int partIndex)
+{
+    unsigned int* populations = spectrumParallelPartData[partIndex].entityCategoryPopulations;
+    setMem(populations, sizeof(entityCategoryPopulations), 0);
+
+    const unsigned int endIndex = (partIndex + 1) * spectrumParallelPartSize;
+    for (unsigned int i = partIndex * spectrumParallelPartSize; i < endIndex; i++)
     {
         const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
         if (balance)
         {
-            entityCategoryPopulations[63 - __lzcnt64(balance)]++;
+            populations[entityCategoryIndex(balance)]++;
+        }
+    }
+}
+
+// Count entity balances per category from scratch (expensive, because it iterates the whole spectrum), acquire no lock.
+// Needed after loading the spectrum and for checking the continuously updated entityCategoryPopulations.
+static void countEntityCategoryPopulations(unsigned int* populations = entityCategoryPopulations)
+{
+    PROFILE_SCOPE();
+    static_assert(sizeof(SpectrumParallelPartData::entityCategoryPopulations) == sizeof(entityCategoryPopulations));
+
+    runParallelJob(countEntityCategoryPopulationsPart, nullptr, spectrumParallelPartCount);
+
+    setMem(populations, sizeof(entityCategoryPopulations), 0);
+    for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+    {
+        for (unsigned int categoryIndex = 0; categoryIndex < entityCategoryCount; categoryIndex++)
+        {
+            populations[categoryIndex] += spectrumParallelPartData[partIndex].entityCategoryPopulations[categoryIndex];
         }
     }
+}
+
+// Compute balances that count as dust and are burned if 75% of spectrum hash map is filled, based on the
+// continuously updated entityCategoryPopulations.
+// All balances <= dustThresholdBurnAll are burned in this case.
+// Every 2nd balance <= dustThresholdBurnHalf is burned in this case.
+static void updateAndAnalzeEntityCategoryPopulations()
+{
+    PROFILE_SCOPE();
+    static_assert(MAX_SUPPLY < (1llu << entityCategoryCount));
 
     dustThresholdBurnAll = 0;
     dustThresholdBurnHalf = 0;
@@ -100,6 +185,7 @@ static void updateAndAnalzeEntityCategoryPopulations()
 static void logSpectrumStats()
 {
     SpectrumStats spectrumStats;
+    setMem(&spectrumStats, sizeof(spectrumStats), 0); // padding at the end is logged too
     spectrumStats.totalAmount = spectrumInfo.totalAmount;
     spectrumStats.dustThresholdBurnAll = dustThresholdBurnAll;
     spectrumStats.dustThresholdBurnHalf = dustThresholdBurnHalf;
@@ -142,43 +228,176 @@ private:
     DustBurning* buf;
 };
 
-// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
-static void reorganizeSpectrum()
+// Count balances in one part of the spectrum that are candidates for burning every second balance
+// (parallel job of burnDust())
+static void countBurnHalfCandidatesPart(void*, unsigned int partIndex)
 {
-    PROFILE_SCOPE();
+    unsigned int count = 0;
+    const unsigned int endIndex = (partIndex + 1) * spectrumParallelPartSize;
+    for (unsigned int i = partIndex * spectrumParallelPartSize; i < endIndex; i++)
+    {
+        const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+        if (balance > dustThresholdBurnAll && balance <= dustThresholdBurnHalf)
+        {
+            count++;
+        }
+    }
+    spectrumParallelPartData[partIndex].burnHalfCandidatesBefore = count;
+}
 
-    unsigned long long spectrumReorgStartTick = __rdtsc();
+// Burn dust in one part of the spectrum (parallel job of burnDust()). Counts the burned entities per category.
+static void burnDustPart(void*, unsigned int partIndex)
+{
+    unsigned int* burnedPopulations = spectrumParallelPartData[partIndex].entityCategoryPopulations;
+    setMem(burnedPopulations, sizeof(entityCategoryPopulations), 0);
 
-    EntityRecord* reorgSpectrum = (EntityRecord*)reorgBuffer;
-    setMem(reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord), 0);
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    unsigned int countBurnCanadiates = spectrumParallelPartData[partIndex].burnHalfCandidatesBefore;
+    const unsigned int endIndex = (partIndex + 1) * spectrumParallelPartSize;
+    for (unsigned int i = partIndex * spectrumParallelPartSize; i < endIndex; i++)
     {
-        if (spectrum[i].incomingAmount - spectrum[i].outgoingAmount)
+        const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+        if (!balance)
+            continue;
+
+        if (balance <= dustThresholdBurnAll)
         {
-            unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+            burnedPopulations[entityCategoryIndex(balance)]++;
+        }
+        else if (balance <= dustThresholdBurnHalf)
+        {
+            if (++countBurnCanadiates & 1)
+            {
+                spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                burnedPopulations[entityCategoryIndex(balance)]++;
+            }
+        }
+    }
+}
 
-        iteration:
-            if (isZero(reorgSpectrum[index].publicKey))
+#if LOG_SPECTRUM
+// Log the burns that burnDust() is going to do (in the order of spectrum indices, first burn-all, then burn-half).
+// Needs to be called before burnDust(), because the burned amounts are not available afterwards.
+static void logDustBurns()
+{
+    DustBurnLogger dbl;
+
+    if (dustThresholdBurnAll > 0)
+    {
+        for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+        {
+            const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+            if (balance <= dustThresholdBurnAll && balance)
             {
-                copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(EntityRecord));
+                dbl.addDustBurn(spectrum[i].publicKey, balance);
             }
-            else
+        }
+    }
+
+    if (dustThresholdBurnHalf > 0)
+    {
+        unsigned int countBurnCanadiates = 0;
+        for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+        {
+            const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+            if (balance > dustThresholdBurnAll && balance <= dustThresholdBurnHalf)
             {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+                if (++countBurnCanadiates & 1)
+                {
+                    dbl.addDustBurn(spectrum[i].publicKey, balance);
+                }
+            }
+        }
+    }
 
-                goto iteration;
+    // Finished dust burning (pass message to log)
+    dbl.finished();
+}
+#endif
+
+// Burn every balance <= dustThresholdBurnAll and every second balance <= dustThresholdBurnHalf (counted in the order of
+// spectrum indices). Updates entityCategoryPopulations but not spectrumInfo. The result is the same as burning in one
+// serial pass.
+static void burnDust()
+{
+    PROFILE_SCOPE();
+
+    if (dustThresholdBurnHalf > 0)
+    {
+        // Count burn-half candidates per part and compute number of candidates before each part (exclusive prefix sum)
+        runParallelJob(countBurnHalfCandidatesPart, nullptr, spectrumParallelPartCount);
+        unsigned int candidatesBefore = 0;
+        for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+        {
+            const unsigned int partCandidates = spectrumParallelPartData[partIndex].burnHalfCandidatesBefore;
+            spectrumParallelPartData[partIndex].burnHalfCandidatesBefore = candidatesBefore;
+            candidatesBefore += partCandidates;
+        }
+    }
+    else
+    {
+        for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+        {
+            spectrumParallelPartData[partIndex].burnHalfCandidatesBefore = 0;
+        }
+    }
+
+    if (dustThresholdBurnAll > 0 || dustThresholdBurnHalf > 0)
+    {
+        runParallelJob(burnDustPart, nullptr, spectrumParallelPartCount);
+
+        for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+        {
+            for (unsigned int categoryIndex = 0; categoryIndex < entityCategoryCount; categoryIndex++)
+            {
+                entityCategoryPopulations[categoryIndex] -= spectrumParallelPartData[partIndex].entityCategoryPopulations[categoryIndex];
             }
         }
     }
-    copyMem(spectrum, reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord));
+}
 
-    unsigned int digestIndex;
-    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+// Compute leaf digests and the digest subtree of one part of the spectrum (parallel job of rebuildSpectrumDigests())
+static void computeSpectrumDigestsPart(void*, unsigned int partIndex)
+{
+    unsigned int partBeginning = partIndex * spectrumParallelPartSize;
+    for (unsigned int i = 0; i < spectrumParallelPartSize; i++)
     {
-        KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
+        KangarooTwelve64To32(&spectrum[partBeginning + i], &spectrumDigests[partBeginning + i]);
+    }
+
+    unsigned int levelBeginning = 0;
+    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
+    unsigned int numberOfPartLeafs = spectrumParallelPartSize;
+    while (numberOfPartLeafs > 1)
+    {
+        for (unsigned int i = 0; i < numberOfPartLeafs; i += 2)
+        {
+            KangarooTwelve64To32(&spectrumDigests[levelBeginning + partBeginning + i], &spectrumDigests[levelBeginning + numberOfLeafs + ((partBeginning + i) >> 1)]);
+        }
+
+        levelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+        partBeginning >>= 1;
+        numberOfPartLeafs >>= 1;
     }
+}
+
+// Compute all digests of the spectrum Merkle tree from scratch. Subtrees are computed in parallel, the top levels
+// serially. Acquire no lock.
+static void rebuildSpectrumDigests()
+{
+    PROFILE_SCOPE();
+
+    runParallelJob(computeSpectrumDigestsPart, nullptr, spectrumParallelPartCount);
+
     unsigned int previousLevelBeginning = 0;
     unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
+    while (numberOfLeafs > spectrumParallelPartCount)
+    {
+        previousLevelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+    }
+    unsigned int digestIndex = previousLevelBeginning + numberOfLeafs;
     while (numberOfLeafs > 1)
     {
         for (unsigned int i = 0; i < numberOfLeafs; i += 2)
@@ -189,45 +408,129 @@ static void reorganizeSpectrum()
         previousLevelBeginning += numberOfLeafs;
         numberOfLeafs >>= 1;
     }
+}
 
-    updateSpectrumInfo();
+// Insert entities with non-zero balance of spectrum[beginIndex, endIndex) into reorgSpectrum in index order
+static void reinsertSpectrumRange(EntityRecord* reorgSpectrum, unsigned int beginIndex, unsigned int endIndex, SpectrumInfo& si)
+{
+    for (unsigned int i = beginIndex; i < endIndex; i++)
+    {
+        const long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+        if (balance)
+        {
+            unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            while (!isZero(reorgSpectrum[index].publicKey))
+            {
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            }
+            copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(EntityRecord));
+
+            si.numberOfEntities++;
+            si.totalAmount += balance;
+        }
+    }
+}
+
+// Reorganize one range of the spectrum (parallel job of reorganizeSpectrum()).
+// Each range starts with an empty slot and ends before an empty slot, so it consists of complete clusters of the
+// linear probing hash map. Re-inserting a subset of the entities of a cluster only fills slots of the same cluster.
+// Thus, ranges can be processed independently, giving the same result as re-inserting all entities serially in
+// index order. The only exception is the cluster wrapping around the end of the hash map, whose entities at the
+// beginning are inserted first in serial order. It is handled by the part whose range ends at the end of the hash map,
+// which isn't the last part if the last parts have no empty slot (their ranges are empty in this case).
+static void reorganizeSpectrumPart(void*, unsigned int partIndex)
+{
+    EntityRecord* reorgSpectrum = (EntityRecord*)reorgBuffer;
+    SpectrumParallelPartData& part = spectrumParallelPartData[partIndex];
+
+    const unsigned int beginIndex = part.reorgBeginIndex;
+    const unsigned int endIndex = (partIndex + 1 < spectrumParallelPartCount) ? spectrumParallelPartData[partIndex + 1].reorgBeginIndex : SPECTRUM_CAPACITY;
+    const unsigned int wrappedEndIndex = (beginIndex < SPECTRUM_CAPACITY && endIndex == SPECTRUM_CAPACITY) ? spectrumParallelPartData[0].reorgBeginIndex : 0;
+
+    part.info.numberOfEntities = 0;
+    part.info.totalAmount = 0;
+
+    setMem(&reorgSpectrum[beginIndex], (endIndex - beginIndex) * sizeof(EntityRecord), 0);
+    setMem(&reorgSpectrum[0], wrappedEndIndex * sizeof(EntityRecord), 0);
+
+    reinsertSpectrumRange(reorgSpectrum, 0, wrappedEndIndex, part.info);
+    reinsertSpectrumRange(reorgSpectrum, beginIndex, endIndex, part.info);
+
+    copyMem(&spectrum[beginIndex], &reorgSpectrum[beginIndex], (endIndex - beginIndex) * sizeof(EntityRecord));
+    copyMem(&spectrum[0], &reorgSpectrum[0], wrappedEndIndex * sizeof(EntityRecord));
+
+    rebuildSpectrumTags(beginIndex, endIndex);
+    rebuildSpectrumTags(0, wrappedEndIndex);
+}
+
+// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
+static void reorganizeSpectrum()
+{
+    PROFILE_SCOPE();
+
+    unsigned long long spectrumReorgStartTick = __rdtsc();
+
+    // Split hash map into ranges of complete clusters, each starting with the first empty slot of a part
+    for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+    {
+        unsigned int index = partIndex * spectrumParallelPartSize;
+        if (partIndex > 0 && index < spectrumParallelPartData[partIndex - 1].reorgBeginIndex)
+        {
+            index = spectrumParallelPartData[partIndex - 1].reorgBeginIndex;
+        }
+        while (index < SPECTRUM_CAPACITY && !isZero(spectrum[index].publicKey))
+        {
+            index++;
+        }
+        spectrumParallelPartData[partIndex].reorgBeginIndex = index;
+    }
+    ASSERT(spectrumParallelPartData[0].reorgBeginIndex < SPECTRUM_CAPACITY); // at most 75% of the slots are used
+
+    runParallelJob(reorganizeSpectrumPart, nullptr, spectrumParallelPartCount);
+
+    rebuildSpectrumDigests();
+
+    // Entities have been moved, so a delta snapshot would be as large as a full one
+    spectrumSnapshotChanges.invalidateBase();
+
+    spectrumInfo.numberOfEntities = 0;
+    spectrumInfo.totalAmount = 0;
+    for (unsigned int partIndex = 0; partIndex < spectrumParallelPartCount; partIndex++)
+    {
+        spectrumInfo.numberOfEntities += spectrumParallelPartData[partIndex].info.numberOfEntities;
+        spectrumInfo.totalAmount += spectrumParallelPartData[partIndex].info.totalAmount;
+    }
 
     spectrumReorgTotalExecutionTicks += __rdtsc() - spectrumReorgStartTick;
 }
 
-static int spectrumIndex(const m256i& publicKey)
+// Return index of entity or -1 if not found. Caller must hold spectrumLock.
+static int spectrumIndexWithoutLock(const m256i& publicKey)
 {
     if (isZero(publicKey))
     {
         return -1;
     }
 
-    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    bool found;
+    const unsigned int index = probeFingerprintTags<SPECTRUM_CAPACITY>(spectrumTags, publicKey.m256i_u32[0], spectrumTag(publicKey),
+        [&publicKey](unsigned int i) { return spectrum[i].publicKey == publicKey; }, found);
 
-    ACQUIRE(spectrumLock);
+    return found ? index : -1;
+}
 
-iteration:
-    if (spectrum[index].publicKey == publicKey)
+static int spectrumIndex(const m256i& publicKey)
+{
+    if (isZero(publicKey))
     {
-        RELEASE(spectrumLock);
-
-        return index;
+        return -1;
     }
-    else
-    {
-        if (isZero(spectrum[index].publicKey))
-        {
-            RELEASE(spectrumLock);
 
-            return -1;
-        }
-        else
-        {
-            index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    ACQUIRE(spectrumLock);
+    const int index = spectrumIndexWithoutLock(publicKey);
+    RELEASE(spectrumLock);
 
-            goto iteration;
-        }
-    }
+    return index;
 }
 
 static long long energy(const int index)
@@ -235,119 +538,142 @@ static long long energy(const int index)
     return spectrum[index].incomingAmount - spectrum[index].outgoingAmount;
 }
 
-// Increase balance of entity.
-static void increaseEnergy(const m256i& publicKey, long long amount)
+// Return if the next call of increaseEnergyWithLock() may log events (spectrum stats and dust burning if anti-dust is
+// triggered, spectrum stats if a new entity hits the next half million). Caller must hold spectrumLock.
+static inline bool mayLogWhenIncreasingEnergy()
 {
-    if (!isZero(publicKey) && amount >= 0)
-    {
-        unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
-        ACQUIRE(spectrumLock);
-
-        // Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast
-        if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
-        {
-            // Update anti-dust burn thresholds (and log spectrum stats before burning)
-            updateAndAnalzeEntityCategoryPopulations();
-#if LOG_SPECTRUM
-            logSpectrumStats();
-#endif
 #if LOG_SPECTRUM
-            DustBurnLogger dbl;
+    return spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4)
+        || ((spectrumInfo.numberOfEntities + 1) & 0x7ffff) == 1;
+#else
+    return false;
 #endif
+}
 
-            if (dustThresholdBurnAll > 0)
-            {
-                // Burn every balance with balance < dustThresholdBurnAll
-                for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
-                {
-                    const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
-                    if (balance <= dustThresholdBurnAll && balance)
-                    {
-                        spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+// Increase balance of entity. Caller must hold spectrumLock and check that publicKey is not zero and amount >= 0.
+static void increaseEnergyWithLock(const m256i& publicKey, long long amount)
+{
+    // Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast
+    if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
+    {
+        // Update anti-dust burn thresholds (and log spectrum stats before burning)
+        updateAndAnalzeEntityCategoryPopulations();
 #if LOG_SPECTRUM
-                        dbl.addDustBurn(spectrum[i].publicKey, balance);
+        logSpectrumStats();
 #endif
-                    }
-                }
-            }
-
-            if (dustThresholdBurnHalf > 0)
-            {
-                // Burn every second balance with balance < dustThresholdBurnHalf
-                unsigned int countBurnCanadiates = 0;
-                for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
-                {
-                    const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
-                    if (balance <= dustThresholdBurnHalf && balance)
-                    {
-                        if (++countBurnCanadiates & 1)
-                        {
-                            spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
 #if LOG_SPECTRUM
-                            dbl.addDustBurn(spectrum[i].publicKey, balance);
+        logDustBurns();
 #endif
-                        }
-                    }
-                }
-            }
+
+        // Burn balances below thresholds
+        burnDust();
+
+        // Remove entries with balance zero from hash map
+        reorganizeSpectrum();
 
 #if LOG_SPECTRUM
-            // Finished dust burning (pass message to log)
-            dbl.finished();
+        // Log spectrum stats after burning (before increasing energy / potenitally creating entity)
+        updateAndAnalzeEntityCategoryPopulations();
+        logSpectrumStats();
 #endif
+    }
 
-            // Remove entries with balance zero from hash map
-            reorganizeSpectrum();
+    const unsigned char tag = spectrumTag(publicKey);
+    bool found;
+    const unsigned int index = probeFingerprintTags<SPECTRUM_CAPACITY>(spectrumTags, publicKey.m256i_u32[0], tag,
+        [&publicKey](unsigned int i) { return spectrum[i].publicKey == publicKey; }, found);
+    if (found)
+    {
+        const unsigned long long oldBalance = spectrum[index].incomingAmount - spectrum[index].outgoingAmount;
+        spectrum[index].incomingAmount += amount;
+        spectrum[index].numberOfIncomingTransfers++;
+        spectrum[index].latestIncomingTransferTick = system.tick;
+        spectrumSnapshotChanges.markChanged(index);
+
+        spectrumInfo.totalAmount += amount;
+        updateEntityCategoryPopulations(oldBalance, oldBalance + amount);
+    }
+    else
+    {
+        // Insert entity into first empty slot
+        spectrum[index].publicKey = publicKey;
+        spectrum[index].incomingAmount = amount;
+        spectrum[index].numberOfIncomingTransfers = 1;
+        spectrum[index].latestIncomingTransferTick = system.tick;
+        setFingerprintTag<SPECTRUM_CAPACITY>(spectrumTags, index, tag);
+        spectrumSnapshotChanges.markChanged(index);
+
+        spectrumInfo.numberOfEntities++;
+        spectrumInfo.totalAmount += amount;
+        updateEntityCategoryPopulations(0, amount);
 
 #if LOG_SPECTRUM
-            // Log spectrum stats after burning (before increasing energy / potenitally creating entity)
+        if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
+        {
+            // Log spectrum stats when the number of entities hits the next half million
+            // (== 1 is to avoid duplicate when anti-dust is triggered)
             updateAndAnalzeEntityCategoryPopulations();
             logSpectrumStats();
-#endif
         }
+#endif
+    }
+}
 
-    iteration:
-        if (spectrum[index].publicKey == publicKey)
-        {
-            spectrum[index].incomingAmount += amount;
-            spectrum[index].numberOfIncomingTransfers++;
-            spectrum[index].latestIncomingTransferTick = system.tick;
+// Increase balance of entity.
+static void increaseEnergy(const m256i& publicKey, long long amount)
+{
+    if (!isZero(publicKey) && amount >= 0)
+    {
+        ACQUIRE(spectrumLock);
+        increaseEnergyWithLock(publicKey, amount);
+        RELEASE(spectrumLock);
+    }
+}
 
-            spectrumInfo.totalAmount += amount;
-        }
-        else
-        {
-            if (isZero(spectrum[index].publicKey))
-            {
-                spectrum[index].publicKey = publicKey;
-                spectrum[index].incomingAmount = amount;
-                spectrum[index].numberOfIncomingTransfers = 1;
-                spectrum[index].latestIncomingTransferTick = system.tick;
+// Prefetch the hash map slot where the lookup of publicKey starts.
+static inline void prefetchSpectrumSlot(const m256i& publicKey)
+{
+    const unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    _mm_prefetch((const char*)(spectrumTags + index), _MM_HINT_T0);
+    _mm_prefetch((const char*)(spectrum + index), _MM_HINT_T0);
+}
 
-                spectrumInfo.numberOfEntities++;
-                spectrumInfo.totalAmount += amount;
+// Increase balances of up to count entities with one acquisition of spectrumLock, for example for paying dividends.
+// The entities are credited in the order given, which yields the same spectrum as calling increaseEnergy() for each
+// (the order matters for the slots of new entities). Entries with zero publicKey or negative amount are skipped.
+// Crediting stops before an entity (except the first) that may cause spectrum stats or dust burning to be logged,
+// so the caller can log the transfers credited so far first and keep the order of the log. Returns the number of
+// entries processed (at least 1 if count > 0); the caller continues with the remaining entries.
+static unsigned int increaseEnergies(const m256i* publicKeys, const long long* amounts, unsigned int count)
+{
+    constexpr unsigned int prefetchDistance = 4;
 
-#if LOG_SPECTRUM
-                if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
-                {
-                    // Log spectrum stats when the number of entities hits the next half million
-                    // (== 1 is to avoid duplicate when anti-dust is triggered)
-                    updateAndAnalzeEntityCategoryPopulations();
-                    logSpectrumStats();
-                }
-#endif
-            }
-            else
-            {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    ACQUIRE(spectrumLock);
 
-                goto iteration;
-            }
+    for (unsigned int i = 0; i < count && i < prefetchDistance; i++)
+    {
+        prefetchSpectrumSlot(publicKeys[i]);
+    }
+    unsigned int i = 0;
+    for (; i < count; i++)
+    {
+        if (i > 0 && mayLogWhenIncreasingEnergy())
+        {
+            break;
+        }
+        if (i + prefetchDistance < count)
+        {
+            prefetchSpectrumSlot(publicKeys[i + prefetchDistance]);
+        }
+        if (!isZero(publicKeys[i]) && amounts[i] >= 0)
+        {
+            increaseEnergyWithLock(publicKeys[i], amounts[i]);
         }
-
-        RELEASE(spectrumLock);
     }
+
+    RELEASE(spectrumLock);
+
+    return i;
 }
 
 // Decrease balance of entity if it is high enough. Does NOT check if index is valid.
@@ -357,13 +683,16 @@ static bool decreaseEnergy(const int index, long long amount)
     {
         ACQUIRE(spectrumLock);
 
-        if (energy(index) >= amount)
+        const long long oldBalance = energy(index);
+        if (oldBalance >= amount)
         {
             spectrum[index].outgoingAmount += amount;
             spectrum[index].numberOfOutgoingTransfers++;
             spectrum[index].latestOutgoingTransferTick = system.tick;
+            spectrumSnapshotChanges.markChanged(index);
 
             spectrumInfo.totalAmount -= amount;
+            updateEntityCategoryPopulations(oldBalance, oldBalance - amount);
 
             RELEASE(spectrumLock);
 
@@ -377,17 +706,50 @@ static bool decreaseEnergy(const int index, long long amount)
 }
 
 
-static bool loadSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR16* directory = nullptr)
+// Load spectrum from file in dense or sparse format (see saveSpectrumSnapshot()). If sparseFileMerkleRoot is passed,
+// it is set to the spectrum digest stored in the sparse file header (or zero for dense files). If deltaFileName is
+// passed, the delta file of the node state snapshot is applied and sparseFileMerkleRoot is set to the root stored in
+// the delta file. Saving the next snapshot continues from the loaded base and delta in this case.
+static bool loadSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR16* directory = nullptr, m256i* sparseFileMerkleRoot = nullptr,
+    const CHAR16* deltaFileName = nullptr)
 {
     logToConsole(L"Loading spectrum file ...");
-    long long loadedSize = load(fileName, SPECTRUM_CAPACITY * sizeof(EntityRecord), (unsigned char*)spectrum, directory);
-    if (loadedSize != SPECTRUM_CAPACITY * sizeof(EntityRecord))
+    m256i baseMerkleRoot, baseDigest;
+    long long loadedSize = loadSparseOrDenseSnapshot<EntityRecord, SPECTRUM_CAPACITY>(fileName, spectrum, &baseMerkleRoot,
+        (unsigned char*)reorgBuffer, reorgBufferSize, directory, deltaFileName ? &baseDigest : nullptr);
+    if (loadedSize < 0)
     {
         logStatusToConsole(L"EFI_FILE_PROTOCOL.Read() reads invalid number of bytes", loadedSize, __LINE__);
 
         return false;
     }
+
+    m256i merkleRoot = baseMerkleRoot;
+    if (deltaFileName)
+    {
+        spectrumSnapshotChanges.setBase(loadedSize, baseDigest);
+        const long long loadedDeltaSize = loadSnapshotDelta<EntityRecord, SPECTRUM_CAPACITY>(deltaFileName, spectrum, baseDigest,
+            merkleRoot, spectrumSnapshotChanges, (unsigned char*)reorgBuffer, reorgBufferSize, directory);
+        if (loadedDeltaSize < 0)
+        {
+            spectrumSnapshotChanges.invalidateBase();
+            logToConsole(L"Spectrum delta file is missing, invalid, or does not match spectrum file");
+
+            return false;
+        }
+    }
+    else
+    {
+        spectrumSnapshotChanges.invalidateBase();
+    }
+    if (sparseFileMerkleRoot)
+    {
+        *sparseFileMerkleRoot = merkleRoot;
+    }
+
     updateSpectrumInfo();
+    countEntityCategoryPopulations();
+    rebuildSpectrumTags();
     return true;
 }
 
@@ -413,10 +775,41 @@ static bool saveSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR
     return false;
 }
 
+// Save spectrum snapshot of the node states. If only few pages changed since the last base file, only the changed
+// pages are saved to the delta file. Otherwise, the spectrum is saved to the base file in sparse format (only storing
+// entities with their index, falling back to dense format if the data does not fit into reorgBuffer) and the delta is
+// reset. Spectrum digests have to be up to date, because the root is stored for verification. Uses reorgBuffer, so it
+// must not run in parallel to tick processing.
+static bool saveSpectrumSnapshot(const CHAR16* fileName, const CHAR16* deltaFileName, const CHAR16* directory = nullptr)
+{
+    logToConsole(L"Saving spectrum snapshot...");
+
+    const unsigned long long beginningTick = __rdtsc();
+
+    bool savedBase;
+    ACQUIRE(spectrumLock);
+    long long savedSize = saveSnapshotBaseOrDelta<EntityRecord, SPECTRUM_CAPACITY>(fileName, deltaFileName, spectrum,
+        spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1], [](const EntityRecord& entity) { return isZero(entity.publicKey); },
+        spectrumSnapshotChanges, (unsigned char*)reorgBuffer, reorgBufferSize, directory, savedBase);
+    RELEASE(spectrumLock);
+
+    if (savedSize > 0)
+    {
+        setNumber(message, savedSize, TRUE);
+        appendText(message, savedBase ? L" bytes of the spectrum data are saved (full, " : L" bytes of the spectrum data are saved (delta, ");
+        appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
+        appendText(message, L" microseconds).");
+        logToConsole(message);
+        return true;
+    }
+    return false;
+}
+
 static bool initSpectrum()
 {
     if (!allocPoolWithErrorLog(L"spectrum", spectrumSizeInBytes, (void**)&spectrum, __LINE__)
-        || !allocPoolWithErrorLog(L"spectrumDigests", spectrumDigestsSizeInByte, (void**)&spectrumDigests, __LINE__))
+        || !allocPoolWithErrorLog(L"spectrumDigests", spectrumDigestsSizeInByte, (void**)&spectrumDigests, __LINE__)
+        || !allocPoolWithErrorLog(L"spectrumTags", spectrumTagsSizeInBytes, (void**)&spectrumTags, __LINE__))
     {
         return false;
     }
@@ -427,6 +820,10 @@ static bool initSpectrum()
 
 static void deinitSpectrum()
 {
+    if (spectrumTags)
+    {
+        freePool(spectrumTags);
+    }
     if (spectrumDigests)
     {
         freePool(spectrumDigests);
@@ -118,11 +118,48 @@ public:
             EXPECT_EQ(it1->second, it2->second);
         }
 
+        // check that issuances with same asset name hash are consecutive in list and first one is referenced by hash
+        std::map<unsigned int, unsigned int> nameHashSegmentCount;
+        unsigned int prevNameHash = 0xffffffff;
+        issuanceIdx = indexLists.issuancesFirstIdx;
+        while (issuanceIdx != NO_ASSET_INDEX)
+        {
+            unsigned int nameHash = IndexLists::assetNameHash((*((unsigned long long*)assets[issuanceIdx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF);
+            if (nameHash != prevNameHash)
+            {
+                EXPECT_EQ(indexLists.issuancesByNameFirstIdx[nameHash], issuanceIdx);
+                ++nameHashSegmentCount[nameHash];
+                prevNameHash = nameHash;
+            }
+            issuanceIdx = indexLists.nextIdx[issuanceIdx];
+        }
+        unsigned int usedNameHashes = 0;
+        for (unsigned int nameHash = 0; nameHash < (1 << IndexLists::assetNameHashBits); ++nameHash)
+        {
+            if (indexLists.issuancesByNameFirstIdx[nameHash] != NO_ASSET_INDEX)
+            {
+                ++usedNameHashes;
+                EXPECT_EQ(nameHashSegmentCount[nameHash], 1);
+            }
+        }
+        EXPECT_EQ(usedNameHashes, nameHashSegmentCount.size());
+
+        // check that fingerprint tags are consistent with assets array
+        unsigned int inconsistentTags = 0;
+        for (unsigned int index = 0; index < ASSETS_CAPACITY; index++)
+        {
+            unsigned char expectedTag = (assets[index].varStruct.issuance.type == EMPTY) ? 0 : assetTag(assets[index].varStruct.issuance.publicKey);
+            if (indexLists.tags[index] != expectedTag || (index < fingerprintTagsPadding && indexLists.tags[ASSETS_CAPACITY + index] != expectedTag))
+                ++inconsistentTags;
+        }
+        EXPECT_EQ(inconsistentTags, 0);
+
         // check that number of owned and possessed shares are equal for each issuance
         issuanceIdx = indexLists.issuancesFirstIdx;
         while (issuanceIdx != NO_ASSET_INDEX)
         {
             Asset asset(assets[issuanceIdx].varStruct.issuance.publicKey, assetNameFromString(assets[issuanceIdx].varStruct.issuance.name));
+            EXPECT_EQ(issuanceIndex(asset.issuer, (*((unsigned long long*)assets[issuanceIdx].varStruct.issuance.name)) & 0xFFFFFFFFFFFFFF), issuanceIdx);
             long long numOfSharesOwned = 0, numOfSharesPossessed = 0;
             for (AssetOwnershipIterator iter(asset); !iter.reachedEnd(); iter.next())
             {
@@ -653,6 +690,125 @@ TEST(TestCoreAssets, AssetIterators)
     test.checkAssetsConsistency();
 }
 
+TEST(TestCoreAssets, AssetPossessionIteratorBySpecificPossessor)
+{
+    AssetsTest test;
+    test.clearUniverse();
+
+    // Possessor whose hash slot is the last one of the universe, so its probe chain wraps around,
+    // and a second entity sharing the same probe chain
+    const id issuer(1, 2, 3, 4);
+    const id possessor(ASSETS_CAPACITY - 1, 1, 1, 1);
+    const id collidingEntity(2 * ASSETS_CAPACITY - 1, 2, 2, 2);
+    const Asset assetA{ issuer, assetNameFromString("ASSETA") };
+    const Asset assetB{ issuer, assetNameFromString("ASSETB") };
+
+    int issuanceIdxA = -1, issuerOwnershipIdxA = -1, issuerPossessionIdxA = -1;
+    int issuanceIdxB = -1, issuerOwnershipIdxB = -1, issuerPossessionIdxB = -1;
+    EXPECT_EQ(issueAsset(issuer, "ASSETA", 0, CONTRACT_ASSET_UNIT_OF_MEASUREMENT, 1000, 1, &issuanceIdxA, &issuerOwnershipIdxA, &issuerPossessionIdxA), 1000);
+    EXPECT_EQ(issueAsset(issuer, "ASSETB", 0, CONTRACT_ASSET_UNIT_OF_MEASUREMENT, 1000, 1, &issuanceIdxB, &issuerOwnershipIdxB, &issuerPossessionIdxB), 1000);
+
+    // Possessor gets shares of both issuances, colliding entity gets shares of A
+    int ownershipIdxA1 = -1, possessionIdxA1 = -1, ownershipIdxB1 = -1, possessionIdxB1 = -1, ownershipIdxCollA = -1, possessionIdxCollA = -1;
+    EXPECT_TRUE(transferShareOwnershipAndPossession(issuerOwnershipIdxA, issuerPossessionIdxA, possessor, 300, &ownershipIdxA1, &possessionIdxA1, false));
+    EXPECT_TRUE(transferShareOwnershipAndPossession(issuerOwnershipIdxB, issuerPossessionIdxB, possessor, 200, &ownershipIdxB1, &possessionIdxB1, false));
+    EXPECT_TRUE(transferShareOwnershipAndPossession(issuerOwnershipIdxA, issuerPossessionIdxA, collidingEntity, 100, &ownershipIdxCollA, &possessionIdxCollA, false));
+
+    // Possessor splits its shares of A into several ownerships (with different possession managing contracts)
+    int ownershipIdxA2 = -1, possessionIdxA2 = -1, ownershipIdxA3 = -1, possessionIdxA3 = -1;
+    EXPECT_TRUE(transferShareManagementRights(ownershipIdxA1, possessionIdxA1, 2, 3, 50, &ownershipIdxA2, &possessionIdxA2, false));
+    EXPECT_TRUE(transferShareManagementRights(ownershipIdxA1, possessionIdxA1, 4, 4, 70, &ownershipIdxA3, &possessionIdxA3, false));
+    test.checkAssetsConsistency();
+
+    // Probe chain of possessor wraps around and has possession of B between the possessions of A
+    EXPECT_EQ(ownershipIdxA1, ASSETS_CAPACITY - 1);
+    EXPECT_LT(possessionIdxA1, ownershipIdxA1);
+    EXPECT_LT(possessionIdxA1, possessionIdxB1);
+    EXPECT_LT(possessionIdxB1, possessionIdxA2);
+
+    struct PossessionTestData
+    {
+        unsigned int ownershipIdx;
+        unsigned int ownershipManagingContract;
+        unsigned int possessionManagingContract;
+        long long numOfShares;
+    };
+    const std::map<unsigned int, PossessionTestData> possessionsA = {
+        { possessionIdxA1, { (unsigned int)ownershipIdxA1, 1, 1, 180 } },
+        { possessionIdxA2, { (unsigned int)ownershipIdxA2, 2, 3, 50 } },
+        { possessionIdxA3, { (unsigned int)ownershipIdxA3, 4, 4, 70 } },
+    };
+    const std::map<unsigned int, PossessionTestData> possessionsB = {
+        { possessionIdxB1, { (unsigned int)ownershipIdxB1, 1, 1, 200 } },
+    };
+
+    // Iterate with given filters and check that exactly the expected possession records are returned
+    auto checkIteration = [&](const Asset& issuance, const AssetOwnershipSelect& ownership, const AssetPossessionSelect& possession,
+        const std::map<unsigned int, PossessionTestData>& allPossessions, const std::vector<unsigned int>& expectedPossessionIndices)
+    {
+        std::set<unsigned int> remaining(expectedPossessionIndices.begin(), expectedPossessionIndices.end());
+        AssetPossessionIterator iter(issuance, ownership, possession);
+        while (!iter.reachedEnd())
+        {
+            EXPECT_EQ(remaining.erase(iter.possessionIndex()), 1);
+            const auto it = allPossessions.find(iter.possessionIndex());
+            EXPECT_NE(it, allPossessions.end());
+            if (it != allPossessions.end())
+            {
+                EXPECT_EQ(iter.ownershipIndex(), it->second.ownershipIdx);
+                EXPECT_EQ((unsigned int)iter.ownershipManagingContract(), it->second.ownershipManagingContract);
+                EXPECT_EQ((unsigned int)iter.possessionManagingContract(), it->second.possessionManagingContract);
+                EXPECT_EQ(iter.numberOfPossessedShares(), it->second.numOfShares);
+            }
+            EXPECT_EQ(iter.possessor(), possessor);
+            EXPECT_EQ(iter.issuer(), issuance.issuer);
+            EXPECT_EQ(iter.assetName(), issuance.assetName);
+            bool hasNext = iter.next();
+            EXPECT_EQ(hasNext, !iter.reachedEnd());
+        }
+        EXPECT_EQ(iter.ownershipIndex(), NO_ASSET_INDEX);
+        EXPECT_EQ(remaining.size(), 0);
+    };
+
+    const auto any = AssetOwnershipSelect::any();
+    const auto byPossessor = AssetPossessionSelect::byPossessor(possessor);
+
+    // Several ownerships of one issuance possessed by the same entity, skipping possessions of other issuance and entity in the same chain
+    checkIteration(assetA, any, byPossessor, possessionsA, { (unsigned int)possessionIdxA1, (unsigned int)possessionIdxA2, (unsigned int)possessionIdxA3 });
+    checkIteration(assetB, any, byPossessor, possessionsB, { (unsigned int)possessionIdxB1 });
+
+    // Ownership managing contract filter
+    checkIteration(assetA, AssetOwnershipSelect::byManagingContract(1), byPossessor, possessionsA, { (unsigned int)possessionIdxA1 });
+    checkIteration(assetA, AssetOwnershipSelect::byManagingContract(2), byPossessor, possessionsA, { (unsigned int)possessionIdxA2 });
+    checkIteration(assetA, AssetOwnershipSelect::byManagingContract(3), byPossessor, possessionsA, { });
+    checkIteration(assetB, AssetOwnershipSelect::byManagingContract(2), byPossessor, possessionsB, { });
+
+    // Possession managing contract filter
+    checkIteration(assetA, any, AssetPossessionSelect{ possessor, 3, false, false }, possessionsA, { (unsigned int)possessionIdxA2 });
+    checkIteration(assetA, any, AssetPossessionSelect{ possessor, 4, false, false }, possessionsA, { (unsigned int)possessionIdxA3 });
+    checkIteration(assetA, any, AssetPossessionSelect{ possessor, 2, false, false }, possessionsA, { });
+
+    // Both managing contract filters
+    checkIteration(assetA, AssetOwnershipSelect::byManagingContract(2), AssetPossessionSelect{ possessor, 3, false, false }, possessionsA, { (unsigned int)possessionIdxA2 });
+    checkIteration(assetA, AssetOwnershipSelect::byManagingContract(2), AssetPossessionSelect{ possessor, 4, false, false }, possessionsA, { });
+
+    // Same result as iterating all possessions of the issuance and filtering by possessor
+    {
+        std::set<unsigned int> filtered;
+        for (AssetPossessionIterator iter(assetA); !iter.reachedEnd(); iter.next())
+        {
+            if (iter.possessor() == possessor)
+                filtered.insert(iter.possessionIndex());
+        }
+        std::set<unsigned int> byHash;
+        for (AssetPossessionIterator iter(assetA, any, byPossessor); !iter.reachedEnd(); iter.next())
+        {
+            byHash.insert(iter.possessionIndex());
+        }
+        EXPECT_EQ(filtered, byHash);
+    }
+}
+
 TEST(TestCoreAssets, AssetTransferShareManagementRights)
 {
     AssetsTest test;
@@ -5,6 +5,7 @@
 #define TRACK_MAX_STACK_BUFFER_SIZE
 #include "../src/contract_core/stack_buffer.h"
 #include "../src/contract_core/contract_action_tracker.h"
+#include "../src/contract_core/contract_function_cache.h"
 
 TEST(TestCoreContractCore, StackBuffer)
 {
@@ -113,6 +114,22 @@ TEST(TestCoreContractCore, StackBuffer)
         EXPECT_EQ(ptr, ptrArray[i]);
         EXPECT_EQ(special, i % 3 == 0);
     }
+
+    // stack using external buffer
+    std::vector<char> buffer(4096);
+    StackBuffer<unsigned int, 0> s3;
+    s3.init(nullptr, 0);
+    EXPECT_EQ(s3.capacity(), 0);
+    EXPECT_EQ(s3.allocate(1), nullptr);
+    s3.init(buffer.data(), 4096);
+    EXPECT_EQ(s3.capacity(), 4096);
+    EXPECT_EQ(s3.size(), 0);
+    ptr = s3.allocate(1000);
+    EXPECT_GE(ptr, buffer.data());
+    EXPECT_LE(ptr + 1000, buffer.data() + buffer.size());
+    EXPECT_EQ(s3.allocate(4000), nullptr);
+    EXPECT_TRUE(s3.free());
+    EXPECT_EQ(s3.size(), 0);
 }
 
 TEST(TestCoreContractCore, ContractActionTracker)
@@ -163,5 +180,107 @@ TEST(TestCoreContractCore, ContractActionTracker)
     EXPECT_EQ(at.getOverallQuTransferBalance(id1), 200);
     EXPECT_EQ(at.getOverallQuTransferBalance(id2), 300);
 
+    // Net balances in order of first appearance
+    std::vector<std::pair<m256i, long long>> balances;
+    EXPECT_TRUE(at.forEachQuTransferBalance([&balances](const m256i& publicKey, long long amount) { balances.emplace_back(publicKey, amount); }));
+    ASSERT_EQ(balances.size(), 3);
+    EXPECT_EQ(balances[0].first, id0);
+    EXPECT_EQ(balances[0].second, -500);
+    EXPECT_EQ(balances[1].first, id1);
+    EXPECT_EQ(balances[1].second, 200);
+    EXPECT_EQ(balances[2].first, id2);
+    EXPECT_EQ(balances[2].second, 300);
+
+    // Reset clears balances
+    at.init();
+    EXPECT_EQ(at.getOverallQuTransferBalance(id0), 0);
+    EXPECT_EQ(at.getOverallQuTransferBalance(id1), 0);
+    EXPECT_TRUE(at.addQuTransfer(id1, id2, 7));
+    EXPECT_EQ(at.getOverallQuTransferBalance(id0), 0);
+    EXPECT_EQ(at.getOverallQuTransferBalance(id1), -7);
+    EXPECT_EQ(at.getOverallQuTransferBalance(id2), 7);
+
     at.freeBuffer();
+
+    // More entities than fit into balance map -> fall back to scanning actions
+    ContractActionTracker<40000> at2;
+    EXPECT_TRUE(at2.allocBuffer());
+    at2.init();
+    for (unsigned int i = 0; i < 40000; ++i)
+    {
+        EXPECT_TRUE(at2.addQuTransfer(m256i(i, 1, 2, 3), m256i(i, 4, 5, 6), i));
+    }
+    EXPECT_FALSE(at2.addQuTransfer(id0, id1, 1));
+    EXPECT_EQ(at2.getOverallQuTransferBalance(m256i(10, 1, 2, 3)), -10);
+    EXPECT_EQ(at2.getOverallQuTransferBalance(m256i(39000, 4, 5, 6)), 39000);
+    EXPECT_EQ(at2.getOverallQuTransferBalance(id1), 0);
+    EXPECT_FALSE(at2.forEachQuTransferBalance([](const m256i&, long long) {}));
+
+    // Balance map is used again after reset
+    at2.init();
+    EXPECT_TRUE(at2.addQuTransfer(id0, id1, 1));
+    EXPECT_EQ(at2.getOverallQuTransferBalance(id1), 1);
+    EXPECT_EQ(at2.getOverallQuTransferBalance(m256i(10, 1, 2, 3)), 0);
+    EXPECT_TRUE(at2.forEachQuTransferBalance([](const m256i&, long long) {}));
+}
+
+TEST(TestCoreContractCore, ContractFunctionCache)
+{
+    EXPECT_TRUE(initContractFunctionCache());
+
+    unsigned char input[40] = { 1, 2, 3 };
+    unsigned char output[100];
+    for (int i = 0; i < 100; ++i)
+        output[i] = (unsigned char)i;
+
+    // miss, then hit after caching output
+    ContractFunctionCacheKey key;
+    key.set(1, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key), nullptr);
+    cacheContractFunctionOutput(key, output, sizeof(output));
+    ContractFunctionCacheKey key2;
+    key2.set(1, 2, input, sizeof(input), 100);
+    ContractFunctionCacheSlot* slot = acquireCachedContractFunctionOutput(key2);
+    ASSERT_NE(slot, nullptr);
+    EXPECT_EQ(slot->outputSize, sizeof(output));
+    EXPECT_EQ(memcmp(slot->output, output, sizeof(output)), 0);
+    // slot is locked while output is used
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    releaseContractFunctionCacheSlot(slot);
+    EXPECT_EQ(contractFunctionCacheHits, 1);
+    EXPECT_EQ(contractFunctionCacheMisses, 1);
+
+    // different contract, input type, input, or tick -> miss
+    key2.set(2, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    key2.set(1, 3, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    key2.set(1, 2, input, sizeof(input) - 1, 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    input[39] = 1;
+    key2.set(1, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    input[39] = 0;
+    key2.set(1, 2, input, sizeof(input), 101);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+
+    // cache is not used while states are changed
+    beginContractStateChanges();
+    key2.set(1, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+    cacheContractFunctionOutput(key2, output, sizeof(output));
+    endContractStateChanges();
+
+    // entries created before state changes are invalid
+    key2.set(1, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+
+    // output isn't cached if states changed while function was executed
+    beginContractStateChanges();
+    endContractStateChanges();
+    cacheContractFunctionOutput(key2, output, sizeof(output));
+    key2.set(1, 2, input, sizeof(input), 100);
+    EXPECT_EQ(acquireCachedContractFunctionOutput(key2), nullptr);
+
+    deinitContractFunctionCache();
 }
@@ -66,6 +66,16 @@ public:
     {
         return this->prevPostAcquireSharesInput;
     }
+
+    QpiFunctionsOutput getQpiFunctionsOutputBeginTick(uint32 tick) const
+    {
+        return this->qpiFunctionsOutputBeginTick.get(tick);
+    }
+
+    QpiFunctionsOutput getQpiFunctionsOutputEndTick(uint32 tick) const
+    {
+        return this->qpiFunctionsOutputEndTick.get(tick);
+    }
 };
 
 class StateCheckerTestExampleB : public TESTEXB
@@ -1326,3 +1336,316 @@ TEST(ContractTestEx, BurnAssets)
         EXPECT_EQ(1000000 - 100, numberOfShares(asset, { USER1, QX_CONTRACT_INDEX }, { USER1, QX_CONTRACT_INDEX }));
     }
 }
+
+// Digests of all data changed by contract system procedures, for comparing parallel and serial execution
+struct SystemProcedureRunDigests
+{
+    m256i contractStates[contractCount];
+    m256i spectrum;
+    m256i universe;
+    m256i log;
+    unsigned long long numberOfLogEvents;
+};
+
+static void getSystemProcedureRunDigests(SystemProcedureRunDigests& digests)
+{
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+    {
+        digests.contractStates[contractIndex] = m256i::zero();
+        if (contractStates[contractIndex])
+            KangarooTwelve(contractStates[contractIndex], (unsigned int)contractDescriptions[contractIndex].stateSize, &digests.contractStates[contractIndex], 32);
+    }
+    KangarooTwelve(spectrum, (unsigned int)spectrumSizeInBytes, &digests.spectrum, 32);
+    KangarooTwelve(assets, (unsigned int)universeSizeInBytes, &digests.universe, 32);
+
+    logger.flushStagedLogEvents();
+    digests.numberOfLogEvents = logger.logBuf.getNumberOfLogIds();
+    digests.log = m256i::zero();
+    if (digests.numberOfLogEvents)
+    {
+        const qLogger::BlobInfo lastEvent = logger.logBuf.getBlobInfo(digests.numberOfLogEvents - 1);
+        std::vector<char> logData(lastEvent.startIndex + lastEvent.length);
+        logger.logBuf.getMany(logData.data(), 0, logData.size());
+        KangarooTwelve(logData.data(), (unsigned int)logData.size(), &digests.log, 32);
+    }
+}
+
+// Run BEGIN_TICK and END_TICK of the test contracts for several ticks, either serially like the node did before or in
+// parallel with helper threads joining the parallel jobs like the request processors of the node. In the first ticks
+// of the parallel run, END_TICK of TESTEXD (in turn first) is held back until END_TICK of TESTEXA has been started
+// before its turn. TESTEXD then reads the state of TESTEXA, so the early run of TESTEXA has to be rolled back.
+static void runSystemProceduresOfSeveralContracts(bool parallel, SystemProcedureRunDigests& digests)
+{
+    ContractTestingTestEx test;
+    const id TESTEXD_CONTRACT_ID(TESTEXD_CONTRACT_INDEX, 0, 0, 0);
+    system.tick = 1000;
+
+    // TESTEXD distributes its balance to its shareholders in END_TICK
+    std::vector<std::pair<m256i, unsigned int>> sharesTestExD{ {USER1, 600}, {USER2, 76} };
+    issueContractShares(TESTEXD_CONTRACT_INDEX, sharesTestExD);
+    increaseEnergy(TESTEXD_CONTRACT_ID, NUMBER_OF_COMPUTORS * 1000);
+
+    volatile bool stopHelpers = false;
+    std::vector<std::thread> helpers;
+    if (parallel)
+    {
+        for (int i = 0; i < NUMBER_OF_CONTRACT_SYSTEM_PROCEDURE_WORKERS - 1; ++i)
+        {
+            helpers.emplace_back([&stopHelpers]()
+                {
+                    while (!stopHelpers)
+                        helpWithParallelJob();
+                });
+        }
+    }
+
+    const unsigned int beginTickOrder[] = { TESTEXA_CONTRACT_INDEX, TESTEXB_CONTRACT_INDEX, TESTEXC_CONTRACT_INDEX, TESTEXD_CONTRACT_INDEX };
+    const unsigned int endTickOrder[] = { TESTEXD_CONTRACT_INDEX, TESTEXC_CONTRACT_INDEX, TESTEXB_CONTRACT_INDEX, TESTEXA_CONTRACT_INDEX };
+    auto runSerially = [](SystemProcedureID systemProcId, const unsigned int* contractIndices, unsigned int numberOfContracts)
+    {
+        for (unsigned int i = 0; i < numberOfContracts; ++i)
+        {
+            QpiContextSystemProcedureCall qpiContext(contractIndices[i], systemProcId);
+            qpiContext.call();
+        }
+    };
+    // ticket of END_TICK of TESTEXA (tickets are only assigned to contracts that have the procedure)
+    long endTickTicketTestExA = 0;
+    for (unsigned int contractIndex : endTickOrder)
+    {
+        if (contractIndex == TESTEXA_CONTRACT_INDEX)
+            break;
+        if (contractSystemProcedures[contractIndex][END_TICK])
+            ++endTickTicketTestExA;
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        ++system.tick;
+        if (!parallel)
+        {
+            runSerially(BEGIN_TICK, beginTickOrder, 4);
+            runSerially(END_TICK, endTickOrder, 4);
+        }
+        else if (i >= 10)
+        {
+            runContractSystemProcedures(BEGIN_TICK, beginTickOrder, 4);
+            runContractSystemProcedures(END_TICK, endTickOrder, 4);
+        }
+        else
+        {
+            runContractSystemProcedures(BEGIN_TICK, beginTickOrder, 4);
+
+            // Handshake: TESTEXD can't finish while its state is locked here, so TESTEXA can't get its turn and a helper
+            // starts it before its turn (no timeout needed, the schedule is idle before the thread is started)
+            const long long rolledBackBeforeTick = contractSystemProceduresRolledBack;
+            contractSystemProcedureSchedule.ticketRunStates[endTickTicketTestExA] = ContractSysProcNotStarted;
+            contractStateLock[TESTEXD_CONTRACT_INDEX].acquireWrite();
+            std::thread endTickThread([&endTickOrder]() { runContractSystemProcedures(END_TICK, endTickOrder, 4); });
+            while (contractSystemProcedureSchedule.ticketRunStates[endTickTicketTestExA] == ContractSysProcNotStarted)
+            {
+                _mm_pause();
+            }
+            contractStateLock[TESTEXD_CONTRACT_INDEX].releaseWrite();
+            endTickThread.join();
+            EXPECT_EQ(contractSystemProceduresRolledBack, rolledBackBeforeTick + 1);
+        }
+
+        EXPECT_EQ(test.getStateTestExampleA()->getQpiFunctionsOutputBeginTick(system.tick).tick, system.tick);
+        EXPECT_EQ(test.getStateTestExampleA()->getQpiFunctionsOutputEndTick(system.tick).tick, system.tick);
+        EXPECT_EQ(contractSystemProceduresRunningBeforeTurn, 0);
+    }
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+
+    // dividends have been paid exactly once
+    EXPECT_EQ(getBalance(TESTEXD_CONTRACT_ID), 0);
+    EXPECT_EQ(getBalance(USER1), 600 * 1000);
+    EXPECT_EQ(getBalance(USER2), 76 * 1000);
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+    {
+        EXPECT_EQ(contractSystemProcedureSchedule.contractTickets[contractIndex], -1);
+        EXPECT_EQ(contractError[contractIndex], 0);
+    }
+
+    getSystemProcedureRunDigests(digests);
+}
+
+TEST(ContractTestEx, RunSystemProceduresOfSeveralContracts)
+{
+    // parallel execution (including roll back of procedures started before their turn) has the same result as serial
+    // execution: contract states, spectrum, universe, and log are equal byte by byte
+    static SystemProcedureRunDigests serialDigests, parallelDigests;
+    runSystemProceduresOfSeveralContracts(false, serialDigests);
+    runSystemProceduresOfSeveralContracts(true, parallelDigests);
+
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+        EXPECT_EQ(serialDigests.contractStates[contractIndex], parallelDigests.contractStates[contractIndex]) << "contract " << contractIndex;
+    EXPECT_EQ(serialDigests.spectrum, parallelDigests.spectrum);
+    EXPECT_EQ(serialDigests.universe, parallelDigests.universe);
+    EXPECT_GT(serialDigests.numberOfLogEvents, 0);
+    EXPECT_EQ(serialDigests.numberOfLogEvents, parallelDigests.numberOfLogEvents);
+    EXPECT_EQ(serialDigests.log, parallelDigests.log);
+}
+
+TEST(ContractTestEx, FunctionsReadCommittedStatesWhileStatesAreChanged)
+{
+    ContractTestingTestEx test;
+    increaseEnergy(TESTEXC_CONTRACT_ID, 1000);
+    increaseEnergy(USER1, 1000);
+
+    // allocate copies of states like the node does on startup and commit the initial states
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+    {
+        if (contractStates[contractIndex])
+            EXPECT_TRUE(allocContractCommittedStates(contractIndex));
+    }
+    system.tick = 100;
+    EXPECT_TRUE(updateContractCommittedStates(system.tick));
+
+    // tick processor starts changing states of tick 101
+    system.tick = 101;
+    beginContractStateChanges();
+    EXPECT_TRUE(test.qpiTransfer<TESTEXC>(TESTEXB_CONTRACT_ID, 100));
+    EXPECT_EQ(test.getIncomingTransferAmounts<TESTEXB>().qpiTransferAmount, 0);
+
+    // functions don't wait for states locked by contract processor, including states of called contracts
+    contractStateLock[TESTEXA_CONTRACT_INDEX].acquireWrite();
+    contractStateLock[TESTEXB_CONTRACT_INDEX].acquireWrite();
+    {
+        QpiContextUserFunctionCall qpiContext(TESTEXB_CONTRACT_INDEX);
+        EXPECT_EQ(qpiContext.call(20, nullptr, 0), NoContractError);
+        EXPECT_EQ(qpiContext.stateTick, 100);
+        EXPECT_EQ(((TESTEXB::IncomingTransferAmounts_output*)qpiContext.outputBuffer)->qpiTransferAmount, 0);
+    }
+    TESTEXA::QueryQpiFunctions_input input{};
+    TESTEXA::QueryQpiFunctions_output output{};
+    EXPECT_EQ(test.callFunctionOfTestExampleAFromTextExampleB(input, output, true), NoContractError);
+    contractStateLock[TESTEXB_CONTRACT_INDEX].releaseWrite();
+    contractStateLock[TESTEXA_CONTRACT_INDEX].releaseWrite();
+    EXPECT_EQ(contractFunctionCallsOnCommittedStates, 3);
+
+    // commit changes of tick 101 (state change flags are passed on by getComputerDigest() in the node)
+    markContractCommittedStateOutdated(TESTEXB_CONTRACT_INDEX);
+    EXPECT_TRUE(updateContractCommittedStates(system.tick));
+    endContractStateChanges();
+    {
+        QpiContextUserFunctionCall qpiContext(TESTEXB_CONTRACT_INDEX);
+        EXPECT_EQ(qpiContext.call(20, nullptr, 0), NoContractError);
+        EXPECT_EQ(qpiContext.stateTick, 101);
+        EXPECT_EQ(((TESTEXB::IncomingTransferAmounts_output*)qpiContext.outputBuffer)->qpiTransferAmount, 100);
+    }
+    EXPECT_EQ(contractFunctionCallsOnCommittedStates, 3);
+
+    beginContractStateChanges();
+    EXPECT_EQ(test.getIncomingTransferAmounts<TESTEXB>().qpiTransferAmount, 100);
+    endContractStateChanges();
+    EXPECT_EQ(contractFunctionCallsOnCommittedStates, 4);
+
+    // tick processor doesn't wait for functions reading committed states: with set of tick 101 pinned by a function,
+    // it updates the other set for tick 102, but skips the update of tick 103, because the function still reads the
+    // set that would be updated
+    const unsigned int pinnedIndex = acquireContractCommittedStatesForReading();
+    EXPECT_EQ(contractCommittedStatesTicks[pinnedIndex], 101);
+    const unsigned long long stateSizeB = contractDescriptions[TESTEXB_CONTRACT_INDEX].stateSize;
+    std::vector<unsigned char> pinnedStateB(contractCommittedStates[pinnedIndex][TESTEXB_CONTRACT_INDEX],
+        contractCommittedStates[pinnedIndex][TESTEXB_CONTRACT_INDEX] + stateSizeB);
+    system.tick = 102;
+    beginContractStateChanges();
+    EXPECT_TRUE(test.qpiTransfer<TESTEXC>(TESTEXB_CONTRACT_ID, 10));
+    markContractCommittedStateOutdated(TESTEXB_CONTRACT_INDEX);
+    EXPECT_TRUE(updateContractCommittedStates(system.tick));
+    endContractStateChanges();
+    system.tick = 103;
+    beginContractStateChanges();
+    EXPECT_TRUE(test.qpiTransfer<TESTEXC>(TESTEXB_CONTRACT_ID, 1));
+    markContractCommittedStateOutdated(TESTEXB_CONTRACT_INDEX);
+    const unsigned long long updatesSkipped = contractCommittedStatesUpdatesSkipped;
+    EXPECT_FALSE(updateContractCommittedStates(system.tick));
+    EXPECT_EQ(contractCommittedStatesUpdatesSkipped, updatesSkipped + 1);
+    {
+        // new function calls read set of tick 102, the pinned set still contains tick 101
+        QpiContextUserFunctionCall qpiContext(TESTEXB_CONTRACT_INDEX);
+        EXPECT_EQ(qpiContext.call(20, nullptr, 0), NoContractError);
+        EXPECT_EQ(qpiContext.stateTick, 102);
+        EXPECT_EQ(((TESTEXB::IncomingTransferAmounts_output*)qpiContext.outputBuffer)->qpiTransferAmount, 110);
+        EXPECT_EQ(memcmp(pinnedStateB.data(), contractCommittedStates[pinnedIndex][TESTEXB_CONTRACT_INDEX], stateSizeB), 0);
+    }
+
+    // after the function has finished, the skipped changes are committed with the next update
+    releaseContractCommittedStatesForReading(pinnedIndex);
+    EXPECT_TRUE(updateContractCommittedStates(system.tick));
+    endContractStateChanges();
+    EXPECT_EQ(contractCommittedStatesIndex, pinnedIndex);
+    EXPECT_EQ(memcmp(contractStates[TESTEXB_CONTRACT_INDEX], contractCommittedStates[pinnedIndex][TESTEXB_CONTRACT_INDEX], stateSizeB), 0);
+    EXPECT_NE(memcmp(contractStates[TESTEXB_CONTRACT_INDEX], contractCommittedStates[pinnedIndex ^ 1][TESTEXB_CONTRACT_INDEX], stateSizeB), 0);
+    EXPECT_EQ(test.getIncomingTransferAmounts<TESTEXB>().qpiTransferAmount, 111);
+
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; ++contractIndex)
+    {
+        freeContractCommittedStates(contractIndex);
+    }
+}
+
+TEST(ContractTestEx, ContractStateDigestOnlyRehashesChangedPages)
+{
+    ContractTestingTestEx test;
+    const unsigned int contractIndex = QX_CONTRACT_INDEX;
+    const unsigned long long size = contractDescriptions[contractIndex].stateSize;
+    const unsigned long long pageCount = getContractStatePageCount(contractIndex);
+    ASSERT_GT(pageCount, 10);
+    unsigned char* state = contractStates[contractIndex];
+    EXPECT_TRUE(allocContractCommittedStates(contractIndex));
+    EXPECT_TRUE(allocContractStatePageTracking(contractIndex));
+
+    // compute digest and commit state like the node does after processing a tick
+    auto digestAndCommit = [&](unsigned long long expectedPagesHashed)
+    {
+        const unsigned long long pagesHashedBefore = contractStatePagesHashed;
+        m256i digest, expectedDigest;
+        KangarooTwelve(state, (unsigned int)size, &expectedDigest, 32);
+        computeContractStateDigest(contractIndex, digest);
+        EXPECT_EQ(digest, expectedDigest);
+        EXPECT_EQ(contractStatePagesHashed - pagesHashedBefore, expectedPagesHashed);
+
+        // getComputerDigest() clears change flag and marks committed state as outdated
+        contractStateChangeFlags[contractIndex >> 6] &= ~(1ULL << (contractIndex & 63));
+        markContractCommittedStateOutdated(contractIndex);
+        EXPECT_TRUE(updateContractCommittedStates(system.tick));
+        EXPECT_EQ(memcmp(state, getPublishedContractCommittedState(contractIndex), size), 0);
+    };
+
+    // first digest hashes all pages
+    digestAndCommit(pageCount - 1);
+
+    // only changed pages are rehashed (page 0 is part of final node and not counted)
+    state[10] ^= 1;
+    state[5 * CONTRACT_STATE_PAGE_SIZE + 100] ^= 0xff;
+    state[size - 1] ^= 0x80;
+    digestAndCommit(2);
+    digestAndCommit(0);
+
+    // state changed after digest and before commit -> full copy and all pages are rehashed next time
+    state[7 * CONTRACT_STATE_PAGE_SIZE] ^= 1;
+    m256i digest;
+    computeContractStateDigest(contractIndex, digest);
+    state[9 * CONTRACT_STATE_PAGE_SIZE] ^= 1;
+    setContractStateChangeFlag(contractIndex);
+    markContractCommittedStateOutdated(contractIndex);
+    EXPECT_TRUE(updateContractCommittedStates(system.tick));
+    EXPECT_EQ(memcmp(state, getPublishedContractCommittedState(contractIndex), size), 0);
+    digestAndCommit(pageCount - 1);
+
+    // unpublished copy lags behind by one update: the pages changed in the latest two updates are copied
+    state[3 * CONTRACT_STATE_PAGE_SIZE] ^= 1;
+    digestAndCommit(1);
+    state[4 * CONTRACT_STATE_PAGE_SIZE] ^= 1;
+    const unsigned long long pagesCopiedBefore = contractStatePagesCopied;
+    digestAndCommit(1);
+    EXPECT_EQ(contractStatePagesCopied - pagesCopiedBefore, 2);
+    digestAndCommit(0);
+    EXPECT_EQ(memcmp(contractCommittedStates[0][contractIndex], contractCommittedStates[1][contractIndex], size), 0);
+
+    freeContractStatePageTracking(contractIndex);
+    freeContractCommittedStates(contractIndex);
+}
@@ -59,6 +59,8 @@ public:
         initSpectrum();
         memset(spectrum, 0, spectrumSizeInBytes);
         updateSpectrumInfo();
+        countEntityCategoryPopulations();
+        rebuildSpectrumTags();
     }
 
     void initEmptyUniverse()
@@ -187,7 +189,7 @@ static inline void checkContractExecCleanup()
         EXPECT_EQ(contractStateLock[i].getCurrentReaderLockCount(), 0);
     }
 
-    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_LOCALS_STACKS; ++i)
     {
         EXPECT_EQ(contractLocalsStack[i].size(), 0);
         EXPECT_EQ(contractLocalsStackLock[i], 0);
@@ -682,3 +682,110 @@ TEST(TestAsyncFileIO, FindKLargestKDuplicated)
     }
 }
 
+TEST(TestAsyncFileIO, BackgroundSaveWaitsForFreeSlotIfQueueIsFull)
+{
+    // More background saves than queue slots, issued by another thread while this thread flushes from time to time
+    constexpr int numberOfFiles = ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS + 16;
+    std::vector<unsigned long long> data(numberOfFiles);
+    std::vector<long long> results(numberOfFiles, 0);
+    for (int i = 0; i < numberOfFiles; i++)
+    {
+        data[i] = i * 1000003ULL;
+    }
+
+    volatile bool done = false;
+    std::thread saver([&]()
+        {
+            for (int i = 0; i < numberOfFiles; i++)
+            {
+                CHAR16 fileName[64];
+                setText(fileName, L"tmp_bg_file_");
+                appendNumber(fileName, i, false);
+                asyncBackgroundSave(fileName, sizeof(data[i]), (const unsigned char*)&data[i], NULL, (volatile long long*)&results[i]);
+            }
+            done = true;
+        });
+    while (!done)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        flushAsyncFileIOBuffer();
+    }
+    saver.join();
+    flushAsyncFileIOBuffer();
+
+    for (int i = 0; i < numberOfFiles; i++)
+    {
+        waitForAsyncBackgroundFileIO((volatile long long*)&results[i]);
+        EXPECT_EQ(results[i], sizeof(data[i]));
+
+        CHAR16 fileName[64];
+        setText(fileName, L"tmp_bg_file_");
+        appendNumber(fileName, i, false);
+        unsigned long long loaded = 0;
+        EXPECT_EQ(loadFile(fileName, sizeof(loaded), (char*)&loaded), sizeof(loaded));
+        EXPECT_EQ(loaded, data[i]);
+        _wremove(fileName);
+    }
+}
+
+TEST(TestAsyncFileIO, BackgroundRequestsFinishedOnStop)
+{
+    AsyncFileIO* fileIO = nullptr;
+    allocatePool(sizeof(AsyncFileIO), (void**)&fileIO);
+    setMem(fileIO, sizeof(AsyncFileIO), 0);
+    fileIO->init(NULL, 0);
+
+    // Request pending when stopping is processed (or failed), but never stays pending
+    unsigned long long data = 42;
+    volatile long long result = AsyncFileIO::kPending;
+    EXPECT_EQ(fileIO->asyncBackgroundSave(L"tmp_bg_stop_file", sizeof(data), (const unsigned char*)&data, NULL, &result), AsyncFileIO::kNoError);
+    EXPECT_EQ(result, AsyncFileIO::kPending);
+    fileIO->deInit();
+    EXPECT_NE(result, AsyncFileIO::kPending);
+
+    // Request after stopping is rejected
+    EXPECT_EQ(fileIO->asyncBackgroundSave(L"tmp_bg_stop_file", sizeof(data), (const unsigned char*)&data, NULL, &result), AsyncFileIO::kStop);
+
+    freePool(fileIO);
+    _wremove(L"tmp_bg_stop_file");
+}
+
+TEST(TestAsyncFileIO, BackgroundSavePreparedByWritingThread)
+{
+    // The data is prepared by the thread flushing the queue, not by the thread requesting the save
+    struct PrepareContext
+    {
+        unsigned long long buffer[4];
+        std::thread::id threadId;
+    } context;
+    setMem(context.buffer, sizeof(context.buffer), 0);
+    const AsyncFileIOPrepareSaveFunction prepare = [](void* ctx) -> unsigned long long
+        {
+            PrepareContext* context = (PrepareContext*)ctx;
+            context->threadId = std::this_thread::get_id();
+            context->buffer[0] = 123456789;
+            context->buffer[1] = 987654321;
+            return 2 * sizeof(unsigned long long);
+        };
+
+    CHAR16 fileName[64];
+    setText(fileName, L"tmp_bg_prepared_file");
+    volatile long long result = 0;
+    std::thread saver([&]()
+        {
+            asyncBackgroundSave(fileName, sizeof(context.buffer), (const unsigned char*)context.buffer, NULL, &result, prepare, &context);
+        });
+    saver.join();
+    EXPECT_EQ(result, AsyncFileIO::kPending);
+    EXPECT_EQ(context.buffer[0], 0);
+    flushAsyncFileIOBuffer();
+    waitForAsyncBackgroundFileIO(&result);
+    EXPECT_EQ(result, 2 * sizeof(unsigned long long));
+    EXPECT_EQ(context.threadId, std::this_thread::get_id());
+
+    unsigned long long loaded[4] = { 0 };
+    EXPECT_EQ(loadFile(fileName, 2 * sizeof(unsigned long long), (char*)loaded), 2 * sizeof(unsigned long long));
+    EXPECT_EQ(loaded[0], 123456789);
+    EXPECT_EQ(loaded[1], 987654321);
+    _wremove(fileName);
+}
@@ -8,6 +8,7 @@
 
 #include <chrono>
 #include <iostream>
+#include <vector>
 
 
 TEST(TestCoreK12, PerformanceDigest32Of1GB)
@@ -90,3 +91,26 @@ TEST(TestCoreK12, CompareK12Implementations)
     ASSERT_EQ(memcmp(outputArrayXKCP, outputArray, outputN), 0);
     delete [] inputPtr;
 }
+
+TEST(TestCoreK12, TreeDigestFromChainingValues)
+{
+    const unsigned int sizes[] = { 8192, 8193, 16383, 16384, 16385, 100000, 3 * 8192 + 1 };
+    std::vector<unsigned char> input(100000);
+    for (size_t i = 0; i < input.size(); ++i)
+        input[i] = (unsigned char)(i * 7 + (i >> 8));
+
+    for (unsigned int size : sizes)
+    {
+        const unsigned long long leafCount = KangarooTwelveLeafCount(size);
+        ASSERT_GE(leafCount, 1);
+        std::vector<unsigned char> chainingValues(leafCount * 32);
+        for (unsigned long long leafIndex = 1; leafIndex <= leafCount; ++leafIndex)
+            KangarooTwelveLeafChainingValue(input.data(), size, leafIndex, chainingValues.data() + (leafIndex - 1) * 32);
+
+        unsigned char expected[32], digest[32];
+        KangarooTwelve(input.data(), size, expected, 32);
+        KangarooTwelveTreeDigest(input.data(), chainingValues.data(), leafCount, digest, 32);
+        EXPECT_EQ(memcmp(expected, digest, 32), 0) << "size " << size;
+    }
+    EXPECT_EQ(KangarooTwelveLeafCount(8191), 0);
+}
@@ -0,0 +1,727 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "logging_test.h"
+#include <lib/platform_efi/uefi_globals.h>
+#include "network_core/peers.h"
+#include "logging/net_msg_impl.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+template <typename T>
+struct RequestMessage
+{
+    RequestResponseHeader header;
+    T payload;
+};
+
+// Test fixture for the log reading network messages. Log events are QU transfers created with logger, responses are
+// taken from the response queue.
+class LogNetworkMessagesTest : public LoggingTest
+{
+public:
+    static constexpr unsigned int eventSize = LOG_HEADER_SIZE + offsetof(QuTransfer, _terminator);
+
+    Peer peer;
+
+    LogNetworkMessagesTest(unsigned int tickBegin = 1000)
+    {
+        EXPECT_TRUE(allocatePool(RESPONSE_QUEUE_BUFFER_SIZE, (void**)&responseQueueBuffer));
+        responseQueueBufferHead = responseQueueBufferTail = 0;
+        responseQueueElementHead = responseQueueElementTail = 0;
+
+        setMem(&peer, sizeof(peer), 0);
+        peer.tcp4Protocol = (EFI_TCP4_PROTOCOL*)&peer; // only checked for NULL
+        peer.isConnectedAccepted = TRUE;
+        peer.address.u8[0] = 1;
+
+        system.epoch = 100;
+        qLogger::reset(tickBegin);
+    }
+
+    ~LogNetworkMessagesTest()
+    {
+        freePool(responseQueueBuffer);
+        responseQueueBuffer = NULL;
+    }
+
+    // log numberOfTransfers QU transfers from entities (source, 0, 0, 0) with source in [1, numberOfTransfers]
+    // to destination in one tx of the next tick and commit the tick
+    void addTick(unsigned int tick, unsigned int numberOfTransfers, const m256i& destination)
+    {
+        system.tick = tick;
+        logger.registerNewTx(tick, 0);
+        for (unsigned int i = 0; i < numberOfTransfers; i++)
+        {
+            QuTransfer transfer;
+            transfer.sourcePublicKey = m256i(i + 1, 0, 0, 0);
+            transfer.destinationPublicKey = destination;
+            transfer.amount = i;
+            logger.logQuTransfer(transfer);
+        }
+        logger.updateTick(tick);
+    }
+
+    void addTick(unsigned int tick, unsigned int numberOfTransfers)
+    {
+        addTick(tick, numberOfTransfers, m256i(tick, 1, 0, 0));
+    }
+
+    // log dust burning of numberOfBurns entities in current tx and return size of the log event
+    static unsigned int logDustBurning(unsigned short numberOfBurns)
+    {
+        std::vector<char> buffer(2 + numberOfBurns * sizeof(DustBurning::Entity));
+        DustBurning* message = (DustBurning*)buffer.data();
+        message->numberOfBurns = numberOfBurns;
+        for (unsigned short i = 0; i < numberOfBurns; i++)
+        {
+            const m256i publicKey(i + 1, 2, 0, 0);
+            copyMem(&message->entity(i).publicKey, &publicKey, sizeof(publicKey));
+            message->entity(i).amount = i;
+        }
+        logger.logDustBurning(message);
+        return LOG_HEADER_SIZE + message->messageSize();
+    }
+
+    // return next response of the queue (or NULL)
+    RequestResponseHeader* popResponse()
+    {
+        if (responseQueueElementTail == responseQueueElementHead)
+        {
+            return NULL;
+        }
+        RequestResponseHeader* response = (RequestResponseHeader*)&responseQueueBuffer[responseQueueElements[responseQueueElementTail].offset];
+        responseQueueElementTail++;
+        return response;
+    }
+
+    // check that response is a RespondLog with consecutive events starting with fromID and return number of events
+    static unsigned long long checkEvents(const RequestResponseHeader* response, unsigned long long fromID)
+    {
+        EXPECT_EQ(response->type(), RespondLog::type);
+        const char* event = (const char*)(response + 1);
+        const char* end = (const char*)response + response->size();
+        unsigned long long numberOfEvents = 0;
+        while (event < end)
+        {
+            EXPECT_EQ(*((unsigned long long*)(event + 10)), fromID + numberOfEvents);
+            EXPECT_EQ(*((unsigned int*)(event + 6)) & 0xFFFFFF, offsetof(QuTransfer, _terminator));
+            event += eventSize;
+            numberOfEvents++;
+        }
+        EXPECT_EQ(event, end);
+        return numberOfEvents;
+    }
+
+    // send RequestLogSubscription and return the response
+    RespondLogSubscription subscribe(unsigned long long fromID, unsigned long long windowSize)
+    {
+        RequestMessage<RequestLogSubscription> request;
+        request.header.checkAndSetSize(sizeof(request));
+        request.header.setType(RequestLogSubscription::type);
+        request.header.setDejavu(42);
+        copyMem(request.payload.passcode, logReaderPasscodes, sizeof(request.payload.passcode));
+        request.payload.fromID = fromID;
+        request.payload.windowSize = windowSize;
+        qLogger::processRequestLogSubscription(&peer, &request.header);
+
+        RespondLogSubscription resp;
+        RequestResponseHeader* response = popResponse();
+        EXPECT_NE(response, nullptr);
+        EXPECT_EQ(response->type(), RespondLogSubscription::type);
+        EXPECT_EQ(response->size(), sizeof(RequestResponseHeader) + sizeof(resp));
+        copyMem(&resp, response + 1, sizeof(resp));
+        return resp;
+    }
+
+    // send RequestLogIdsOfEntity, return the response (NULL if it is empty), and append the log IDs to logIds
+    RespondLogIdsOfEntity* getLogIdsOfEntity(const m256i& entity, unsigned int fromTick, unsigned int toTick, unsigned long long fromLogId,
+        std::vector<long long>& logIds)
+    {
+        RequestMessage<RequestLogIdsOfEntity> request;
+        request.header.checkAndSetSize(sizeof(request));
+        request.header.setType(RequestLogIdsOfEntity::type);
+        request.header.setDejavu(1);
+        copyMem(request.payload.passcode, logReaderPasscodes, sizeof(request.payload.passcode));
+        request.payload.entity = entity;
+        request.payload.fromTick = fromTick;
+        request.payload.toTick = toTick;
+        request.payload.fromLogId = fromLogId;
+        qLogger::processRequestLogIdsOfEntity(0, &peer, &request.header);
+
+        RequestResponseHeader* response = popResponse();
+        EXPECT_NE(response, nullptr);
+        EXPECT_EQ(response->type(), RespondLogIdsOfEntity::type);
+        if (response->size() == sizeof(RequestResponseHeader))
+        {
+            return NULL;
+        }
+        RespondLogIdsOfEntity* resp = (RespondLogIdsOfEntity*)(response + 1);
+        EXPECT_EQ(response->size(), sizeof(RequestResponseHeader) + sizeof(RespondLogIdsOfEntity) + resp->numberOfLogIds * sizeof(long long));
+        const long long* ids = (const long long*)(resp + 1);
+        logIds.insert(logIds.end(), ids, ids + resp->numberOfLogIds);
+        return resp;
+    }
+
+    // get log IDs of entity in [fromTick, toTick] with one request, expecting the search to be complete up to lastTick
+    std::vector<long long> getLogIdsOfEntity(const m256i& entity, unsigned int fromTick, unsigned int toTick, unsigned long long fromLogId = 0,
+        unsigned int lastTick = 0)
+    {
+        std::vector<long long> logIds;
+        RespondLogIdsOfEntity* resp = getLogIdsOfEntity(entity, fromTick, toTick, fromLogId, logIds);
+        EXPECT_NE(resp, nullptr);
+        if (resp)
+        {
+            EXPECT_EQ(resp->nextTick, ((lastTick) ? lastTick : toTick) + 1);
+            EXPECT_EQ(resp->nextLogId, 0);
+        }
+        return logIds;
+    }
+
+    // send RequestLogPage and return the response (NULL if it is empty)
+    RespondLogPage* getLogPage(unsigned long long fromID, unsigned long long toID, unsigned long long& eventsSize)
+    {
+        RequestMessage<RequestLogPage> request;
+        request.header.checkAndSetSize(sizeof(request));
+        request.header.setType(RequestLogPage::type);
+        request.header.setDejavu(1);
+        copyMem(request.payload.passcode, logReaderPasscodes, sizeof(request.payload.passcode));
+        request.payload.fromID = fromID;
+        request.payload.toID = toID;
+        qLogger::processRequestLogPage(0, &peer, &request.header);
+
+        RequestResponseHeader* response = popResponse();
+        EXPECT_NE(response, nullptr);
+        EXPECT_EQ(response->type(), RespondLogPage::type);
+        if (response->size() < sizeof(RequestResponseHeader) + sizeof(RespondLogPage))
+        {
+            eventsSize = 0;
+            return NULL;
+        }
+        eventsSize = response->size() - sizeof(RequestResponseHeader) - sizeof(RespondLogPage);
+        return (RespondLogPage*)(response + 1);
+    }
+
+    // push log events to subscribers and return the message pushed to peer (or NULL)
+    RequestResponseHeader* push()
+    {
+        qLogger::pushLogEventsToSubscribers();
+        RequestResponseHeader* response = popResponse();
+        EXPECT_EQ(popResponse(), nullptr);
+        EXPECT_TRUE(!response || responseQueueElements[(unsigned short)(responseQueueElementTail - 1)].peer == &peer);
+        return response;
+    }
+};
+
+TEST(TestCoreLogging, SubscriptionWindowAndAcknowledgement)
+{
+    LogNetworkMessagesTest test;
+
+    // more events than fit into the minimum window (which is the maximum message size)
+    constexpr unsigned int numberOfEvents = RequestResponseHeader::max_size / LogNetworkMessagesTest::eventSize + 1000;
+    constexpr unsigned long long eventsPerMessage = (RequestResponseHeader::max_size - sizeof(RequestResponseHeader)) / LogNetworkMessagesTest::eventSize;
+    constexpr unsigned long long eventsPerWindow = RequestResponseHeader::max_size / LogNetworkMessagesTest::eventSize;
+    static_assert(eventsPerWindow > eventsPerMessage);
+    test.addTick(1000, numberOfEvents);
+
+    // nothing pushed without subscription
+    EXPECT_EQ(test.push(), nullptr);
+
+    RespondLogSubscription resp = test.subscribe(0, 1);
+    EXPECT_EQ(resp.nextLogId, 0);
+    EXPECT_EQ(resp.windowSize, RequestResponseHeader::max_size);
+
+    // first message has maximum size, second one fills the window
+    RequestResponseHeader* response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(response->dejavu(), 42);
+    EXPECT_EQ(test.checkEvents(response, 0), eventsPerMessage);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, eventsPerMessage), eventsPerWindow - eventsPerMessage);
+    const unsigned long long numberOfPushedEvents = eventsPerWindow;
+
+    // window is full until acknowledged
+    EXPECT_EQ(test.push(), nullptr);
+    EXPECT_EQ(test.push(), nullptr);
+
+    // acknowledging continues the stream where it stopped
+    resp = test.subscribe(numberOfPushedEvents, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, numberOfPushedEvents);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, numberOfPushedEvents), numberOfEvents - numberOfPushedEvents);
+    EXPECT_EQ(test.push(), nullptr);
+
+    // events of later ticks are pushed after the tick is committed
+    test.addTick(1001, 10);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, numberOfEvents), 10);
+
+    // events of a tick in progress are not pushed before the tick is committed
+    system.tick = 1002;
+    logger.registerNewTx(1002, 0);
+    QuTransfer transfer;
+    transfer.sourcePublicKey = m256i(1, 2, 3, 4);
+    transfer.destinationPublicKey = m256i(5, 6, 7, 8);
+    transfer.amount = 9;
+    logger.logQuTransfer(transfer);
+    EXPECT_EQ(test.push(), nullptr);
+    logger.updateTick(1002);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, numberOfEvents + 10), 1);
+
+    // larger window (up to limit) is used from acknowledgement on
+    resp = test.subscribe(numberOfEvents + 11, LOG_SUBSCRIPTION_MAX_WINDOW_SIZE + 1);
+    EXPECT_EQ(resp.nextLogId, numberOfEvents + 11);
+    EXPECT_EQ(resp.windowSize, LOG_SUBSCRIPTION_MAX_WINDOW_SIZE);
+}
+
+TEST(TestCoreLogging, SubscriptionRestartAndCancel)
+{
+    LogNetworkMessagesTest test;
+    test.addTick(1000, 100);
+
+    RespondLogSubscription resp = test.subscribe(20, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 20);
+    RequestResponseHeader* response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 20), 80);
+
+    // fromID before acknowledged ID restarts the stream
+    resp = test.subscribe(10, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 10);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 10), 90);
+
+    // fromID beyond pushed events restarts the stream too (client has skipped events)
+    test.addTick(1001, 100);
+    resp = test.subscribe(150, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 150);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 150), 50);
+
+    // acknowledging all events doesn't push anything again
+    resp = test.subscribe(200, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 200);
+    EXPECT_EQ(test.push(), nullptr);
+
+    // cancel subscription
+    resp = test.subscribe(200, 0);
+    EXPECT_EQ(resp.nextLogId, -1);
+    test.addTick(1002, 5);
+    EXPECT_EQ(test.push(), nullptr);
+
+    // subscribe again
+    resp = test.subscribe(200, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 200);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 200), 5);
+
+    // closed connection ends subscription
+    test.peer.isClosing = TRUE;
+    test.addTick(1003, 5);
+    EXPECT_EQ(test.push(), nullptr);
+    test.peer.isClosing = FALSE;
+    EXPECT_EQ(test.push(), nullptr);
+
+    // wrong passcode is rejected
+    RequestMessage<RequestLogSubscription> request;
+    request.header.checkAndSetSize(sizeof(request));
+    request.header.setType(RequestLogSubscription::type);
+    request.header.setDejavu(1);
+    copyMem(request.payload.passcode, logReaderPasscodes, sizeof(request.payload.passcode));
+    request.payload.passcode[2]++;
+    request.payload.fromID = 0;
+    request.payload.windowSize = RequestResponseHeader::max_size;
+    qLogger::processRequestLogSubscription(&test.peer, &request.header);
+    response = test.popResponse();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(response->type(), RespondLogSubscription::type);
+    EXPECT_EQ(response->size(), sizeof(RequestResponseHeader));
+    EXPECT_EQ(test.push(), nullptr);
+}
+
+TEST(TestCoreLogging, SubscriptionRestartWithNewEpoch)
+{
+    LogNetworkMessagesTest test;
+    test.addTick(1000, 100);
+
+    RespondLogSubscription resp = test.subscribe(0, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 0);
+    RequestResponseHeader* response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 0), 100);
+
+    // log IDs restart with new epoch, so stream restarts at 0 without new subscription
+    system.epoch++;
+    qLogger::reset(2000);
+    EXPECT_EQ(test.push(), nullptr);
+    test.addTick(2000, 30);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 0), 30);
+    EXPECT_EQ(*((unsigned short*)(response + 1)), system.epoch);
+
+    // acknowledgement of the new epoch's events continues the stream
+    test.addTick(2001, 30);
+    resp = test.subscribe(30, RequestResponseHeader::max_size);
+    EXPECT_EQ(resp.nextLogId, 30);
+    response = test.push();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(test.checkEvents(response, 30), 30);
+}
+
+TEST(TestCoreLogging, SubscriptionPushedByConcurrentProcessors)
+{
+    LogNetworkMessagesTest test;
+    RespondLogSubscription resp = test.subscribe(0, LOG_SUBSCRIPTION_MAX_WINDOW_SIZE);
+    EXPECT_EQ(resp.nextLogId, 0);
+
+    // several request processors push while the tick processor commits ticks, each event has to be pushed once in order
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> requestProcessors;
+    for (int i = 0; i < 4; i++)
+    {
+        requestProcessors.emplace_back([&stop]()
+            {
+                while (!stop)
+                {
+                    qLogger::pushLogEventsToSubscribers();
+                }
+            });
+    }
+    constexpr unsigned int numberOfTicks = 200;
+    constexpr unsigned int eventsPerTick = 50;
+    for (unsigned int tick = 1000; tick < 1000 + numberOfTicks; tick++)
+    {
+        test.addTick(tick, eventsPerTick);
+    }
+    stop = true;
+    for (auto& thread : requestProcessors)
+    {
+        thread.join();
+    }
+    qLogger::pushLogEventsToSubscribers();
+
+    unsigned long long numberOfPushedEvents = 0;
+    while (RequestResponseHeader* response = test.popResponse())
+    {
+        numberOfPushedEvents += test.checkEvents(response, numberOfPushedEvents);
+    }
+    EXPECT_EQ(numberOfPushedEvents, numberOfTicks * eventsPerTick);
+}
+
+TEST(TestCoreLogging, EntityFilter)
+{
+    std::mt19937_64 gen64(42);
+    auto randomEntity = [&gen64]() { return m256i(gen64(), gen64(), gen64(), gen64()); };
+
+    for (unsigned long long numberOfEntities : { 1ULL, 10ULL, 1000ULL, (unsigned long long)LOG_ENTITY_FILTER_MAX_ENTITIES })
+    {
+        const unsigned long long numberOfBlocks = qLogger::EntityFilter::getNumberOfBlocks(numberOfEntities);
+        EXPECT_GE(numberOfBlocks, 1);
+        EXPECT_LE(numberOfBlocks, qLogger::EntityFilter::maxNumberOfBlocks);
+        std::vector<qLogger::EntityFilter::Block> blocks(numberOfBlocks);
+        setMem(blocks.data(), numberOfBlocks * sizeof(qLogger::EntityFilter::Block), 0);
+
+        std::vector<m256i> entities;
+        for (unsigned long long i = 0; i < numberOfEntities; i++)
+        {
+            entities.push_back(randomEntity());
+            const unsigned long long h = qLogger::EntityFilter::hash(entities.back());
+            qLogger::EntityFilter::add(blocks[qLogger::EntityFilter::getBlockIndex(h, numberOfBlocks)], h);
+        }
+
+        // no false negatives
+        for (const m256i& entity : entities)
+        {
+            const unsigned long long h = qLogger::EntityFilter::hash(entity);
+            EXPECT_TRUE(qLogger::EntityFilter::mayContain(blocks[qLogger::EntityFilter::getBlockIndex(h, numberOfBlocks)], h));
+        }
+
+        // few false positives, also for contract IDs that only differ in the first 8 bytes
+        unsigned int falsePositives = 0;
+        constexpr unsigned int numberOfChecks = 100000;
+        for (unsigned int i = 0; i < numberOfChecks; i++)
+        {
+            const m256i entity = (i & 1) ? randomEntity() : m256i(i, 0, 0, 0);
+            const unsigned long long h = qLogger::EntityFilter::hash(entity);
+            EXPECT_NE(h, 0);
+            if (qLogger::EntityFilter::mayContain(blocks[qLogger::EntityFilter::getBlockIndex(h, numberOfBlocks)], h))
+            {
+                falsePositives++;
+            }
+        }
+        EXPECT_LT(falsePositives, numberOfChecks / 100);
+    }
+}
+
+TEST(TestCoreLogging, LogIdsOfEntity)
+{
+    LogNetworkMessagesTest test;
+
+    // log IDs: tick 1000 [0, 10), tick 1001 [10, 30), tick 1002 none, tick 1003 [30, 35), tick 1004 [35, 65)
+    test.addTick(1000, 10);
+    test.addTick(1001, 20);
+    test.addTick(1002, 0);
+    test.addTick(1003, 5);
+    test.addTick(1004, 30);
+
+    // source (k, 0, 0, 0) is k-th event of ticks with at least k events
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1000, 1004), std::vector<long long>({ 2, 12, 32, 37 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(10, 0, 0, 0), 1000, 1004), std::vector<long long>({ 9, 19, 44 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(25, 0, 0, 0), 1000, 1004), std::vector<long long>({ 59 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1001, 1003), std::vector<long long>({ 12, 32 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1002, 1002), std::vector<long long>());
+
+    // destination (tick, 1, 0, 0) is in all events of the tick
+    std::vector<long long> expectedLogIds;
+    for (long long id = 10; id < 30; id++)
+    {
+        expectedLogIds.push_back(id);
+    }
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1001, 1, 0, 0), 1000, 1004), expectedLogIds);
+
+    // entities that aren't touched
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(31, 0, 0, 0), 1000, 1004), std::vector<long long>());
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1002, 1, 0, 0), 1000, 1004), std::vector<long long>());
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 1), 1000, 1004), std::vector<long long>());
+
+    // ticks that haven't been processed yet are not searched
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1003, 2000, 0, 1004), std::vector<long long>({ 32, 37 }));
+
+    // events of fromTick before fromLogId are skipped
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1001, 1, 0, 0), 1001, 1004, 25), std::vector<long long>({ 25, 26, 27, 28, 29 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1001, 1004, 13), std::vector<long long>({ 32, 37 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1000, 1004, 1), std::vector<long long>({ 2, 12, 32, 37 }));
+
+    // invalid tick ranges
+    std::vector<long long> logIds;
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 999, 1004, 0, logIds), nullptr);
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1005, 1010, 0, logIds), nullptr);
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1003, 1002, 0, logIds), nullptr);
+    EXPECT_TRUE(logIds.empty());
+
+    // state loaded without entity filters (saved by older version): committed ticks are searched without filter
+    qLogger::disableEntityFiltersOfCommittedTicks();
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1000, 1004), std::vector<long long>({ 2, 12, 32, 37 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1001, 1, 0, 0), 1000, 1004), expectedLogIds);
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(31, 0, 0, 0), 1000, 1004), std::vector<long long>());
+
+    // ticks committed later have filters again
+    test.addTick(1005, 3);
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(3, 0, 0, 0), 1000, 1005), std::vector<long long>({ 2, 12, 32, 37, 67 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1005, 1, 0, 0), 1000, 1005), std::vector<long long>({ 65, 66, 67 }));
+    EXPECT_EQ(test.getLogIdsOfEntity(m256i(1004, 1, 0, 0), 1005, 1005), std::vector<long long>());
+}
+
+TEST(TestCoreLogging, LogIdsOfEntityContinuedInTick)
+{
+    LogNetworkMessagesTest test;
+
+    // more matching events in tick 1001 than fit into one response (too many entities for a filter in that tick)
+    constexpr unsigned long long maxLogIds = (RequestResponseHeader::max_size / 2 - sizeof(RespondLogIdsOfEntity)) / sizeof(long long);
+    const m256i entity(9, 9, 9, 9);
+    test.addTick(1000, 5, entity);
+    test.addTick(1001, maxLogIds + 10, entity);
+    test.addTick(1002, 5, entity);
+    constexpr unsigned long long numberOfEvents = 5 + maxLogIds + 10 + 5;
+
+    std::vector<long long> logIds;
+    RespondLogIdsOfEntity* resp = test.getLogIdsOfEntity(entity, 1000, 1002, 0, logIds);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->numberOfLogIds, maxLogIds);
+    EXPECT_EQ(resp->nextTick, 1001);
+    EXPECT_EQ(resp->nextLogId, maxLogIds);
+
+    resp = test.getLogIdsOfEntity(entity, resp->nextTick, 1002, resp->nextLogId, logIds);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->numberOfLogIds, numberOfEvents - maxLogIds);
+    EXPECT_EQ(resp->nextTick, 1003);
+    EXPECT_EQ(resp->nextLogId, 0);
+
+    // no event is missed or returned twice
+    ASSERT_EQ(logIds.size(), numberOfEvents);
+    for (unsigned long long i = 0; i < numberOfEvents; i++)
+    {
+        EXPECT_EQ(logIds[i], i);
+    }
+}
+
+// largest toID <= maxToID, such that events [fromID, toID] fit into maxSize bytes (-1 if there is none)
+static long long getLastLogIdFittingReference(const std::vector<unsigned int>& eventSizes, unsigned long long fromID, unsigned long long maxToID,
+    unsigned long long maxSize)
+{
+    long long lastID = -1;
+    unsigned long long size = 0;
+    for (unsigned long long id = fromID; id <= maxToID && id < eventSizes.size(); id++)
+    {
+        size += eventSizes[id];
+        if (size > maxSize)
+        {
+            break;
+        }
+        lastID = id;
+    }
+    return lastID;
+}
+
+TEST(TestCoreLogging, LastLogIdFitting)
+{
+    LogNetworkMessagesTest test;
+
+    // empty log
+    EXPECT_EQ(qLogger::logBuf.getNumberOfLogIds(), 0);
+    EXPECT_EQ(qLogger::logBuf.getLastLogIdFitting(0, 0, RequestResponseHeader::max_size), -1);
+    EXPECT_EQ(qLogger::logBuf.getLastLogIdFitting(0, 100, RequestResponseHeader::max_size), -1);
+    EXPECT_EQ(qLogger::logBuf.getBlobInfo(0).startIndex, -1);
+
+    // events of different sizes in several ticks
+    const std::vector<unsigned short> numbersOfBurns = { 1, 2, 0, 100, 3, 1000, 5, 5, 0, 20000, 1, 7 };
+    std::vector<unsigned int> eventSizes;
+    for (unsigned int i = 0; i < numbersOfBurns.size(); i++)
+    {
+        const unsigned int tick = 1000 + i / 4;
+        system.tick = tick;
+        logger.registerNewTx(tick, i % 4);
+        eventSizes.push_back(test.logDustBurning(numbersOfBurns[i]));
+        if (i % 4 == 3)
+        {
+            logger.updateTick(tick);
+        }
+    }
+
+    // events of tx that hasn't ended are not available yet
+    system.tick = 1003;
+    logger.registerNewTx(1003, 0);
+    test.logDustBurning(10);
+    EXPECT_EQ(qLogger::logBuf.getNumberOfLogIds(), eventSizes.size());
+
+    // sizes that fit the events exactly or are one byte too small or too large
+    std::vector<unsigned long long> maxSizes = { 0, 1, LOG_HEADER_SIZE - 1, LOG_HEADER_SIZE, RequestResponseHeader::max_size };
+    for (unsigned int fromID = 0; fromID < eventSizes.size(); fromID++)
+    {
+        unsigned long long size = 0;
+        for (unsigned int toID = fromID; toID < eventSizes.size(); toID++)
+        {
+            size += eventSizes[toID];
+            maxSizes.push_back(size - 1);
+            maxSizes.push_back(size);
+            maxSizes.push_back(size + 1);
+        }
+    }
+
+    const unsigned long long numberOfEvents = eventSizes.size();
+    for (unsigned long long fromID = 0; fromID < numberOfEvents + 2; fromID++)
+    {
+        for (unsigned long long maxToID : { fromID - 1, fromID, fromID + 1, fromID + 3, numberOfEvents - 1, numberOfEvents, numberOfEvents + 100 })
+        {
+            for (unsigned long long maxSize : maxSizes)
+            {
+                const long long expected = (maxToID >= fromID) ? getLastLogIdFittingReference(eventSizes, fromID, maxToID, maxSize) : -1;
+                EXPECT_EQ(qLogger::logBuf.getLastLogIdFitting(fromID, maxToID, maxSize), expected)
+                    << "fromID " << fromID << ", maxToID " << maxToID << ", maxSize " << maxSize;
+            }
+        }
+    }
+}
+
+TEST(TestCoreLogging, LogPage)
+{
+    LogNetworkMessagesTest test;
+    unsigned long long eventsSize;
+
+    // empty log
+    RespondLogPage* resp = test.getLogPage(0, 10, eventsSize);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->nextLogId, -1);
+    EXPECT_EQ(eventsSize, 0);
+
+    // events that need several pages (large ones fill pages only partly)
+    std::vector<unsigned int> eventSizes;
+    for (unsigned int tick = 1000; tick < 1010; tick++)
+    {
+        system.tick = tick;
+        logger.registerNewTx(tick, 0);
+        for (unsigned int i = 0; i < 20; i++)
+        {
+            eventSizes.push_back(test.logDustBurning((i == 7) ? 65535 : (unsigned short)(i * 37 % 500)));
+        }
+        logger.updateTick(tick);
+    }
+    const unsigned long long numberOfEvents = eventSizes.size();
+    constexpr unsigned long long maxEventsSize = RequestResponseHeader::max_size - sizeof(RequestResponseHeader) - sizeof(RespondLogPage);
+
+    // follow nextLogId until end of requested range
+    for (unsigned long long toID : { numberOfEvents - 1, numberOfEvents + 1000, 100ULL, 5ULL })
+    {
+        unsigned long long fromID = 0;
+        unsigned int numberOfPages = 0;
+        while (fromID <= toID && fromID < numberOfEvents)
+        {
+            resp = test.getLogPage(fromID, toID, eventsSize);
+            ASSERT_NE(resp, nullptr);
+            ASSERT_GT(resp->nextLogId, (long long)fromID);
+            EXPECT_LE(resp->nextLogId, (long long)min(toID, numberOfEvents - 1) + 1);
+
+            // events [fromID, nextLogId) are returned, the next one wouldn't fit
+            const char* event = (const char*)(resp + 1);
+            unsigned long long size = 0;
+            for (unsigned long long id = fromID; id < (unsigned long long)resp->nextLogId; id++)
+            {
+                EXPECT_EQ(*((unsigned long long*)(event + size + 10)), id);
+                size += eventSizes[id];
+            }
+            EXPECT_EQ(size, eventsSize);
+            EXPECT_LE(eventsSize, maxEventsSize);
+            if ((unsigned long long)resp->nextLogId <= min(toID, numberOfEvents - 1))
+            {
+                EXPECT_GT(eventsSize + eventSizes[resp->nextLogId], maxEventsSize);
+            }
+            fromID = resp->nextLogId;
+            numberOfPages++;
+        }
+        EXPECT_EQ(fromID, min(toID, numberOfEvents - 1) + 1);
+        EXPECT_GT(numberOfPages, (toID > 100) ? 1u : 0u);
+    }
+
+    // fromID after last log event or toID before fromID
+    resp = test.getLogPage(numberOfEvents, numberOfEvents + 10, eventsSize);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->nextLogId, -1);
+    EXPECT_EQ(eventsSize, 0);
+    resp = test.getLogPage(10, 9, eventsSize);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->nextLogId, -1);
+    EXPECT_EQ(eventsSize, 0);
+
+    // single event
+    resp = test.getLogPage(numberOfEvents - 1, numberOfEvents - 1, eventsSize);
+    ASSERT_NE(resp, nullptr);
+    EXPECT_EQ(resp->nextLogId, numberOfEvents);
+    EXPECT_EQ(eventsSize, eventSizes.back());
+
+    // wrong passcode
+    RequestMessage<RequestLogPage> request;
+    request.header.checkAndSetSize(sizeof(request));
+    request.header.setType(RequestLogPage::type);
+    request.header.setDejavu(1);
+    copyMem(request.payload.passcode, logReaderPasscodes, sizeof(request.payload.passcode));
+    request.payload.passcode[0]++;
+    request.payload.fromID = 0;
+    request.payload.toID = 10;
+    qLogger::processRequestLogPage(0, &test.peer, &request.header);
+    RequestResponseHeader* response = test.popResponse();
+    ASSERT_NE(response, nullptr);
+    EXPECT_EQ(response->size(), sizeof(RequestResponseHeader));
+}
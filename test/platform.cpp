@@ -5,6 +5,13 @@
 #include "../src/platform/stack_size_tracker.h"
 #include "../src/platform/custom_stack.h"
 #include "../src/platform/profiling.h"
+#include "../src/platform/parallel_jobs.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <sstream>
 
 TEST(TestCoreReadWriteLock, SimpleSingleThread)
 {
@@ -199,6 +206,55 @@ void iterativeProfilingTest(int n)
     }
 }
 
+struct ParallelJobTestContext
+{
+    volatile long partCounts[64];
+};
+
+static void parallelJobTestFunction(void* context, unsigned int partIndex)
+{
+    ParallelJobTestContext* c = (ParallelJobTestContext*)context;
+    _InterlockedIncrement(&c->partCounts[partIndex]);
+}
+
+TEST(TestCoreParallelJobs, ManyBackToBackJobsWithSpinningHelpers)
+{
+    // Helpers spin on helpWithParallelJob() while the main thread runs many short jobs, each with its context and
+    // job struct on the stack. A helper that still accessed a job after runParallelJob() returned would process parts
+    // of a stale frame, which shows up as wrong part counts.
+    std::atomic<bool> stopHelpers = false;
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 0; i < 4; ++i)
+        helpers.emplace_back([&stopHelpers]() { while (!stopHelpers) helpWithParallelJob(); });
+
+    constexpr unsigned int numberOfJobs = 100000;
+    bool allPartsProcessedOnce = true;
+    for (unsigned int job = 0; job < numberOfJobs && allPartsProcessedOnce; ++job)
+    {
+        ParallelJobTestContext context;
+        for (unsigned int i = 0; i < 64; ++i)
+            context.partCounts[i] = 0;
+        const unsigned int numberOfParts = 1 + job % 64;
+
+        runParallelJob(parallelJobTestFunction, &context, numberOfParts);
+
+        for (unsigned int i = 0; i < 64; ++i)
+            allPartsProcessedOnce &= (context.partCounts[i] == ((i < numberOfParts) ? 1 : 0));
+
+        // overwrite context, so stale accesses change the counts of the next check
+        for (unsigned int i = 0; i < 64; ++i)
+            context.partCounts[i] = 0x1000;
+    }
+    EXPECT_TRUE(allPartsProcessedOnce);
+
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+
+    EXPECT_EQ(currentParallelJob, nullptr);
+    EXPECT_EQ(parallelJobHelperCount, 0);
+}
+
 TEST(TestCoreProfiling, SleepTest)
 {
     ProfilingStopwatch profStopwatch(__FUNCTION__, __LINE__);
@@ -324,3 +380,135 @@ TEST(TestCoreProfiling, CheckTicksToMicroseconds)
     checkTicksToMicroseconds(2, 0xffffffffffffffffllu, 12345);
     checkTicksToMicroseconds(2, 0xffffffffffffffffllu, 123456);
 }
+
+TEST(TestCoreProfiling, ExecutionTimeHistogram)
+{
+    ExecutionTimeHistogram h;
+    setMem((void*)&h, sizeof(h), 0);
+    EXPECT_EQ(h.count(), 0);
+
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(0), 0);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(1), 0);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(2), 1);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(3), 1);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(4), 2);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(1023), 9);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(1024), 10);
+    EXPECT_EQ(ExecutionTimeHistogram::getBucket(0xffffffffffffffffllu), ExecutionTimeHistogram::bucketCount - 1);
+
+    // 98 short and 2 long executions
+    for (int i = 0; i < 98; ++i)
+        h.add(100);
+    h.add(100000);
+    h.add(100000);
+    EXPECT_EQ(h.count(), 100);
+    EXPECT_EQ(h.totalTicks, 98 * 100 + 2 * 100000);
+    EXPECT_EQ(h.bucketCounts[6], 98);
+    EXPECT_EQ(h.bucketCounts[16], 2);
+    EXPECT_EQ(h.percentileUpperBound(50), 128);
+    EXPECT_EQ(h.percentileUpperBound(98), 128);
+    EXPECT_EQ(h.percentileUpperBound(99), 131072);
+}
+
+TEST(TestCoreProfiling, ConcurrentMeasurementsAndCsv)
+{
+    ProfilingDataCollector collector;
+    EXPECT_TRUE(collector.init(16));
+
+    // record measurements from multiple threads at the same time (more threads than shards, so some threads
+    // have their own shard and others share one)
+    constexpr int threadCount = ProfilingDataCollector::shardCount + 8;
+    static const char* names[4] = { "name0", "name1", "name2", "name3" };
+    unsigned long long processorIds[threadCount];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&collector, &processorIds, t]()
+            {
+                processorIds[t] = getRunningProcessorID();
+                for (unsigned long long i = 1; i <= 1000; ++i)
+                    collector.addMeasurement(names[(t + i) % 4], 10 + t % 2, 100, 100 + i);
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    EXPECT_EQ(collector.droppedMeasurements(), 0);
+
+    // each thread must have run as a different processor, otherwise all measurements end up in one shard
+    std::sort(processorIds, processorIds + threadCount);
+    EXPECT_EQ(std::unique(processorIds, processorIds + threadCount) - processorIds, threadCount);
+
+    // check merged data (4 names x 2 lines)
+    ::frequency = 1000000;
+    char csv[4096];
+    unsigned int csvSize = collector.writeCsvToBuffer(csv, sizeof(csv));
+    std::string csvString(csv, csvSize);
+    EXPECT_EQ(std::count(csvString.begin(), csvString.end(), '\n'), 9);
+    std::istringstream lines(csvString);
+    std::string line;
+    std::getline(lines, line); // skip header
+    unsigned long long totalCount = 0, totalSum = 0;
+    while (std::getline(lines, line))
+    {
+        // idx,"name",line,count,sum,avg,min,max (1 tick = 1 microsecond)
+        unsigned long long values[6];
+        EXPECT_EQ(sscanf(line.c_str() + line.find("\",") + 2, "%llu,%llu,%llu,%llu,%llu,%llu",
+            &values[0], &values[1], &values[2], &values[3], &values[4], &values[5]), 6);
+        EXPECT_EQ(values[1], threadCount / 2 * 250);
+        EXPECT_GE(values[4], 1);
+        EXPECT_LE(values[4], 4);
+        EXPECT_GE(values[5], 997);
+        EXPECT_LE(values[5], 1000);
+        totalCount += values[1];
+        totalSum += values[2];
+    }
+    EXPECT_EQ(totalCount, threadCount * 1000);
+    EXPECT_EQ(totalSum, threadCount * 500500);
+
+    // truncate at end of line if buffer is too small
+    csvSize = collector.writeCsvToBuffer(csv, 150);
+    EXPECT_LE(csvSize, 150);
+    EXPECT_GT(csvSize, 0);
+    EXPECT_EQ(csv[csvSize - 1], '\n');
+    ::frequency = 0;
+
+    collector.deinit();
+}
+
+TEST(TestCoreProfiling, EventTracerChromeTraceJson)
+{
+    ProfilingEventTracer tracer;
+
+    // tracer without buffers ignores events
+    tracer.addEvent("ignored", 0, 1);
+    EXPECT_EQ(tracer.writeChromeTraceFile(), -1);
+
+    EXPECT_TRUE(tracer.init(4));
+    ::frequency = 1000000000; // 1 tick = 1 nanosecond
+
+    // ring buffer keeps the last 4 events of each processor
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        tracer.setTick(100 + i);
+        tracer.addEvent("phase", 1000 + i * 10000, 1000 + i * 10000 + 1234);
+    }
+
+    std::vector<char> buffer(4096);
+    unsigned int numberOfEvents = 0;
+    unsigned long long size = tracer.writeChromeTraceJson(buffer.data(), buffer.size(), &numberOfEvents);
+    std::string json(buffer.data(), size);
+    EXPECT_EQ(numberOfEvents, 4);
+    EXPECT_EQ(json.find("\"tick\":101"), std::string::npos);
+    EXPECT_NE(json.find("{\"name\":\"phase\",\"ph\":\"X\",\"pid\":0,\"tid\":" + std::to_string((unsigned int)getRunningProcessorID()) + ",\"ts\":0.000,\"dur\":1.234,\"args\":{\"tick\":102}}"), std::string::npos);
+    EXPECT_NE(json.find("\"ts\":30.000,\"dur\":1.234,\"args\":{\"tick\":105}}"), std::string::npos);
+    EXPECT_EQ(json.substr(0, 39), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+
+    // events not fitting into buffer are omitted
+    size = tracer.writeChromeTraceJson(buffer.data(), 300, &numberOfEvents);
+    EXPECT_LE(size, 300);
+    EXPECT_EQ(numberOfEvents, 1);
+
+    ::frequency = 0;
+    tracer.deinit();
+}
@@ -3,6 +3,7 @@
 #include "gtest/gtest.h"
 
 #include <type_traits>
+#include <random>
 
 // workaround for name clash with stdlib
 #define system qubicSystemStruct
@@ -13,6 +14,7 @@
 #include "../src/contract_core/qpi_trivial_impl.h"
 #include "../src/contract_core/qpi_proposal_voting.h"
 #include "../src/contract_core/qpi_system_impl.h"
+#include "../src/contract_core/qpi_asset_impl.h"
 
 // changing offset simulates changed computor set with changed epoch
 void initComputors(unsigned short computorIdOffset)
@@ -557,6 +559,123 @@ TEST(TestCoreQPI, ProposalWithAllVoteDataYesNoProposals)
     EXPECT_FALSE(proposal.checkValidity());
 }
 
+// Check running sums of ProposalWithAllVoteDataAndSummary against summary computed from all votes
+template <typename ProposalT, QPI::uint32 numVoters>
+void expectRunningSummaryMatchesVotes(
+    const QPI::ProposalWithAllVoteDataAndSummary<ProposalT, numVoters>& pwav,
+    const QPI::uint32* weights
+)
+{
+    QPI::ProposalSummarizedVotingDataV1 summary;
+    summary.optionCount = QPI::ProposalTypes::optionCount(pwav.type);
+    pwav.getVotingSummary(summary);
+
+    QPI::uint32 totalVotes = 0;
+    QPI::uint32 optionVoteCount[8] = { 0 };
+    QPI::sint64 scalarSum = 0;
+    for (QPI::uint32 i = 0; i < numVoters; ++i)
+    {
+        QPI::sint64 value = pwav.getVoteValue(i);
+        if (value == QPI::NO_VOTE_VALUE)
+            continue;
+        totalVotes += weights[i];
+        if (pwav.type == QPI::ProposalTypes::VariableScalarMean)
+            scalarSum += value * weights[i];
+        else
+            optionVoteCount[value] += weights[i];
+    }
+
+    EXPECT_EQ(summary.totalVotes, totalVotes);
+    if (pwav.type == QPI::ProposalTypes::VariableScalarMean)
+    {
+        EXPECT_EQ(summary.scalarVotingResult, (totalVotes) ? scalarSum / QPI::sint64(totalVotes) : 0);
+    }
+    else
+    {
+        for (QPI::uint32 i = 0; i < 8; ++i)
+            EXPECT_EQ(summary.optionVoteCount.get(i), optionVoteCount[i]);
+    }
+}
+
+TEST(TestCoreQPI, ProposalWithAllVoteDataAndSummary)
+{
+    typedef QPI::ProposalDataV1<true> ProposalT;
+    constexpr QPI::uint32 numVoters = 42;
+    QPI::ProposalWithAllVoteDataAndSummary<ProposalT, numVoters> pwav;
+    QPI::uint32 weights[numVoters];
+    for (QPI::uint32 i = 0; i < numVoters; ++i)
+        weights[i] = i % 5 + 1;
+    std::mt19937_64 gen64(42);
+
+    // option voting: change and remove votes randomly
+    ProposalT proposal;
+    proposal.type = QPI::ProposalTypes::type(QPI::ProposalTypes::Class::GeneralOptions, 8);
+    EXPECT_TRUE(pwav.set(proposal));
+    expectRunningSummaryMatchesVotes(pwav, weights);
+    for (int i = 0; i < 1000; ++i)
+    {
+        QPI::uint32 voterIndex = gen64() % numVoters;
+        QPI::sint64 value = gen64() % 9;
+        if (value == 8)
+            value = QPI::NO_VOTE_VALUE;
+        EXPECT_TRUE(pwav.setVoteValue(voterIndex, value, weights[voterIndex]));
+        if (i % 50 == 0)
+            expectRunningSummaryMatchesVotes(pwav, weights);
+    }
+    expectRunningSummaryMatchesVotes(pwav, weights);
+
+    // invalid votes do not change sums
+    EXPECT_FALSE(pwav.setVoteValue(numVoters, 1, 1));
+    EXPECT_FALSE(pwav.setVoteValue(0, 8, weights[0]));
+    expectRunningSummaryMatchesVotes(pwav, weights);
+
+    // setting proposal resets sums
+    proposal.type = QPI::ProposalTypes::VariableScalarMean;
+    proposal.variableScalar.minValue = -1000000000;
+    proposal.variableScalar.maxValue = 1000000000;
+    EXPECT_TRUE(pwav.set(proposal));
+    expectRunningSummaryMatchesVotes(pwav, weights);
+
+    // scalar voting: mean is rounded toward zero
+    for (int i = 0; i < 1000; ++i)
+    {
+        QPI::uint32 voterIndex = gen64() % numVoters;
+        QPI::sint64 value = QPI::sint64(gen64() % 2000000001) - 1000000000;
+        if (gen64() % 10 == 0)
+            value = QPI::NO_VOTE_VALUE;
+        EXPECT_TRUE(pwav.setVoteValue(voterIndex, value, weights[voterIndex]));
+        if (i % 50 == 0)
+            expectRunningSummaryMatchesVotes(pwav, weights);
+    }
+    expectRunningSummaryMatchesVotes(pwav, weights);
+
+    // scalar voting with extreme values does not overflow
+    proposal.variableScalar.minValue = proposal.variableScalar.minSupportedValue;
+    proposal.variableScalar.maxValue = proposal.variableScalar.maxSupportedValue;
+    EXPECT_TRUE(pwav.set(proposal));
+    QPI::ProposalSummarizedVotingDataV1 summary;
+    for (QPI::uint32 i = 0; i < numVoters; ++i)
+        EXPECT_TRUE(pwav.setVoteValue(i, proposal.variableScalar.maxValue, 1000));
+    pwav.getVotingSummary(summary);
+    EXPECT_EQ(summary.totalVotes, numVoters * 1000);
+    EXPECT_EQ(summary.scalarVotingResult, proposal.variableScalar.maxValue);
+    for (QPI::uint32 i = 0; i < numVoters; ++i)
+        EXPECT_TRUE(pwav.setVoteValue(i, proposal.variableScalar.minValue, 1000));
+    pwav.getVotingSummary(summary);
+    EXPECT_EQ(summary.scalarVotingResult, proposal.variableScalar.minValue);
+    EXPECT_TRUE(pwav.setVoteValue(0, proposal.variableScalar.maxValue, 1000));
+    pwav.getVotingSummary(summary);
+    EXPECT_EQ(summary.scalarVotingResult, -8784163844623596006); // -(max * 40 / 42)
+
+    // only two votes: 3 * max + min = 2 * max, which is divided by 4
+    EXPECT_TRUE(pwav.set(proposal));
+    EXPECT_TRUE(pwav.setVoteValue(0, proposal.variableScalar.maxValue, 3));
+    EXPECT_TRUE(pwav.setVoteValue(1, proposal.variableScalar.minValue, 1));
+    pwav.getVotingSummary(summary);
+    EXPECT_EQ(summary.totalVotes, 4);
+    EXPECT_EQ(summary.scalarVotingResult, proposal.variableScalar.maxValue / 2);
+}
+
 template <typename ProposalVotingType>
 void expectNoVotes(
     const QPI::QpiContextFunctionCall& qpi,
@@ -1171,5 +1290,122 @@ TEST(TestCoreQPI, ProposalVotingV1proposalByAnyoneWithoutScalarVoteSupport)
 }
 
 
+TEST(TestCoreQPI, ProposalVotingByShareholders)
+{
+    ContractExecInitDeinitGuard initDeinitGuard;
+    EXPECT_TRUE(initAssets());
+    setMem(assets, ASSETS_CAPACITY * sizeof(assets[0]), 0);
+    as.indexLists.reset();
+
+    system.tick = 123456789;
+    system.epoch = 12345;
+
+    // issue contract shares and distribute them to 30 shareholders with i shares each, remaining shares go to holder 0
+    constexpr QPI::uint32 holderCount = 30;
+    int issuanceIdx, ownershipIdx, possessionIdx, destOwnershipIdx, destPossessionIdx;
+    EXPECT_EQ(issueAsset(m256i::zero(), "SHAREHO", 0, CONTRACT_ASSET_UNIT_OF_MEASUREMENT, NUMBER_OF_COMPUTORS, QX_CONTRACT_INDEX, &issuanceIdx, &ownershipIdx, &possessionIdx), NUMBER_OF_COMPUTORS);
+    QPI::uint32 expectedShares[holderCount];
+    QPI::uint32 sharesTransferred = 0;
+    for (QPI::uint32 i = 1; i < holderCount; ++i)
+    {
+        EXPECT_TRUE(transferShareOwnershipAndPossession(ownershipIdx, possessionIdx, QPI::id(i, 9, 8, 7), i, &destOwnershipIdx, &destPossessionIdx, false));
+        expectedShares[i] = i;
+        sharesTransferred += i;
+    }
+    EXPECT_TRUE(transferShareOwnershipAndPossession(ownershipIdx, possessionIdx, QPI::id(0, 9, 8, 7), NUMBER_OF_COMPUTORS - sharesTransferred, &destOwnershipIdx, &destPossessionIdx, false));
+    expectedShares[0] = NUMBER_OF_COMPUTORS - sharesTransferred;
+
+    QpiContextUserProcedureCall qpi(0, QPI::id(1, 2, 3, 4), 123);
+    typedef QPI::ProposalAndVotingByShareholders<8, 0x4f484552414853> ProposerAndVoterHandling; // asset name "SHAREHO"
+    auto* pv = new QPI::ProposalVoting<ProposerAndVoterHandling, QPI::ProposalDataV1<true>>;
+    QPI::setMemory(*pv, 0);
+
+    // before first proposal of epoch, voters are determined from current possessions
+    QPI::uint32 voterIndicesBeforeProposal[holderCount];
+    for (QPI::uint32 i = 0; i < holderCount; ++i)
+    {
+        voterIndicesBeforeProposal[i] = qpi(*pv).voterIndex(QPI::id(i, 9, 8, 7));
+        EXPECT_LT(voterIndicesBeforeProposal[i], pv->maxVoters);
+        EXPECT_EQ(qpi(*pv).voterId(voterIndicesBeforeProposal[i]), QPI::id(i, 9, 8, 7));
+        EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, voterIndicesBeforeProposal[i]), expectedShares[i]);
+    }
+    EXPECT_EQ(qpi(*pv).voterIndex(QPI::id(1234, 9, 8, 7)), QPI::INVALID_VOTER_INDEX);
+    EXPECT_EQ(qpi(*pv).voterId(holderCount), QPI::NULL_ID);
+    EXPECT_EQ(pv->proposersAndVoters.getTotalVoteWeight(qpi), NUMBER_OF_COMPUTORS);
+
+    // fail: non-shareholder cannot propose
+    QPI::ProposalDataV1<true> proposal;
+    proposal.url.set(0, 0);
+    proposal.epoch = qpi.epoch();
+    proposal.type = QPI::ProposalTypes::ThreeOptions;
+    setProposalExpectFailure(qpi, pv, QPI::id(1234, 9, 8, 7), proposal);
+
+    // okay: shareholder sets proposal, which captures all shareholders
+    EXPECT_EQ((int)qpi(*pv).setProposal(QPI::id(3, 9, 8, 7), proposal), 0);
+    QPI::uint32 voterIndices[holderCount];
+    for (QPI::uint32 i = 0; i < holderCount; ++i)
+    {
+        voterIndices[i] = qpi(*pv).voterIndex(QPI::id(i, 9, 8, 7));
+        EXPECT_EQ(voterIndices[i], voterIndicesBeforeProposal[i]);
+        EXPECT_LT(voterIndices[i], pv->maxVoters);
+        EXPECT_EQ(qpi(*pv).voterId(voterIndices[i]), QPI::id(i, 9, 8, 7));
+        EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, voterIndices[i]), expectedShares[i]);
+    }
+    EXPECT_EQ(qpi(*pv).voterIndex(QPI::id(1234, 9, 8, 7)), QPI::INVALID_VOTER_INDEX);
+    EXPECT_EQ(qpi(*pv).voterIndex(QPI::NULL_ID), QPI::INVALID_VOTER_INDEX);
+    EXPECT_EQ(qpi(*pv).voterId(holderCount), QPI::NULL_ID);
+
+    // votes are weighted by shares
+    QPI::ProposalSummarizedVotingDataV1 summary;
+    QPI::uint32 expectedOptionVotes[3] = { 0 };
+    for (QPI::uint32 i = 0; i < holderCount; i += 2)
+    {
+        voteWithValidVoter<true>(qpi, *pv, QPI::id(i, 9, 8, 7), 0, proposal.type, qpi.tick(), i % 3);
+        expectedOptionVotes[i % 3] += expectedShares[i];
+    }
+    EXPECT_TRUE(qpi(*pv).getVotingSummary(0, summary));
+    EXPECT_EQ(summary.authorizedVoters, NUMBER_OF_COMPUTORS);
+    EXPECT_EQ(summary.totalVotes, expectedOptionVotes[0] + expectedOptionVotes[1] + expectedOptionVotes[2]);
+    for (QPI::uint32 i = 0; i < 3; ++i)
+        EXPECT_EQ(summary.optionVoteCount.get(i), expectedOptionVotes[i]);
+
+    // changing vote moves weight to other option, removing vote subtracts weight
+    voteWithValidVoter<true>(qpi, *pv, QPI::id(0, 9, 8, 7), 0, proposal.type, qpi.tick(), 2);
+    expectedOptionVotes[0] -= expectedShares[0];
+    expectedOptionVotes[2] += expectedShares[0];
+    voteWithValidVoter<true>(qpi, *pv, QPI::id(2, 9, 8, 7), 0, proposal.type, qpi.tick(), QPI::NO_VOTE_VALUE);
+    expectedOptionVotes[2] -= expectedShares[2];
+    EXPECT_TRUE(qpi(*pv).getVotingSummary(0, summary));
+    EXPECT_EQ(summary.totalVotes, expectedOptionVotes[0] + expectedOptionVotes[1] + expectedOptionVotes[2]);
+    for (QPI::uint32 i = 0; i < 3; ++i)
+        EXPECT_EQ(summary.optionVoteCount.get(i), expectedOptionVotes[i]);
+
+    // shares transferred after capturing shareholders cannot be used to vote again in same epoch
+    EXPECT_TRUE(transferShareOwnershipAndPossession(destOwnershipIdx, destPossessionIdx, QPI::id(1234, 9, 8, 7), 10, &destOwnershipIdx, &destPossessionIdx, false));
+    EXPECT_EQ((int)qpi(*pv).setProposal(QPI::id(5, 9, 8, 7), proposal), 1);
+    voteWithInvalidVoter(qpi, *pv, QPI::id(1234, 9, 8, 7), 0, proposal.type, qpi.tick(), 1);
+    EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, voterIndices[0]), expectedShares[0]);
+
+    // in next epoch, voters queried before any proposal already reflect the transferred shares
+    system.epoch++;
+    QPI::uint32 newVoterIndex = qpi(*pv).voterIndex(QPI::id(1234, 9, 8, 7));
+    EXPECT_LT(newVoterIndex, pv->maxVoters);
+    EXPECT_EQ(qpi(*pv).voterId(newVoterIndex), QPI::id(1234, 9, 8, 7));
+    EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, newVoterIndex), 10);
+    EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, qpi(*pv).voterIndex(QPI::id(0, 9, 8, 7))), expectedShares[0] - 10);
+    EXPECT_EQ(pv->proposersAndVoters.getTotalVoteWeight(qpi), NUMBER_OF_COMPUTORS);
+
+    // shareholders are captured again with first proposal, keeping the voter indices
+    proposal.epoch = qpi.epoch();
+    EXPECT_EQ((int)qpi(*pv).setProposal(QPI::id(1234, 9, 8, 7), proposal), 2);
+    EXPECT_EQ(qpi(*pv).voterIndex(QPI::id(1234, 9, 8, 7)), newVoterIndex);
+    EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, newVoterIndex), 10);
+    EXPECT_EQ(pv->proposersAndVoters.getVoteWeight(qpi, qpi(*pv).voterIndex(QPI::id(0, 9, 8, 7))), expectedShares[0] - 10);
+    EXPECT_EQ(pv->proposersAndVoters.getTotalVoteWeight(qpi), NUMBER_OF_COMPUTORS);
+
+    delete pv;
+    deinitAssets();
+}
+
 // TODO: ProposalVoting YesNo
 
@@ -6,6 +6,8 @@
 
 #include <chrono>
 #include <random>
+#include <thread>
+#include <atomic>
 
 #include "logging_test.h"
 #include "spectrum/spectrum.h"
@@ -78,6 +80,23 @@ static SpectrumInfo checkAndGetInfo()
     EXPECT_LE((unsigned long long)si.totalAmount, MAX_SUPPLY);
     EXPECT_EQ(si.totalAmount, spectrumInfo.totalAmount);
     EXPECT_EQ(si.numberOfEntities, spectrumInfo.numberOfEntities);
+
+    // Continuously updated entity category populations are consistent with counting from scratch
+    unsigned int populations[entityCategoryCount];
+    countEntityCategoryPopulations(populations);
+    for (int i = 0; i < entityCategoryCount; ++i)
+        EXPECT_EQ(populations[i], entityCategoryPopulations[i]);
+
+    // Fingerprint tags are consistent with spectrum
+    unsigned int inconsistentTags = 0;
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        unsigned char expectedTag = isZero(spectrum[i].publicKey) ? 0 : spectrumTag(spectrum[i].publicKey);
+        if (spectrumTags[i] != expectedTag || (i < fingerprintTagsPadding && spectrumTags[SPECTRUM_CAPACITY + i] != expectedTag))
+            ++inconsistentTags;
+    }
+    EXPECT_EQ(inconsistentTags, 0);
+
     return si;
 }
 
@@ -148,6 +167,8 @@ struct SpectrumTest : public LoggingTest
     {
         memset(spectrum, 0, spectrumSizeInBytes);
         updateSpectrumInfo();
+        countEntityCategoryPopulations();
+        rebuildSpectrumTags();
     }
 
     void beforeAntiDust()
@@ -283,6 +304,7 @@ TEST(TestCoreSpectrum, AntiDustEdgeCaseAllInSameBin)
 SpectrumStats getSpectrumStatsLog(long long id)
 {
     SpectrumStats res;
+    logger.flushStagedLogEvents();
     qLogger::BlobInfo bi = logger.logBuf.getBlobInfo(id);
     EXPECT_EQ(bi.length, LOG_HEADER_SIZE + sizeof(SpectrumStats));
     logger.logBuf.getMany((char*)&res, bi.startIndex + LOG_HEADER_SIZE, sizeof(SpectrumStats));
@@ -292,6 +314,7 @@ SpectrumStats getSpectrumStatsLog(long long id)
 void getDustBurningLog(long long id, char* ptr)
 {
     DustBurning res;
+    logger.flushStagedLogEvents();
     qLogger::BlobInfo bi = logger.logBuf.getBlobInfo(id);
     logger.logBuf.getMany((char*)&res, bi.startIndex + LOG_HEADER_SIZE, sizeof(DustBurning));
     EXPECT_EQ(bi.length, LOG_HEADER_SIZE + res.messageSize());
@@ -407,3 +430,505 @@ TEST(TestCoreSpectrum, AntiDustEdgeCaseHugeBinZeroBalance)
     test.afterAntiDust();
 }
 
+
+// Serial reference implementation of reorganizeSpectrum() (state before parallelization)
+static void reorganizeSpectrumReference(EntityRecord* reorgSpectrum, m256i* digests)
+{
+    setMem(reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord), 0);
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        if (spectrum[i].incomingAmount - spectrum[i].outgoingAmount)
+        {
+            unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            while (!isZero(reorgSpectrum[index].publicKey))
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(EntityRecord));
+        }
+    }
+
+    unsigned int digestIndex;
+    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+        KangarooTwelve64To32(&reorgSpectrum[digestIndex], &digests[digestIndex]);
+    unsigned int previousLevelBeginning = 0;
+    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
+    while (numberOfLeafs > 1)
+    {
+        for (unsigned int i = 0; i < numberOfLeafs; i += 2)
+            KangarooTwelve64To32(&digests[previousLevelBeginning + i], &digests[digestIndex++]);
+        previousLevelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+    }
+}
+
+static void testParallelReorganizeSpectrum(unsigned int helperThreads, bool lastPartsWithoutEmptySlot = false)
+{
+    SpectrumTest test;
+
+    if (lastPartsWithoutEmptySlot)
+    {
+        // One cluster covering the last one and a half parts and wrapping around the end of the hash map, so the
+        // range of the part before handles the wrapped cluster
+        const unsigned int clusterBegin = SPECTRUM_CAPACITY - spectrumParallelPartSize - spectrumParallelPartSize / 2;
+        for (unsigned int i = clusterBegin; i < SPECTRUM_CAPACITY + 100; ++i)
+        {
+            m256i id(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+            id.m256i_u32[0] = (i < SPECTRUM_CAPACITY) ? i : SPECTRUM_CAPACITY - 1 - i % 5;
+            increaseEnergy(id, 1 + i % 100);
+            if (i % 3 == 0)
+                decreaseEnergy(spectrumIndex(id), 1 + i % 100);
+        }
+    }
+
+    // Fill spectrum with clusters, including one wrapping around the end of the hash map, and zero balances
+    const unsigned int homeIndexCount = (lastPartsWithoutEmptySlot) ? SPECTRUM_CAPACITY - 2 * spectrumParallelPartSize : SPECTRUM_CAPACITY;
+    for (unsigned long long i = 0; i < SPECTRUM_CAPACITY / 2; ++i)
+    {
+        m256i id(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        id.m256i_u32[0] %= homeIndexCount;
+        if (i % 1000 == 0 && !lastPartsWithoutEmptySlot)
+            id.m256i_u32[0] = SPECTRUM_CAPACITY - 1 - (i / 1000) % 7;
+        increaseEnergy(id, 1 + i % 100);
+        if (i % 3 == 0)
+            decreaseEnergy(spectrumIndex(id), 1 + i % 100);
+    }
+    ASSERT_FALSE(isZero(spectrum[SPECTRUM_CAPACITY - 1].publicKey));
+    ASSERT_FALSE(isZero(spectrum[0].publicKey));
+    for (unsigned int i = SPECTRUM_CAPACITY - spectrumParallelPartSize; lastPartsWithoutEmptySlot && i < SPECTRUM_CAPACITY; ++i)
+        ASSERT_FALSE(isZero(spectrum[i].publicKey));
+
+    std::vector<EntityRecord> expectedSpectrum(SPECTRUM_CAPACITY);
+    std::vector<m256i> expectedDigests(SPECTRUM_CAPACITY * 2 - 1);
+    reorganizeSpectrumReference(expectedSpectrum.data(), expectedDigests.data());
+
+    std::atomic<bool> stopHelpers = false;
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 0; i < helperThreads; ++i)
+        helpers.emplace_back([&stopHelpers]() { while (!stopHelpers) helpWithParallelJob(); });
+
+    reorganizeSpectrum();
+
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+
+    EXPECT_EQ(memcmp(spectrum, expectedSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(memcmp(spectrumDigests, expectedDigests.data(), spectrumDigestsSizeInByte), 0);
+    checkAndGetInfo();
+}
+
+TEST(TestCoreSpectrum, EntityCategoryPopulationsUpdatedContinuously)
+{
+    SpectrumTest test;
+    m256i id1(1, 2, 3, 4), id2(5, 6, 7, 8);
+
+    increaseEnergy(id1, 1);
+    EXPECT_EQ(entityCategoryPopulations[0], 1);
+
+    increaseEnergy(id1, 1000);
+    EXPECT_EQ(entityCategoryPopulations[0], 0);
+    EXPECT_EQ(entityCategoryPopulations[9], 1);
+
+    increaseEnergy(id2, 600);
+    EXPECT_EQ(entityCategoryPopulations[9], 2);
+
+    decreaseEnergy(spectrumIndex(id1), 1001);
+    EXPECT_EQ(entityCategoryPopulations[9], 1);
+
+    EXPECT_FALSE(decreaseEnergy(spectrumIndex(id2), 601));
+    EXPECT_TRUE(decreaseEnergy(spectrumIndex(id2), 100));
+    EXPECT_EQ(entityCategoryPopulations[8], 1);
+    EXPECT_EQ(entityCategoryPopulations[9], 0);
+
+    checkAndGetInfo();
+}
+
+TEST(TestCoreSpectrum, LookupWithFingerprintTags)
+{
+    SpectrumTest test;
+
+    // Create long cluster wrapping around the end of the hash map, with many entities sharing the same tag
+    std::vector<m256i> ids;
+    for (unsigned int i = 0; i < 300; ++i)
+    {
+        m256i id(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        id.m256i_u32[0] = SPECTRUM_CAPACITY - 100 + (i % 3);
+        if (i % 2)
+            id.m256i_u8[8] = 42;
+        increaseEnergy(id, i + 1);
+        ids.push_back(id);
+    }
+
+    for (unsigned int i = 0; i < ids.size(); ++i)
+    {
+        int index = spectrumIndex(ids[i]);
+        ASSERT_GE(index, 0);
+        EXPECT_EQ(spectrum[index].publicKey, ids[i]);
+        EXPECT_EQ(energy(index), i + 1);
+    }
+
+    // Entities not in the spectrum, with same home slot and same tag
+    m256i unknownId = ids[1];
+    unknownId.m256i_u64[3] ^= 1;
+    EXPECT_EQ(spectrumIndex(unknownId), -1);
+    unknownId.m256i_u32[0] = 5;
+    EXPECT_EQ(spectrumIndex(unknownId), -1);
+
+    // Adding to existing entity does not create new entry
+    increaseEnergy(ids[299], 1);
+    EXPECT_EQ(spectrumInfo.numberOfEntities, ids.size());
+    EXPECT_EQ(energy(spectrumIndex(ids[299])), 301);
+
+    checkAndGetInfo();
+}
+
+TEST(TestCoreSpectrum, IncreaseEnergiesSameAsIncreaseEnergy)
+{
+    SpectrumTest test;
+
+    // Credits to existing and new entities, many of them with the same home slot, some duplicates and invalid entries
+    std::vector<m256i> ids;
+    std::vector<long long> amounts;
+    for (unsigned int i = 0; i < 2000; ++i)
+    {
+        m256i id(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        if (i % 4 == 0)
+            id.m256i_u32[0] = SPECTRUM_CAPACITY - 10 + (i % 7);
+        if (i % 10 == 0 && i)
+            id = ids[i / 2];
+        if (i % 97 == 0)
+            id = m256i::zero();
+        ids.push_back(id);
+        amounts.push_back((i % 101 == 0) ? -1 : (long long)(test.rnd64() % 1000000));
+    }
+    for (unsigned int i = 0; i < 500; ++i)
+        increaseEnergy(ids[i], 1);
+
+    std::vector<EntityRecord> spectrumBefore(spectrum, spectrum + SPECTRUM_CAPACITY);
+    const SpectrumInfo infoBefore = spectrumInfo;
+
+    for (unsigned int i = 0; i < ids.size(); ++i)
+        increaseEnergy(ids[i], amounts[i]);
+    std::vector<EntityRecord> expectedSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+    const SpectrumInfo expectedInfo = spectrumInfo;
+
+    copyMem(spectrum, spectrumBefore.data(), spectrumSizeInBytes);
+    spectrumInfo = infoBefore;
+    countEntityCategoryPopulations();
+    rebuildSpectrumTags();
+
+    for (unsigned int i = 0; i < ids.size(); )
+        i += increaseEnergies(ids.data() + i, amounts.data() + i, (unsigned int)ids.size() - i);
+    EXPECT_EQ(memcmp(spectrum, expectedSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(spectrumInfo.numberOfEntities, expectedInfo.numberOfEntities);
+    EXPECT_EQ(spectrumInfo.totalAmount, expectedInfo.totalAmount);
+    EXPECT_EQ(increaseEnergies(nullptr, nullptr, 0), 0);
+
+    checkAndGetInfo();
+}
+
+// Credit entities with one increaseEnergy() each or with increaseEnergies() like distributeDividends(), logging each
+// QU transfer after crediting it. Returns all log events (with headers including log ID and log digest).
+static std::vector<char> creditAndLogTransfers(const std::vector<m256i>& ids, const std::vector<long long>& amounts, bool batched)
+{
+    qLogger::reset(system.tick);
+    logger.registerNewTx(system.tick, 0);
+    if (batched)
+    {
+        for (unsigned int i = 0; i < ids.size(); )
+        {
+            const unsigned int creditedEnd = i + increaseEnergies(ids.data() + i, amounts.data() + i, (unsigned int)ids.size() - i);
+            EXPECT_GT(creditedEnd, i);
+            for (; i < creditedEnd; ++i)
+            {
+                const QuTransfer quTransfer = { m256i::zero(), ids[i], amounts[i] };
+                logger.logQuTransfer(quTransfer);
+            }
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < ids.size(); ++i)
+        {
+            increaseEnergy(ids[i], amounts[i]);
+            const QuTransfer quTransfer = { m256i::zero(), ids[i], amounts[i] };
+            logger.logQuTransfer(quTransfer);
+        }
+    }
+
+    logger.flushStagedLogEvents();
+    std::vector<char> events;
+    for (unsigned long long logId = 0; ; ++logId)
+    {
+        const qLogger::BlobInfo bi = logger.logBuf.getBlobInfo(logId);
+        if (bi.startIndex < 0)
+            break;
+        const size_t offset = events.size();
+        events.resize(offset + bi.length);
+        logger.logBuf.getMany(events.data() + offset, bi.startIndex, bi.length);
+    }
+    return events;
+}
+
+TEST(TestCoreSpectrum, IncreaseEnergiesLogsSameAsIncreaseEnergy)
+{
+    SpectrumTest test;
+
+    // Batches crossing the next half million entities (spectrum stats logged when creating entity) and the anti-dust
+    // threshold (spectrum stats and dust burning logged before crediting). The state digest is fed with the log
+    // messages in the order of the log, so the same events in the same order also yield the same digest.
+    const unsigned long long antiDustThreshold = SPECTRUM_CAPACITY / 2 + SPECTRUM_CAPACITY / 4;
+    const unsigned long long entitiesBeforeBatch[2] = { 0x80000 - 3, antiDustThreshold - 3 };
+    unsigned long long nextId = 0;
+    for (int phase = 0; phase < 2; ++phase)
+    {
+        while (spectrumInfo.numberOfEntities < entitiesBeforeBatch[phase])
+        {
+            increaseEnergy(m256i(nextId, 1, 2, 3), (nextId < SPECTRUM_CAPACITY / 4) ? 100 : 10000);
+            ++nextId;
+        }
+
+        // new and existing entities
+        std::vector<m256i> ids;
+        std::vector<long long> amounts;
+        for (unsigned int i = 0; i < 10; ++i)
+        {
+            ids.push_back((i % 3 == 1) ? m256i(i, 1, 2, 3) : m256i(phase * 100 + i, 4, 5, 6));
+            amounts.push_back(1000 + i);
+        }
+
+        std::vector<EntityRecord> spectrumBefore(spectrum, spectrum + SPECTRUM_CAPACITY);
+        const SpectrumInfo infoBefore = spectrumInfo;
+
+        const std::vector<char> expectedEvents = creditAndLogTransfers(ids, amounts, false);
+        const SpectrumInfo expectedInfo = spectrumInfo;
+
+        copyMem(spectrum, spectrumBefore.data(), spectrumSizeInBytes);
+        spectrumInfo = infoBefore;
+        countEntityCategoryPopulations();
+        rebuildSpectrumTags();
+
+        const std::vector<char> events = creditAndLogTransfers(ids, amounts, true);
+        EXPECT_GT(events.size(), ids.size() * (LOG_HEADER_SIZE + offsetof(QuTransfer, _terminator)));
+        EXPECT_TRUE(events == expectedEvents);
+        EXPECT_EQ(spectrumInfo.numberOfEntities, expectedInfo.numberOfEntities);
+        EXPECT_EQ(spectrumInfo.totalAmount, expectedInfo.totalAmount);
+    }
+
+    checkAndGetInfo();
+}
+
+TEST(TestCoreSpectrum, SaveAndLoadSparseAndDense)
+{
+    SpectrumTest test;
+    frequency = 1000000000; // needed for logging duration of saving
+    for (unsigned int i = 0; i < 10000; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), i + 1);
+    rebuildSpectrumDigests();
+    const m256i expectedRoot = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+    std::vector<EntityRecord> expectedSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+
+    for (int sparse = 0; sparse < 2; ++sparse)
+    {
+        const CHAR16* fileName = sparse ? L"spectrum_test_sparse.000" : L"spectrum_test_dense.000";
+        spectrumSnapshotChanges.invalidateBase();
+        EXPECT_TRUE(sparse ? saveSpectrumSnapshot(fileName, L"spectrum_test_delta.000") : saveSpectrum(fileName));
+        test.clearSpectrum();
+
+        m256i root;
+        EXPECT_TRUE(loadSpectrum(fileName, nullptr, &root));
+        EXPECT_EQ(root, sparse ? expectedRoot : m256i::zero());
+        EXPECT_EQ(memcmp(spectrum, expectedSpectrum.data(), spectrumSizeInBytes), 0);
+        EXPECT_EQ(spectrumInfo.numberOfEntities, 10000);
+        checkAndGetInfo();
+
+        _wremove(fileName);
+    }
+
+    // Corrupted sparse file is rejected
+    spectrumSnapshotChanges.invalidateBase();
+    EXPECT_TRUE(saveSpectrumSnapshot(L"spectrum_test_sparse.000", L"spectrum_test_delta.000"));
+    FILE* file = nullptr;
+    ASSERT_EQ(_wfopen_s(&file, L"spectrum_test_sparse.000", L"r+b"), 0);
+    unsigned int invalidIndex = SPECTRUM_CAPACITY;
+    fseek(file, sizeof(SparseSnapshotHeader), SEEK_SET);
+    fwrite(&invalidIndex, sizeof(invalidIndex), 1, file);
+    fclose(file);
+    EXPECT_FALSE(loadSpectrum(L"spectrum_test_sparse.000"));
+
+    // Sparse file with corrupted record (but valid indices and header) is rejected
+    copyMem(spectrum, expectedSpectrum.data(), spectrumSizeInBytes);
+    spectrumSnapshotChanges.invalidateBase();
+    EXPECT_TRUE(saveSpectrumSnapshot(L"spectrum_test_sparse.000", L"spectrum_test_delta.000"));
+    ASSERT_EQ(_wfopen_s(&file, L"spectrum_test_sparse.000", L"r+b"), 0);
+    long long corruptedBalance = 123456789;
+    fseek(file, sizeof(SparseSnapshotHeader) + 10000 * sizeof(unsigned int) + 5 * sizeof(EntityRecord) + offsetof(EntityRecord, incomingAmount), SEEK_SET);
+    fwrite(&corruptedBalance, sizeof(corruptedBalance), 1, file);
+    fclose(file);
+    EXPECT_FALSE(loadSpectrum(L"spectrum_test_sparse.000"));
+    _wremove(L"spectrum_test_sparse.000");
+    _wremove(L"spectrum_test_delta.000");
+    frequency = 0;
+}
+
+TEST(TestCoreSpectrum, SaveAndLoadDeltaSnapshot)
+{
+    SpectrumTest test;
+    frequency = 1000000000; // needed for logging duration of saving
+    const CHAR16* baseFileName = L"spectrum_test_base.000";
+    const CHAR16* deltaFileName = L"spectrum_test_delta.000";
+    std::vector<m256i> ids;
+    for (unsigned int i = 0; i < 10000; ++i)
+    {
+        ids.push_back(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()));
+        increaseEnergy(ids.back(), i + 1);
+    }
+    rebuildSpectrumDigests();
+
+    // First snapshot saves base file
+    spectrumSnapshotChanges.invalidateBase();
+    EXPECT_TRUE(saveSpectrumSnapshot(baseFileName, deltaFileName));
+    const unsigned long long baseSize = spectrumSnapshotChanges.baseSize;
+    EXPECT_GT(baseSize, 0);
+    EXPECT_EQ(spectrumSnapshotChanges.countChangedPages(), 0);
+
+    // Few changes -> only delta is saved
+    for (unsigned int i = 0; i < 20; ++i)
+        increaseEnergy(ids[test.rnd64() % ids.size()], 1000);
+    for (unsigned int i = 0; i < 5; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1000);
+    EXPECT_TRUE(decreaseEnergy(spectrumIndex(ids[42]), 10));
+    const unsigned int changedPages = spectrumSnapshotChanges.countChangedPages();
+    EXPECT_GT(changedPages, 0);
+    EXPECT_LE(changedPages, 26);
+    rebuildSpectrumDigests();
+    const m256i expectedRoot = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+    std::vector<EntityRecord> expectedSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+    EXPECT_TRUE(saveSpectrumSnapshot(baseFileName, deltaFileName));
+    EXPECT_EQ(spectrumSnapshotChanges.baseSize, baseSize);
+    EXPECT_EQ(spectrumSnapshotChanges.countChangedPages(), changedPages);
+
+    // Loading base and delta restores state and tracking of changed pages
+    test.clearSpectrum();
+    spectrumSnapshotChanges.invalidateBase();
+    m256i root;
+    EXPECT_TRUE(loadSpectrum(baseFileName, nullptr, &root, deltaFileName));
+    EXPECT_EQ(root, expectedRoot);
+    EXPECT_EQ(memcmp(spectrum, expectedSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(spectrumSnapshotChanges.baseSize, baseSize);
+    EXPECT_EQ(spectrumSnapshotChanges.countChangedPages(), changedPages);
+    checkAndGetInfo();
+
+    // Loading base only gives the old state
+    EXPECT_TRUE(loadSpectrum(baseFileName, nullptr, &root));
+    EXPECT_NE(root, expectedRoot);
+    EXPECT_NE(memcmp(spectrum, expectedSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(spectrumSnapshotChanges.baseSize, 0);
+    EXPECT_TRUE(loadSpectrum(baseFileName, nullptr, &root, deltaFileName));
+    std::vector<unsigned char> oldDelta(snapshotDeltaSize<EntityRecord, 64>(changedPages));
+    EXPECT_EQ(load(deltaFileName, oldDelta.size(), oldDelta.data()), oldDelta.size());
+
+    // Many changes -> new base is saved
+    for (unsigned int i = 0; i < 10000; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1000);
+    rebuildSpectrumDigests();
+    EXPECT_TRUE(saveSpectrumSnapshot(baseFileName, deltaFileName));
+    EXPECT_NE(spectrumSnapshotChanges.baseSize, baseSize);
+    EXPECT_EQ(spectrumSnapshotChanges.countChangedPages(), 0);
+
+    // Delta of old base is rejected
+    EXPECT_EQ(save(deltaFileName, oldDelta.size(), oldDelta.data()), oldDelta.size());
+    EXPECT_FALSE(loadSpectrum(baseFileName, nullptr, &root, deltaFileName));
+
+    // Missing delta is rejected
+    _wremove(deltaFileName);
+    EXPECT_FALSE(loadSpectrum(baseFileName, nullptr, &root, deltaFileName));
+
+    // Reorganization requires saving full snapshot
+    EXPECT_TRUE(loadSpectrum(baseFileName, nullptr, &root));
+    spectrumSnapshotChanges.setBase(baseSize, root);
+    reorganizeSpectrum();
+    EXPECT_EQ(spectrumSnapshotChanges.baseSize, 0);
+
+    _wremove(baseFileName);
+    _wremove(deltaFileName);
+    frequency = 0;
+}
+
+TEST(TestCoreSpectrum, SnapshotDeltaBoundToDenseBase)
+{
+    // Small hash map with buffer too small for sparse format, so base files are saved in dense format
+    constexpr unsigned int capacity = 64 * 64;
+    constexpr long long denseSize = capacity * sizeof(unsigned long long);
+    const CHAR16* baseFileName = L"snapshot_test_base.000";
+    const CHAR16* deltaFileName = L"snapshot_test_delta.000";
+    std::vector<unsigned long long> records(capacity), expectedRecords;
+    std::vector<unsigned char> buffer(1024);
+    SnapshotChangeTracker<capacity, 64>* tracker = new SnapshotChangeTracker<capacity, 64>;
+    m256i root, baseDigest;
+    bool savedBase = false;
+    auto saveSnapshot = [&]()
+    {
+        return saveSnapshotBaseOrDelta<unsigned long long, capacity>(baseFileName, deltaFileName, records.data(), m256i::zero(),
+            [](const unsigned long long& record) { return record == 0; }, *tracker, buffer.data(), buffer.size(), nullptr, savedBase);
+    };
+    auto loadBase = [&]()
+    {
+        return loadSparseOrDenseSnapshot<unsigned long long, capacity>(baseFileName, records.data(), &root, buffer.data(), buffer.size(),
+            nullptr, &baseDigest);
+    };
+    auto loadDelta = [&]()
+    {
+        return loadSnapshotDelta<unsigned long long, capacity>(deltaFileName, records.data(), baseDigest, root, *tracker,
+            buffer.data(), buffer.size());
+    };
+
+    for (unsigned int i = 0; i < 200; ++i)
+        records[i * 17] = i + 1;
+    tracker->invalidateBase();
+    EXPECT_EQ(saveSnapshot(), denseSize + (long long)sizeof(SnapshotDeltaHeader));
+    EXPECT_TRUE(savedBase);
+
+    // Delta is applied to its dense base
+    records[100] = 12345;
+    tracker->markChanged(100);
+    EXPECT_GT(saveSnapshot(), 0);
+    EXPECT_FALSE(savedBase);
+    expectedRecords = records;
+    std::vector<unsigned char> oldDelta(sizeof(SnapshotDeltaHeader) + sizeof(unsigned int) + 64 * sizeof(unsigned long long));
+    EXPECT_EQ(load(deltaFileName, oldDelta.size(), oldDelta.data()), oldDelta.size());
+
+    setMem(records.data(), denseSize, 0);
+    EXPECT_EQ(loadBase(), denseSize);
+    tracker->setBase(denseSize, baseDigest);
+    EXPECT_EQ(loadDelta(), oldDelta.size());
+    EXPECT_EQ(records, expectedRecords);
+
+    // Delta of other dense base is rejected (the Merkle roots of dense bases are unknown, but the digests differ)
+    for (unsigned int i = 0; i < 100; ++i)
+        records[i * 31] = i + 1000;
+    tracker->invalidateBase();
+    EXPECT_GT(saveSnapshot(), 0);
+    EXPECT_TRUE(savedBase);
+    EXPECT_EQ(save(deltaFileName, oldDelta.size(), oldDelta.data()), oldDelta.size());
+    EXPECT_EQ(loadBase(), denseSize);
+    EXPECT_EQ(loadDelta(), -1);
+
+    // Missing delta is an error instead of silently using the base only
+    _wremove(deltaFileName);
+    EXPECT_EQ(loadDelta(), -1);
+
+    _wremove(baseFileName);
+    delete tracker;
+}
+
+TEST(TestCoreSpectrum, ParallelReorganizeSameAsSerial)
+{
+    testParallelReorganizeSpectrum(0);
+    testParallelReorganizeSpectrum(3);
+}
+
+TEST(TestCoreSpectrum, ParallelReorganizeWithoutEmptySlotInLastParts)
+{
+    testParallelReorganizeSpectrum(0, true);
+    testParallelReorganizeSpectrum(3, true);
+}
@@ -6,6 +6,7 @@
 #include "../src/platform/virtual_memory.h"
 
 #include <random>
+#include <thread>
 
 TEST(TestVirtualMemory, TestVirtualMemory_NativeChar) {
     initFilesystem();
@@ -236,4 +237,306 @@ TEST(TestVirtualMemory, TestVirtualMemory_SpecialCases) {
     }
 
     test_vm.deinit();
-}
\ No newline at end of file
+}
+TEST(TestVirtualMemory, TestVirtualMemory_WriteBehindPages) {
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    const unsigned long long name_u64 = 123456789;
+    const unsigned long long pageDir = 0;
+    const unsigned long long pageCap = 1000;
+    // only one cache page, so most reads need the full page in write-behind slot or loading from disk
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 1> test_vm;
+    test_vm.init();
+    std::vector<unsigned long long> arr;
+    const int N = pageCap * 5 + 123;
+    arr.resize(N);
+    srand(0);
+    for (int i = 0; i < N; i++)
+    {
+        arr[i] = rand64();
+    }
+
+    int pos = 0;
+    while (pos < N)
+    {
+        int n_item = std::min(int(rand() % 1500) + 1, N - pos);
+        test_vm.appendMany(arr.data() + pos, n_item);
+        pos += n_item;
+
+        // last full page is readable while it is written to disk
+        if (pos >= pageCap)
+        {
+            unsigned long long index = (pos / pageCap) * pageCap - 1;
+            EXPECT_EQ(test_vm[index], arr[index]);
+        }
+    }
+    EXPECT_EQ(test_vm.size(), N);
+
+    // read all pages in random order (loading from disk, cache, write-behind slot, or current page)
+    std::vector<unsigned long long> fetcher;
+    for (int i = 0; i < 256; i++)
+    {
+        int offset = rand() % N;
+        int test_len = rand() % (N - offset) + 1;
+        fetcher.resize(test_len);
+        test_vm.getMany(fetcher.data(), offset, test_len);
+        EXPECT_TRUE(memcmp(fetcher.data(), arr.data() + offset, test_len * sizeof(unsigned long long)) == 0);
+    }
+    for (int i = 0; i < 1024; i++)
+    {
+        int index = rand() % N;
+        EXPECT_EQ(test_vm[index], arr[index]);
+    }
+
+    // dumped state refers to pages on disk and can be loaded into another instance
+    std::vector<unsigned char> state(test_vm.getPageSize() + 16);
+    EXPECT_EQ(test_vm.dumpVMState(state.data()), state.size());
+    test_vm.deinit();
+
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 1> loaded_vm;
+    loaded_vm.init();
+    EXPECT_EQ(loaded_vm.loadVMState(state.data()), state.size());
+    EXPECT_EQ(loaded_vm.size(), N);
+    for (int i = 0; i < 1024; i++)
+    {
+        int index = rand() % N;
+        EXPECT_EQ(loaded_vm[index], arr[index]);
+    }
+    loaded_vm.deinit();
+}
+
+TEST(TestVirtualMemory, TestVirtualMemory_ConcurrentReaders) {
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    const unsigned long long name_u64 = 987654321;
+    const unsigned long long pageDir = 0;
+    const unsigned long long pageCap = 500;
+    // few cache pages, so readers compete for slots and evict pages read ahead by other readers
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 3> test_vm;
+    test_vm.init();
+    std::vector<unsigned long long> arr;
+    const int N = pageCap * 20 + 77;
+    const int nInitial = pageCap * 12 + 5;
+    arr.resize(N);
+    srand(1);
+    for (int i = 0; i < N; i++)
+    {
+        arr[i] = rand64();
+    }
+    test_vm.appendMany(arr.data(), nInitial);
+
+    // readers scan ranges sequentially and read random items while more items are appended
+    bool ok[4] = { true, true, true, true };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+    {
+        readers.emplace_back([&, t]()
+            {
+                std::mt19937_64 gen(t);
+                std::vector<unsigned long long> fetcher;
+                for (int i = 0; i < 100; i++)
+                {
+                    int offset = gen() % nInitial;
+                    int test_len = std::min(int(gen() % (3 * pageCap)) + 1, nInitial - offset);
+                    fetcher.resize(test_len);
+                    if (test_vm.getMany(fetcher.data(), offset, test_len) != test_len * sizeof(unsigned long long)
+                        || memcmp(fetcher.data(), arr.data() + offset, test_len * sizeof(unsigned long long)) != 0)
+                    {
+                        ok[t] = false;
+                    }
+                    for (int j = 0; j < 20; j++)
+                    {
+                        int index = (t & 1) ? gen() % nInitial : (offset + j * 97) % nInitial;
+                        if (test_vm[index] != arr[index])
+                        {
+                            ok[t] = false;
+                        }
+                    }
+                }
+            });
+    }
+    for (int pos = nInitial; pos < N; pos++)
+    {
+        test_vm.append(arr[pos]);
+    }
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+    for (int t = 0; t < 4; t++)
+    {
+        EXPECT_TRUE(ok[t]);
+    }
+
+    // sequential scan over all pages
+    std::vector<unsigned long long> fetcher(pageCap / 2);
+    for (int offset = 0; offset + fetcher.size() <= N; offset += fetcher.size())
+    {
+        EXPECT_EQ(test_vm.getMany(fetcher.data(), offset, fetcher.size()), fetcher.size() * sizeof(unsigned long long));
+        EXPECT_TRUE(memcmp(fetcher.data(), arr.data() + offset, fetcher.size() * sizeof(unsigned long long)) == 0);
+    }
+    test_vm.deinit();
+}
+
+TEST(TestVirtualMemory, TestBlockCompression) {
+    std::mt19937_64 gen(42);
+    std::vector<unsigned char> src(LZ_MAX_BLOCK_SIZE), compressed(LZ_MAX_BLOCK_SIZE), decompressed(LZ_MAX_BLOCK_SIZE);
+    unsigned short hashTable[LZ_HASH_TABLE_SIZE];
+    for (int test = 0; test < 50; test++)
+    {
+        unsigned int size = (test < 10) ? test : (unsigned int)(gen() % LZ_MAX_BLOCK_SIZE) + 1;
+        if (test == 10)
+        {
+            size = LZ_MAX_BLOCK_SIZE;
+        }
+        // mix of zeros, repeated records with small numbers, and random bytes
+        for (unsigned int i = 0; i < size; i++)
+        {
+            switch ((i / 1000 + test) % 3)
+            {
+            case 0: src[i] = 0; break;
+            case 1: src[i] = (i % 40 < 32) ? (unsigned char)(i % 40) : (unsigned char)(gen() % 4); break;
+            default: src[i] = (unsigned char)gen(); break;
+            }
+        }
+        unsigned int compressedSize = lzCompressBlock(src.data(), size, compressed.data(), size + 16, hashTable);
+        EXPECT_GT(compressedSize, 0u);
+        if (size > 3000)
+        {
+            EXPECT_LT(compressedSize, size);
+        }
+        EXPECT_TRUE(lzDecompressBlock(compressed.data(), compressedSize, decompressed.data(), size));
+        EXPECT_TRUE(memcmp(src.data(), decompressed.data(), size) == 0);
+
+        // too small output buffer and data not matching the size are detected
+        if (compressedSize > 1)
+        {
+            EXPECT_EQ(lzCompressBlock(src.data(), size, compressed.data(), compressedSize - 1, hashTable), 0u);
+            EXPECT_FALSE(lzDecompressBlock(compressed.data(), compressedSize, decompressed.data(), size + 1));
+            EXPECT_FALSE(lzDecompressBlock(compressed.data(), compressedSize / 2, decompressed.data(), size));
+        }
+    }
+
+    // random data does not compress
+    for (unsigned int i = 0; i < LZ_MAX_BLOCK_SIZE; i++)
+    {
+        src[i] = (unsigned char)gen();
+    }
+    EXPECT_EQ(lzCompressBlock(src.data(), LZ_MAX_BLOCK_SIZE, compressed.data(), LZ_MAX_BLOCK_SIZE - 1, hashTable), 0u);
+}
+
+TEST(TestVirtualMemory, TestVirtualMemory_CompressedPages) {
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    const unsigned long long name_u64 = 192837465;
+    const unsigned long long pageDir = 0;
+    const unsigned long long pageCap = 20000;
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 2, true> test_vm;
+    test_vm.init();
+    std::vector<unsigned long long> arr;
+    const int N = pageCap * 6 + 321;
+    arr.resize(N);
+    srand(2);
+    for (int i = 0; i < N; i++)
+    {
+        // pages with small numbers (compressible) and random numbers (stored uncompressed)
+        arr[i] = ((i / pageCap) % 3 == 2) ? rand64() : rand() % 1000;
+    }
+    test_vm.appendMany(arr.data(), N);
+    EXPECT_EQ(test_vm.size(), N);
+
+    std::vector<unsigned long long> fetcher;
+    for (int i = 0; i < 64; i++)
+    {
+        int offset = rand() % N;
+        int test_len = rand() % std::min(N - offset, int(3 * pageCap)) + 1;
+        fetcher.resize(test_len);
+        EXPECT_EQ(test_vm.getMany(fetcher.data(), offset, test_len), test_len * sizeof(unsigned long long));
+        EXPECT_TRUE(memcmp(fetcher.data(), arr.data() + offset, test_len * sizeof(unsigned long long)) == 0);
+    }
+    for (int i = 0; i < 1024; i++)
+    {
+        int index = rand() % N;
+        EXPECT_EQ(test_vm[index], arr[index]);
+    }
+    test_vm.deinit();
+
+    // pages stored without compression can be loaded by instance with compression
+    VirtualMemory<unsigned long long, name_u64 + 1, pageDir, pageCap, 2, false> raw_vm;
+    raw_vm.init();
+    raw_vm.appendMany(arr.data(), N);
+    std::vector<unsigned char> state(raw_vm.getPageSize() + 16);
+    EXPECT_EQ(raw_vm.dumpVMState(state.data()), state.size());
+    raw_vm.deinit();
+
+    VirtualMemory<unsigned long long, name_u64 + 1, pageDir, pageCap, 2, true> loaded_vm;
+    loaded_vm.init();
+    EXPECT_EQ(loaded_vm.loadVMState(state.data()), state.size());
+    for (int i = 0; i < 1024; i++)
+    {
+        int index = rand() % N;
+        EXPECT_EQ(loaded_vm[index], arr[index]);
+    }
+    loaded_vm.deinit();
+}
+
+TEST(TestVirtualMemory, TestVirtualMemory_CompressedPagesWithConcurrentReaders) {
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    const unsigned long long name_u64 = 564738291;
+    const unsigned long long pageDir = 0;
+    const unsigned long long pageCap = 20000;
+    // compressing borrows one of the two cache slots, so readers compete with writing full pages
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 2, true> test_vm;
+    test_vm.init();
+    std::vector<unsigned long long> arr;
+    const int N = pageCap * 10 + 55;
+    const int nInitial = pageCap * 4 + 3;
+    arr.resize(N);
+    srand(3);
+    for (int i = 0; i < N; i++)
+    {
+        arr[i] = rand() % 1000;
+    }
+    test_vm.appendMany(arr.data(), nInitial);
+
+    bool ok[3] = { true, true, true };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+    {
+        readers.emplace_back([&, t]()
+            {
+                std::mt19937_64 gen(t);
+                std::vector<unsigned long long> fetcher;
+                for (int i = 0; i < 30; i++)
+                {
+                    int offset = gen() % nInitial;
+                    int test_len = std::min(int(gen() % (2 * pageCap)) + 1, nInitial - offset);
+                    fetcher.resize(test_len);
+                    if (test_vm.getMany(fetcher.data(), offset, test_len) != test_len * sizeof(unsigned long long)
+                        || memcmp(fetcher.data(), arr.data() + offset, test_len * sizeof(unsigned long long)) != 0)
+                    {
+                        ok[t] = false;
+                    }
+                }
+            });
+    }
+    for (int pos = nInitial; pos < N; pos++)
+    {
+        test_vm.append(arr[pos]);
+    }
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+    for (int t = 0; t < 3; t++)
+    {
+        EXPECT_TRUE(ok[t]);
+    }
+    for (int i = 0; i < 1024; i++)
+    {
+        int index = rand() % N;
+        EXPECT_EQ(test_vm[index], arr[index]);
+    }
+    test_vm.deinit();
+}